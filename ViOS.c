@@ -33,6 +33,12 @@ typedef struct __attribute__((packed)) E820Entries {
   E820Entry entries[];
 } E820Entries;
 
+typedef struct __attribute__((packed)) RamDiskInfo {
+  UINT64 magic;
+  UINT64 base;
+  UINT64 size;
+} RamDiskInfo;
+
 EFI_HANDLE imageHandle = NULL;
 EFI_SYSTEM_TABLE *systemTable = NULL;
 
@@ -115,8 +121,9 @@ EFI_STATUS SetupMemoryMaps() {
   return EFI_SUCCESS;
 }
 
-EFI_STATUS ReadFileFromCurrentFilesystem(CHAR16 *FileName, VOID **Buffer_Out,
-                                         UINTN *BufferSize_Out) {
+EFI_STATUS OpenFileFromCurrentFilesystem(CHAR16 *FileName,
+                                         EFI_FILE_PROTOCOL **File_Out,
+                                         UINTN *FileSize_Out) {
   EFI_STATUS Status = 0;
   EFI_LOADED_IMAGE_PROTOCOL *LoadedImageProtocol = NULL;
   EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *SimpleFileSystem = NULL;
@@ -125,8 +132,8 @@ EFI_STATUS ReadFileFromCurrentFilesystem(CHAR16 *FileName, VOID **Buffer_Out,
   EFI_FILE_PROTOCOL *File = NULL;
   UINTN FileInfoSize = 0;
 
-  *Buffer_Out = NULL;
-  *BufferSize_Out = 0;
+  *File_Out = NULL;
+  *FileSize_Out = 0;
 
   Status = gBS->HandleProtocol(imageHandle, &gEfiLoadedImageProtocolGuid,
                                (VOID **)&LoadedImageProtocol);
@@ -178,9 +185,25 @@ EFI_STATUS ReadFileFromCurrentFilesystem(CHAR16 *FileName, VOID **Buffer_Out,
     return Status;
   }
 
-  UINTN BufferSize = FileInfo->FileSize;
+  *File_Out = File;
+  *FileSize_Out = FileInfo->FileSize;
   FreePool(FileInfoBuffer);
-  FileInfoBuffer = NULL;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS ReadFileFromCurrentFilesystem(CHAR16 *FileName, VOID **Buffer_Out,
+                                         UINTN *BufferSize_Out) {
+  EFI_STATUS Status = 0;
+  EFI_FILE_PROTOCOL *File = NULL;
+  UINTN BufferSize = 0;
+
+  *Buffer_Out = NULL;
+  *BufferSize_Out = 0;
+
+  Status = OpenFileFromCurrentFilesystem(FileName, &File, &BufferSize);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
 
   // Allocate the memory for the file content
   VOID *Buffer = AllocatePool(BufferSize);
@@ -208,6 +231,66 @@ EFI_STATUS ReadFileFromCurrentFilesystem(CHAR16 *FileName, VOID **Buffer_Out,
   return EFI_SUCCESS;
 }
 
+/*
+  Loads the RAM disk image into its own pages with a single read and
+  describes it at VIOS_RAMDISK_INFO_LOCATION for the kernel. Must run
+  before SetupMemoryMaps so the image is kept out of the E820 map.
+  A missing image is not an error, the kernel then reads from disk.
+*/
+EFI_STATUS LoadRamDisk() {
+  EFI_STATUS Status = 0;
+  EFI_FILE_PROTOCOL *File = NULL;
+  UINTN FileSize = 0;
+
+  EFI_PHYSICAL_ADDRESS InfoLocation = VIOS_RAMDISK_INFO_LOCATION;
+  Status = gBS->AllocatePages(AllocateAddress, EfiLoaderData,
+                              EFI_SIZE_TO_PAGES(sizeof(RamDiskInfo)),
+                              &InfoLocation);
+  if (EFI_ERROR(Status)) {
+    // Without the magic there the kernel reads from disk
+    Print(L"Warning: no memory for the RAM disk info, booting from disk: "
+          L"%r\n",
+          Status);
+    return EFI_SUCCESS;
+  }
+
+  RamDiskInfo *Info = (RamDiskInfo *)InfoLocation;
+  Info->magic = VIOS_RAMDISK_MAGIC;
+  Info->base = 0;
+  Info->size = 0;
+
+  Status = OpenFileFromCurrentFilesystem(L"ramdisk.img", &File, &FileSize);
+  if (EFI_ERROR(Status)) {
+    Print(L"No RAM disk image, booting from disk\n");
+    return EFI_SUCCESS;
+  }
+
+  // Read overwrites FileSize with the bytes read, the pages are kept
+  // apart to free them
+  EFI_PHYSICAL_ADDRESS RamDiskBase = 0;
+  UINTN RamDiskPages = EFI_SIZE_TO_PAGES(FileSize);
+  Status = gBS->AllocatePages(AllocateAnyPages, EfiLoaderData, RamDiskPages,
+                              &RamDiskBase);
+  if (EFI_ERROR(Status)) {
+    Print(L"Error allocating memory for the RAM disk: %r\n", Status);
+    File->Close(File);
+    return EFI_SUCCESS;
+  }
+
+  Status = File->Read(File, &FileSize, (VOID *)RamDiskBase);
+  File->Close(File);
+  if (EFI_ERROR(Status)) {
+    Print(L"Error reading the RAM disk: %r\n", Status);
+    gBS->FreePages(RamDiskBase, RamDiskPages);
+    return EFI_SUCCESS;
+  }
+
+  Info->base = RamDiskBase;
+  Info->size = FileSize;
+  Print(L"RAM disk of %d bytes loaded at: %p\n", FileSize, RamDiskBase);
+  return EFI_SUCCESS;
+}
+
 EFI_STATUS GetFrameBufferInfo(EFI_GRAPHICS_OUTPUT_PROTOCOL **GraphicsOutput) {
   EFI_STATUS Status;
   // Locate the graphics output protocol
@@ -261,6 +344,12 @@ UefiMain(IN EFI_HANDLE ImageHandle, IN EFI_SYSTEM_TABLE *SystemTable) {
   
   Print(L"ViOS OS UEFI bootloader.");
 
+  // The RAM disk pages must be allocated before the E820 map is built
+  Status = LoadRamDisk();
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
   // Setup and load E820 Entries
   SetupMemoryMaps();
 
@@ -0,0 +1,135 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "vios.h"
+#include <stdint.h>
+
+#define FILEBENCH_MAX_CHUNK (1024 * 1024)
+
+static const char *filebench_files[] = {"@:/bench64k.bin", "@:/bench1m.bin",
+                                        "@:/bench32m.bin"};
+
+static const int filebench_chunks[] = {4096, 64 * 1024, FILEBENCH_MAX_CHUNK};
+
+#define FILEBENCH_TOTAL_FILES                                                  \
+  (sizeof(filebench_files) / sizeof(filebench_files[0]))
+#define FILEBENCH_TOTAL_CHUNKS                                                 \
+  (sizeof(filebench_chunks) / sizeof(filebench_chunks[0]))
+
+static uint64_t filebench_rdtsc() {
+  uint32_t low, high;
+  __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * Reads the whole file front to back in "chunk" sized calls, returns the
+ * bytes read or a negative error
+ */
+static int filebench_read_sequential(int fd, char *buf, int chunk) {
+  int res = vios_fseek(fd, 0, SEEK_SET);
+  if (res < 0) {
+    return res;
+  }
+
+  int total = 0;
+  while ((res = vios_fread(fd, buf, chunk)) > 0) {
+    total += res;
+  }
+
+  return res < 0 ? res : total;
+}
+
+/**
+ * Reads the whole file back to front with positioned reads, so every
+ * call has to seek and the read ahead of the previous call never helps
+ */
+static int filebench_read_backwards(int fd, char *buf, int chunk,
+                                    unsigned int filesize) {
+  int total = 0;
+  unsigned int offset = filesize - filesize % chunk;
+  if (offset == filesize && offset) {
+    offset -= chunk;
+  }
+
+  while (1) {
+    int res = vios_fpread(fd, buf, chunk, offset);
+    if (res < 0) {
+      return res;
+    }
+
+    total += res;
+    if (offset == 0) {
+      break;
+    }
+    offset -= chunk;
+  }
+
+  return total;
+}
+
+static void filebench_print_padded(const char *str, int width) {
+  print(str);
+  for (int i = strlen(str); i < width; i++) {
+    print(" ");
+  }
+}
+
+static void filebench_print_result(const char *file, const char *pattern,
+                                   int chunk, int bytes, uint64_t cycles) {
+  filebench_print_padded(file, 18);
+  filebench_print_padded(pattern, 11);
+  filebench_print_padded(itoa(chunk), 9);
+  if (bytes < 0) {
+    printf("failed (%i)\n", bytes);
+    return;
+  }
+
+  uint64_t kilobytes = bytes / 1024 ? bytes / 1024 : 1;
+  filebench_print_padded(itoa(bytes / 1024), 10);
+  printf("%i\n", (int)(cycles / kilobytes));
+}
+
+int main(int argc, char **argv) {
+  char *buf = malloc(FILEBENCH_MAX_CHUNK);
+  if (!buf) {
+    print("filebench: out of memory\n");
+    return -1;
+  }
+
+  print("file              pattern    chunk    kb        cycles/kb\n");
+  for (int i = 0; i < FILEBENCH_TOTAL_FILES; i++) {
+    int fd = vios_fopen(filebench_files[i], "r");
+    if (fd < 0) {
+      printf("%s: cannot open (%i)\n", filebench_files[i], fd);
+      continue;
+    }
+
+    struct file_stat stat;
+    if (vios_fstat(fd, &stat) < 0) {
+      printf("%s: cannot stat\n", filebench_files[i]);
+      vios_fclose(fd);
+      continue;
+    }
+
+    for (int c = 0; c < FILEBENCH_TOTAL_CHUNKS; c++) {
+      int chunk = filebench_chunks[c];
+      uint64_t start = filebench_rdtsc();
+      int bytes = filebench_read_sequential(fd, buf, chunk);
+      uint64_t end = filebench_rdtsc();
+      filebench_print_result(filebench_files[i], "read", chunk, bytes,
+                             end - start);
+
+      start = filebench_rdtsc();
+      bytes = filebench_read_backwards(fd, buf, chunk, stat.filesize);
+      end = filebench_rdtsc();
+      filebench_print_result(filebench_files[i], "pread", chunk, bytes,
+                             end - start);
+    }
+
+    vios_fclose(fd);
+  }
+
+  free(buf);
+  return 0;
+}
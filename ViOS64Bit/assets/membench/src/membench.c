@@ -0,0 +1,187 @@
+#include "memory.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "vios.h"
+#include <stdint.h>
+
+#define MEMBENCH_MAX_SIZE (1024 * 1024)
+
+// Every measurement moves at least this many bytes so small sizes are stable
+#define MEMBENCH_BYTES_PER_RUN (1024 * 1024)
+
+/*
+ * The byte at a time loops the stdlib used before it was optimized,
+ * kept here as the baseline every result is compared against.
+ */
+static void *membench_loop_memset(void *ptr, int c, size_t size) {
+  char *c_ptr = (char *)ptr;
+  for (int i = 0; i < size; i++) {
+    c_ptr[i] = (char)c;
+  }
+  return ptr;
+}
+
+static int membench_loop_memcmp(void *s1, void *s2, int count) {
+  char *c1 = s1;
+  char *c2 = s2;
+  while (count-- > 0) {
+    if (*c1++ != *c2++) {
+      return c1[-1] < c2[-1] ? -1 : 1;
+    }
+  }
+
+  return 0;
+}
+
+static void *membench_loop_memcpy(void *dest, void *src, int len) {
+  char *d = dest;
+  char *s = src;
+  while (len--) {
+    *d++ = *s++;
+  }
+  return dest;
+}
+
+static int membench_loop_strlen(const char *ptr) {
+  int i = 0;
+  while (*ptr != 0) {
+    i++;
+    ptr += 1;
+  }
+
+  return i;
+}
+
+static char *membench_loop_strncpy(char *dest, const char *src, int count) {
+  int i = 0;
+  for (i = 0; i < count - 1; i++) {
+    if (src[i] == 0x00)
+      break;
+
+    dest[i] = src[i];
+  }
+
+  dest[i] = 0x00;
+  return dest;
+}
+
+enum {
+  MEMBENCH_MEMCPY,
+  MEMBENCH_MEMSET,
+  MEMBENCH_MEMCMP,
+  MEMBENCH_STRLEN,
+  MEMBENCH_STRNCPY,
+  MEMBENCH_TOTAL_OPERATIONS
+};
+
+static const char *membench_operation_names[] = {"memcpy", "memset", "memcmp",
+                                                 "strlen", "strncpy"};
+
+static uint64_t membench_rdtsc() {
+  uint32_t low, high;
+  __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * Runs one operation repeatedly and returns the average cycles per call
+ */
+static uint64_t membench_run(int operation, bool optimized, char *dest,
+                             char *src, size_t size, size_t iterations) {
+  uint64_t start = membench_rdtsc();
+  for (size_t i = 0; i < iterations; i++) {
+    switch (operation) {
+    case MEMBENCH_MEMCPY:
+      if (optimized)
+        memcpy(dest, src, size);
+      else
+        membench_loop_memcpy(dest, src, size);
+      break;
+    case MEMBENCH_MEMSET:
+      if (optimized)
+        memset(dest, 'a', size);
+      else
+        membench_loop_memset(dest, 'a', size);
+      break;
+    case MEMBENCH_MEMCMP:
+      if (optimized)
+        memcmp(dest, src, size);
+      else
+        membench_loop_memcmp(dest, src, size);
+      break;
+    case MEMBENCH_STRLEN:
+      if (optimized)
+        strlen(src);
+      else
+        membench_loop_strlen(src);
+      break;
+    case MEMBENCH_STRNCPY:
+      if (optimized)
+        strncpy(dest, src, size + 1);
+      else
+        membench_loop_strncpy(dest, src, size + 1);
+      break;
+    }
+  }
+  uint64_t end = membench_rdtsc();
+
+  return (end - start) / iterations;
+}
+
+static void membench_print_padded(const char *str, int width) {
+  print(str);
+  for (int i = strlen(str); i < width; i++) {
+    print(" ");
+  }
+}
+
+static void membench_print_speedup(uint64_t baseline, uint64_t optimized) {
+  if (!optimized) {
+    optimized = 1;
+  }
+
+  // Two decimal places without floating point
+  uint64_t hundredths = baseline * 100 / optimized;
+  printf("%i.", (int)(hundredths / 100));
+  if (hundredths % 100 < 10) {
+    printf("0");
+  }
+  printf("%ix", (int)(hundredths % 100));
+}
+
+int main(int argc, char **argv) {
+  // One spare byte for the terminator of the string benchmarks
+  char *src = malloc(MEMBENCH_MAX_SIZE + 1);
+  char *dest = malloc(MEMBENCH_MAX_SIZE + 1);
+  if (!src || !dest) {
+    print("membench: out of memory\n");
+    return -1;
+  }
+
+  print("size     operation  loop cycles  stdlib cycles  speedup\n");
+  for (size_t size = 16; size <= MEMBENCH_MAX_SIZE; size *= 16) {
+    size_t iterations = MEMBENCH_BYTES_PER_RUN / size;
+
+    for (int op = 0; op < MEMBENCH_TOTAL_OPERATIONS; op++) {
+      // Equal, terminated buffers so compare and strlen scan the full size
+      memset(src, 'a', size);
+      memset(dest, 'a', size);
+      src[size] = 0;
+      dest[size] = 0;
+
+      uint64_t baseline = membench_run(op, false, dest, src, size, iterations);
+      uint64_t optimized = membench_run(op, true, dest, src, size, iterations);
+      membench_print_padded(itoa(size), 9);
+      membench_print_padded(membench_operation_names[op], 11);
+      membench_print_padded(itoa(baseline), 13);
+      membench_print_padded(itoa(optimized), 15);
+      membench_print_speedup(baseline, optimized);
+      print("\n");
+    }
+  }
+
+  free(src);
+  free(dest);
+  return 0;
+}
@@ -1,25 +1,138 @@
 #include "memory.h"
+#include <stdint.h>
 
+// Word type used to move eight bytes at a time through unaligned pointers
+typedef uint64_t __attribute__((may_alias, aligned(1))) memory_word_t;
+
+#define MEMORY_WORD_SIZE sizeof(uint64_t)
+#define MEMORY_BYTE_BROADCAST 0x0101010101010101ULL
+
+// Below this size the SSE2 setup costs more than it saves
+#define MEMORY_SSE2_MINIMUM 128
+
+static void* memory_copy_words(uint8_t* d, const uint8_t* s, size_t len)
+{
+    void* dest = d;
+    while (len >= MEMORY_WORD_SIZE)
+    {
+        *(memory_word_t*)d = *(const memory_word_t*)s;
+        d += MEMORY_WORD_SIZE;
+        s += MEMORY_WORD_SIZE;
+        len -= MEMORY_WORD_SIZE;
+    }
+
+    while (len--)
+    {
+        *d++ = *s++;
+    }
+
+    return dest;
+}
+
+static void memory_set_words(uint8_t* d, int c, size_t len)
+{
+    uint64_t pattern = (uint8_t)c * MEMORY_BYTE_BROADCAST;
+    while (len >= MEMORY_WORD_SIZE)
+    {
+        *(memory_word_t*)d = pattern;
+        d += MEMORY_WORD_SIZE;
+        len -= MEMORY_WORD_SIZE;
+    }
+
+    while (len--)
+    {
+        *d++ = (uint8_t)c;
+    }
+}
+
+/**
+ * SSE2 is part of every x86-64 CPU so it needs no feature check. The
+ * xmm registers are caller saved, so only clobbers are declared.
+ */
 void* memset(void* ptr, int c, size_t size)
 {
-    char* c_ptr = (char*) ptr;
-    for (int i = 0; i < size; i++)
+    uint8_t* d = ptr;
+    if (size < MEMORY_SSE2_MINIMUM)
     {
-        c_ptr[i] = (char) c;
+        memory_set_words(d, c, size);
+        return ptr;
     }
+
+    // Align the destination so the loop can use aligned stores
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    memory_set_words(d, c, head);
+    d += head;
+    size -= head;
+
+    size_t blocks = size / 64;
+    uint64_t pattern = (uint8_t)c * MEMORY_BYTE_BROADCAST;
+    __asm__ __volatile__("movq %[pattern], %%xmm0\n\t"
+                         "punpcklqdq %%xmm0, %%xmm0\n\t"
+                         "1:\n\t"
+                         "movdqa %%xmm0, 0(%[d])\n\t"
+                         "movdqa %%xmm0, 16(%[d])\n\t"
+                         "movdqa %%xmm0, 32(%[d])\n\t"
+                         "movdqa %%xmm0, 48(%[d])\n\t"
+                         "add $64, %[d]\n\t"
+                         "dec %[n]\n\t"
+                         "jnz 1b\n\t"
+                         : [d] "+r"(d), [n] "+r"(blocks)
+                         : [pattern] "r"(pattern)
+                         : "xmm0", "memory", "cc");
+
+    memory_set_words(d, c, size % 64);
     return ptr;
 }
 
 int memcmp(void* s1, void* s2, int count)
 {
-    char* c1 = s1;
-    char* c2 = s2;
-    while(count-- > 0)
+    const uint8_t* a = s1;
+    const uint8_t* b = s2;
+    if (count <= 0)
     {
-        if (*c1++ != *c2++)
+        return 0;
+    }
+
+    size_t len = count;
+    if (len >= MEMORY_SSE2_MINIMUM)
+    {
+        size_t blocks = len / 16;
+        size_t remaining = blocks;
+
+        // Stops at the first 16 byte block that differs
+        __asm__ __volatile__("1:\n\t"
+                             "movdqu (%[a]), %%xmm0\n\t"
+                             "movdqu (%[b]), %%xmm1\n\t"
+                             "pcmpeqb %%xmm1, %%xmm0\n\t"
+                             "pmovmskb %%xmm0, %%eax\n\t"
+                             "cmp $0xffff, %%eax\n\t"
+                             "jne 2f\n\t"
+                             "add $16, %[a]\n\t"
+                             "add $16, %[b]\n\t"
+                             "dec %[n]\n\t"
+                             "jnz 1b\n\t"
+                             "2:\n\t"
+                             : [a] "+r"(a), [b] "+r"(b), [n] "+r"(remaining)
+                             :
+                             : "rax", "xmm0", "xmm1", "memory", "cc");
+        len -= (blocks - remaining) * 16;
+    }
+
+    while (len >= MEMORY_WORD_SIZE && *(const memory_word_t*)a == *(const memory_word_t*)b)
+    {
+        a += MEMORY_WORD_SIZE;
+        b += MEMORY_WORD_SIZE;
+        len -= MEMORY_WORD_SIZE;
+    }
+
+    while (len--)
+    {
+        if (*a != *b)
         {
-            return c1[-1] < c2[-1] ? -1 : 1;
+            return *a < *b ? -1 : 1;
         }
+        a++;
+        b++;
     }
 
     return 0;
@@ -27,11 +140,76 @@ int memcmp(void* s1, void* s2, int count)
 
 void* memcpy(void* dest, void* src, int len)
 {
-    char *d = dest;
-    char *s = src;
-    while(len--)
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    if (len <= 0)
     {
-        *d++ = *s++;
+        return dest;
     }
+
+    size_t size = len;
+    if (size < MEMORY_SSE2_MINIMUM)
+    {
+        return memory_copy_words(d, s, size);
+    }
+
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    memory_copy_words(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    size_t blocks = size / 64;
+    __asm__ __volatile__("1:\n\t"
+                         "movdqu 0(%[s]), %%xmm0\n\t"
+                         "movdqu 16(%[s]), %%xmm1\n\t"
+                         "movdqu 32(%[s]), %%xmm2\n\t"
+                         "movdqu 48(%[s]), %%xmm3\n\t"
+                         "movdqa %%xmm0, 0(%[d])\n\t"
+                         "movdqa %%xmm1, 16(%[d])\n\t"
+                         "movdqa %%xmm2, 32(%[d])\n\t"
+                         "movdqa %%xmm3, 48(%[d])\n\t"
+                         "add $64, %[s]\n\t"
+                         "add $64, %[d]\n\t"
+                         "dec %[n]\n\t"
+                         "jnz 1b\n\t"
+                         : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+                         :
+                         : "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+
+    memory_copy_words(d, s, size % 64);
     return dest;
-}
\ No newline at end of file
+}
+
+void* memmove(void* dest, void* src, int len)
+{
+    uint8_t* d = dest;
+    const uint8_t* s = src;
+    if (len <= 0 || d == s)
+    {
+        return dest;
+    }
+
+    // A forward copy is only unsafe when the destination starts inside the source
+    if (d < s || d >= s + len)
+    {
+        return memcpy(dest, src, len);
+    }
+
+    d += len;
+    s += len;
+    while (len >= MEMORY_WORD_SIZE)
+    {
+        d -= MEMORY_WORD_SIZE;
+        s -= MEMORY_WORD_SIZE;
+        *(memory_word_t*)d = *(const memory_word_t*)s;
+        len -= MEMORY_WORD_SIZE;
+    }
+
+    while (len--)
+    {
+        *--d = *--s;
+    }
+
+    return dest;
+}
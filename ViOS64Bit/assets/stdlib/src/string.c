@@ -1,4 +1,28 @@
 #include "string.h"
+#include "memory.h"
+#include <stdint.h>
+
+// Eight characters are examined at once where it is safe to do so
+typedef uint64_t __attribute__((may_alias, aligned(1))) string_word_t;
+
+#define STRING_WORD_SIZE sizeof(uint64_t)
+#define STRING_PAGE_SIZE 4096
+
+#define STRING_IS_DELIMITER(map, c) \
+    ((map)[(unsigned char)(c) >> 6] & (1ULL << ((unsigned char)(c) & 63)))
+
+// Non zero when any byte of the word is zero
+#define STRING_HAS_ZERO(w) \
+    (((w) - 0x0101010101010101ULL) & ~(w) & 0x8080808080808080ULL)
+
+/**
+ * Unaligned word reads may run past the terminator, only allow them
+ * when the whole word lives on the same page as the first byte.
+ */
+static inline bool string_word_safe(const char* ptr)
+{
+    return ((uintptr_t)ptr & (STRING_PAGE_SIZE - 1)) <= STRING_PAGE_SIZE - STRING_WORD_SIZE;
+}
 
 char tolower(char s1)
 {
@@ -11,21 +35,55 @@ char tolower(char s1)
 }
 
 int strlen(const char* ptr)
+{
+    // Round down to 16 bytes, an aligned load never crosses into the next page
+    const char* block = (const char*)((uintptr_t)ptr & ~(uintptr_t)15);
+    unsigned int mask;
+
+    // Bytes before ptr in the first block are shifted out of the mask
+    __asm__ __volatile__("pxor %%xmm0, %%xmm0\n\t"
+                         "movdqa (%[block]), %%xmm1\n\t"
+                         "pcmpeqb %%xmm0, %%xmm1\n\t"
+                         "pmovmskb %%xmm1, %[mask]\n\t"
+                         : [mask] "=r"(mask)
+                         : [block] "r"(block)
+                         : "xmm0", "xmm1", "memory");
+    mask >>= ptr - block;
+    if (mask)
+        return __builtin_ctz(mask);
+
+    __asm__ __volatile__("pxor %%xmm0, %%xmm0\n\t"
+                         "1:\n\t"
+                         "add $16, %[block]\n\t"
+                         "movdqa (%[block]), %%xmm1\n\t"
+                         "pcmpeqb %%xmm0, %%xmm1\n\t"
+                         "pmovmskb %%xmm1, %[mask]\n\t"
+                         "test %[mask], %[mask]\n\t"
+                         "jz 1b\n\t"
+                         : [block] "+r"(block), [mask] "=r"(mask)
+                         :
+                         : "xmm0", "xmm1", "memory", "cc");
+
+    return block - ptr + __builtin_ctz(mask);
+}
+
+int strnlen(const char* ptr, int max)
 {
     int i = 0;
-    while(*ptr != 0)
+    while (i < max && ((uintptr_t)(ptr + i) & (STRING_WORD_SIZE - 1)))
     {
+        if (ptr[i] == 0)
+            return i;
         i++;
-        ptr += 1;
     }
 
-    return i;
-}
+    while (i + (int)STRING_WORD_SIZE <= max &&
+           !STRING_HAS_ZERO(*(const string_word_t*)(ptr + i)))
+    {
+        i += STRING_WORD_SIZE;
+    }
 
-int strnlen(const char* ptr, int max)
-{
-    int i = 0;
-    for (i = 0; i < max; i++)
+    for (; i < max; i++)
     {
         if (ptr[i] == 0)
             break;
@@ -65,6 +123,21 @@ int strncmp(const char* str1, const char* str2, int n)
 {
     unsigned char u1, u2;
 
+    // Skip identical words that hold no terminator, the remainder is
+    // compared bytewise so the result matches the plain loop
+    while (n >= (int)STRING_WORD_SIZE && string_word_safe(str1) &&
+           string_word_safe(str2))
+    {
+        string_word_t w1 = *(const string_word_t*)str1;
+        string_word_t w2 = *(const string_word_t*)str2;
+        if (w1 != w2 || STRING_HAS_ZERO(w1))
+            break;
+
+        str1 += STRING_WORD_SIZE;
+        str2 += STRING_WORD_SIZE;
+        n -= STRING_WORD_SIZE;
+    }
+
     while(n-- > 0)
     {
         u1 = (unsigned char)*str1++;
@@ -80,23 +153,27 @@ int strncmp(const char* str1, const char* str2, int n)
 
 char* strcpy(char* dest, const char* src)
 {
-    char* res = dest;
-    while(*src != 0)
-    {
-        *dest = *src;
-        src += 1;
-        dest += 1;
-    }
-
-    *dest = 0x00;
-
-    return res;
+    // Copying the terminator along with the string keeps this one pass of memcpy
+    memcpy(dest, (void*)src, strlen(src) + 1);
+    return dest;
 }
 
 char* strncpy(char* dest, const char* src, int count)
 {
     int i = 0;
-    for (i = 0; i < count-1; i++)
+
+    // Copy whole words while they are known to hold no terminator
+    while (i + (int)STRING_WORD_SIZE <= count - 1 && string_word_safe(src + i))
+    {
+        string_word_t w = *(const string_word_t*)(src + i);
+        if (STRING_HAS_ZERO(w))
+            break;
+
+        *(string_word_t*)(dest + i) = w;
+        i += STRING_WORD_SIZE;
+    }
+
+    for (; i < count-1; i++)
     {
         if (src[i] == 0x00)
             break;
@@ -120,34 +197,29 @@ int tonumericdigit(char c)
 char* sp = 0;
 char* strtok(char* str, const char* delimiters)
 {
-    int i = 0;
-    int len = strlen(delimiters);
+    // One bit per character value so each test is a single lookup
+    // instead of a scan of the delimiter string
+    uint64_t delimiter_map[4] = {0};
+    for (const unsigned char* d = (const unsigned char*)delimiters; *d; d++)
+    {
+        delimiter_map[*d >> 6] |= 1ULL << (*d & 63);
+    }
+
     if (!str && !sp)
         return 0;
-    
+
     if (str && !sp)
     {
         sp = str;
     }
 
+    // The terminator is never a delimiter so skipping stops at the end
     char* p_start = sp;
-    while(1)
+    while (STRING_IS_DELIMITER(delimiter_map, *p_start))
     {
-        for (i = 0; i < len; i++)
-        {
-            if(*p_start == delimiters[i])
-            {
-                p_start++;
-                break;
-            }
-        }
-
-        if (i == len)
-        {
-            sp = p_start;
-            break;
-        }
+        p_start++;
     }
+    sp = p_start;
 
     if (*sp == '\0')
     {
@@ -156,21 +228,16 @@ char* strtok(char* str, const char* delimiters)
     }
 
     // Find end of substring
-    while(*sp != '\0')
+    while (*sp != '\0')
     {
-        for (i = 0; i < len; i++)
+        if (STRING_IS_DELIMITER(delimiter_map, *sp))
         {
-            if (*sp == delimiters[i])
-            {
-                *sp = '\0';
-                break;
-            }
+            *sp++ = '\0';
+            break;
         }
 
         sp++;
-        if (i < len)
-            break;
     }
 
     return p_start;
-}
\ No newline at end of file
+}
@@ -11,6 +11,13 @@ global vios_process_load_start:function
 global vios_process_get_arguments:function
 global vios_system:function
 global vios_exit:function
+global vios_fopen:function
+global vios_fread:function
+global vios_fpread:function
+global vios_fseek:function
+global vios_fstat:function
+global vios_fclose:function
+global vios_mmap:function
 
 ; void print(const char* filename)
 print:
@@ -80,3 +87,71 @@ vios_exit:
     mov rax, 9 ; Command 9 process exit
     int 0x80
     ret
+
+; int vios_fopen(const char* filename, const char* mode)
+vios_fopen:
+    mov rax, 10 ; Command 10 opens a file for this process
+    push rsi ; Variable "mode"
+    push rdi ; Variable "filename"
+    int 0x80
+    add rsp, 16
+    ret
+
+; int vios_fread(int fd, void* buf, size_t count)
+vios_fread:
+    mov rax, 11 ; Command 11 reads from the file position into "buf"
+    push rdx ; Variable "count"
+    push rsi ; Variable "buf"
+    push rdi ; Variable "fd"
+    int 0x80
+    add rsp, 24
+    ret
+
+; int vios_fpread(int fd, void* buf, size_t count, unsigned int offset)
+vios_fpread:
+    mov rax, 12 ; Command 12 reads from "offset" into "buf"
+    push rcx ; Variable "offset"
+    push rdx ; Variable "count"
+    push rsi ; Variable "buf"
+    push rdi ; Variable "fd"
+    int 0x80
+    add rsp, 32
+    ret
+
+; int vios_fseek(int fd, int offset, int whence)
+vios_fseek:
+    mov rax, 13 ; Command 13 moves the file position
+    push rdx ; Variable "whence"
+    push rsi ; Variable "offset"
+    push rdi ; Variable "fd"
+    int 0x80
+    add rsp, 24
+    ret
+
+; int vios_fstat(int fd, struct file_stat* stat)
+vios_fstat:
+    mov rax, 14 ; Command 14 gets the size and flags of the file
+    push rsi ; Variable "stat"
+    push rdi ; Variable "fd"
+    int 0x80
+    add rsp, 16
+    ret
+
+; int vios_fclose(int fd)
+vios_fclose:
+    mov rax, 15 ; Command 15 closes the file
+    push rdi ; Variable "fd"
+    int 0x80
+    add rsp, 8
+    ret
+
+; void* vios_mmap(int fd, unsigned int offset, size_t length, int flags)
+vios_mmap:
+    mov rax, 16 ; Command 16 maps the file into this process
+    push rcx ; Variable "flags"
+    push rdx ; Variable "length"
+    push rsi ; Variable "offset"
+    push rdi ; Variable "fd"
+    int 0x80
+    add rsp, 32
+    ret
@@ -13,6 +13,23 @@ struct process_arguments {
   char **argv;
 };
 
+enum { SEEK_SET, SEEK_CUR, SEEK_END };
+
+enum { FILE_STAT_READ_ONLY = 0b00000001 };
+
+struct file_stat {
+  unsigned int flags;
+  unsigned int filesize;
+  unsigned int id;
+};
+
+enum {
+  // Read only, every process mapping the file shares the same pages
+  VIOS_MAP_SHARED,
+  // Writable, the process gets its own copy
+  VIOS_MAP_PRIVATE
+};
+
 void print(const char *filename);
 int vios_getkey();
 
@@ -27,4 +44,15 @@ void vios_process_get_arguments(struct process_arguments *arguments);
 int vios_system(struct command_argument *arguments);
 int vios_system_run(const char *command);
 void vios_exit();
+
+// Files take full paths such as "0:/file.bin", errors are negative
+int vios_fopen(const char *filename, const char *mode);
+int vios_fread(int fd, void *buf, size_t count);
+int vios_fpread(int fd, void *buf, size_t count, unsigned int offset);
+int vios_fseek(int fd, int offset, int whence);
+int vios_fstat(int fd, struct file_stat *stat);
+int vios_fclose(int fd);
+// "offset" must be a multiple of 4096, a negative error cast to a pointer
+// when the file cannot be mapped
+void *vios_mmap(int fd, unsigned int offset, size_t length, int flags);
 #endif
\ No newline at end of file
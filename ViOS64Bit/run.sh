@@ -4,6 +4,7 @@
 AUDIO=true
 DEBUG=false
 SERIAL=true
+DISK=ide
 
 # Get max resolution using macOS system profiler
 SCREEN_WIDTH=$(system_profiler SPDisplaysDataType | awk -F': ' '/Resolution/ {print $2; exit}' | awk '{print $1}')
@@ -27,6 +28,15 @@ for arg in "$@"; do
         -s|--no-serial)
             SERIAL=false
             ;;
+        --ahci)
+            DISK=ahci
+            ;;
+        --nvme)
+            DISK=nvme
+            ;;
+        --virtio)
+            DISK=virtio
+            ;;
         *)
             echo "Unknown option: $arg"
             exit 1
@@ -42,7 +52,18 @@ if [ ! -f "$QEMU_BIN" ]; then
     QEMU_BIN=$(which qemu-system-x86_64 2>/dev/null || echo "qemu-system-x86_64")
 fi
 
-QEMU_CMD="$QEMU_BIN -m 1204M -d guest_errors -drive file=bin/os.bin,if=ide,index=0,media=disk,format=raw"
+QEMU_CMD="$QEMU_BIN -m 1204M -d guest_errors"
+
+# Disk controller option
+if [ "$DISK" = ahci ]; then
+    QEMU_CMD="$QEMU_CMD -machine q35 -drive file=bin/os.bin,if=none,id=disk0,format=raw -device ide-hd,drive=disk0,bus=ide.0"
+elif [ "$DISK" = nvme ]; then
+    QEMU_CMD="$QEMU_CMD -drive file=bin/os.bin,if=none,id=disk0,format=raw -device nvme,drive=disk0,serial=vios0"
+elif [ "$DISK" = virtio ]; then
+    QEMU_CMD="$QEMU_CMD -drive file=bin/os.bin,if=none,id=disk0,format=raw -device virtio-blk-pci,drive=disk0,disable-modern=on"
+else
+    QEMU_CMD="$QEMU_CMD -drive file=bin/os.bin,if=ide,index=0,media=disk,format=raw"
+fi
 # TODO: add gpu here
 
 # Serial option
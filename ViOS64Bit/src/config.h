@@ -22,6 +22,10 @@
 // Where to find the E820 records
 #define VIOS_MEMORY_MAP_LOCATION 0x210008
 
+// Where the UEFI loader describes the RAM disk image it loaded
+#define VIOS_RAMDISK_INFO_LOCATION 0x20F000
+#define VIOS_RAMDISK_MAGIC 0x4B5349444D415256ULL
+
 
 // 100MB heap size
 #define VIOS_HEAP_MINIMUM_SIZE_BYTES 104857600
@@ -37,13 +41,121 @@
 #define VIOS_MINIMAL_HEAP_TABLE_SIZE VIOS_MINIMAL_HEAP_ADDRESS-VIOS_MINIMAL_HEAP_TABLE_ADDRESS
 
 
+// Copies smaller than this never touch the vector registers
+#define VIOS_MEMORY_VECTOR_MINIMUM 256
+
+// Above this size REP MOVSB/STOSB wins when the CPU supports ERMS
+#define VIOS_MEMORY_ERMS_THRESHOLD 2048
+
+// Copies larger than this use non-temporal stores to avoid thrashing the cache
+#define VIOS_MEMORY_NONTEMPORAL_THRESHOLD 1048576
+
+// Set to 1 to print the memory routine benchmark table during boot
+#define VIOS_MEMORY_BENCHMARK 0
+
 #define VIOS_SECTOR_SIZE 512
 
+// Memory set aside for cached disk blocks, 4MB
+#define VIOS_DISK_BCACHE_MAX_BYTES 4194304
+#define VIOS_DISK_BCACHE_BLOCK_SIZE VIOS_SECTOR_SIZE
+// Must be a power of two
+#define VIOS_DISK_BCACHE_HASH_BUCKETS 1024
+// Reads larger than this many blocks are not kept in the cache
+#define VIOS_DISK_BCACHE_MAX_READ_BLOCKS 64
+// Writes are held back until this much of the cache is dirty, 2MB
+#define VIOS_DISK_BCACHE_MAX_DIRTY_BLOCKS 4096
+// Or until the oldest dirty block has waited this long
+#define VIOS_DISK_BCACHE_WRITEBACK_MS 5000
+// Blocks written back with a single device command
+#define VIOS_DISK_BCACHE_FLUSH_BLOCKS 128
+
+// Bounds of the adaptive read ahead window of a disk stream
+#define VIOS_DISKSTREAM_MIN_READAHEAD_SECTORS 8
+#define VIOS_DISKSTREAM_MAX_READAHEAD_SECTORS 256
+
+// Largest command the block queue builds by merging adjacent bios
+#define VIOS_DISK_QUEUE_MAX_MERGE_SECTORS 256
+
+// Set to 0 to force the ATA driver to use PIO only
+#define VIOS_DISK_ATA_DMA 1
+
+// Requests to AHCI, NVMe and virtio disks fail once the device has
+// completed nothing for this long
+#define VIOS_DISK_REQUEST_TIMEOUT_MS 5000
+
+// Most AHCI controllers the kernel will drive
+#define VIOS_DISK_AHCI_MAX_CONTROLLERS 2
+
+// Most NVMe controllers the kernel will drive
+#define VIOS_DISK_NVME_MAX_CONTROLLERS 2
+// I/O queue pairs per NVMe controller, one per CPU we run on
+#define VIOS_DISK_NVME_IO_QUEUES 1
+
+// Most virtio block devices the kernel will drive
+#define VIOS_DISK_VIRTIO_MAX_DEVICES 2
+
+// Set to 1 to print disk throughput numbers during boot
+#define VIOS_DISK_BENCHMARK 0
+#define VIOS_DISK_BENCHMARK_BYTES 8388608
+#define VIOS_DISK_BENCHMARK_FILE "@:/bkground.bmp"
+// Files build.sh writes to the data partition for the read size sweep
+#define VIOS_DISK_BENCHMARK_SWEEP_FILES                                        \
+  {"bench64k.bin", "bench1m.bin", "bench32m.bin"}
+// Random 4KB reads issued at every queue depth by the benchmark
+#define VIOS_DISK_BENCHMARK_RANDOM_READS 2048
+
 #define VIOS_MAX_FILESYSTEMS 12
-#define VIOS_MAX_FILE_DESCRIPTORS 512
+
+// Largest FAT32 allocation table kept in memory, a larger one is read a
+// sector at a time through the block cache
+#define VIOS_FAT32_MAX_FAT_CACHE_BYTES 16777216
+
+// Names looked up in directories, found or not, remembered by the VFS
+#define VIOS_FS_DCACHE_ENTRIES 512
+// Must be a power of two
+#define VIOS_FS_DCACHE_HASH_BUCKETS 256
+// Longer names are always looked up in the directory
+#define VIOS_FS_DCACHE_NAME_MAX 32
+
+// Descriptors a process starts with room for, its table doubles up to
+// the maximum as it opens more
+#define VIOS_FILE_TABLE_INITIAL_SIZE 64
+#define VIOS_MAX_FILE_DESCRIPTORS 65536
 
 #define VIOS_MAX_PATH 108
 
+// Buffers one vectored read may fill
+#define VIOS_FILE_MAX_IOVECS 16
+
+// File pages the page cache holds before it evicts files nobody uses
+#define VIOS_PAGECACHE_MAX_BYTES 67108864
+// Pages read in one go when a missing page is asked for
+#define VIOS_PAGECACHE_READAHEAD_PAGES 64
+
+// Memory the files of the tmpfs drive may hold between them
+#define VIOS_TMPFS_MAX_BYTES 33554432
+#define VIOS_TMPFS_NAME_MAX 64
+
+// Set to 0 to draw straight to the real framebuffer instead of a back
+// buffer flushed in row spans
+#define VIOS_GRAPHICS_BACK_BUFFER 1
+// Damaged rectangles remembered between flushes, more are merged
+#define VIOS_GRAPHICS_MAX_DAMAGE_RECTS 32
+// Longest drawing waits before it reaches the screen, about 60 frames a
+// second
+#define VIOS_GRAPHICS_FLUSH_INTERVAL_US 16000
+
+// Set to 0 to draw every character bit by bit from the font bitmap
+#define VIOS_FONT_GLYPH_CACHE 1
+// Characters kept rasterized in the colour they were drawn in, must be a
+// power of two
+#define VIOS_FONT_GLYPH_CACHE_ENTRIES 256
+// Fonts with larger characters are not cached
+#define VIOS_FONT_GLYPH_MAX_PIXELS 512
+
+// Set to 1 to print the full screen paste and text benchmarks during boot
+#define VIOS_GRAPHICS_BENCHMARK 0
+
 #define VIOS_TOTAL_GDT_SEGMENTS 6
 
 #define VIOS_PROGRAM_VIRTUAL_ADDRESS 0x400000
@@ -52,6 +164,9 @@
 #define VIOS_PROGRAM_VIRTUAL_STACK_ADDRESS_END VIOS_PROGRAM_VIRTUAL_STACK_ADDRESS_START - VIOS_USER_PROGRAM_STACK_SIZE
 
 #define VIOS_MAX_PROGRAM_ALLOCATIONS 1024
+// Files a process can map, placed one after another from the address
+#define VIOS_MAX_PROGRAM_MAPPINGS 64
+#define VIOS_PROGRAM_MMAP_VIRTUAL_ADDRESS 0x700000000000
 #define VIOS_MAX_PROCESSES 12
 
 #define USER_DATA_SEGMENT 0x33 // Also includes requested privilage level 3 
@@ -0,0 +1,250 @@
+#include "cpu.h"
+#include "io/io.h"
+#include "memory/memory.h"
+
+#define CPU_CR0_MONITOR_COPROCESSOR 0x02
+#define CPU_CR0_EMULATION 0x04
+#define CPU_CR4_OSFXSR 0x200
+#define CPU_CR4_OSXMMEXCPT 0x400
+#define CPU_CR4_OSXSAVE 0x40000
+
+// XCR0 bits for the x87, SSE and AVX register state
+#define CPU_XCR0_X87 0x01
+#define CPU_XCR0_SSE 0x02
+#define CPU_XCR0_AVX 0x04
+
+// CPUID leaf 1
+#define CPU_CPUID1_EDX_SSE2 (1 << 26)
+#define CPU_CPUID1_ECX_SSE42 (1 << 20)
+#define CPU_CPUID1_ECX_XSAVE (1 << 26)
+#define CPU_CPUID1_ECX_AVX (1 << 28)
+
+// CPUID leaf 7 subleaf 0
+#define CPU_CPUID7_EBX_AVX2 (1 << 5)
+#define CPU_CPUID7_EBX_ERMS (1 << 9)
+#define CPU_CPUID7_EDX_FSRM (1 << 4)
+
+#define CPU_RFLAGS_INTERRUPT_ENABLE 0x200
+
+// Length of the TSC calibration window
+#define CPU_TSC_CALIBRATION_MS 10
+
+static struct cpu_info cpu_information;
+
+void cpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx,
+               uint32_t *ecx, uint32_t *edx) {
+  uint32_t a, b, c, d;
+  __asm__ __volatile__("cpuid"
+                       : "=a"(a), "=b"(b), "=c"(c), "=d"(d)
+                       : "a"(leaf), "c"(subleaf));
+  *eax = a;
+  *ebx = b;
+  *ecx = c;
+  *edx = d;
+}
+
+uint64_t cpu_rdtsc() {
+  uint32_t low, high;
+  __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+static uint64_t cpu_read_cr0() {
+  uint64_t value;
+  __asm__ __volatile__("mov %%cr0, %0" : "=r"(value));
+  return value;
+}
+
+static void cpu_write_cr0(uint64_t value) {
+  __asm__ __volatile__("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static uint64_t cpu_read_cr4() {
+  uint64_t value;
+  __asm__ __volatile__("mov %%cr4, %0" : "=r"(value));
+  return value;
+}
+
+static void cpu_write_cr4(uint64_t value) {
+  __asm__ __volatile__("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+static uint64_t cpu_xgetbv(uint32_t index) {
+  uint32_t low, high;
+  __asm__ __volatile__("xgetbv" : "=a"(low), "=d"(high) : "c"(index));
+  return ((uint64_t)high << 32) | low;
+}
+
+static void cpu_xsetbv(uint32_t index, uint64_t value) {
+  __asm__ __volatile__("xsetbv"
+                       :
+                       : "c"(index), "a"((uint32_t)value),
+                         "d"((uint32_t)(value >> 32)));
+}
+
+/**
+ * The firmware normally leaves SSE enabled for us, but make sure
+ * the kernel never depends on that.
+ */
+static void cpu_enable_sse() {
+  uint64_t cr0 = cpu_read_cr0();
+  cr0 &= ~CPU_CR0_EMULATION;
+  cr0 |= CPU_CR0_MONITOR_COPROCESSOR;
+  cpu_write_cr0(cr0);
+
+  cpu_write_cr4(cpu_read_cr4() | CPU_CR4_OSFXSR | CPU_CR4_OSXMMEXCPT);
+}
+
+/**
+ * AVX instructions fault unless the OS has enabled XSAVE and the AVX
+ * state component in XCR0, returns true if AVX can be used.
+ */
+static bool cpu_enable_avx(uint32_t cpuid1_ecx) {
+  if (!(cpuid1_ecx & CPU_CPUID1_ECX_XSAVE) ||
+      !(cpuid1_ecx & CPU_CPUID1_ECX_AVX)) {
+    return false;
+  }
+
+  cpu_write_cr4(cpu_read_cr4() | CPU_CR4_OSXSAVE);
+  cpu_xsetbv(0, cpu_xgetbv(0) | CPU_XCR0_X87 | CPU_XCR0_SSE | CPU_XCR0_AVX);
+  return true;
+}
+
+/**
+ * Counts TSC ticks across a fixed PIT channel two countdown
+ */
+static uint64_t cpu_calibrate_tsc() {
+  uint16_t count = (CPU_PIT_FREQUENCY * CPU_TSC_CALIBRATION_MS) / 1000;
+
+  // Disable the speaker and enable the channel two gate
+  outb(0x61, (insb(0x61) & ~0x02) | 0x01);
+
+  // Channel two, lobyte/hibyte, mode 0 (interrupt on terminal count)
+  outb(0x43, 0xB0);
+  outb(0x42, count & 0xff);
+  outb(0x42, (count >> 8) & 0xff);
+
+  // Restart the countdown by toggling the gate
+  uint8_t gate = insb(0x61) & ~0x01;
+  outb(0x61, gate);
+  outb(0x61, gate | 0x01);
+
+  uint64_t start = cpu_rdtsc();
+  uint64_t spins = 0;
+  // Bit 5 is the channel two output which goes high on terminal count
+  while (!(insb(0x61) & 0x20)) {
+    if (++spins > 100000000) {
+      // The PIT never fired, we cannot trust the TSC
+      return 0;
+    }
+  }
+  uint64_t end = cpu_rdtsc();
+
+  return (end - start) / CPU_TSC_CALIBRATION_MS;
+}
+
+void cpu_init() {
+  uint32_t eax, ebx, ecx, edx;
+  memset(&cpu_information, 0, sizeof(cpu_information));
+
+  cpu_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+  uint32_t max_leaf = eax;
+  memcpy(&cpu_information.vendor[0], &ebx, sizeof(ebx));
+  memcpy(&cpu_information.vendor[4], &edx, sizeof(edx));
+  memcpy(&cpu_information.vendor[8], &ecx, sizeof(ecx));
+
+  cpu_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+  uint32_t cpuid1_ecx = ecx;
+  if (edx & CPU_CPUID1_EDX_SSE2) {
+    cpu_enable_sse();
+    cpu_information.features |= CPU_FEATURE_SSE2;
+  }
+
+  if (ecx & CPU_CPUID1_ECX_SSE42) {
+    cpu_information.features |= CPU_FEATURE_SSE42;
+  }
+
+  if (cpu_enable_avx(cpuid1_ecx)) {
+    cpu_information.features |= CPU_FEATURE_AVX;
+  }
+
+  if (max_leaf >= 7) {
+    cpu_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+    if ((ebx & CPU_CPUID7_EBX_AVX2) &&
+        (cpu_information.features & CPU_FEATURE_AVX)) {
+      cpu_information.features |= CPU_FEATURE_AVX2;
+    }
+
+    if (ebx & CPU_CPUID7_EBX_ERMS) {
+      cpu_information.features |= CPU_FEATURE_ERMS;
+    }
+
+    if (edx & CPU_CPUID7_EDX_FSRM) {
+      cpu_information.features |= CPU_FEATURE_FSRM;
+    }
+  }
+
+  cpu_information.tsc_per_ms = cpu_calibrate_tsc();
+}
+
+struct cpu_info *cpu_info() { return &cpu_information; }
+
+bool cpu_has_feature(uint32_t feature) {
+  return (cpu_information.features & feature) == feature;
+}
+
+uint64_t cpu_tsc_to_us(uint64_t ticks) {
+  if (!cpu_information.tsc_per_ms) {
+    return 0;
+  }
+
+  return (ticks * 1000) / cpu_information.tsc_per_ms;
+}
+
+/**
+ * Disables interrupts and returns the previous flags for
+ * cpu_restore_interrupts
+ */
+uint64_t cpu_save_interrupts() {
+  uint64_t flags;
+  __asm__ __volatile__("pushfq\n\t"
+                       "pop %0\n\t"
+                       "cli"
+                       : "=r"(flags)
+                       :
+                       : "memory");
+  return flags;
+}
+
+void cpu_restore_interrupts(uint64_t flags) {
+  if (flags & CPU_RFLAGS_INTERRUPT_ENABLE) {
+    __asm__ __volatile__("sti" : : : "memory");
+  }
+}
+
+/**
+ * Halts until the next interrupt has been handled, must be called with
+ * interrupts disabled and returns with them disabled again. STI only
+ * takes effect after HLT so no interrupt can slip in between.
+ */
+void cpu_wait_for_interrupt() {
+  __asm__ __volatile__("sti\n\t"
+                       "hlt\n\t"
+                       "cli"
+                       :
+                       :
+                       : "memory");
+}
+
+/**
+ * Lets pending interrupts in for a moment, the instruction in the STI
+ * shadow runs before any interrupt is taken
+ */
+void cpu_interrupt_window() {
+  __asm__ __volatile__("sti\n\t"
+                       "nop\n\t"
+                       "cli"
+                       :
+                       :
+                       : "memory");
+}
@@ -0,0 +1,79 @@
+#ifndef KERNEL_CPU_H
+#define KERNEL_CPU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum {
+  CPU_FEATURE_SSE2 = 0b00000001,
+  CPU_FEATURE_SSE42 = 0b00000010,
+  CPU_FEATURE_AVX = 0b00000100,
+  CPU_FEATURE_AVX2 = 0b00001000,
+  // Enhanced REP MOVSB/STOSB
+  CPU_FEATURE_ERMS = 0b00010000,
+  // Fast short REP MOVSB
+  CPU_FEATURE_FSRM = 0b00100000
+};
+
+// The PIT input clock in Hz, used to calibrate the TSC
+#define CPU_PIT_FREQUENCY 1193182
+
+/**
+ * Vector loops in inline assembly may run inside a system call, the task
+ * switching code does not preserve user SIMD state so the registers they
+ * use are saved to a buffer named "save" and restored around the loop.
+ * These cover xmm0-xmm3 and ymm0-ymm3
+ */
+#define CPU_SSE2_SAVE_BYTES 64
+#define CPU_AVX_SAVE_BYTES 128
+
+#define CPU_SSE2_SAVE                                                          \
+  "movdqu %%xmm0, 0(%[save])\n\t"                                              \
+  "movdqu %%xmm1, 16(%[save])\n\t"                                             \
+  "movdqu %%xmm2, 32(%[save])\n\t"                                             \
+  "movdqu %%xmm3, 48(%[save])\n\t"
+
+#define CPU_SSE2_RESTORE                                                       \
+  "movdqu 0(%[save]), %%xmm0\n\t"                                              \
+  "movdqu 16(%[save]), %%xmm1\n\t"                                             \
+  "movdqu 32(%[save]), %%xmm2\n\t"                                             \
+  "movdqu 48(%[save]), %%xmm3\n\t"
+
+#define CPU_AVX_SAVE                                                           \
+  "vmovdqu %%ymm0, 0(%[save])\n\t"                                             \
+  "vmovdqu %%ymm1, 32(%[save])\n\t"                                            \
+  "vmovdqu %%ymm2, 64(%[save])\n\t"                                            \
+  "vmovdqu %%ymm3, 96(%[save])\n\t"
+
+#define CPU_AVX_RESTORE                                                        \
+  "vmovdqu 0(%[save]), %%ymm0\n\t"                                             \
+  "vmovdqu 32(%[save]), %%ymm1\n\t"                                            \
+  "vmovdqu 64(%[save]), %%ymm2\n\t"                                            \
+  "vmovdqu 96(%[save]), %%ymm3\n\t"
+
+struct cpu_info {
+  // Null terminated vendor string e.g "GenuineIntel"
+  char vendor[13];
+
+  // Bitmask of CPU_FEATURE_* that are usable, AVX is only reported
+  // once the kernel has enabled the AVX state in XCR0
+  uint32_t features;
+
+  // Time stamp counter ticks per millisecond, zero if calibration failed
+  uint64_t tsc_per_ms;
+};
+
+void cpu_init();
+struct cpu_info *cpu_info();
+bool cpu_has_feature(uint32_t feature);
+void cpu_cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax, uint32_t *ebx,
+               uint32_t *ecx, uint32_t *edx);
+uint64_t cpu_rdtsc();
+uint64_t cpu_tsc_to_us(uint64_t ticks);
+uint64_t cpu_save_interrupts();
+void cpu_restore_interrupts(uint64_t flags);
+void cpu_wait_for_interrupt();
+void cpu_interrupt_window();
+
+#endif
@@ -0,0 +1,674 @@
+#include "ahci.h"
+#include "config.h"
+#include "cpu/cpu.h"
+#include "disk/disk.h"
+#include "idt/idt.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "pci/pci.h"
+#include "status.h"
+#include "string/string.h"
+
+// IDENTIFY DEVICE words we care about
+#define AHCI_IDENTIFY_QUEUE_DEPTH 75
+#define AHCI_IDENTIFY_SATA_CAPABILITIES 76
+#define AHCI_IDENTIFY_COMMAND_SETS 83
+#define AHCI_IDENTIFY_LBA48_SECTORS 100
+
+#define AHCI_QUEUE_DEPTH_MASK 0x1F
+#define AHCI_SATA_CAPABILITIES_NCQ (1 << 8)
+#define AHCI_COMMAND_SETS_LBA48 (1 << 10)
+
+// The received FIS area follows the command list in the same page
+#define AHCI_COMMAND_LIST_SIZE 1024
+
+#define AHCI_PORT_IE_DEFAULT                                                   \
+  (AHCI_PORT_IS_D2H_FIS | AHCI_PORT_IS_PIO_SETUP_FIS |                         \
+   AHCI_PORT_IS_DMA_SETUP_FIS | AHCI_PORT_IS_SET_DEVICE_BITS |                 \
+   AHCI_PORT_IS_DESCRIPTOR_PROCESSED | AHCI_PORT_IS_ERROR)
+
+static struct ahci_controller ahci_controllers[VIOS_DISK_AHCI_MAX_CONTROLLERS];
+static int ahci_total_controllers = 0;
+
+// Ports with a disk attached across all controllers
+static struct ahci_port *ahci_ports[VIOS_DISK_AHCI_MAX_CONTROLLERS *
+                                    AHCI_MAX_PORTS];
+static int ahci_port_count = 0;
+
+// Counts interrupts taken, used to check the firmware routed our line
+static volatile uint32_t ahci_interrupt_count = 0;
+
+/**
+ * Orders our writes to the command tables before the doorbell write
+ */
+static void ahci_barrier() { __asm__ __volatile__("mfence" : : : "memory"); }
+
+static int ahci_wait_clear(volatile uint32_t *reg, uint32_t mask) {
+  for (int i = 0; i < AHCI_TIMEOUT_SPINS; i++) {
+    if (!(*reg & mask)) {
+      return 0;
+    }
+  }
+
+  return -EIO;
+}
+
+static int ahci_port_stop(struct ahci_port *port) {
+  volatile struct ahci_port_registers *regs = port->registers;
+  regs->command &= ~AHCI_PORT_CMD_START;
+  if (ahci_wait_clear(&regs->command, AHCI_PORT_CMD_LIST_RUNNING) < 0) {
+    return -EIO;
+  }
+
+  regs->command &= ~AHCI_PORT_CMD_FIS_RECEIVE;
+  return ahci_wait_clear(&regs->command, AHCI_PORT_CMD_FIS_RUNNING);
+}
+
+static int ahci_port_start(struct ahci_port *port) {
+  volatile struct ahci_port_registers *regs = port->registers;
+  int res = ahci_wait_clear(&regs->command, AHCI_PORT_CMD_LIST_RUNNING);
+  if (res < 0) {
+    return res;
+  }
+
+  regs->command |= AHCI_PORT_CMD_FIS_RECEIVE;
+  res = ahci_wait_clear(&regs->task_file_data,
+                        AHCI_PORT_TFD_BSY | AHCI_PORT_TFD_DRQ);
+  if (res < 0) {
+    return res;
+  }
+
+  regs->command |= AHCI_PORT_CMD_START;
+  return 0;
+}
+
+static bool ahci_address_reachable(struct ahci_port *port, uint64_t address,
+                                   size_t bytes) {
+  return port->controller->addressing64 || address + bytes <= 0x100000000ULL;
+}
+
+/**
+ * Describes "bytes" at "buf" in the PRDT of "table", returns the number
+ * of entries or -EINVARG when the buffer cannot be reached by the HBA
+ */
+static int ahci_build_prdt(struct ahci_port *port,
+                           struct ahci_command_table *table, uint8_t *buf,
+                           size_t bytes) {
+  struct paging_desc *desc = paging_current_descriptor();
+  int total_entries = 0;
+  struct ahci_prdt_entry *entry = NULL;
+  size_t entry_bytes = 0;
+  uint64_t entry_end = 0;
+
+  while (bytes) {
+    size_t chunk =
+        MIN(bytes, PAGING_PAGE_SIZE - ((uintptr_t)buf % PAGING_PAGE_SIZE));
+    uint64_t phys = (uint64_t)(uintptr_t)buf;
+    if (desc) {
+      phys = (uint64_t)(uintptr_t)paging_get_physical_address(desc, buf);
+    }
+
+    if (!phys || (phys & 1) || !ahci_address_reachable(port, phys, chunk)) {
+      return -EINVARG;
+    }
+
+    // Grow the previous region while memory stays contiguous
+    if (entry && phys == entry_end &&
+        entry_bytes + chunk <= AHCI_PRDT_MAX_BYTES) {
+      entry_bytes += chunk;
+    } else {
+      if (entry) {
+        entry->byte_count = entry_bytes - 1;
+      }
+
+      if (total_entries == AHCI_PRDT_MAX_ENTRIES) {
+        return -EINVARG;
+      }
+
+      entry = &table->prdt[total_entries++];
+      entry->address = phys & 0xFFFFFFFF;
+      entry->address_upper = phys >> 32;
+      entry->reserved = 0;
+      entry_bytes = chunk;
+    }
+
+    entry_end = phys + chunk;
+    buf += chunk;
+    bytes -= chunk;
+  }
+
+  if (entry) {
+    entry->byte_count = entry_bytes - 1;
+  }
+
+  return total_entries;
+}
+
+static bool ahci_command_is_queued(uint8_t command) {
+  return command == AHCI_COMMAND_READ_FPDMA_QUEUED ||
+         command == AHCI_COMMAND_WRITE_FPDMA_QUEUED;
+}
+
+/**
+ * Fills in the command header and table of "slot", the command is not
+ * issued until its bit is written to the command issue register
+ */
+static int ahci_prepare_command(struct ahci_port *port, int slot,
+                                uint8_t command, uint64_t lba, size_t count,
+                                void *buf, size_t bytes, bool write) {
+  struct ahci_command_table *table = &port->command_tables[slot];
+  int entries = ahci_build_prdt(port, table, buf, bytes);
+  if (entries < 0) {
+    return entries;
+  }
+
+  struct ahci_fis_h2d *fis = (struct ahci_fis_h2d *)table->command_fis;
+  memset(fis, 0, sizeof(*fis));
+  fis->fis_type = AHCI_FIS_TYPE_REG_H2D;
+  fis->flags = AHCI_FIS_H2D_COMMAND;
+  fis->command = command;
+  fis->lba0 = lba & 0xff;
+  fis->lba1 = (lba >> 8) & 0xff;
+  fis->lba2 = (lba >> 16) & 0xff;
+  fis->lba3 = (lba >> 24) & 0xff;
+  fis->lba4 = (lba >> 32) & 0xff;
+  fis->lba5 = (lba >> 40) & 0xff;
+  if (command != AHCI_COMMAND_IDENTIFY) {
+    fis->device = AHCI_FIS_DEVICE_LBA;
+  }
+
+  if (ahci_command_is_queued(command)) {
+    // Queued commands carry the count in the features and the tag in
+    // the count register
+    fis->feature_low = count & 0xff;
+    fis->feature_high = (count >> 8) & 0xff;
+    fis->count_low = slot << 3;
+  } else {
+    fis->count_low = count & 0xff;
+    fis->count_high = (count >> 8) & 0xff;
+  }
+
+  struct ahci_command_header *header = &port->command_list[slot];
+  uint64_t table_address = (uint64_t)(uintptr_t)table;
+  header->flags = sizeof(struct ahci_fis_h2d) / sizeof(uint32_t);
+  if (write) {
+    header->flags |= AHCI_COMMAND_HEADER_WRITE;
+  }
+  header->prdt_length = entries;
+  header->prd_byte_count = 0;
+  header->table_base = table_address & 0xFFFFFFFF;
+  header->table_base_upper = table_address >> 32;
+  return 0;
+}
+
+/**
+ * Runs a single non queued command in slot zero and polls for it,
+ * only used while probing before the port takes requests
+ */
+static int ahci_execute_polled(struct ahci_port *port, uint8_t command,
+                               void *buf, size_t bytes) {
+  volatile struct ahci_port_registers *regs = port->registers;
+  int res = ahci_prepare_command(port, 0, command, 0, 0, buf, bytes, false);
+  if (res < 0) {
+    return res;
+  }
+
+  ahci_barrier();
+  regs->command_issue = 1;
+  for (int i = 0; i < AHCI_TIMEOUT_SPINS; i++) {
+    if (regs->interrupt_status & AHCI_PORT_IS_ERROR) {
+      return -EIO;
+    }
+
+    if (!(regs->command_issue & 1)) {
+      return (regs->task_file_data & AHCI_PORT_TFD_ERR) ? -EIO : 0;
+    }
+  }
+
+  return -EIO;
+}
+
+static int ahci_identify(struct ahci_port *port) {
+  uint16_t identify[256];
+  int res = ahci_execute_polled(port, AHCI_COMMAND_IDENTIFY, identify,
+                                sizeof(identify));
+  if (res < 0) {
+    return res;
+  }
+
+  // The queued and EXT commands we issue all need 48 bit addressing
+  if (!(identify[AHCI_IDENTIFY_COMMAND_SETS] & AHCI_COMMAND_SETS_LBA48)) {
+    return -EIO;
+  }
+
+  memcpy(&port->total_sectors, &identify[AHCI_IDENTIFY_LBA48_SECTORS],
+         sizeof(uint64_t));
+
+  port->queue_depth = 1;
+  port->ncq = false;
+  if ((port->controller->registers->capabilities & AHCI_CAP_NCQ) &&
+      (identify[AHCI_IDENTIFY_SATA_CAPABILITIES] &
+       AHCI_SATA_CAPABILITIES_NCQ)) {
+    port->ncq = true;
+    port->queue_depth =
+        (identify[AHCI_IDENTIFY_QUEUE_DEPTH] & AHCI_QUEUE_DEPTH_MASK) + 1;
+    if (port->queue_depth > port->command_slots) {
+      port->queue_depth = port->command_slots;
+    }
+  }
+
+  return 0;
+}
+
+static int ahci_port_allocate(struct ahci_port *port) {
+  // The command list needs 1KB alignment, heap blocks are page aligned
+  port->command_list = kzalloc(PAGING_PAGE_SIZE);
+  port->command_tables =
+      kzalloc(sizeof(struct ahci_command_table) * port->command_slots);
+  if (!port->command_list || !port->command_tables) {
+    return -ENOMEM;
+  }
+
+  port->received_fis = (uint8_t *)port->command_list + AHCI_COMMAND_LIST_SIZE;
+  if (!ahci_address_reachable(port, (uintptr_t)port->command_list,
+                              PAGING_PAGE_SIZE) ||
+      !ahci_address_reachable(port, (uintptr_t)port->command_tables,
+                              sizeof(struct ahci_command_table) *
+                                  port->command_slots)) {
+    return -ENOMEM;
+  }
+
+  return 0;
+}
+
+static int ahci_port_setup(struct ahci_port *port) {
+  volatile struct ahci_port_registers *regs = port->registers;
+  int res = ahci_port_stop(port);
+  if (res < 0) {
+    return res;
+  }
+
+  res = ahci_port_allocate(port);
+  if (res < 0) {
+    return res;
+  }
+
+  uint64_t command_list = (uint64_t)(uintptr_t)port->command_list;
+  uint64_t received_fis = (uint64_t)(uintptr_t)port->received_fis;
+  regs->command_list_base = command_list & 0xFFFFFFFF;
+  regs->command_list_base_upper = command_list >> 32;
+  regs->fis_base = received_fis & 0xFFFFFFFF;
+  regs->fis_base_upper = received_fis >> 32;
+
+  // Both registers clear when written as one
+  regs->sata_error = 0xFFFFFFFF;
+  regs->interrupt_status = 0xFFFFFFFF;
+  regs->command |= AHCI_PORT_CMD_SPIN_UP | AHCI_PORT_CMD_POWER_ON;
+  return ahci_port_start(port);
+}
+
+/**
+ * Fails every outstanding command and restarts the port, stopping the
+ * command list engine clears the issue and active registers
+ */
+static void ahci_port_recover(struct ahci_port *port) {
+  volatile struct ahci_port_registers *regs = port->registers;
+  for (int slot = 0; slot < AHCI_MAX_COMMAND_SLOTS; slot++) {
+    if (port->slot_requests[slot]) {
+      port->slot_requests[slot]->status = -EIO;
+      port->slot_requests[slot] = NULL;
+    }
+  }
+  port->slots_in_use = 0;
+
+  ahci_port_stop(port);
+  regs->sata_error = 0xFFFFFFFF;
+  regs->interrupt_status = 0xFFFFFFFF;
+  port->error = false;
+  ahci_port_start(port);
+}
+
+/**
+ * Completes the requests whose slots the HBA and the drive have both
+ * released, returns how many or -EIO if the port reported an error
+ */
+static int ahci_port_reap(struct ahci_port *port) {
+  volatile struct ahci_port_registers *regs = port->registers;
+  if (port->error || (regs->interrupt_status & AHCI_PORT_IS_ERROR)) {
+    return -EIO;
+  }
+
+  // Queued commands stay active until the drive sends Set Device Bits
+  uint32_t active = regs->command_issue;
+  if (port->ncq) {
+    active |= regs->sata_active;
+  }
+
+  uint32_t done = port->slots_in_use & ~active;
+  int total = 0;
+  while (done) {
+    int slot = __builtin_ctz(done);
+    done &= done - 1;
+    port->slot_requests[slot]->status = 0;
+    port->slot_requests[slot] = NULL;
+    port->slots_in_use &= ~(1U << slot);
+    total++;
+  }
+
+  return total;
+}
+
+static int ahci_issue_request(struct ahci_port *port,
+                              struct disk_request *request) {
+  volatile struct ahci_port_registers *regs = port->registers;
+  if (!request->count || request->count > AHCI_MAX_SECTORS_PER_COMMAND) {
+    return -EINVARG;
+  }
+
+  if (request->lba + request->count > port->total_sectors) {
+    return -EIO;
+  }
+
+  uint8_t command;
+  if (port->ncq) {
+    command = request->write ? AHCI_COMMAND_WRITE_FPDMA_QUEUED
+                             : AHCI_COMMAND_READ_FPDMA_QUEUED;
+  } else {
+    command =
+        request->write ? AHCI_COMMAND_WRITE_DMA_EXT : AHCI_COMMAND_READ_DMA_EXT;
+  }
+
+  int slot = __builtin_ctz(~port->slots_in_use);
+  int res = ahci_prepare_command(port, slot, command, request->lba,
+                                 request->count, request->buf,
+                                 request->count * AHCI_SECTOR_SIZE,
+                                 request->write);
+  if (res < 0) {
+    return res;
+  }
+
+  port->slot_requests[slot] = request;
+  port->slots_in_use |= 1U << slot;
+  request->status = 1;
+
+  ahci_barrier();
+  // The active bit must be set before the command is issued
+  if (port->ncq) {
+    regs->sata_active = 1U << slot;
+  }
+  regs->command_issue = 1U << slot;
+  return 0;
+}
+
+static int ahci_request_issue(void *device, struct disk_request *request) {
+  return ahci_issue_request(device, request);
+}
+
+static int ahci_request_reap(void *device) { return ahci_port_reap(device); }
+
+static bool ahci_request_wait(void *device) {
+  struct ahci_port *port = device;
+  if (!port->controller->interrupts) {
+    return false;
+  }
+
+  uint64_t start = cpu_rdtsc();
+  cpu_wait_for_interrupt();
+  port->idle_ticks += cpu_rdtsc() - start;
+  return true;
+}
+
+static void ahci_request_abort(void *device) { ahci_port_recover(device); }
+
+static const struct disk_request_ops ahci_request_ops = {
+    .issue = ahci_request_issue,
+    .reap = ahci_request_reap,
+    .wait = ahci_request_wait,
+    .abort = ahci_request_abort,
+    .timeout_spins = AHCI_TIMEOUT_SPINS};
+
+int ahci_submit_requests(struct ahci_port *port, struct disk_request *requests,
+                         size_t total, int queue_depth) {
+  return disk_request_submit(&ahci_request_ops, port, requests, total,
+                             queue_depth, port->queue_depth);
+}
+
+/**
+ * Splits a transfer into commands the PRDT can describe and runs them
+ * concurrently
+ */
+static int ahci_transfer(struct ahci_port *port, uint64_t lba, size_t total,
+                         uint8_t *buf, bool write) {
+  int res = 0;
+  struct disk_request requests[AHCI_MAX_COMMAND_SLOTS];
+  while (total) {
+    size_t batch = 0;
+    while (total && batch < AHCI_MAX_COMMAND_SLOTS) {
+      size_t count = MIN(total, AHCI_MAX_SECTORS_PER_COMMAND);
+      requests[batch].lba = lba;
+      requests[batch].count = count;
+      requests[batch].buf = buf;
+      requests[batch].write = write;
+      requests[batch].status = 0;
+      batch++;
+
+      lba += count;
+      total -= count;
+      buf += count * AHCI_SECTOR_SIZE;
+    }
+
+    res = ahci_submit_requests(port, requests, batch, port->queue_depth);
+    if (res < 0) {
+      break;
+    }
+  }
+
+  return res;
+}
+
+int ahci_read_sectors(struct ahci_port *port, uint64_t lba, size_t total,
+                      void *buf) {
+  return ahci_transfer(port, lba, total, buf, false);
+}
+
+int ahci_write_sectors(struct ahci_port *port, uint64_t lba, size_t total,
+                       const void *buf) {
+  return ahci_transfer(port, lba, total, (uint8_t *)buf, true);
+}
+
+static int ahci_disk_read(struct disk *disk, size_t lba, int total,
+                          void *buf) {
+  return ahci_read_sectors(disk->driver_private, lba, total, buf);
+}
+
+static int ahci_disk_write(struct disk *disk, size_t lba, int total,
+                           const void *buf) {
+  return ahci_write_sectors(disk->driver_private, lba, total, buf);
+}
+
+struct disk_driver ahci_disk_driver = {
+    .name = "ahci", .read = ahci_disk_read, .write = ahci_disk_write};
+
+/**
+ * Acknowledges every port that raised an interrupt, completions are
+ * reaped by the sleeping submitter
+ */
+static void ahci_interrupt_handler(struct interrupt_frame *frame) {
+  ahci_interrupt_count++;
+  for (int i = 0; i < ahci_total_controllers; i++) {
+    struct ahci_controller *controller = &ahci_controllers[i];
+    volatile struct ahci_hba_registers *hba = controller->registers;
+    uint32_t pending = hba->interrupt_status;
+    if (!controller->interrupts || !pending) {
+      continue;
+    }
+
+    // Port status must be cleared before the controller status, even for
+    // ports without a disk or the line would stay asserted
+    for (int index = 0; index < AHCI_MAX_PORTS; index++) {
+      if (!(pending & (1U << index))) {
+        continue;
+      }
+
+      uint32_t status = hba->ports[index].interrupt_status;
+      hba->ports[index].interrupt_status = status;
+      if (!(status & AHCI_PORT_IS_ERROR)) {
+        continue;
+      }
+
+      for (int p = 0; p < controller->total_ports; p++) {
+        if (controller->ports[p].index == index) {
+          controller->ports[p].error = true;
+        }
+      }
+    }
+    hba->interrupt_status = pending;
+  }
+}
+
+/**
+ * Interrupt routing on the PIC is left to the firmware, make sure our
+ * line really fires before sleeping on it
+ */
+static bool ahci_interrupts_arrive() {
+  for (int i = 0; i < AHCI_TIMEOUT_SPINS / 100 && !ahci_interrupt_count;
+       i++) {
+    cpu_interrupt_window();
+  }
+
+  return ahci_interrupt_count != 0;
+}
+
+static void ahci_interrupts_init(struct ahci_controller *controller) {
+  if (pci_enable_interrupts(controller->pci, ahci_interrupt_handler) < 0) {
+    return;
+  }
+
+  controller->interrupt_line = controller->pci->interrupt_line;
+  controller->interrupts = true;
+  controller->registers->global_host_control |= AHCI_GHC_INTERRUPT_ENABLE;
+}
+
+/**
+ * Brings up a port with a SATA disk attached and registers it as a
+ * real disk, returns -EIO for empty or unsupported ports
+ */
+static int ahci_port_init(struct ahci_controller *controller, int index,
+                          int command_slots) {
+  volatile struct ahci_port_registers *regs =
+      &controller->registers->ports[index];
+  uint32_t sata_status = regs->sata_status;
+  if ((sata_status & AHCI_PORT_SSTS_DET_MASK) != AHCI_PORT_SSTS_DET_PRESENT ||
+      ((sata_status >> AHCI_PORT_SSTS_IPM_SHIFT) & AHCI_PORT_SSTS_IPM_MASK) !=
+          AHCI_PORT_SSTS_IPM_ACTIVE ||
+      regs->signature != AHCI_SIGNATURE_ATA) {
+    return -EIO;
+  }
+
+  struct ahci_port *port = &controller->ports[controller->total_ports];
+  memset(port, 0, sizeof(*port));
+  port->controller = controller;
+  port->registers = regs;
+  port->index = index;
+  port->command_slots = command_slots;
+
+  int res = ahci_port_setup(port);
+  if (res < 0) {
+    return res;
+  }
+
+  regs->interrupt_enable = AHCI_PORT_IE_DEFAULT;
+  res = ahci_identify(port);
+  if (res < 0) {
+    ahci_port_stop(port);
+    return res;
+  }
+
+  if (controller->interrupts && !ahci_interrupts_arrive()) {
+    print("AHCI: no interrupts, polling for completions\n");
+    controller->interrupts = false;
+    controller->registers->global_host_control &= ~AHCI_GHC_INTERRUPT_ENABLE;
+  }
+  regs->interrupt_status = 0xFFFFFFFF;
+  controller->registers->interrupt_status = 1U << index;
+
+  controller->total_ports++;
+  ahci_ports[ahci_port_count++] = port;
+
+  print("AHCI: port ");
+  print(itoa(index));
+  print(port->ncq ? " NCQ depth " : " queue depth ");
+  print(itoa(port->queue_depth));
+  print("\n");
+
+  return disk_create_new(VIOS_DISK_TYPE_REAL, 0, 0, AHCI_SECTOR_SIZE,
+                         &ahci_disk_driver, port, NULL);
+}
+
+static int ahci_controller_init(struct ahci_controller *controller,
+                                struct pci_device *pci) {
+  controller->pci = pci;
+  controller->registers =
+      pci_map_bar(pci, AHCI_ABAR, sizeof(struct ahci_hba_registers));
+  if (!controller->registers) {
+    return -EIO;
+  }
+
+  pci_enable(pci, PCI_COMMAND_MEMORY_SPACE | PCI_COMMAND_BUS_MASTER);
+
+  volatile struct ahci_hba_registers *hba = controller->registers;
+  hba->global_host_control |= AHCI_GHC_AHCI_ENABLE;
+
+  uint32_t capabilities = hba->capabilities;
+  controller->addressing64 = (capabilities & AHCI_CAP_64BIT) != 0;
+  int command_slots = ((capabilities >> AHCI_CAP_COMMAND_SLOTS_SHIFT) &
+                       AHCI_CAP_COMMAND_SLOTS_MASK) +
+                      1;
+
+  hba->interrupt_status = 0xFFFFFFFF;
+  ahci_interrupts_init(controller);
+
+  uint32_t implemented = hba->ports_implemented;
+  for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+    if (implemented & (1U << i)) {
+      ahci_port_init(controller, i, command_slots);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Finds every AHCI controller and registers each attached disk,
+ * returns the number of disks found
+ */
+int ahci_init() {
+  size_t next = 0;
+  struct pci_device *pci = NULL;
+  while (ahci_total_controllers < VIOS_DISK_AHCI_MAX_CONTROLLERS &&
+         (pci = pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_SATA,
+                               next)) != NULL) {
+    next = (pci - pci_device_get(0)) + 1;
+    // Counted before init so the interrupt handler already sees it
+    struct ahci_controller *controller =
+        &ahci_controllers[ahci_total_controllers++];
+    memset(controller, 0, sizeof(*controller));
+    if (ahci_controller_init(controller, pci) < 0) {
+      ahci_total_controllers--;
+    }
+  }
+
+  return ahci_port_count;
+}
+
+int ahci_total_ports() { return ahci_port_count; }
+
+struct ahci_port *ahci_port_get(int index) {
+  if (index < 0 || index >= ahci_port_count) {
+    return NULL;
+  }
+
+  return ahci_ports[index];
+}
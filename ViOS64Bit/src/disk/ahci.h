@@ -0,0 +1,234 @@
+#ifndef KERNEL_DISK_AHCI_H
+#define KERNEL_DISK_AHCI_H
+
+#include "disk/request.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// BAR5 of the controller holds the HBA registers (ABAR)
+#define AHCI_ABAR 5
+
+#define AHCI_MAX_PORTS 32
+#define AHCI_MAX_COMMAND_SLOTS 32
+
+#define AHCI_SECTOR_SIZE 512
+
+// Global HBA control
+#define AHCI_GHC_HBA_RESET 0x00000001
+#define AHCI_GHC_INTERRUPT_ENABLE 0x00000002
+#define AHCI_GHC_AHCI_ENABLE 0x80000000
+
+// HBA capabilities
+#define AHCI_CAP_COMMAND_SLOTS_SHIFT 8
+#define AHCI_CAP_COMMAND_SLOTS_MASK 0x1F
+#define AHCI_CAP_NCQ 0x40000000
+#define AHCI_CAP_64BIT 0x80000000
+
+// Port command and status
+#define AHCI_PORT_CMD_START 0x0001
+#define AHCI_PORT_CMD_SPIN_UP 0x0002
+#define AHCI_PORT_CMD_POWER_ON 0x0004
+#define AHCI_PORT_CMD_FIS_RECEIVE 0x0010
+#define AHCI_PORT_CMD_FIS_RUNNING 0x4000
+#define AHCI_PORT_CMD_LIST_RUNNING 0x8000
+
+// Port interrupt status and enable bits
+#define AHCI_PORT_IS_D2H_FIS 0x00000001
+#define AHCI_PORT_IS_PIO_SETUP_FIS 0x00000002
+#define AHCI_PORT_IS_DMA_SETUP_FIS 0x00000004
+#define AHCI_PORT_IS_SET_DEVICE_BITS 0x00000008
+#define AHCI_PORT_IS_DESCRIPTOR_PROCESSED 0x00000020
+#define AHCI_PORT_IS_INTERFACE_FATAL 0x08000000
+#define AHCI_PORT_IS_HOST_BUS_DATA 0x10000000
+#define AHCI_PORT_IS_HOST_BUS_FATAL 0x20000000
+#define AHCI_PORT_IS_TASK_FILE_ERROR 0x40000000
+#define AHCI_PORT_IS_ERROR                                                     \
+  (AHCI_PORT_IS_INTERFACE_FATAL | AHCI_PORT_IS_HOST_BUS_DATA |                 \
+   AHCI_PORT_IS_HOST_BUS_FATAL | AHCI_PORT_IS_TASK_FILE_ERROR)
+
+// Task file data mirrors the ATA status register
+#define AHCI_PORT_TFD_ERR 0x01
+#define AHCI_PORT_TFD_DRQ 0x08
+#define AHCI_PORT_TFD_BSY 0x80
+
+// SATA status, device detected with the PHY up and the link active
+#define AHCI_PORT_SSTS_DET_MASK 0x0F
+#define AHCI_PORT_SSTS_DET_PRESENT 0x03
+#define AHCI_PORT_SSTS_IPM_SHIFT 8
+#define AHCI_PORT_SSTS_IPM_MASK 0x0F
+#define AHCI_PORT_SSTS_IPM_ACTIVE 0x01
+
+// Signature of a plain SATA disk, ATAPI and port multipliers differ
+#define AHCI_SIGNATURE_ATA 0x00000101
+
+#define AHCI_FIS_TYPE_REG_H2D 0x27
+// Set in a register FIS that carries a command
+#define AHCI_FIS_H2D_COMMAND 0x80
+#define AHCI_FIS_DEVICE_LBA 0x40
+
+#define AHCI_COMMAND_READ_DMA_EXT 0x25
+#define AHCI_COMMAND_WRITE_DMA_EXT 0x35
+#define AHCI_COMMAND_READ_FPDMA_QUEUED 0x60
+#define AHCI_COMMAND_WRITE_FPDMA_QUEUED 0x61
+#define AHCI_COMMAND_IDENTIFY 0xEC
+
+// Command header flags, the low five bits hold the FIS length in dwords
+#define AHCI_COMMAND_HEADER_WRITE 0x0040
+#define AHCI_COMMAND_HEADER_PREFETCH 0x0080
+
+// Sizes the command table to exactly one page
+#define AHCI_PRDT_MAX_ENTRIES 248
+// A region may describe up to 4MB, the byte count is stored minus one
+#define AHCI_PRDT_MAX_BYTES 0x400000
+#define AHCI_PRDT_INTERRUPT 0x80000000
+
+// Keeps the PRDT within bounds even for buffers split on every page
+#define AHCI_MAX_SECTORS_PER_COMMAND 1024
+
+// Gives up on a port that stays busy this many polls
+#define AHCI_TIMEOUT_SPINS 10000000
+
+struct ahci_port_registers {
+  uint32_t command_list_base;
+  uint32_t command_list_base_upper;
+  uint32_t fis_base;
+  uint32_t fis_base_upper;
+  uint32_t interrupt_status;
+  uint32_t interrupt_enable;
+  uint32_t command;
+  uint32_t reserved0;
+  uint32_t task_file_data;
+  uint32_t signature;
+  uint32_t sata_status;
+  uint32_t sata_control;
+  uint32_t sata_error;
+  uint32_t sata_active;
+  uint32_t command_issue;
+  uint32_t sata_notification;
+  uint32_t fis_switching_control;
+  uint32_t reserved1[11];
+  uint32_t vendor[4];
+};
+
+struct ahci_hba_registers {
+  uint32_t capabilities;
+  uint32_t global_host_control;
+  uint32_t interrupt_status;
+  uint32_t ports_implemented;
+  uint32_t version;
+  uint32_t ccc_control;
+  uint32_t ccc_ports;
+  uint32_t enclosure_location;
+  uint32_t enclosure_control;
+  uint32_t capabilities2;
+  uint32_t handoff_control;
+  uint8_t reserved[0x74];
+  uint8_t vendor[0x60];
+  struct ahci_port_registers ports[AHCI_MAX_PORTS];
+};
+
+// Host to device register FIS
+struct ahci_fis_h2d {
+  uint8_t fis_type;
+  uint8_t flags;
+  uint8_t command;
+  uint8_t feature_low;
+  uint8_t lba0;
+  uint8_t lba1;
+  uint8_t lba2;
+  uint8_t device;
+  uint8_t lba3;
+  uint8_t lba4;
+  uint8_t lba5;
+  uint8_t feature_high;
+  uint8_t count_low;
+  uint8_t count_high;
+  uint8_t icc;
+  uint8_t control;
+  uint8_t reserved[4];
+} __attribute__((packed));
+
+struct ahci_command_header {
+  uint16_t flags;
+  // Entries in the physical region descriptor table
+  uint16_t prdt_length;
+  // Bytes transferred, written by the HBA
+  volatile uint32_t prd_byte_count;
+  uint32_t table_base;
+  uint32_t table_base_upper;
+  uint32_t reserved[4];
+} __attribute__((packed));
+
+struct ahci_prdt_entry {
+  uint32_t address;
+  uint32_t address_upper;
+  uint32_t reserved;
+  // Bits 0-21 hold the byte count minus one
+  uint32_t byte_count;
+} __attribute__((packed));
+
+struct ahci_command_table {
+  uint8_t command_fis[64];
+  uint8_t atapi_command[16];
+  uint8_t reserved[48];
+  struct ahci_prdt_entry prdt[AHCI_PRDT_MAX_ENTRIES];
+} __attribute__((packed));
+
+struct ahci_controller;
+
+struct ahci_port {
+  struct ahci_controller *controller;
+  volatile struct ahci_port_registers *registers;
+  int index;
+
+  // 32 command headers followed by the received FIS area
+  struct ahci_command_header *command_list;
+  void *received_fis;
+
+  // One page sized table per command slot
+  struct ahci_command_table *command_tables;
+  int command_slots;
+
+  // Commands allowed in flight, one without NCQ
+  int queue_depth;
+  bool ncq;
+  uint64_t total_sectors;
+
+  // Slots we issued that have not been reaped yet
+  uint32_t slots_in_use;
+  struct disk_request *slot_requests[AHCI_MAX_COMMAND_SLOTS];
+
+  // Set by the interrupt handler when the port reports an error
+  volatile bool error;
+
+  // TSC ticks spent halted waiting for commands
+  uint64_t idle_ticks;
+};
+
+struct ahci_controller {
+  struct pci_device *pci;
+  volatile struct ahci_hba_registers *registers;
+  bool addressing64;
+
+  // False when the controller has no legacy interrupt line, we then poll
+  bool interrupts;
+  uint8_t interrupt_line;
+
+  struct ahci_port ports[AHCI_MAX_PORTS];
+  int total_ports;
+};
+
+extern struct disk_driver ahci_disk_driver;
+
+int ahci_init();
+int ahci_total_ports();
+struct ahci_port *ahci_port_get(int index);
+int ahci_submit_requests(struct ahci_port *port, struct disk_request *requests,
+                         size_t total, int queue_depth);
+int ahci_read_sectors(struct ahci_port *port, uint64_t lba, size_t total,
+                      void *buf);
+int ahci_write_sectors(struct ahci_port *port, uint64_t lba, size_t total,
+                       const void *buf);
+
+#endif
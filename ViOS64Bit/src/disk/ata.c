@@ -0,0 +1,623 @@
+#include "ata.h"
+#include "config.h"
+#include "cpu/cpu.h"
+#include "disk/disk.h"
+#include "idt/idt.h"
+#include "idt/irq.h"
+#include "io/io.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "pci/pci.h"
+#include "status.h"
+
+// IDENTIFY DEVICE words we care about
+#define ATA_IDENTIFY_MAX_MULTIPLE 47
+#define ATA_IDENTIFY_CAPABILITIES 49
+#define ATA_IDENTIFY_CURRENT_MULTIPLE 59
+#define ATA_IDENTIFY_LBA28_SECTORS 60
+#define ATA_IDENTIFY_COMMAND_SETS 83
+#define ATA_IDENTIFY_LBA48_SECTORS 100
+
+#define ATA_CAPABILITIES_DMA (1 << 8)
+#define ATA_COMMAND_SETS_LBA48 (1 << 10)
+
+// BAR4 of the IDE controller holds the bus master registers
+#define ATA_BM_BAR 4
+
+// Programming interface bit set when the primary channel is in native mode
+#define ATA_PROG_IF_PRIMARY_NATIVE 0x01
+
+// Gives up on a drive that stays busy this many status polls
+#define ATA_TIMEOUT_SPINS 10000000
+
+static struct ata_device ata_primary_device = {
+    .io_base = ATA_PRIMARY_IO_BASE,
+    .control_base = ATA_PRIMARY_CONTROL_BASE,
+    .drive = 0};
+
+static uint8_t ata_status(struct ata_device *device) {
+  return insb(device->io_base + ATA_REG_STATUS);
+}
+
+/**
+ * Reading the alternate status register takes around 100ns, four reads
+ * give the drive the 400ns it needs to present a valid status.
+ */
+static void ata_delay(struct ata_device *device) {
+  for (int i = 0; i < 4; i++) {
+    insb(device->control_base);
+  }
+}
+
+static int ata_wait_not_busy(struct ata_device *device) {
+  for (int i = 0; i < ATA_TIMEOUT_SPINS; i++) {
+    if (!(ata_status(device) & ATA_STATUS_BSY)) {
+      return 0;
+    }
+  }
+
+  return -EIO;
+}
+
+/**
+ * Waits until the drive has a block of data ready for us
+ */
+static int ata_wait_data(struct ata_device *device) {
+  for (int i = 0; i < ATA_TIMEOUT_SPINS; i++) {
+    uint8_t status = ata_status(device);
+    if (status & ATA_STATUS_BSY) {
+      continue;
+    }
+
+    if (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+      return -EIO;
+    }
+
+    if (status & ATA_STATUS_DRQ) {
+      return 0;
+    }
+  }
+
+  return -EIO;
+}
+
+/**
+ * Programs the task file for a command of "count" sectors at "lba",
+ * a count equal to the command maximum is written as zero.
+ */
+static void ata_setup_command(struct ata_device *device, uint64_t lba,
+                              size_t count, bool lba48) {
+  uint16_t io = device->io_base;
+  if (lba48) {
+    outb(io + ATA_REG_DRIVE, 0x40 | (device->drive << 4));
+    // High order bytes go first
+    outb(io + ATA_REG_SECTOR_COUNT, (count >> 8) & 0xff);
+    outb(io + ATA_REG_LBA_LOW, (lba >> 24) & 0xff);
+    outb(io + ATA_REG_LBA_MID, (lba >> 32) & 0xff);
+    outb(io + ATA_REG_LBA_HIGH, (lba >> 40) & 0xff);
+  } else {
+    outb(io + ATA_REG_DRIVE,
+         0xE0 | (device->drive << 4) | ((lba >> 24) & 0x0F));
+  }
+
+  outb(io + ATA_REG_SECTOR_COUNT, count & 0xff);
+  outb(io + ATA_REG_LBA_LOW, lba & 0xff);
+  outb(io + ATA_REG_LBA_MID, (lba >> 8) & 0xff);
+  outb(io + ATA_REG_LBA_HIGH, (lba >> 16) & 0xff);
+}
+
+static int ata_identify(struct ata_device *device) {
+  int res = 0;
+  uint16_t identify[256];
+  uint16_t io = device->io_base;
+
+  outb(io + ATA_REG_DRIVE, 0xA0 | (device->drive << 4));
+  ata_delay(device);
+  outb(io + ATA_REG_SECTOR_COUNT, 0);
+  outb(io + ATA_REG_LBA_LOW, 0);
+  outb(io + ATA_REG_LBA_MID, 0);
+  outb(io + ATA_REG_LBA_HIGH, 0);
+  outb(io + ATA_REG_COMMAND, ATA_COMMAND_IDENTIFY);
+  ata_delay(device);
+
+  // A status of zero means there is no drive, a floating bus reads 0xFF
+  uint8_t status = ata_status(device);
+  if (status == 0 || status == 0xFF) {
+    res = -EIO;
+    goto out;
+  }
+
+  res = ata_wait_not_busy(device);
+  if (res < 0) {
+    goto out;
+  }
+
+  // ATAPI and SATA devices set the LBA registers instead of answering
+  if (insb(io + ATA_REG_LBA_MID) || insb(io + ATA_REG_LBA_HIGH)) {
+    res = -EIO;
+    goto out;
+  }
+
+  res = ata_wait_data(device);
+  if (res < 0) {
+    goto out;
+  }
+
+  insws(io + ATA_REG_DATA, identify, 256);
+
+  device->lba48 =
+      (identify[ATA_IDENTIFY_COMMAND_SETS] & ATA_COMMAND_SETS_LBA48) != 0;
+  if (device->lba48) {
+    memcpy(&device->total_sectors, &identify[ATA_IDENTIFY_LBA48_SECTORS],
+           sizeof(uint64_t));
+  } else {
+    device->total_sectors = identify[ATA_IDENTIFY_LBA28_SECTORS] |
+                            ((uint32_t)identify[ATA_IDENTIFY_LBA28_SECTORS + 1]
+                             << 16);
+  }
+
+  device->multiple_sectors = identify[ATA_IDENTIFY_MAX_MULTIPLE] & 0xff;
+  device->dma =
+      (identify[ATA_IDENTIFY_CAPABILITIES] & ATA_CAPABILITIES_DMA) != 0;
+  device->present = true;
+
+out:
+  return res;
+}
+
+/**
+ * Asks the drive to transfer its largest supported DRQ block,
+ * READ MULTIPLE then raises one interrupt and one wait per block
+ * instead of per sector.
+ */
+static void ata_set_multiple_mode(struct ata_device *device) {
+  if (!device->multiple_sectors) {
+    return;
+  }
+
+  uint16_t io = device->io_base;
+  outb(io + ATA_REG_DRIVE, 0xA0 | (device->drive << 4));
+  outb(io + ATA_REG_SECTOR_COUNT, device->multiple_sectors);
+  outb(io + ATA_REG_COMMAND, ATA_COMMAND_SET_MULTIPLE_MODE);
+  ata_delay(device);
+
+  if (ata_wait_not_busy(device) < 0 ||
+      (ata_status(device) & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+    // The drive refused, stick to one sector per block
+    device->multiple_sectors = 0;
+  }
+}
+
+static void ata_interrupt_handler(struct interrupt_frame *frame) {
+  struct ata_device *device = &ata_primary_device;
+  if (!device->dma) {
+    return;
+  }
+
+  uint8_t status = insb(device->busmaster_base + ATA_BM_REG_STATUS);
+  if (!(status & ATA_BM_STATUS_INTERRUPT)) {
+    return;
+  }
+
+  // Reading the status register acknowledges the drive's interrupt
+  insb(device->io_base + ATA_REG_STATUS);
+
+  // The interrupt and error bits clear when written as one
+  outb(device->busmaster_base + ATA_BM_REG_STATUS, status);
+  device->dma_status = status;
+  device->dma_done = true;
+}
+
+/**
+ * Sets up bus master DMA when a PIIX style IDE controller drives the
+ * primary channel in compatibility mode, where it interrupts on IRQ14.
+ */
+static void ata_dma_init(struct ata_device *device) {
+  struct pci_device *controller =
+      pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE, 0);
+  if (!VIOS_DISK_ATA_DMA || !device->dma || !controller ||
+      (controller->prog_if & ATA_PROG_IF_PRIMARY_NATIVE) ||
+      !pci_bar_is_io(controller, ATA_BM_BAR)) {
+    device->dma = false;
+    return;
+  }
+
+  // The PRD table may not cross a 64KB boundary, a heap page never does
+  device->prd_table = kzalloc(PAGING_PAGE_SIZE);
+  if (!device->prd_table ||
+      (uintptr_t)device->prd_table + PAGING_PAGE_SIZE > 0xFFFFFFFF) {
+    device->dma = false;
+    return;
+  }
+
+  device->busmaster_base = pci_bar_address(controller, ATA_BM_BAR);
+  pci_enable(controller, PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+
+  idt_register_interrupt_callback(ATA_PRIMARY_INTERRUPT,
+                                  ata_interrupt_handler);
+  IRQ_enable(IRQ_CASCADE);
+  IRQ_enable(IRQ_PRIMARY_ATA_HDD);
+}
+
+int ata_init() {
+  int res = ata_identify(&ata_primary_device);
+  if (res < 0) {
+    goto out;
+  }
+
+  ata_set_multiple_mode(&ata_primary_device);
+  ata_dma_init(&ata_primary_device);
+
+out:
+  return res;
+}
+
+struct ata_device *ata_primary() { return &ata_primary_device; }
+
+/**
+ * Reads "count" sectors with a single command, "count" must not exceed
+ * the maximum of the addressing mode in use.
+ */
+static int ata_read_command(struct ata_device *device, uint64_t lba,
+                            size_t count, bool lba48, uint8_t *buf) {
+  int res = ata_wait_not_busy(device);
+  if (res < 0) {
+    goto out;
+  }
+
+  // PIO completion is polled, keep the drive from raising IRQ14
+  outb(device->control_base, ATA_CONTROL_NIEN);
+  ata_setup_command(device, lba, count, lba48);
+
+  size_t block_sectors = device->multiple_sectors;
+  uint8_t command = lba48 ? ATA_COMMAND_READ_MULTIPLE_EXT
+                          : ATA_COMMAND_READ_MULTIPLE;
+  if (!block_sectors) {
+    block_sectors = 1;
+    command = lba48 ? ATA_COMMAND_READ_SECTORS_EXT : ATA_COMMAND_READ_SECTORS;
+  }
+  outb(device->io_base + ATA_REG_COMMAND, command);
+  ata_delay(device);
+
+  while (count) {
+    res = ata_wait_data(device);
+    if (res < 0) {
+      goto out;
+    }
+
+    // The final block of a READ MULTIPLE may be short
+    size_t sectors = MIN(count, block_sectors);
+    insws(device->io_base + ATA_REG_DATA, buf,
+          sectors * (ATA_SECTOR_SIZE / sizeof(uint16_t)));
+    buf += sectors * ATA_SECTOR_SIZE;
+    count -= sectors;
+  }
+
+out:
+  return res;
+}
+
+/**
+ * Writes "count" sectors with a single command, the drive takes a DRQ
+ * block at a time like READ MULTIPLE hands them out
+ */
+static int ata_write_command(struct ata_device *device, uint64_t lba,
+                             size_t count, bool lba48, const uint8_t *buf) {
+  int res = ata_wait_not_busy(device);
+  if (res < 0) {
+    goto out;
+  }
+
+  outb(device->control_base, ATA_CONTROL_NIEN);
+  ata_setup_command(device, lba, count, lba48);
+
+  size_t block_sectors = device->multiple_sectors;
+  uint8_t command = lba48 ? ATA_COMMAND_WRITE_MULTIPLE_EXT
+                          : ATA_COMMAND_WRITE_MULTIPLE;
+  if (!block_sectors) {
+    block_sectors = 1;
+    command =
+        lba48 ? ATA_COMMAND_WRITE_SECTORS_EXT : ATA_COMMAND_WRITE_SECTORS;
+  }
+  outb(device->io_base + ATA_REG_COMMAND, command);
+  ata_delay(device);
+
+  while (count) {
+    res = ata_wait_data(device);
+    if (res < 0) {
+      goto out;
+    }
+
+    size_t sectors = MIN(count, block_sectors);
+    outsws(device->io_base + ATA_REG_DATA, buf,
+           sectors * (ATA_SECTOR_SIZE / sizeof(uint16_t)));
+    buf += sectors * ATA_SECTOR_SIZE;
+    count -= sectors;
+  }
+
+  // The drive stays busy until the last block has been written
+  ata_delay(device);
+  res = ata_wait_not_busy(device);
+  if (res == 0 && (ata_status(device) & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+    res = -EIO;
+  }
+
+out:
+  return res;
+}
+
+/**
+ * Transfers "total" sectors at "lba" issuing commands of at most
+ * "max_per_command" sectors, zero lets the driver choose the largest
+ * the drive supports.
+ */
+static int ata_pio_transfer(struct ata_device *device, uint64_t lba,
+                            size_t total, size_t max_per_command,
+                            uint8_t *buf, bool write) {
+  int res = 0;
+  if (!device->present) {
+    res = -EIO;
+    goto out;
+  }
+
+  while (total) {
+    bool lba48 = device->lba48;
+    size_t limit = lba48 ? ATA_LBA48_MAX_SECTORS : ATA_LBA28_MAX_SECTORS;
+    if (max_per_command && max_per_command < limit) {
+      limit = max_per_command;
+    }
+
+    // Prefer the shorter LBA28 task file when the request fits it
+    size_t count = MIN(total, limit);
+    if (lba48 && count <= ATA_LBA28_MAX_SECTORS &&
+        lba + count <= ATA_LBA28_MAX_LBA) {
+      lba48 = false;
+    }
+
+    if (write) {
+      res = ata_write_command(device, lba, count, lba48, buf);
+    } else {
+      res = ata_read_command(device, lba, count, lba48, buf);
+    }
+    if (res < 0) {
+      goto out;
+    }
+
+    lba += count;
+    total -= count;
+    buf += count * ATA_SECTOR_SIZE;
+  }
+
+out:
+  return res;
+}
+
+int ata_pio_read_sectors(struct ata_device *device, uint64_t lba,
+                         size_t total, size_t max_per_command, void *buf) {
+  return ata_pio_transfer(device, lba, total, max_per_command, buf, false);
+}
+
+int ata_pio_write_sectors(struct ata_device *device, uint64_t lba,
+                          size_t total, const void *buf) {
+  return ata_pio_transfer(device, lba, total, 0, (uint8_t *)buf, true);
+}
+
+/**
+ * Describes "bytes" at "buf" as physical regions, fails with -EINVARG
+ * when the buffer cannot be reached by the 32 bit DMA engine.
+ */
+static int ata_dma_build_prd_table(struct ata_device *device, uint8_t *buf,
+                                   size_t bytes) {
+  struct paging_desc *desc = paging_current_descriptor();
+  int total_entries = 0;
+  struct ata_prd *prd = NULL;
+  uint64_t prd_end = 0;
+
+  while (bytes) {
+    size_t chunk =
+        MIN(bytes, PAGING_PAGE_SIZE - ((uintptr_t)buf % PAGING_PAGE_SIZE));
+    uint64_t phys = (uint64_t)(uintptr_t)buf;
+    if (desc) {
+      phys = (uint64_t)(uintptr_t)paging_get_physical_address(desc, buf);
+    }
+
+    if (!phys || (phys & 1) || phys + chunk > 0x100000000ULL) {
+      return -EINVARG;
+    }
+
+    // Grow the previous region while memory stays contiguous, a page
+    // never straddles the 64KB boundaries regions may not cross
+    if (prd && phys == prd_end && (phys % ATA_PRD_MAX_BYTES) != 0) {
+      // A byte count of zero can only mean a full 64KB region
+      prd->byte_count = (prd->byte_count + chunk) & 0xFFFF;
+    } else {
+      if (total_entries == ATA_PRD_MAX_ENTRIES) {
+        return -EINVARG;
+      }
+
+      prd = &device->prd_table[total_entries++];
+      prd->address = phys;
+      prd->byte_count = chunk & 0xFFFF;
+      prd->flags = 0;
+    }
+
+    prd_end = phys + chunk;
+    buf += chunk;
+    bytes -= chunk;
+  }
+
+  if (prd) {
+    prd->flags = ATA_PRD_END_OF_TABLE;
+  }
+
+  return total_entries;
+}
+
+static int ata_dma_command(struct ata_device *device, uint64_t lba,
+                           size_t count, bool lba48, uint8_t *buf,
+                           bool write) {
+  int res = ata_dma_build_prd_table(device, buf, count * ATA_SECTOR_SIZE);
+  if (res < 0) {
+    return res;
+  }
+
+  uint16_t bm = device->busmaster_base;
+  res = ata_wait_not_busy(device);
+  if (res < 0) {
+    return res;
+  }
+
+  outb(bm + ATA_BM_REG_COMMAND, 0);
+  outb(bm + ATA_BM_REG_STATUS, ATA_BM_STATUS_INTERRUPT | ATA_BM_STATUS_ERROR);
+  outdw(bm + ATA_BM_REG_PRDT, (uint32_t)(uintptr_t)device->prd_table);
+  uint8_t direction = write ? 0 : ATA_BM_COMMAND_READ;
+  outb(bm + ATA_BM_REG_COMMAND, direction);
+
+  // Interrupts stay off until we sleep so the completion cannot be missed
+  uint64_t flags = cpu_save_interrupts();
+  device->dma_done = false;
+
+  outb(device->control_base, 0);
+  ata_setup_command(device, lba, count, lba48);
+  if (write) {
+    outb(device->io_base + ATA_REG_COMMAND,
+         lba48 ? ATA_COMMAND_WRITE_DMA_EXT : ATA_COMMAND_WRITE_DMA);
+  } else {
+    outb(device->io_base + ATA_REG_COMMAND,
+         lba48 ? ATA_COMMAND_READ_DMA_EXT : ATA_COMMAND_READ_DMA);
+  }
+  outb(bm + ATA_BM_REG_COMMAND, direction | ATA_BM_COMMAND_START);
+
+  // Sleep rather than spin, the IRQ14 handler marks the transfer done
+  while (!device->dma_done) {
+    uint64_t start = cpu_rdtsc();
+    cpu_wait_for_interrupt();
+    device->idle_ticks += cpu_rdtsc() - start;
+  }
+
+  outb(bm + ATA_BM_REG_COMMAND, 0);
+  cpu_restore_interrupts(flags);
+
+  if ((device->dma_status & ATA_BM_STATUS_ERROR) ||
+      (ata_status(device) & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+    return -EIO;
+  }
+
+  return 0;
+}
+
+/**
+ * Transfers "total" sectors at "lba" with bus master DMA
+ */
+static int ata_dma_transfer(struct ata_device *device, uint64_t lba,
+                            size_t total, uint8_t *buf, bool write) {
+  int res = 0;
+  if (!device->present || !device->dma) {
+    res = -EIO;
+    goto out;
+  }
+
+  while (total) {
+    size_t count = MIN(total, ATA_DMA_MAX_SECTORS_PER_COMMAND);
+    bool lba48 = count > ATA_LBA28_MAX_SECTORS ||
+                 lba + count > ATA_LBA28_MAX_LBA;
+    if (lba48 && !device->lba48) {
+      count = MIN(count, ATA_LBA28_MAX_SECTORS);
+      lba48 = false;
+    }
+
+    res = ata_dma_command(device, lba, count, lba48, buf, write);
+    if (res < 0) {
+      goto out;
+    }
+
+    lba += count;
+    total -= count;
+    buf += count * ATA_SECTOR_SIZE;
+  }
+
+out:
+  return res;
+}
+
+int ata_dma_read_sectors(struct ata_device *device, uint64_t lba, size_t total,
+                         void *buf) {
+  return ata_dma_transfer(device, lba, total, buf, false);
+}
+
+/**
+ * Reads with DMA when the controller supports it, falling back to PIO
+ * for buffers the DMA engine cannot reach.
+ */
+int ata_read_sectors(struct ata_device *device, uint64_t lba, size_t total,
+                     void *buf) {
+  if (device->dma) {
+    int res = ata_dma_read_sectors(device, lba, total, buf);
+    if (res != -EINVARG) {
+      return res;
+    }
+  }
+
+  return ata_pio_read_sectors(device, lba, total, 0, buf);
+}
+
+/**
+ * Writes with DMA when the controller supports it, falling back to PIO
+ * for buffers the DMA engine cannot reach.
+ */
+int ata_write_sectors(struct ata_device *device, uint64_t lba, size_t total,
+                      const void *buf) {
+  if (device->dma) {
+    int res = ata_dma_transfer(device, lba, total, (uint8_t *)buf, true);
+    if (res != -EINVARG) {
+      return res;
+    }
+  }
+
+  return ata_pio_write_sectors(device, lba, total, buf);
+}
+
+/**
+ * Waits for the drive to move its write cache to the media
+ */
+int ata_flush(struct ata_device *device) {
+  int res = ata_wait_not_busy(device);
+  if (res < 0) {
+    goto out;
+  }
+
+  outb(device->control_base, ATA_CONTROL_NIEN);
+  outb(device->io_base + ATA_REG_DRIVE, 0xE0 | (device->drive << 4));
+  outb(device->io_base + ATA_REG_COMMAND, device->lba48
+                                              ? ATA_COMMAND_FLUSH_CACHE_EXT
+                                              : ATA_COMMAND_FLUSH_CACHE);
+  ata_delay(device);
+
+  res = ata_wait_not_busy(device);
+  if (res == 0 && (ata_status(device) & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+    res = -EIO;
+  }
+
+out:
+  return res;
+}
+
+static int ata_disk_read(struct disk *disk, size_t lba, int total, void *buf) {
+  return ata_read_sectors(disk->driver_private, lba, total, buf);
+}
+
+static int ata_disk_write(struct disk *disk, size_t lba, int total,
+                          const void *buf) {
+  return ata_write_sectors(disk->driver_private, lba, total, buf);
+}
+
+static int ata_disk_flush(struct disk *disk) {
+  return ata_flush(disk->driver_private);
+}
+
+struct disk_driver ata_disk_driver = {.name = "ata",
+                                      .read = ata_disk_read,
+                                      .write = ata_disk_write,
+                                      .flush = ata_disk_flush};
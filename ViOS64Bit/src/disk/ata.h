@@ -0,0 +1,135 @@
+#ifndef KERNEL_DISK_ATA_H
+#define KERNEL_DISK_ATA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Primary ATA channel
+#define ATA_PRIMARY_IO_BASE 0x1F0
+#define ATA_PRIMARY_CONTROL_BASE 0x3F6
+
+// Register offsets from the IO base
+#define ATA_REG_DATA 0x00
+#define ATA_REG_ERROR 0x01
+#define ATA_REG_SECTOR_COUNT 0x02
+#define ATA_REG_LBA_LOW 0x03
+#define ATA_REG_LBA_MID 0x04
+#define ATA_REG_LBA_HIGH 0x05
+#define ATA_REG_DRIVE 0x06
+#define ATA_REG_STATUS 0x07
+#define ATA_REG_COMMAND 0x07
+
+// Device control register, nIEN masks the drive's interrupt
+#define ATA_CONTROL_NIEN 0x02
+
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_DF 0x20
+#define ATA_STATUS_BSY 0x80
+
+#define ATA_COMMAND_READ_SECTORS 0x20
+#define ATA_COMMAND_READ_SECTORS_EXT 0x24
+#define ATA_COMMAND_READ_DMA_EXT 0x25
+#define ATA_COMMAND_READ_MULTIPLE_EXT 0x29
+#define ATA_COMMAND_READ_MULTIPLE 0xC4
+#define ATA_COMMAND_READ_DMA 0xC8
+#define ATA_COMMAND_SET_MULTIPLE_MODE 0xC6
+#define ATA_COMMAND_IDENTIFY 0xEC
+#define ATA_COMMAND_WRITE_SECTORS 0x30
+#define ATA_COMMAND_WRITE_SECTORS_EXT 0x34
+#define ATA_COMMAND_WRITE_DMA_EXT 0x35
+#define ATA_COMMAND_WRITE_MULTIPLE_EXT 0x39
+#define ATA_COMMAND_WRITE_MULTIPLE 0xC5
+#define ATA_COMMAND_WRITE_DMA 0xCA
+#define ATA_COMMAND_FLUSH_CACHE 0xE7
+#define ATA_COMMAND_FLUSH_CACHE_EXT 0xEA
+
+// The most sectors a single command can transfer
+#define ATA_LBA28_MAX_SECTORS 256
+#define ATA_LBA48_MAX_SECTORS 65536
+
+// The highest sector LBA28 commands can address
+#define ATA_LBA28_MAX_LBA 0x0FFFFFFF
+
+#define ATA_SECTOR_SIZE 512
+
+// Interrupt vector of IRQ14 after the PIC remap
+#define ATA_PRIMARY_INTERRUPT 0x2E
+
+// Bus master IDE registers, offsets from BAR4 for the primary channel
+#define ATA_BM_REG_COMMAND 0x00
+#define ATA_BM_REG_STATUS 0x02
+#define ATA_BM_REG_PRDT 0x04
+
+#define ATA_BM_COMMAND_START 0x01
+// Set when the controller writes to memory, i.e. a disk read
+#define ATA_BM_COMMAND_READ 0x08
+
+#define ATA_BM_STATUS_ACTIVE 0x01
+#define ATA_BM_STATUS_ERROR 0x02
+#define ATA_BM_STATUS_INTERRUPT 0x04
+
+// Marks the last entry of a PRD table
+#define ATA_PRD_END_OF_TABLE 0x8000
+
+// A PRD table fills one page, each entry covers at most 64KB
+#define ATA_PRD_MAX_ENTRIES 512
+#define ATA_PRD_MAX_BYTES 65536
+
+// Keeps the PRD table within bounds even for buffers split on every page
+#define ATA_DMA_MAX_SECTORS_PER_COMMAND 2048
+
+// Physical region descriptor, one contiguous piece of a DMA buffer
+struct ata_prd {
+  uint32_t address;
+  // Zero means 64KB
+  uint16_t byte_count;
+  uint16_t flags;
+} __attribute__((packed));
+
+struct ata_device {
+  uint16_t io_base;
+  uint16_t control_base;
+
+  // 0 for the master drive, 1 for the slave
+  uint8_t drive;
+
+  bool present;
+  bool lba48;
+
+  // Sectors transferred per DRQ block by READ MULTIPLE, zero if unsupported
+  uint16_t multiple_sectors;
+
+  uint64_t total_sectors;
+
+  // Bus master DMA, only used when "dma" is set
+  bool dma;
+  uint16_t busmaster_base;
+  struct ata_prd *prd_table;
+
+  // Written by the IRQ14 handler when a transfer completes
+  volatile bool dma_done;
+  volatile uint8_t dma_status;
+
+  // TSC ticks spent halted waiting for DMA transfers
+  uint64_t idle_ticks;
+};
+
+extern struct disk_driver ata_disk_driver;
+
+int ata_init();
+struct ata_device *ata_primary();
+int ata_pio_read_sectors(struct ata_device *device, uint64_t lba,
+                         size_t total, size_t max_per_command, void *buf);
+int ata_dma_read_sectors(struct ata_device *device, uint64_t lba, size_t total,
+                         void *buf);
+int ata_read_sectors(struct ata_device *device, uint64_t lba, size_t total,
+                     void *buf);
+int ata_pio_write_sectors(struct ata_device *device, uint64_t lba,
+                          size_t total, const void *buf);
+int ata_write_sectors(struct ata_device *device, uint64_t lba, size_t total,
+                      const void *buf);
+int ata_flush(struct ata_device *device);
+
+#endif
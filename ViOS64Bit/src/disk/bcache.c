@@ -0,0 +1,491 @@
+#include "bcache.h"
+#include "config.h"
+#include "cpu/cpu.h"
+#include "disk.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include "string/string.h"
+
+#include <stdbool.h>
+
+#define DISK_BCACHE_TOTAL_BLOCKS                                               \
+  (VIOS_DISK_BCACHE_MAX_BYTES / VIOS_DISK_BCACHE_BLOCK_SIZE)
+
+struct disk_bcache {
+  struct disk_bcache_entry *buckets[VIOS_DISK_BCACHE_HASH_BUCKETS];
+
+  // Every entry ever handed out, blocks are recycled rather than freed
+  struct disk_bcache_entry *entries;
+  uint8_t *data;
+  size_t total_used;
+
+  struct disk_bcache_entry *lru_head;
+  struct disk_bcache_entry *lru_tail;
+
+  // Dirty blocks, and when the oldest of them was written
+  size_t total_dirty;
+  uint64_t dirty_since;
+
+  // A flush sorts the dirty blocks here and gathers runs of them into
+  // the flush buffer
+  struct disk_bcache_entry **flush_list;
+  uint8_t *flush_buffer;
+
+  struct disk_bcache_stats stats;
+};
+
+static struct disk_bcache bcache;
+
+static size_t disk_bcache_hash(struct disk *disk, size_t lba) {
+  uint64_t key = ((uint64_t)lba * 0x9E3779B97F4A7C15ULL) ^ (uintptr_t)disk;
+  return (key >> 32) & (VIOS_DISK_BCACHE_HASH_BUCKETS - 1);
+}
+
+static void disk_bcache_lru_unlink(struct disk_bcache_entry *entry) {
+  if (entry->lru_prev) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    bcache.lru_head = entry->lru_next;
+  }
+
+  if (entry->lru_next) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    bcache.lru_tail = entry->lru_prev;
+  }
+
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void disk_bcache_lru_push_front(struct disk_bcache_entry *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = bcache.lru_head;
+  if (bcache.lru_head) {
+    bcache.lru_head->lru_prev = entry;
+  }
+  bcache.lru_head = entry;
+
+  if (!bcache.lru_tail) {
+    bcache.lru_tail = entry;
+  }
+}
+
+static void disk_bcache_hash_remove(struct disk_bcache_entry *entry) {
+  struct disk_bcache_entry **link =
+      &bcache.buckets[disk_bcache_hash(entry->disk, entry->lba)];
+  while (*link) {
+    if (*link == entry) {
+      *link = entry->hash_next;
+      break;
+    }
+    link = &(*link)->hash_next;
+  }
+
+  entry->hash_next = NULL;
+}
+
+static struct disk_bcache_entry *disk_bcache_lookup(struct disk *disk,
+                                                    size_t lba) {
+  struct disk_bcache_entry *entry =
+      bcache.buckets[disk_bcache_hash(disk, lba)];
+  while (entry) {
+    if (entry->disk == disk && entry->lba == lba) {
+      return entry;
+    }
+    entry = entry->hash_next;
+  }
+
+  return NULL;
+}
+
+static void disk_bcache_set_dirty(struct disk_bcache_entry *entry,
+                                  bool dirty) {
+  if (entry->dirty == dirty) {
+    return;
+  }
+
+  entry->dirty = dirty;
+  if (!dirty) {
+    bcache.total_dirty--;
+    return;
+  }
+
+  if (bcache.total_dirty++ == 0) {
+    bcache.dirty_since = cpu_rdtsc();
+  }
+}
+
+/**
+ * Returns an unused block, either one never handed out before or the
+ * least recently used block which is evicted. NULL when every block is
+ * dirty and cannot be written back, their data is never thrown away
+ */
+static struct disk_bcache_entry *disk_bcache_take_entry() {
+  struct disk_bcache_entry *entry = NULL;
+  if (bcache.total_used < DISK_BCACHE_TOTAL_BLOCKS) {
+    entry = &bcache.entries[bcache.total_used];
+    entry->data =
+        bcache.data + (bcache.total_used * VIOS_DISK_BCACHE_BLOCK_SIZE);
+    bcache.total_used++;
+    return entry;
+  }
+
+  entry = bcache.lru_tail;
+  if (entry->dirty) {
+    // Write back every dirty block of the disk in one sorted batch
+    // rather than this block alone
+    disk_bcache_flush(entry->disk);
+  }
+
+  // Blocks whose write back failed stay dirty, skip past them
+  while (entry && entry->dirty) {
+    entry = entry->lru_prev;
+  }
+
+  if (!entry) {
+    return NULL;
+  }
+
+  disk_bcache_lru_unlink(entry);
+  if (entry->disk) {
+    disk_bcache_hash_remove(entry);
+    bcache.stats.evictions++;
+  }
+  return entry;
+}
+
+static struct disk_bcache_entry *
+disk_bcache_insert(struct disk *disk, size_t lba, const void *data) {
+  struct disk_bcache_entry *entry = disk_bcache_take_entry();
+  if (!entry) {
+    return NULL;
+  }
+
+  entry->disk = disk;
+  entry->lba = lba;
+  memcpy(entry->data, (void *)data, VIOS_DISK_BCACHE_BLOCK_SIZE);
+
+  size_t bucket = disk_bcache_hash(disk, lba);
+  entry->hash_next = bcache.buckets[bucket];
+  bcache.buckets[bucket] = entry;
+  disk_bcache_lru_push_front(entry);
+  return entry;
+}
+
+static bool disk_bcache_enabled(struct disk *disk) {
+  // Caching a RAM disk would only add a copy
+  return bcache.entries && disk->type != VIOS_DISK_TYPE_RAM &&
+         disk->sector_size == VIOS_DISK_BCACHE_BLOCK_SIZE;
+}
+
+/**
+ * Reads a run of blocks that were not cached with one device command
+ * and keeps a copy of each of them.
+ */
+static int disk_bcache_fill(struct disk *disk, size_t lba, int total,
+                            uint8_t *buf) {
+  int res = disk_read_physical(disk, lba, total, buf);
+  bcache.stats.device_reads++;
+  if (res < 0) {
+    return res;
+  }
+
+  bcache.stats.misses += total;
+  for (int i = 0; i < total; i++) {
+    if (!disk_bcache_insert(disk, lba + i,
+                            buf + (i * VIOS_DISK_BCACHE_BLOCK_SIZE))) {
+      return -EIO;
+    }
+  }
+
+  return res;
+}
+
+void disk_bcache_init() {
+  memset(&bcache, 0, sizeof(bcache));
+  bcache.entries =
+      kzalloc(DISK_BCACHE_TOTAL_BLOCKS * sizeof(struct disk_bcache_entry));
+  bcache.data = kzalloc(VIOS_DISK_BCACHE_MAX_BYTES);
+  bcache.flush_list =
+      kzalloc(DISK_BCACHE_TOTAL_BLOCKS * sizeof(struct disk_bcache_entry *));
+  bcache.flush_buffer =
+      kzalloc(VIOS_DISK_BCACHE_FLUSH_BLOCKS * VIOS_DISK_BCACHE_BLOCK_SIZE);
+  if (!bcache.entries || !bcache.data || !bcache.flush_list ||
+      !bcache.flush_buffer) {
+    // Without memory the disks are simply read and written uncached
+    bcache.entries = NULL;
+    bcache.data = NULL;
+  }
+}
+
+/**
+ * Reads "total" blocks from the absolute "lba" of the physical "disk",
+ * serving what it can from the cache and reading the rest from the device.
+ */
+int disk_bcache_read(struct disk *disk, size_t lba, int total, void *buf) {
+  int res = 0;
+  uint8_t *out = buf;
+  if (!disk_bcache_enabled(disk)) {
+    bcache.stats.device_reads++;
+    return disk_read_physical(disk, lba, total, buf);
+  }
+
+  bcache.stats.blocks_requested += total;
+
+  // Bulk reads would flush every useful block, read them directly but
+  // still prefer any cached copy which is always the most recent data
+  if (total > VIOS_DISK_BCACHE_MAX_READ_BLOCKS) {
+    res = disk_read_physical(disk, lba, total, buf);
+    bcache.stats.device_reads++;
+    if (res < 0) {
+      goto out;
+    }
+
+    for (int i = 0; i < total; i++) {
+      struct disk_bcache_entry *entry = disk_bcache_lookup(disk, lba + i);
+      if (entry) {
+        memcpy(out + (i * VIOS_DISK_BCACHE_BLOCK_SIZE), entry->data,
+               VIOS_DISK_BCACHE_BLOCK_SIZE);
+      }
+    }
+    goto out;
+  }
+
+  int miss_start = -1;
+  for (int i = 0; i < total; i++) {
+    struct disk_bcache_entry *entry = disk_bcache_lookup(disk, lba + i);
+    if (!entry) {
+      if (miss_start < 0) {
+        miss_start = i;
+      }
+      continue;
+    }
+
+    memcpy(out + (i * VIOS_DISK_BCACHE_BLOCK_SIZE), entry->data,
+           VIOS_DISK_BCACHE_BLOCK_SIZE);
+    disk_bcache_lru_unlink(entry);
+    disk_bcache_lru_push_front(entry);
+    bcache.stats.hits++;
+
+    // A cached block ends the current run of misses, it is copied out
+    // first as filling the run may evict it
+    if (miss_start >= 0) {
+      res = disk_bcache_fill(disk, lba + miss_start, i - miss_start,
+                             out + (miss_start * VIOS_DISK_BCACHE_BLOCK_SIZE));
+      if (res < 0) {
+        goto out;
+      }
+      miss_start = -1;
+    }
+  }
+
+  if (miss_start >= 0) {
+    res = disk_bcache_fill(disk, lba + miss_start, total - miss_start,
+                           out + (miss_start * VIOS_DISK_BCACHE_BLOCK_SIZE));
+  }
+
+out:
+  return res;
+}
+
+/**
+ * Drops any cached copy of the given blocks, must be called whenever
+ * the device contents change underneath the cache.
+ */
+void disk_bcache_invalidate(struct disk *disk, size_t lba, int total) {
+  if (!bcache.entries) {
+    return;
+  }
+
+  for (int i = 0; i < total; i++) {
+    struct disk_bcache_entry *entry = disk_bcache_lookup(disk, lba + i);
+    if (!entry) {
+      continue;
+    }
+
+    disk_bcache_hash_remove(entry);
+    disk_bcache_lru_unlink(entry);
+    disk_bcache_set_dirty(entry, false);
+
+    // Move the block to the back of the list so it is reused first
+    entry->disk = NULL;
+    entry->lru_prev = bcache.lru_tail;
+    if (bcache.lru_tail) {
+      bcache.lru_tail->lru_next = entry;
+    }
+    bcache.lru_tail = entry;
+    if (!bcache.lru_head) {
+      bcache.lru_head = entry;
+    }
+  }
+}
+
+/**
+ * Keeps the blocks written to the physical "disk" as dirty cache blocks,
+ * the device sees them on the next flush. Bulk writes and disks the
+ * cache does not cover go straight to the device
+ */
+int disk_bcache_write(struct disk *disk, size_t lba, int total,
+                      const void *buf) {
+  int res = 0;
+  const uint8_t *in = buf;
+  if (!disk_bcache_enabled(disk) ||
+      total > VIOS_DISK_BCACHE_MAX_READ_BLOCKS) {
+    res = disk_write_physical(disk, lba, total, buf);
+    bcache.stats.device_writes++;
+    if (res >= 0) {
+      // Any cached copy, dirty or not, is older than what was written
+      disk_bcache_invalidate(disk, lba, total);
+    }
+    return res;
+  }
+
+  bcache.stats.blocks_written += total;
+  for (int i = 0; i < total; i++) {
+    const uint8_t *data = in + (i * VIOS_DISK_BCACHE_BLOCK_SIZE);
+    struct disk_bcache_entry *entry = disk_bcache_lookup(disk, lba + i);
+    if (entry) {
+      memcpy(entry->data, (void *)data, VIOS_DISK_BCACHE_BLOCK_SIZE);
+      disk_bcache_lru_unlink(entry);
+      disk_bcache_lru_push_front(entry);
+    } else {
+      entry = disk_bcache_insert(disk, lba + i, data);
+      if (!entry) {
+        return -EIO;
+      }
+    }
+    disk_bcache_set_dirty(entry, true);
+  }
+
+  if (bcache.total_dirty >= VIOS_DISK_BCACHE_MAX_DIRTY_BLOCKS) {
+    res = disk_bcache_flush(NULL);
+  }
+
+  return res;
+}
+
+static bool disk_bcache_before(struct disk_bcache_entry *a,
+                               struct disk_bcache_entry *b) {
+  if (a->disk != b->disk) {
+    return (uintptr_t)a->disk < (uintptr_t)b->disk;
+  }
+
+  return a->lba < b->lba;
+}
+
+static void disk_bcache_sort(struct disk_bcache_entry **list, size_t total) {
+  // Shell sort, the list is sorted in place
+  for (size_t gap = total / 2; gap > 0; gap /= 2) {
+    for (size_t i = gap; i < total; i++) {
+      struct disk_bcache_entry *entry = list[i];
+      size_t j = i;
+      while (j >= gap && disk_bcache_before(entry, list[j - gap])) {
+        list[j] = list[j - gap];
+        j -= gap;
+      }
+      list[j] = entry;
+    }
+  }
+}
+
+/**
+ * Writes the dirty blocks of "disk", or of every disk when NULL, back in
+ * sector order, each run of consecutive blocks with one command.
+ * Blocks that fail to write stay dirty
+ */
+int disk_bcache_flush(struct disk *disk) {
+  int res = 0;
+  if (!bcache.total_dirty) {
+    return 0;
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < bcache.total_used; i++) {
+    struct disk_bcache_entry *entry = &bcache.entries[i];
+    if (entry->dirty && (!disk || entry->disk == disk)) {
+      bcache.flush_list[total++] = entry;
+    }
+  }
+
+  if (!total) {
+    return 0;
+  }
+
+  disk_bcache_sort(bcache.flush_list, total);
+  bcache.stats.flushes++;
+
+  size_t i = 0;
+  while (i < total) {
+    struct disk_bcache_entry *first = bcache.flush_list[i];
+    size_t run = 1;
+    while (i + run < total && run < VIOS_DISK_BCACHE_FLUSH_BLOCKS &&
+           bcache.flush_list[i + run]->disk == first->disk &&
+           bcache.flush_list[i + run]->lba == first->lba + run) {
+      run++;
+    }
+
+    uint8_t *data = first->data;
+    if (run > 1) {
+      data = bcache.flush_buffer;
+      for (size_t j = 0; j < run; j++) {
+        memcpy(data + (j * VIOS_DISK_BCACHE_BLOCK_SIZE),
+               bcache.flush_list[i + j]->data, VIOS_DISK_BCACHE_BLOCK_SIZE);
+      }
+    }
+
+    int write_res = disk_write_physical(first->disk, first->lba, run, data);
+    bcache.stats.device_writes++;
+    if (write_res < 0) {
+      if (res == 0) {
+        res = write_res;
+      }
+    } else {
+      for (size_t j = 0; j < run; j++) {
+        disk_bcache_set_dirty(bcache.flush_list[i + j], false);
+      }
+    }
+
+    i += run;
+  }
+
+  return res;
+}
+
+/**
+ * Flushes every disk once the oldest dirty block has waited long enough,
+ * called from the file layer as the kernel has no timer to drive it
+ */
+int disk_bcache_writeback() {
+  if (!bcache.total_dirty ||
+      cpu_tsc_to_us(cpu_rdtsc() - bcache.dirty_since) <
+          VIOS_DISK_BCACHE_WRITEBACK_MS * 1000ULL) {
+    return 0;
+  }
+
+  return disk_bcache_flush(NULL);
+}
+
+struct disk_bcache_stats *disk_bcache_stats() {
+  return &bcache.stats;
+}
+
+void disk_bcache_print_stats() {
+  print("Block cache: ");
+  print(itoa(bcache.stats.hits));
+  print(" hits, ");
+  print(itoa(bcache.stats.misses));
+  print(" misses, ");
+  print(itoa(bcache.stats.evictions));
+  print(" evictions, ");
+  print(itoa(bcache.stats.device_reads));
+  print(" device reads for ");
+  print(itoa(bcache.stats.blocks_requested));
+  print(" blocks requested, ");
+  print(itoa(bcache.stats.blocks_written));
+  print(" blocks written back in ");
+  print(itoa(bcache.stats.device_writes));
+  print(" device writes\n");
+}
@@ -0,0 +1,57 @@
+#ifndef KERNEL_DISK_BCACHE_H
+#define KERNEL_DISK_BCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct disk;
+
+struct disk_bcache_entry {
+  // The physical disk and absolute LBA this block caches
+  struct disk *disk;
+  size_t lba;
+
+  // Next entry in the same hash bucket
+  struct disk_bcache_entry *hash_next;
+
+  // Least recently used list, the head is the most recently used block
+  struct disk_bcache_entry *lru_prev;
+  struct disk_bcache_entry *lru_next;
+
+  uint8_t *data;
+
+  // Newer than the device, written back on the next flush
+  bool dirty;
+};
+
+struct disk_bcache_stats {
+  // Blocks served from the cache
+  size_t hits;
+  // Blocks that had to be read from the device
+  size_t misses;
+  // Blocks thrown out to make room for others
+  size_t evictions;
+  // Read commands issued to the device driver
+  size_t device_reads;
+  // Blocks requested by callers of the cache
+  size_t blocks_requested;
+  // Blocks written by callers of the cache
+  size_t blocks_written;
+  // Write commands issued to the device driver
+  size_t device_writes;
+  // Times the dirty blocks were written back
+  size_t flushes;
+};
+
+void disk_bcache_init();
+int disk_bcache_read(struct disk *disk, size_t lba, int total, void *buf);
+int disk_bcache_write(struct disk *disk, size_t lba, int total,
+                      const void *buf);
+int disk_bcache_flush(struct disk *disk);
+int disk_bcache_writeback();
+void disk_bcache_invalidate(struct disk *disk, size_t lba, int total);
+struct disk_bcache_stats *disk_bcache_stats();
+void disk_bcache_print_stats();
+
+#endif
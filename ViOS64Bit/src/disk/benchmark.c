@@ -0,0 +1,392 @@
+#include "benchmark.h"
+#include "config.h"
+#include "cpu/cpu.h"
+#include "disk/ahci.h"
+#include "disk/ata.h"
+#include "disk/bcache.h"
+#include "disk/disk.h"
+#include "disk/nvme.h"
+#include "disk/virtio_blk.h"
+#include "fs/file.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "string/string.h"
+
+static uint64_t disk_benchmark_mb_per_second(size_t bytes, uint64_t ticks) {
+  uint64_t us = cpu_tsc_to_us(ticks);
+  if (!us) {
+    return 0;
+  }
+
+  return (bytes * 1000000 / us) / (1024 * 1024);
+}
+
+/**
+ * Prints throughput and, when "busy_ticks" is known, the CPU time
+ * each megabyte cost
+ */
+static void disk_benchmark_print_result(const char *name, size_t bytes,
+                                        uint64_t ticks, uint64_t busy_ticks) {
+  print(name);
+  print(": ");
+  print(itoa(bytes / 1024));
+  print("KB in ");
+  print(itoa(cpu_tsc_to_us(ticks)));
+  print("us, ");
+  print(itoa(disk_benchmark_mb_per_second(bytes, ticks)));
+  print(" MB/s");
+  if (busy_ticks && bytes >= 1024 * 1024) {
+    print(", ");
+    print(itoa(cpu_tsc_to_us(busy_ticks) / (bytes / (1024 * 1024))));
+    print("us CPU per MB");
+  }
+  print("\n");
+}
+
+/**
+ * Reads the same span of the primary ATA disk with growing PIO command
+ * sizes and then with DMA
+ */
+static void disk_benchmark_ata(void *buf) {
+  struct ata_device *device = ata_primary();
+  size_t total = VIOS_DISK_BENCHMARK_BYTES / ATA_SECTOR_SIZE;
+  if (!device->present) {
+    print("ATA benchmark: no disk\n");
+    return;
+  }
+
+  if (device->total_sectors < total) {
+    total = device->total_sectors;
+  }
+
+  size_t command_sizes[] = {1, 8, ATA_LBA28_MAX_SECTORS, 0};
+  for (size_t i = 0; i < sizeof(command_sizes) / sizeof(command_sizes[0]);
+       i++) {
+    uint64_t start = cpu_rdtsc();
+    int res = ata_pio_read_sectors(device, 0, total, command_sizes[i], buf);
+    uint64_t end = cpu_rdtsc();
+    if (res < 0) {
+      print("ATA benchmark: read failed\n");
+      return;
+    }
+
+    // PIO keeps the CPU busy for the whole transfer
+    print("PIO sectors per command ");
+    print(command_sizes[i] ? itoa(command_sizes[i]) : "max");
+    disk_benchmark_print_result("", total * ATA_SECTOR_SIZE, end - start,
+                                end - start);
+  }
+
+  if (!device->dma) {
+    print("DMA: not available\n");
+    return;
+  }
+
+  uint64_t idle_before = device->idle_ticks;
+  uint64_t start = cpu_rdtsc();
+  int res = ata_dma_read_sectors(device, 0, total, buf);
+  uint64_t end = cpu_rdtsc();
+  if (res < 0) {
+    print("DMA benchmark: read failed\n");
+    return;
+  }
+
+  uint64_t idle = device->idle_ticks - idle_before;
+  disk_benchmark_print_result("DMA", total * ATA_SECTOR_SIZE, end - start,
+                              (end - start) - idle);
+}
+
+// Random reads are 4KB, each in flight request gets its own 4KB of buffer
+#define DISK_BENCHMARK_RANDOM_BYTES 4096
+
+typedef int (*DISK_BENCHMARK_SUBMIT_FUNCTION)(void *device,
+                                              struct disk_request *requests,
+                                              size_t total, int queue_depth);
+
+/**
+ * Returns a 4KB aligned pseudo random sector below "total_sectors"
+ */
+static uint64_t disk_benchmark_random_lba(uint32_t *seed,
+                                          uint64_t total_sectors) {
+  const size_t sectors = DISK_BENCHMARK_RANDOM_BYTES / VIOS_SECTOR_SIZE;
+  *seed = *seed * 1103515245 + 12345;
+  return (*seed % (total_sectors / sectors)) * sectors;
+}
+
+/**
+ * Issues random 4KB reads across "total_sectors" at every queue depth up
+ * to "max_depth" through "submit". The average latency is the one the
+ * driver measured when it times commands, otherwise it follows from
+ * Little's law as elapsed time times queue depth over requests. When
+ * given, "counter" is a device statistic printed per depth
+ */
+static void disk_benchmark_queue_depths(const char *name,
+                                        DISK_BENCHMARK_SUBMIT_FUNCTION submit,
+                                        void *device, uint64_t total_sectors,
+                                        int max_depth, uint64_t *counter,
+                                        const char *counter_name, void *buf) {
+  if (total_sectors < DISK_BENCHMARK_RANDOM_BYTES / VIOS_SECTOR_SIZE) {
+    print(name);
+    print(" benchmark: no disk\n");
+    return;
+  }
+
+  const size_t total = VIOS_DISK_BENCHMARK_RANDOM_READS;
+  struct disk_request *requests = kzalloc(sizeof(struct disk_request) * total);
+  if (!requests) {
+    print(name);
+    print(" benchmark: out of memory\n");
+    return;
+  }
+
+  for (int depth = 1; depth <= max_depth; depth *= 2) {
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < total; i++) {
+      requests[i].lba = disk_benchmark_random_lba(&seed, total_sectors);
+      requests[i].count = DISK_BENCHMARK_RANDOM_BYTES / VIOS_SECTOR_SIZE;
+      // Requests in flight together always have their own buffer
+      requests[i].buf =
+          (uint8_t *)buf + (i % max_depth) * DISK_BENCHMARK_RANDOM_BYTES;
+      requests[i].write = false;
+      requests[i].latency_ticks = 0;
+    }
+
+    uint64_t counter_before = counter ? *counter : 0;
+    uint64_t start = cpu_rdtsc();
+    int res = submit(device, requests, total, depth);
+    uint64_t end = cpu_rdtsc();
+    if (res < 0) {
+      print(name);
+      print(" benchmark: read failed\n");
+      break;
+    }
+
+    uint64_t latency_ticks = 0;
+    for (size_t i = 0; i < total; i++) {
+      latency_ticks += requests[i].latency_ticks;
+    }
+
+    uint64_t us = cpu_tsc_to_us(end - start);
+    print(name);
+    print(" QD ");
+    print(itoa(depth));
+    print(": ");
+    print(itoa(us ? total * 1000000 / us : 0));
+    print(" IOPS, ");
+    print(itoa(latency_ticks ? cpu_tsc_to_us(latency_ticks / total)
+                             : us * depth / total));
+    print("us average latency\n");
+    if (counter) {
+      print("  ");
+      print(counter_name);
+      print(": ");
+      print(itoa(*counter - counter_before));
+      print("\n");
+    }
+  }
+
+  kfree(requests);
+}
+
+static int disk_benchmark_ahci_submit(void *device,
+                                      struct disk_request *requests,
+                                      size_t total, int queue_depth) {
+  return ahci_submit_requests(device, requests, total, queue_depth);
+}
+
+static int disk_benchmark_nvme_submit(void *device,
+                                      struct disk_request *requests,
+                                      size_t total, int queue_depth) {
+  return nvme_submit_requests(device, requests, total, queue_depth);
+}
+
+static int disk_benchmark_virtio_submit(void *device,
+                                        struct disk_request *requests,
+                                        size_t total, int queue_depth) {
+  return virtio_blk_submit_requests(device, requests, total, queue_depth);
+}
+
+static void disk_benchmark_ahci(void *buf) {
+  struct ahci_port *port = ahci_port_get(0);
+  if (!port) {
+    print("AHCI benchmark: no disk\n");
+    return;
+  }
+
+  disk_benchmark_queue_depths("AHCI", disk_benchmark_ahci_submit, port,
+                              port->total_sectors, port->queue_depth, NULL,
+                              NULL, buf);
+}
+
+/**
+ * The NVMe driver times every command itself and counts how few
+ * doorbell writes the batches took
+ */
+static void disk_benchmark_nvme(void *buf) {
+  struct nvme_namespace *ns = nvme_namespace_get(0);
+  if (!ns) {
+    print("NVMe benchmark: no disk\n");
+    return;
+  }
+
+  disk_benchmark_queue_depths(
+      "NVMe", disk_benchmark_nvme_submit, ns, ns->total_sectors,
+      ns->controller->queue_depth,
+      &ns->controller->io_queues[0].doorbell_writes, "doorbell writes", buf);
+}
+
+/**
+ * Reads the benchmark span of the first virtio disk in one go and then
+ * sweeps the queue depths, counting how many notifications the event
+ * index let us skip
+ */
+static void disk_benchmark_virtio(void *buf) {
+  struct virtio_blk_device *device = virtio_blk_device_get(0);
+  if (!device || !device->total_sectors) {
+    print("virtio-blk benchmark: no disk\n");
+    return;
+  }
+
+  size_t sectors = MIN(VIOS_DISK_BENCHMARK_BYTES / VIRTIO_BLK_SECTOR_SIZE,
+                       device->total_sectors);
+  uint64_t idle_before = device->idle_ticks;
+  uint64_t start = cpu_rdtsc();
+  int res = virtio_blk_read_sectors(device, 0, sectors, buf);
+  uint64_t end = cpu_rdtsc();
+  if (res < 0) {
+    print("virtio-blk benchmark: read failed\n");
+    return;
+  }
+
+  uint64_t idle = device->idle_ticks - idle_before;
+  disk_benchmark_print_result("virtio-blk", sectors * VIRTIO_BLK_SECTOR_SIZE,
+                              end - start, (end - start) - idle);
+
+  disk_benchmark_queue_depths("virtio-blk", disk_benchmark_virtio_submit,
+                              device, device->total_sectors,
+                              device->queue_depth, &device->notifications,
+                              "notifications", buf);
+}
+
+/**
+ * Times reading a whole file through the filesystem and counts the
+ * device reads that opening and reading it took
+ */
+static void disk_benchmark_file(void *buf) {
+  size_t device_reads = disk_bcache_stats()->device_reads;
+  int fd = fopen(VIOS_DISK_BENCHMARK_FILE, "r");
+  if (fd <= 0) {
+    print("File benchmark: cannot open " VIOS_DISK_BENCHMARK_FILE "\n");
+    return;
+  }
+
+  struct file_stat stat;
+  if (fstat(fd, &stat) < 0 || stat.filesize > VIOS_DISK_BENCHMARK_BYTES) {
+    print("File benchmark: bad file size\n");
+    goto out;
+  }
+
+  uint64_t start = cpu_rdtsc();
+  int res = fread(buf, stat.filesize, 1, fd);
+  uint64_t end = cpu_rdtsc();
+  if (res < 0) {
+    print("File benchmark: read failed\n");
+    goto out;
+  }
+
+  // Run once per disk controller to compare the drivers on the same file
+  struct disk *fs_disk = disk_primary_fs_disk();
+  if (fs_disk) {
+    print(fs_disk->physical->driver->name);
+    print(" ");
+  }
+  disk_benchmark_print_result(VIOS_DISK_BENCHMARK_FILE, stat.filesize,
+                              end - start, 0);
+  print("  device reads: ");
+  print(itoa(disk_bcache_stats()->device_reads - device_reads));
+  print("\n");
+
+  // The path is resolved by the dentry cache the second time
+  device_reads = disk_bcache_stats()->device_reads;
+  int again = fopen(VIOS_DISK_BENCHMARK_FILE, "r");
+  if (again > 0) {
+    fclose(again);
+  }
+  print("  reopen device reads: ");
+  print(itoa(disk_bcache_stats()->device_reads - device_reads));
+  print("\n");
+out:
+  fclose(fd);
+}
+
+/**
+ * Reads "name" from every disk holding a filesystem, files larger than
+ * "buf" are read in pieces of its size
+ */
+static void disk_benchmark_file_size(void *buf, const char *name) {
+  struct disk *disk = NULL;
+  for (int i = 0; (disk = disk_get(i)) != NULL; i++) {
+    if (!disk->filesystem || disk->id > 9) {
+      continue;
+    }
+
+    char path[VIOS_MAX_PATH];
+    strcpy(path, itoa(disk->id));
+    strcpy(path + strlen(path), ":/");
+    strcpy(path + strlen(path), name);
+    int fd = fopen(path, "r");
+    if (fd <= 0) {
+      continue;
+    }
+
+    struct file_stat stat;
+    if (fstat(fd, &stat) < 0) {
+      fclose(fd);
+      continue;
+    }
+
+    uint64_t start = cpu_rdtsc();
+    size_t left = stat.filesize;
+    int res = 0;
+    while (left && res >= 0) {
+      size_t chunk = MIN(left, VIOS_DISK_BENCHMARK_BYTES);
+      res = fread(buf, chunk, 1, fd);
+      left -= chunk;
+    }
+    uint64_t end = cpu_rdtsc();
+    fclose(fd);
+    if (res < 0) {
+      print("File benchmark: read failed on ");
+      print(path);
+      print("\n");
+      continue;
+    }
+
+    // FAT16 and FAT32 partitions holding the same files compare here
+    print(disk->physical->driver->name);
+    print(" ");
+    print(disk->filesystem->name);
+    print(" ");
+    disk_benchmark_print_result(path, stat.filesize, end - start, 0);
+  }
+}
+
+void disk_benchmark() {
+  void *buf = kmalloc(VIOS_DISK_BENCHMARK_BYTES);
+  if (!buf) {
+    print("Disk benchmark: out of memory\n");
+    return;
+  }
+
+  disk_benchmark_ata(buf);
+  disk_benchmark_ahci(buf);
+  disk_benchmark_nvme(buf);
+  disk_benchmark_virtio(buf);
+  disk_benchmark_file(buf);
+
+  const char *sweep_files[] = VIOS_DISK_BENCHMARK_SWEEP_FILES;
+  for (int i = 0; i < sizeof(sweep_files) / sizeof(sweep_files[0]); i++) {
+    disk_benchmark_file_size(buf, sweep_files[i]);
+  }
+  kfree(buf);
+}
@@ -0,0 +1,6 @@
+#ifndef KERNEL_DISK_BENCHMARK_H
+#define KERNEL_DISK_BENCHMARK_H
+
+void disk_benchmark();
+
+#endif
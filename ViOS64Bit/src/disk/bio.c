@@ -0,0 +1,234 @@
+#include "bio.h"
+#include "bcache.h"
+#include "config.h"
+#include "disk.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include "string/string.h"
+
+void disk_bio_init(struct disk_bio *bio, struct disk *disk, size_t lba,
+                   int total, void *buf, bool write) {
+  memset(bio, 0, sizeof(*bio));
+  bio->disk = disk;
+  bio->lba = lba;
+  bio->total = total;
+  bio->buf = buf;
+  bio->write = write;
+}
+
+/**
+ * Queues "bio" on its physical disk in sector order, the queue runs at
+ * once unless a caller holds it plugged
+ */
+int disk_bio_submit(struct disk_bio *bio) {
+  struct disk *disk = bio->disk;
+  if (bio->total < 1) {
+    return -EINVARG;
+  }
+
+  size_t sector = disk->starting_lba + bio->lba;
+  if (sector + bio->total > disk->ending_lba) {
+    // Is this the primary disk
+    if (disk->starting_lba != 0 && disk->ending_lba != 0) {
+      // Out of bounds, you cannot read over to other virtual disks
+      return -EIO;
+    }
+  }
+
+  bio->physical = disk->physical;
+  bio->sector = sector;
+  bio->status = 1;
+
+  struct disk_queue *queue = &bio->physical->queue;
+  struct disk_bio **link = &queue->head;
+  while (*link && (*link)->sector <= sector) {
+    link = &(*link)->next;
+  }
+  bio->next = *link;
+  *link = bio;
+
+  queue->depth++;
+  queue->stats.bios++;
+  if (queue->depth > queue->stats.max_depth) {
+    queue->stats.max_depth = queue->depth;
+  }
+
+  if (!queue->plugged) {
+    disk_queue_run(bio->physical);
+  }
+
+  return 0;
+}
+
+static bool disk_bio_contiguous(struct disk_bio *bio, struct disk_bio *next) {
+  int sector_size = bio->physical->sector_size;
+  return (uint8_t *)bio->buf + bio->total * sector_size == next->buf;
+}
+
+/**
+ * Hands one command covering every bio chained from "first" to the
+ * driver, going through the bounce buffer when their buffers are apart
+ */
+static int disk_queue_issue(struct disk *physical, struct disk_bio *first,
+                            int total, bool contiguous) {
+  int res = 0;
+  struct disk_queue *queue = &physical->queue;
+  uint8_t *buf = first->buf;
+  if (!contiguous) {
+    queue->stats.bounced++;
+    buf = queue->bounce;
+    if (first->write) {
+      uint8_t *in = buf;
+      for (struct disk_bio *bio = first; bio; bio = bio->next) {
+        memcpy(in, bio->buf, bio->total * physical->sector_size);
+        in += bio->total * physical->sector_size;
+      }
+    }
+  }
+
+  if (first->write) {
+    res = disk_bcache_write(physical, first->sector, total, buf);
+  } else {
+    res = disk_bcache_read(physical, first->sector, total, buf);
+  }
+
+  if (!contiguous && !first->write && res >= 0) {
+    uint8_t *out = buf;
+    for (struct disk_bio *bio = first; bio; bio = bio->next) {
+      memcpy(bio->buf, out, bio->total * physical->sector_size);
+      out += bio->total * physical->sector_size;
+    }
+  }
+
+  return res;
+}
+
+/**
+ * Takes the bio at "link" and every following bio that continues it on
+ * disk out of the queue, issues them as one command and completes them
+ */
+static void disk_queue_dispatch(struct disk *physical,
+                                struct disk_bio **link) {
+  struct disk_queue *queue = &physical->queue;
+  struct disk_bio *first = *link;
+  struct disk_bio *last = first;
+  int total = first->total;
+  bool contiguous = true;
+
+  // Scattered buffers can only merge as far as the bounce buffer reaches
+  if (!queue->bounce) {
+    queue->bounce = kmalloc(VIOS_DISK_QUEUE_MAX_MERGE_SECTORS *
+                            physical->sector_size);
+  }
+
+  while (last->next && last->next->write == first->write &&
+         last->next->sector == last->sector + last->total &&
+         total + last->next->total <= VIOS_DISK_QUEUE_MAX_MERGE_SECTORS) {
+    bool next_contiguous = disk_bio_contiguous(last, last->next);
+    if (!next_contiguous && !queue->bounce) {
+      break;
+    }
+
+    contiguous = contiguous && next_contiguous;
+    total += last->next->total;
+    last = last->next;
+    queue->stats.merges++;
+  }
+
+  *link = last->next;
+  last->next = NULL;
+  for (struct disk_bio *bio = first; bio; bio = bio->next) {
+    queue->depth--;
+  }
+
+  queue->stats.commands++;
+  int res = disk_queue_issue(physical, first, total, contiguous);
+  queue->position = first->sector + total;
+
+  struct disk_bio *bio = first;
+  while (bio) {
+    // The end callback may reuse the bio
+    struct disk_bio *next = bio->next;
+    bio->next = NULL;
+    bio->status = res < 0 ? res : 0;
+    if (bio->end) {
+      bio->end(bio);
+    }
+    bio = next;
+  }
+}
+
+/**
+ * Dispatches every queued bio, sweeping upwards from where the last
+ * command ended and wrapping back to the lowest sector
+ */
+void disk_queue_run(struct disk *disk) {
+  struct disk *physical = disk->physical;
+  struct disk_queue *queue = &physical->queue;
+  while (queue->head) {
+    struct disk_bio **link = &queue->head;
+    while (*link && (*link)->sector < queue->position) {
+      link = &(*link)->next;
+    }
+
+    if (!*link) {
+      link = &queue->head;
+    }
+
+    disk_queue_dispatch(physical, link);
+  }
+}
+
+/**
+ * Completes "bio", a bio still held back by a plug is dispatched on its
+ * own so the rest of the plugged burst can keep merging
+ */
+int disk_bio_wait(struct disk_bio *bio) {
+  if (bio->status > 0) {
+    struct disk_bio **link = &bio->physical->queue.head;
+    while (*link && *link != bio) {
+      link = &(*link)->next;
+    }
+
+    if (*link) {
+      disk_queue_dispatch(bio->physical, link);
+    }
+  }
+
+  return bio->status;
+}
+
+void disk_queue_plug(struct disk *disk) { disk->physical->queue.plugged++; }
+
+void disk_queue_unplug(struct disk *disk) {
+  struct disk_queue *queue = &disk->physical->queue;
+  if (queue->plugged && --queue->plugged == 0) {
+    disk_queue_run(disk);
+  }
+}
+
+void disk_queue_print_stats() {
+  struct disk *disk = NULL;
+  for (int i = 0; (disk = disk_get(i)) != NULL; i++) {
+    if (disk->type == VIOS_DISK_TYPE_PARTITION) {
+      continue;
+    }
+
+    struct disk_queue_stats *stats = &disk->queue.stats;
+    print("Disk ");
+    print(itoa(disk->id));
+    print(" queue: ");
+    print(itoa(stats->bios));
+    print(" bios in ");
+    print(itoa(stats->commands));
+    print(" commands, ");
+    print(itoa(stats->merges));
+    print(" merged, ");
+    print(itoa(stats->bounced));
+    print(" bounced, max depth ");
+    print(itoa(stats->max_depth));
+    print("\n");
+  }
+}
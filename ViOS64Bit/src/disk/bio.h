@@ -0,0 +1,82 @@
+#ifndef KERNEL_DISK_BIO_H
+#define KERNEL_DISK_BIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct disk;
+struct disk_bio;
+
+typedef void (*DISK_BIO_END_FUNCTION)(struct disk_bio *bio);
+
+/**
+ * One read or write of whole sectors, queued on the physical disk and
+ * completed through "end" once the queue dispatches it
+ */
+struct disk_bio {
+  // The disk and sector the caller asked for, may be a partition
+  struct disk *disk;
+  size_t lba;
+  int total;
+  void *buf;
+  bool write;
+
+  // Positive while queued, zero once completed, negative on failure
+  int status;
+
+  // Optional, called with the final status set
+  DISK_BIO_END_FUNCTION end;
+  void *private;
+
+  // Filled in on submit, the real disk and its absolute sector
+  struct disk *physical;
+  size_t sector;
+
+  // Next bio in elevator order, then in the command it was merged into
+  struct disk_bio *next;
+};
+
+struct disk_queue_stats {
+  // Bios submitted to the queue
+  size_t bios;
+  // Commands handed to the driver
+  size_t commands;
+  // Bios that rode along in a command started by another bio
+  size_t merges;
+  // Merged commands whose buffers were not contiguous
+  size_t bounced;
+  // Most bios waiting in the queue at once
+  size_t max_depth;
+};
+
+/**
+ * Bios waiting on one physical disk, kept sorted by sector so adjacent
+ * bios merge and the disk is swept in one direction
+ */
+struct disk_queue {
+  struct disk_bio *head;
+  size_t depth;
+
+  // Nested plugs hold bios back until the outermost unplug
+  int plugged;
+
+  // Where the last command ended, the elevator continues from here
+  size_t position;
+
+  // Gathers merged bios that are not contiguous in memory
+  uint8_t *bounce;
+
+  struct disk_queue_stats stats;
+};
+
+void disk_bio_init(struct disk_bio *bio, struct disk *disk, size_t lba,
+                   int total, void *buf, bool write);
+int disk_bio_submit(struct disk_bio *bio);
+int disk_bio_wait(struct disk_bio *bio);
+void disk_queue_plug(struct disk *disk);
+void disk_queue_unplug(struct disk *disk);
+void disk_queue_run(struct disk *disk);
+void disk_queue_print_stats();
+
+#endif
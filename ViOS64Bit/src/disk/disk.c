@@ -1,6 +1,12 @@
 #include "disk.h"
 #include "config.h"
-#include "io/io.h"
+#include "disk/ahci.h"
+#include "disk/ata.h"
+#include "disk/bcache.h"
+#include "disk/nvme.h"
+#include "disk/ramdisk.h"
+#include "disk/virtio_blk.h"
+#include "fs/tmpfs/tmpfs.h"
 #include "kernel.h"
 #include "lib/vector/vector.h"
 #include "memory/heap/kheap.h"
@@ -18,56 +24,36 @@ struct disk *disk = NULL;
 // where kernel files are found.
 struct disk *primary_fs_disk = NULL;
 
-
-int disk_read_sector(int lba, int total, void *buf) {
-  // Wait for the disk not to be busy
-  while (insb(0x1F7) & 0x80) {
-    // spin
-  }
-
-  // Select drive: bits 7..4=0xE, bits 3..0 = high nibble of lba
-  outb(0x1F6, 0xE0 | ((lba >> 24) & 0x0F));
-  // Sector count
-  outb(0x1F2, (unsigned char)total);
-  // LBA low, mid, high
-  outb(0x1F3, (unsigned char)(lba & 0xff));
-  outb(0x1F4, (unsigned char)((lba >> 8) & 0xff));
-  outb(0x1F5, (unsigned char)((lba >> 16) & 0xff));
-
-  // Read SECTORS command (0x20)
-  outb(0x1F7, 0x20);
-
-  unsigned short *ptr = (unsigned short *)buf;
-  for (int b = 0; b < total; b++) {
-    // Wait for the disk not to be busy
-    while (insb(0x1F7) & 0x80) {
-      // spin
-    }
-
-    // Check error bit
-    char status = insb(0x1F7);
-    if (status & 0x01) {
-      return -EIO;
-    }
-
-    // Wait for the buffer to be ready
-    while (!(insb(0x1F7) & 0x08))
-
-    {
-      // spin
-    }
-
-    // Copy from hard disk to memory
-    for (int word = 0; word < 256; word++) {
-      *ptr++ = insw(0x1F0);
+/**
+ * Finds the whole disk driven by "driver" with "driver_private"
+ */
+static struct disk *disk_find_physical(struct disk_driver *driver,
+                                       void *driver_private) {
+  for (int i = 0; i < (int)vector_count(disk_vector); i++) {
+    struct disk *disk = disk_get(i);
+    if (disk->type != VIOS_DISK_TYPE_PARTITION && disk->driver == driver &&
+        disk->driver_private == driver_private) {
+      return disk;
     }
   }
-  return 0;
+
+  return NULL;
 }
 
 int disk_create_new(int type, int starting_lba, int ending_lba,
-                    size_t sector_size, struct disk **disk_out) {
+                    size_t sector_size, struct disk_driver *driver,
+                    void *driver_private, struct disk **disk_out) {
   int res = 0;
+  // Partitions share the driver of the real disk they were found on
+  struct disk *physical = NULL;
+  if (type == VIOS_DISK_TYPE_PARTITION) {
+    physical = disk_find_physical(driver, driver_private);
+    if (!physical) {
+      res = -EINVARG;
+      goto out;
+    }
+  }
+
   struct disk *disk = kzalloc(sizeof(struct disk));
   if (!disk) {
     res = -ENOMEM;
@@ -78,6 +64,9 @@ int disk_create_new(int type, int starting_lba, int ending_lba,
   disk->sector_size = sector_size;
   disk->starting_lba = starting_lba;
   disk->ending_lba = ending_lba;
+  disk->driver = driver;
+  disk->driver_private = driver_private;
+  disk->physical = physical ? physical : disk;
 
   // Not all disks have filesystems its not an error not to have one
   disk->filesystem = fs_resolve(disk);
@@ -88,7 +77,12 @@ int disk_create_new(int type, int starting_lba, int ending_lba,
             strlen(VIOS_KERNEL_FILESYSTEM_NAME));
     // Is the disk the primary disk, lets check
     disk->filesystem->volume_name(disk->fs_private, fs_name, sizeof(fs_name));
-    if (strncmp(fs_name, primary_drive_fs_name, sizeof(fs_name)) == 0) {
+    bool sticky_primary =
+        primary_fs_disk &&
+        (primary_fs_disk->physical->driver->preferred_primary ||
+         primary_fs_disk->filesystem->preferred_primary);
+    if (strncmp(fs_name, primary_drive_fs_name, sizeof(fs_name)) == 0 &&
+        !sticky_primary) {
       // Set the primary filesystem disk
       primary_fs_disk = disk;
       print("Primary FS disk set: ");
@@ -112,10 +106,34 @@ void disk_search_and_init() {
     goto out;
   }
 
-  res =
-      disk_create_new(VIOS_DISK_TYPE_REAL, 0, 0, VIOS_SECTOR_SIZE, &disk);
+  disk_bcache_init();
+
+  res = ata_init();
   if (res < 0) {
-    goto out;
+    print("No ATA disk found on the primary channel\n");
+  } else {
+    res = disk_create_new(VIOS_DISK_TYPE_REAL, 0, 0, VIOS_SECTOR_SIZE,
+                          &ata_disk_driver, ata_primary(), NULL);
+    if (res < 0) {
+      goto out;
+    }
+  }
+
+  // Every AHCI port, NVMe namespace and virtio disk registers itself
+  ahci_init();
+  nvme_init();
+  virtio_blk_init();
+
+  // Any disk image the UEFI loader left in memory
+  ramdisk_init();
+
+  // Scratch files in memory on a drive of their own
+  tmpfs_mount();
+
+  // The first real disk found is the primary disk
+  disk = disk_get(0);
+  if (!disk) {
+    print("No disks found\n");
   }
 out:
   return;
@@ -137,17 +155,75 @@ struct disk *disk_get(int index) {
   return disk;
 }
 
+/**
+ * Reads through the block queue and waits for the data
+ */
 int disk_read_block(struct disk *idisk, unsigned int lba, int total,
                     void *buf) {
-  size_t absolute_lba = idisk->starting_lba + lba;
-  size_t absolute_ending_lba = absolute_lba + total;
-  if (absolute_ending_lba > idisk->ending_lba) {
-    // Is this the primary disk
-    if (idisk->starting_lba != 0 && idisk->ending_lba != 0) {
-      // Out of bounds, you cannot read over to other virtual disks
-      return -EIO;
-    }
+  struct disk_bio bio;
+  disk_bio_init(&bio, idisk, lba, total, buf, false);
+  int res = disk_bio_submit(&bio);
+  if (res < 0) {
+    return res;
+  }
+
+  return disk_bio_wait(&bio);
+}
+
+/**
+ * Writes through the block queue, the data lands in the write back cache
+ * and reaches the device on the next flush
+ */
+int disk_write_block(struct disk *idisk, unsigned int lba, int total,
+                     const void *buf) {
+  struct disk_bio bio;
+  disk_bio_init(&bio, idisk, lba, total, (void *)buf, true);
+  int res = disk_bio_submit(&bio);
+  if (res < 0) {
+    return res;
+  }
+
+  return disk_bio_wait(&bio);
+}
+
+/**
+ * Writes every cached block of the disk back and waits for the device
+ * to make them durable
+ */
+int disk_flush(struct disk *idisk) {
+  struct disk *physical = idisk->physical;
+  int res = disk_bcache_flush(physical);
+  if (res < 0) {
+    return res;
+  }
+
+  if (physical->driver && physical->driver->flush) {
+    res = physical->driver->flush(physical);
+  }
+
+  return res;
+}
+
+/**
+ * Reads straight from the device, bypassing the block cache
+ */
+int disk_read_physical(struct disk *physical, size_t lba, int total,
+                       void *buf) {
+  if (!physical->driver || !physical->driver->read) {
+    return -EIO;
+  }
+
+  return physical->driver->read(physical, lba, total, buf);
+}
+
+/**
+ * Writes straight to the device, callers must drop any cached copy
+ */
+int disk_write_physical(struct disk *physical, size_t lba, int total,
+                        const void *buf) {
+  if (!physical->driver || !physical->driver->write) {
+    return -EIO;
   }
 
-  return disk_read_sector(absolute_lba, total, buf);
+  return physical->driver->write(physical, lba, total, buf);
 }
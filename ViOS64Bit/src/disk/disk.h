@@ -1,6 +1,7 @@
 #ifndef DISK_H
 #define DISK_H
 
+#include "disk/bio.h"
 #include "fs/file.h"
 
 typedef unsigned int VIOS_DISK_TYPE;
@@ -11,8 +12,33 @@ typedef unsigned int VIOS_DISK_TYPE;
 // Specifies this disk represents a partion/virtual-disk
 #define VIOS_DISK_TYPE_PARTITION 1
 
+// A whole disk image held in memory, loaded by the UEFI loader
+#define VIOS_DISK_TYPE_RAM 2
+
+// Has no sectors, its filesystem keeps the files in memory
+#define VIOS_DISK_TYPE_MEMORY 3
+
 #define VIOS_KERNEL_FILESYSTEM_NAME "VIOS       "
 
+struct disk;
+
+typedef int (*DISK_READ_FUNCTION)(struct disk *disk, size_t lba, int total,
+                                  void *buf);
+typedef int (*DISK_WRITE_FUNCTION)(struct disk *disk, size_t lba, int total,
+                                   const void *buf);
+typedef int (*DISK_FLUSH_FUNCTION)(struct disk *disk);
+
+// Implemented by every controller driver that provides real disks
+struct disk_driver {
+  char name[16];
+  DISK_READ_FUNCTION read;
+  DISK_WRITE_FUNCTION write;
+  // Optional, empties a volatile write cache in the device
+  DISK_FLUSH_FUNCTION flush;
+  // Once primary the disk stays primary over later disks with the volume
+  bool preferred_primary;
+};
+
 struct disk {
   VIOS_DISK_TYPE type;
   int sector_size;
@@ -22,6 +48,13 @@ struct disk {
 
   struct filesystem *filesystem;
 
+  // The real disk this disk lives on, itself for a real disk
+  struct disk *physical;
+
+  // The controller driver of the real disk and its per device data
+  struct disk_driver *driver;
+  void *driver_private;
+
   // Set both to zero for the primary disk
   // all bounds checking is ignored if set to zero.
   size_t starting_lba;
@@ -29,12 +62,19 @@ struct disk {
 
   // The private data of our filesystem
   void *fs_private;
+
+  // Bios waiting for a real disk, unused on partitions
+  struct disk_queue queue;
 };
 
-int disk_create_new(int type, int starting_lba, int ending_lba, size_t sector_size, struct disk** disk_out);
+int disk_create_new(int type, int starting_lba, int ending_lba, size_t sector_size, struct disk_driver* driver, void* driver_private, struct disk** disk_out);
 void disk_search_and_init();
 struct disk* disk_get(int index);
 int disk_read_block(struct disk* idisk, unsigned int lba, int total, void* buf);
+int disk_write_block(struct disk* idisk, unsigned int lba, int total, const void* buf);
+int disk_flush(struct disk* idisk);
+int disk_read_physical(struct disk* physical, size_t lba, int total, void* buf);
+int disk_write_physical(struct disk* physical, size_t lba, int total, const void* buf);
 struct disk* disk_primary_fs_disk();
 struct disk* disk_primary();
 
@@ -6,8 +6,6 @@
 #include "status.h"
 #include "string/string.h"
 
-struct disk *gpt_primary_disk = NULL;
-
 size_t gpt_partition_table_header_real_size(
     struct gpt_partition_table_header *header) {
   return sizeof(*header) +
@@ -16,11 +14,10 @@ size_t gpt_partition_table_header_real_size(
 }
 
 int gpt_partition_table_header_read(
-    struct gpt_partition_table_header *header_out) {
+    struct disk *disk, struct gpt_partition_table_header *header_out) {
   int res = 0;
-  char sector[gpt_primary_disk->sector_size];
-  res = disk_read_block(gpt_primary_disk, GPT_PARTITION_TABLE_HEADER_LBA, 1,
-                        sector);
+  char sector[disk->sector_size];
+  res = disk_read_block(disk, GPT_PARTITION_TABLE_HEADER_LBA, 1, sector);
   if (res < 0) {
     goto out;
   }
@@ -30,14 +27,15 @@ out:
   return res;
 }
 
-int gpt_mount_partitions(struct gpt_partition_table_header *partition_header) {
+int gpt_mount_partitions(struct disk *disk,
+                         struct gpt_partition_table_header *partition_header) {
   int res = 0;
   size_t total_entries = partition_header->total_array_entries;
   uint64_t starting_lba = partition_header->guid_array_lba_start;
-  uint64_t starting_byte = starting_lba * gpt_primary_disk->sector_size;
+  uint64_t starting_byte = starting_lba * disk->sector_size;
   size_t entry_size = partition_header->array_entry_size;
 
-  struct disk_stream *streamer = diskstreamer_new(gpt_primary_disk->id);
+  struct disk_stream *streamer = diskstreamer_new_from_disk(disk);
   if (!streamer) {
     res = -EINVARG;
     goto out;
@@ -67,9 +65,9 @@ int gpt_mount_partitions(struct gpt_partition_table_header *partition_header) {
     }
 
     // We have the entry, lets create a virtual disk
-    res =
-        disk_create_new(VIOS_DISK_TYPE_PARTITION, entry->starting_lba,
-                        entry->ending_lba, gpt_primary_disk->sector_size, NULL);
+    res = disk_create_new(VIOS_DISK_TYPE_PARTITION, entry->starting_lba,
+                          entry->ending_lba, disk->sector_size, disk->driver,
+                          disk->driver_private, NULL);
     if (res < 0) {
       goto out;
     }
@@ -82,17 +80,13 @@ out:
   return res;
 }
 
-int gpt_init() {
+/**
+ * Mounts the partitions of a single real disk
+ */
+static int gpt_init_disk(struct disk *disk) {
   int res = 0;
   struct gpt_partition_table_header partition_header = {0};
-  gpt_primary_disk = disk_get(0);
-
-  if (!gpt_primary_disk) {
-    res = -EINVARG;
-    goto out;
-  }
-
-  res = gpt_partition_table_header_read(&partition_header);
+  res = gpt_partition_table_header_read(disk, &partition_header);
   if (res < 0) {
     goto out;
   }
@@ -106,11 +100,29 @@ int gpt_init() {
 
   // This is a GPT disk mount all partitions as seperate
   // virtual disks
-  res = gpt_mount_partitions(&partition_header);
+  res = gpt_mount_partitions(disk, &partition_header);
   if (res < 0) {
     goto out;
   }
 
 out:
+  return res;
+}
+
+int gpt_init() {
+  int res = -EINVARG;
+  // Partitions are appended as they are mounted, they are never real disks
+  struct disk *disk = NULL;
+  for (int i = 0; (disk = disk_get(i)) != NULL; i++) {
+    if (disk->type != VIOS_DISK_TYPE_REAL) {
+      continue;
+    }
+
+    int disk_res = gpt_init_disk(disk);
+    if (res < 0) {
+      res = disk_res;
+    }
+  }
+
   return res;
 }
\ No newline at end of file
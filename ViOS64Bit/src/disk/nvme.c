@@ -0,0 +1,803 @@
+#include "nvme.h"
+#include "config.h"
+#include "cpu/cpu.h"
+#include "disk/disk.h"
+#include "idt/idt.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "pci/pci.h"
+#include "status.h"
+#include "string/string.h"
+
+// Identify controller fields
+#define NVME_IDENTIFY_MDTS 77
+#define NVME_IDENTIFY_NAMESPACE_COUNT 516
+
+// Identify namespace fields
+#define NVME_IDENTIFY_NSZE 0
+#define NVME_IDENTIFY_FLBAS 26
+#define NVME_IDENTIFY_LBAF 128
+#define NVME_FLBAS_FORMAT_MASK 0x0F
+#define NVME_LBAF_LBADS_SHIFT 16
+
+static struct nvme_controller nvme_controllers[VIOS_DISK_NVME_MAX_CONTROLLERS];
+static int nvme_total_controllers = 0;
+
+// Namespaces registered as disks across all controllers
+static struct nvme_namespace
+    *nvme_namespaces[VIOS_DISK_NVME_MAX_CONTROLLERS * NVME_MAX_NAMESPACES];
+static int nvme_namespace_count = 0;
+
+// Counts interrupts taken, used to check the firmware routed our line
+static volatile uint32_t nvme_interrupt_count = 0;
+
+/**
+ * Orders our writes to the queues before the doorbell write
+ */
+static void nvme_barrier() { __asm__ __volatile__("mfence" : : : "memory"); }
+
+static volatile uint32_t *nvme_doorbell(struct nvme_controller *controller,
+                                        uint16_t queue_id, bool completion) {
+  return (volatile uint32_t *)((uint8_t *)controller->registers +
+                               NVME_DOORBELL_OFFSET +
+                               (2 * queue_id + completion) *
+                                   controller->doorbell_stride);
+}
+
+static int nvme_queue_allocate(struct nvme_controller *controller,
+                               struct nvme_queue *queue, uint16_t id,
+                               uint16_t entries, bool io) {
+  memset(queue, 0, sizeof(*queue));
+  queue->controller = controller;
+  queue->id = id;
+  queue->entries = entries;
+  queue->phase = 1;
+
+  // Heap blocks are page aligned as the queues require
+  queue->submission =
+      kzalloc(sizeof(struct nvme_submission_entry) * entries);
+  queue->completion =
+      kzalloc(sizeof(struct nvme_completion_entry) * entries);
+  if (!queue->submission || !queue->completion) {
+    return -ENOMEM;
+  }
+
+  if (io) {
+    queue->prp_lists = kzalloc(PAGING_PAGE_SIZE * NVME_MAX_QUEUE_DEPTH);
+    if (!queue->prp_lists) {
+      return -ENOMEM;
+    }
+  }
+
+  queue->submission_doorbell = nvme_doorbell(controller, id, false);
+  queue->completion_doorbell = nvme_doorbell(controller, id, true);
+  return 0;
+}
+
+/**
+ * Places a command at the tail, the controller only sees it once the
+ * doorbell is rung
+ */
+static void nvme_queue_push(struct nvme_queue *queue,
+                            struct nvme_submission_entry *command) {
+  memcpy(&queue->submission[queue->submission_tail], command,
+         sizeof(*command));
+  queue->submission_tail = (queue->submission_tail + 1) % queue->entries;
+}
+
+static void nvme_queue_ring(struct nvme_queue *queue) {
+  nvme_barrier();
+  *queue->submission_doorbell = queue->submission_tail;
+  queue->doorbell_writes++;
+}
+
+/**
+ * Takes the next completion if the controller has posted one, the head
+ * doorbell is left for nvme_queue_release
+ */
+static bool nvme_queue_next_completion(struct nvme_queue *queue,
+                                       struct nvme_completion_entry *out) {
+  volatile struct nvme_completion_entry *entry =
+      &queue->completion[queue->completion_head];
+  uint16_t status = entry->status;
+  if ((status & NVME_STATUS_PHASE) != queue->phase) {
+    return false;
+  }
+
+  out->result = entry->result;
+  out->submission_head = entry->submission_head;
+  out->command_id = entry->command_id;
+  out->status = status;
+
+  queue->completion_head++;
+  if (queue->completion_head == queue->entries) {
+    queue->completion_head = 0;
+    queue->phase ^= 1;
+  }
+
+  return true;
+}
+
+static void nvme_queue_release(struct nvme_queue *queue) {
+  *queue->completion_doorbell = queue->completion_head;
+  queue->doorbell_writes++;
+}
+
+/**
+ * Empties a queue the controller no longer knows about so it can be
+ * installed again, every command identifier becomes free
+ */
+static void nvme_queue_reset(struct nvme_queue *queue) {
+  memset(queue->submission, 0,
+         sizeof(struct nvme_submission_entry) * queue->entries);
+  memset((void *)queue->completion, 0,
+         sizeof(struct nvme_completion_entry) * queue->entries);
+  queue->submission_tail = 0;
+  queue->completion_head = 0;
+  queue->phase = 1;
+  queue->commands_in_use = 0;
+  memset(queue->command_requests, 0, sizeof(queue->command_requests));
+}
+
+/**
+ * Runs an admin command and polls for its completion, only used while
+ * the controller is being brought up
+ */
+static int nvme_admin_command(struct nvme_controller *controller,
+                              struct nvme_submission_entry *command,
+                              uint32_t *result) {
+  struct nvme_queue *queue = &controller->admin_queue;
+  struct nvme_completion_entry completion;
+  command->command_id = queue->submission_tail;
+  nvme_queue_push(queue, command);
+  nvme_queue_ring(queue);
+
+  for (int i = 0; i < NVME_TIMEOUT_SPINS; i++) {
+    if (!nvme_queue_next_completion(queue, &completion)) {
+      continue;
+    }
+
+    nvme_queue_release(queue);
+    if (completion.status >> 1) {
+      return -EIO;
+    }
+
+    if (result) {
+      *result = completion.result;
+    }
+    return 0;
+  }
+
+  return -EIO;
+}
+
+static int nvme_identify(struct nvme_controller *controller, uint32_t cns,
+                         uint32_t namespace_id) {
+  struct nvme_submission_entry command = {0};
+  command.opcode = NVME_ADMIN_IDENTIFY;
+  command.namespace_id = namespace_id;
+  command.prp1 = (uint64_t)(uintptr_t)controller->identify;
+  command.cdw10 = cns;
+  return nvme_admin_command(controller, &command, NULL);
+}
+
+static int nvme_wait_ready(struct nvme_controller *controller, bool ready) {
+  for (int i = 0; i < NVME_TIMEOUT_SPINS; i++) {
+    uint32_t status = controller->registers->status;
+    if (status & NVME_CSTS_FATAL) {
+      return -EIO;
+    }
+
+    if (((status & NVME_CSTS_READY) != 0) == ready) {
+      return 0;
+    }
+  }
+
+  return -EIO;
+}
+
+/**
+ * Disables the controller, installs the admin queue and enables it again.
+ * Once disabled the controller has dropped every queue and command, the
+ * admin queue is allocated the first time and emptied after that
+ */
+static int nvme_controller_enable(struct nvme_controller *controller) {
+  volatile struct nvme_registers *regs = controller->registers;
+  regs->configuration &= ~NVME_CC_ENABLE;
+  int res = nvme_wait_ready(controller, false);
+  if (res < 0) {
+    return res;
+  }
+
+  if (controller->admin_queue.submission) {
+    nvme_queue_reset(&controller->admin_queue);
+  } else {
+    res = nvme_queue_allocate(controller, &controller->admin_queue, 0,
+                              NVME_ADMIN_QUEUE_ENTRIES, false);
+    if (res < 0) {
+      return res;
+    }
+  }
+
+  regs->admin_queue_attributes =
+      ((NVME_ADMIN_QUEUE_ENTRIES - 1) << 16) | (NVME_ADMIN_QUEUE_ENTRIES - 1);
+  regs->admin_submission_queue =
+      (uint64_t)(uintptr_t)controller->admin_queue.submission;
+  regs->admin_completion_queue =
+      (uint64_t)(uintptr_t)controller->admin_queue.completion;
+
+  // The NVM command set on 4KB memory pages
+  regs->configuration = NVME_CC_IOSQES | NVME_CC_IOCQES | NVME_CC_ENABLE;
+  return nvme_wait_ready(controller, true);
+}
+
+/**
+ * Tells the controller about an allocated queue pair, the completion
+ * queue must exist before its submission queue
+ */
+static int nvme_install_io_queue(struct nvme_controller *controller,
+                                 struct nvme_queue *queue) {
+  uint32_t size_and_id = ((uint32_t)(queue->entries - 1) << 16) | queue->id;
+  struct nvme_submission_entry command = {0};
+  command.opcode = NVME_ADMIN_CREATE_CQ;
+  command.prp1 = (uint64_t)(uintptr_t)queue->completion;
+  command.cdw10 = size_and_id;
+  command.cdw11 =
+      NVME_QUEUE_PHYSICALLY_CONTIGUOUS | NVME_QUEUE_INTERRUPTS_ENABLED;
+  int res = nvme_admin_command(controller, &command, NULL);
+  if (res < 0) {
+    return res;
+  }
+
+  memset(&command, 0, sizeof(command));
+  command.opcode = NVME_ADMIN_CREATE_SQ;
+  command.prp1 = (uint64_t)(uintptr_t)queue->submission;
+  command.cdw10 = size_and_id;
+  command.cdw11 =
+      ((uint32_t)queue->id << 16) | NVME_QUEUE_PHYSICALLY_CONTIGUOUS;
+  return nvme_admin_command(controller, &command, NULL);
+}
+
+static int nvme_create_io_queue(struct nvme_controller *controller,
+                                struct nvme_queue *queue, uint16_t id,
+                                uint16_t entries) {
+  int res = nvme_queue_allocate(controller, queue, id, entries, true);
+  if (res < 0) {
+    return res;
+  }
+
+  return nvme_install_io_queue(controller, queue);
+}
+
+/**
+ * Asks for one I/O queue pair per CPU, the controller may grant less
+ */
+static int nvme_set_queue_count(struct nvme_controller *controller,
+                                uint32_t *granted) {
+  int wanted = VIOS_DISK_NVME_IO_QUEUES;
+  struct nvme_submission_entry command = {0};
+  command.opcode = NVME_ADMIN_SET_FEATURES;
+  command.cdw10 = NVME_FEATURE_NUMBER_OF_QUEUES;
+  command.cdw11 = ((uint32_t)(wanted - 1) << 16) | (wanted - 1);
+  return nvme_admin_command(controller, &command, granted);
+}
+
+/**
+ * Creates one I/O queue pair per CPU, or fewer if the controller
+ * grants less
+ */
+static int nvme_create_io_queues(struct nvme_controller *controller) {
+  uint32_t granted = 0;
+  int wanted = VIOS_DISK_NVME_IO_QUEUES;
+  int res = nvme_set_queue_count(controller, &granted);
+  if (res < 0) {
+    return res;
+  }
+
+  int total =
+      MIN(wanted, (int)MIN((granted & 0xFFFF) + 1, (granted >> 16) + 1));
+  uint16_t entries =
+      MIN(NVME_IO_QUEUE_ENTRIES,
+          (controller->registers->capabilities & NVME_CAP_MQES_MASK) + 1);
+  controller->queue_depth = MIN(NVME_MAX_QUEUE_DEPTH, entries - 1);
+
+  for (int i = 0; i < total; i++) {
+    res = nvme_create_io_queue(controller, &controller->io_queues[i], i + 1,
+                               entries);
+    if (res < 0) {
+      return res;
+    }
+    controller->total_io_queues++;
+  }
+
+  return 0;
+}
+
+/**
+ * Takes every command back from the controller by disabling it, then
+ * brings it up again with the same queues emptied
+ */
+static int nvme_controller_reset(struct nvme_controller *controller) {
+  int res = nvme_controller_enable(controller);
+  if (res < 0) {
+    return res;
+  }
+
+  if (!controller->interrupts) {
+    controller->registers->interrupt_mask_set = 1;
+  }
+
+  res = nvme_set_queue_count(controller, NULL);
+  if (res < 0) {
+    return res;
+  }
+
+  for (int i = 0; i < controller->total_io_queues; i++) {
+    struct nvme_queue *queue = &controller->io_queues[i];
+    nvme_queue_reset(queue);
+    res = nvme_install_io_queue(controller, queue);
+    if (res < 0) {
+      return res;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Picks the queue pair of the CPU we run on, the kernel only ever runs
+ * on the boot CPU
+ */
+static struct nvme_queue *
+nvme_current_queue(struct nvme_controller *controller) {
+  return &controller->io_queues[0];
+}
+
+static uint64_t nvme_physical_address(struct paging_desc *desc, void *virt) {
+  if (!desc) {
+    return (uint64_t)(uintptr_t)virt;
+  }
+
+  return (uint64_t)(uintptr_t)paging_get_physical_address(desc, virt);
+}
+
+/**
+ * Describes "bytes" at "buf" with PRP entries, anything beyond two pages
+ * goes through the PRP list page owned by "command_id"
+ */
+static int nvme_build_prps(struct nvme_queue *queue, int command_id,
+                           uint8_t *buf, size_t bytes,
+                           struct nvme_submission_entry *command) {
+  struct paging_desc *desc = paging_current_descriptor();
+  uint64_t phys = nvme_physical_address(desc, buf);
+  if (!phys || (phys & 3)) {
+    return -EINVARG;
+  }
+
+  command->prp1 = phys;
+  command->prp2 = 0;
+
+  size_t first = PAGING_PAGE_SIZE - ((uintptr_t)buf % PAGING_PAGE_SIZE);
+  if (bytes <= first) {
+    return 0;
+  }
+
+  buf += first;
+  bytes -= first;
+  if (bytes <= PAGING_PAGE_SIZE) {
+    command->prp2 = nvme_physical_address(desc, buf);
+    return command->prp2 ? 0 : -EINVARG;
+  }
+
+  uint64_t *list = queue->prp_lists + command_id * NVME_PRP_LIST_ENTRIES;
+  int total_entries = 0;
+  while (bytes) {
+    if (total_entries == NVME_PRP_LIST_ENTRIES) {
+      return -EINVARG;
+    }
+
+    phys = nvme_physical_address(desc, buf);
+    if (!phys) {
+      return -EINVARG;
+    }
+
+    list[total_entries++] = phys;
+    size_t chunk = MIN(bytes, PAGING_PAGE_SIZE);
+    buf += chunk;
+    bytes -= chunk;
+  }
+
+  command->prp2 = (uint64_t)(uintptr_t)list;
+  return 0;
+}
+
+/**
+ * Queues a request without ringing the doorbell so a whole batch of
+ * commands costs one doorbell write
+ */
+static int nvme_queue_request(struct nvme_queue *queue,
+                              struct nvme_namespace *ns,
+                              struct disk_request *request) {
+  struct nvme_controller *controller = queue->controller;
+  if (!request->count ||
+      request->count > controller->max_sectors_per_command) {
+    return -EINVARG;
+  }
+
+  if (request->lba + request->count > ns->total_sectors) {
+    return -EIO;
+  }
+
+  if (queue->commands_in_use == ~0ULL) {
+    return -EIO;
+  }
+
+  int command_id = __builtin_ctzll(~queue->commands_in_use);
+  struct nvme_submission_entry command = {0};
+  command.opcode = request->write ? NVME_COMMAND_WRITE : NVME_COMMAND_READ;
+  command.command_id = command_id;
+  command.namespace_id = ns->id;
+  command.cdw10 = request->lba & 0xFFFFFFFF;
+  command.cdw11 = request->lba >> 32;
+  // The block count is zero based
+  command.cdw12 = request->count - 1;
+  int res = nvme_build_prps(queue, command_id, request->buf,
+                            request->count * NVME_SECTOR_SIZE, &command);
+  if (res < 0) {
+    return res;
+  }
+
+  queue->commands_in_use |= 1ULL << command_id;
+  queue->command_requests[command_id] = request;
+  queue->command_start[command_id] = cpu_rdtsc();
+  request->status = 1;
+  nvme_queue_push(queue, &command);
+  return 0;
+}
+
+/**
+ * Completes every posted command and then moves the head doorbell once,
+ * returns the number of requests completed
+ */
+static int nvme_queue_reap(struct nvme_queue *queue) {
+  struct nvme_completion_entry completion;
+  int total = 0;
+  while (nvme_queue_next_completion(queue, &completion)) {
+    int command_id = completion.command_id;
+    if (command_id >= NVME_MAX_QUEUE_DEPTH) {
+      continue;
+    }
+
+    struct disk_request *request = queue->command_requests[command_id];
+    queue->command_requests[command_id] = NULL;
+    queue->commands_in_use &= ~(1ULL << command_id);
+
+    if (!request) {
+      continue;
+    }
+
+    request->latency_ticks = cpu_rdtsc() - queue->command_start[command_id];
+    request->status = (completion.status >> 1) ? -EIO : 0;
+    total++;
+  }
+
+  if (total) {
+    nvme_queue_release(queue);
+  }
+
+  return total;
+}
+
+static int nvme_request_issue(void *device, struct disk_request *request) {
+  struct nvme_namespace *ns = device;
+  return nvme_queue_request(nvme_current_queue(ns->controller), ns, request);
+}
+
+static void nvme_request_kick(void *device) {
+  struct nvme_namespace *ns = device;
+  nvme_queue_ring(nvme_current_queue(ns->controller));
+}
+
+static int nvme_request_reap(void *device) {
+  struct nvme_namespace *ns = device;
+  return nvme_queue_reap(nvme_current_queue(ns->controller));
+}
+
+static bool nvme_request_wait(void *device) {
+  struct nvme_namespace *ns = device;
+  struct nvme_controller *controller = ns->controller;
+  if (!controller->interrupts) {
+    return false;
+  }
+
+  // The interrupt handler masks the controller, unmask before sleeping
+  controller->registers->interrupt_mask_clear = 1;
+  uint64_t start = cpu_rdtsc();
+  cpu_wait_for_interrupt();
+  nvme_current_queue(controller)->idle_ticks += cpu_rdtsc() - start;
+  return true;
+}
+
+/**
+ * Fails what is in flight and resets the controller, until it is
+ * disabled it may still write into the buffers of those requests
+ */
+static void nvme_request_abort(void *device) {
+  struct nvme_namespace *ns = device;
+  struct nvme_queue *queue = nvme_current_queue(ns->controller);
+  for (int i = 0; i < NVME_MAX_QUEUE_DEPTH; i++) {
+    if (queue->command_requests[i]) {
+      queue->command_requests[i]->status = -EIO;
+      queue->command_requests[i] = NULL;
+    }
+  }
+
+  if (nvme_controller_reset(ns->controller) < 0) {
+    print("NVMe: controller reset failed\n");
+  }
+}
+
+static const struct disk_request_ops nvme_request_ops = {
+    .issue = nvme_request_issue,
+    .kick = nvme_request_kick,
+    .reap = nvme_request_reap,
+    .wait = nvme_request_wait,
+    .abort = nvme_request_abort,
+    .timeout_spins = NVME_TIMEOUT_SPINS};
+
+int nvme_submit_requests(struct nvme_namespace *ns,
+                         struct disk_request *requests, size_t total,
+                         int queue_depth) {
+  return disk_request_submit(&nvme_request_ops, ns, requests, total,
+                             queue_depth, ns->controller->queue_depth);
+}
+
+/**
+ * Splits a transfer into commands within the transfer size limit and
+ * runs them concurrently
+ */
+static int nvme_transfer(struct nvme_namespace *ns, uint64_t lba,
+                         size_t total, uint8_t *buf, bool write) {
+  int res = 0;
+  struct disk_request requests[NVME_MAX_QUEUE_DEPTH];
+  size_t max_sectors = ns->controller->max_sectors_per_command;
+  while (total) {
+    size_t batch = 0;
+    while (total && batch < NVME_MAX_QUEUE_DEPTH) {
+      size_t count = MIN(total, max_sectors);
+      requests[batch].lba = lba;
+      requests[batch].count = count;
+      requests[batch].buf = buf;
+      requests[batch].write = write;
+      requests[batch].status = 0;
+      batch++;
+
+      lba += count;
+      total -= count;
+      buf += count * NVME_SECTOR_SIZE;
+    }
+
+    res = nvme_submit_requests(ns, requests, batch, 0);
+    if (res < 0) {
+      break;
+    }
+  }
+
+  return res;
+}
+
+int nvme_read_sectors(struct nvme_namespace *ns, uint64_t lba, size_t total,
+                      void *buf) {
+  return nvme_transfer(ns, lba, total, buf, false);
+}
+
+int nvme_write_sectors(struct nvme_namespace *ns, uint64_t lba, size_t total,
+                       const void *buf) {
+  return nvme_transfer(ns, lba, total, (uint8_t *)buf, true);
+}
+
+static int nvme_disk_read(struct disk *disk, size_t lba, int total,
+                          void *buf) {
+  return nvme_read_sectors(disk->driver_private, lba, total, buf);
+}
+
+static int nvme_disk_write(struct disk *disk, size_t lba, int total,
+                           const void *buf) {
+  return nvme_write_sectors(disk->driver_private, lba, total, buf);
+}
+
+struct disk_driver nvme_disk_driver = {
+    .name = "nvme", .read = nvme_disk_read, .write = nvme_disk_write};
+
+/**
+ * The legacy interrupt stays asserted while completions are unread,
+ * mask it and let the sleeping submitter reap them
+ */
+static void nvme_interrupt_handler(struct interrupt_frame *frame) {
+  nvme_interrupt_count++;
+  for (int i = 0; i < nvme_total_controllers; i++) {
+    if (nvme_controllers[i].interrupts) {
+      nvme_controllers[i].registers->interrupt_mask_set = 1;
+    }
+  }
+}
+
+static void nvme_interrupts_init(struct nvme_controller *controller) {
+  if (pci_enable_interrupts(controller->pci, nvme_interrupt_handler) < 0) {
+    return;
+  }
+
+  controller->interrupts = true;
+}
+
+/**
+ * Interrupt routing on the PIC is left to the firmware, the admin
+ * commands we already ran must have raised our line
+ */
+static void nvme_check_interrupts(struct nvme_controller *controller) {
+  if (!controller->interrupts) {
+    return;
+  }
+
+  for (int i = 0; i < NVME_TIMEOUT_SPINS / 1000 && !nvme_interrupt_count;
+       i++) {
+    cpu_interrupt_window();
+  }
+
+  if (!nvme_interrupt_count) {
+    print("NVMe: no interrupts, polling for completions\n");
+    controller->interrupts = false;
+    controller->registers->interrupt_mask_set = 1;
+  }
+}
+
+/**
+ * Identifies every active namespace with 512 byte blocks and registers
+ * it as a real disk
+ */
+static void nvme_namespaces_init(struct nvme_controller *controller,
+                                 uint32_t total) {
+  uint8_t *identify = controller->identify;
+  for (uint32_t id = 1; id <= total &&
+                        controller->total_namespaces < NVME_MAX_NAMESPACES;
+       id++) {
+    if (nvme_identify(controller, NVME_IDENTIFY_NAMESPACE, id) < 0) {
+      continue;
+    }
+
+    uint64_t sectors = 0;
+    memcpy(&sectors, &identify[NVME_IDENTIFY_NSZE], sizeof(sectors));
+    if (!sectors) {
+      // Inactive namespace
+      continue;
+    }
+
+    uint32_t format = 0;
+    int format_index = identify[NVME_IDENTIFY_FLBAS] & NVME_FLBAS_FORMAT_MASK;
+    memcpy(&format, &identify[NVME_IDENTIFY_LBAF + format_index * 4],
+           sizeof(format));
+    if ((1U << ((format >> NVME_LBAF_LBADS_SHIFT) & 0xFF)) !=
+        NVME_SECTOR_SIZE) {
+      print("NVMe: skipping namespace with non 512 byte blocks\n");
+      continue;
+    }
+
+    struct nvme_namespace *ns =
+        &controller->namespaces[controller->total_namespaces++];
+    ns->controller = controller;
+    ns->id = id;
+    ns->total_sectors = sectors;
+    nvme_namespaces[nvme_namespace_count++] = ns;
+
+    print("NVMe: namespace ");
+    print(itoa(id));
+    print(" queue depth ");
+    print(itoa(controller->queue_depth));
+    print("\n");
+    disk_create_new(VIOS_DISK_TYPE_REAL, 0, 0, NVME_SECTOR_SIZE,
+                    &nvme_disk_driver, ns, NULL);
+  }
+}
+
+static int nvme_controller_init(struct nvme_controller *controller,
+                                struct pci_device *pci) {
+  controller->pci = pci;
+  controller->registers =
+      pci_map_bar(pci, NVME_BAR, sizeof(struct nvme_registers));
+  controller->identify = kzalloc(PAGING_PAGE_SIZE);
+  if (!controller->registers || !controller->identify) {
+    return -EIO;
+  }
+
+  pci_enable(pci, PCI_COMMAND_MEMORY_SPACE | PCI_COMMAND_BUS_MASTER);
+
+  uint64_t capabilities = controller->registers->capabilities;
+  if (!(capabilities & NVME_CAP_CSS_NVM) ||
+      ((capabilities >> NVME_CAP_MPSMIN_SHIFT) & NVME_CAP_MPSMIN_MASK) != 0) {
+    return -EIO;
+  }
+
+  // Map the doorbells of the admin queue and every I/O queue
+  controller->doorbell_stride =
+      4 << ((capabilities >> NVME_CAP_DSTRD_SHIFT) & NVME_CAP_DSTRD_MASK);
+  size_t doorbells = 2 * (VIOS_DISK_NVME_IO_QUEUES + 1);
+  if (!pci_map_bar(pci, NVME_BAR,
+                   NVME_DOORBELL_OFFSET +
+                       doorbells * controller->doorbell_stride)) {
+    return -EIO;
+  }
+
+  nvme_interrupts_init(controller);
+  int res = nvme_controller_enable(controller);
+  if (res < 0) {
+    return res;
+  }
+
+  res = nvme_identify(controller, NVME_IDENTIFY_CONTROLLER, 0);
+  if (res < 0) {
+    return res;
+  }
+
+  uint8_t *identify = controller->identify;
+  uint32_t total_namespaces = 0;
+  memcpy(&total_namespaces, &identify[NVME_IDENTIFY_NAMESPACE_COUNT],
+         sizeof(total_namespaces));
+
+  // The transfer limit is a power of two of the 4KB page size
+  controller->max_sectors_per_command = NVME_MAX_SECTORS_PER_COMMAND;
+  uint8_t mdts = identify[NVME_IDENTIFY_MDTS];
+  if (mdts) {
+    size_t limit = ((size_t)PAGING_PAGE_SIZE << mdts) / NVME_SECTOR_SIZE;
+    controller->max_sectors_per_command =
+        MIN(limit, NVME_MAX_SECTORS_PER_COMMAND);
+  }
+
+  nvme_check_interrupts(controller);
+  res = nvme_create_io_queues(controller);
+  if (res < 0) {
+    return res;
+  }
+
+  nvme_namespaces_init(controller, total_namespaces);
+  return 0;
+}
+
+/**
+ * Finds every NVMe controller and registers each namespace as a disk,
+ * returns the number of namespaces found
+ */
+int nvme_init() {
+  size_t next = 0;
+  struct pci_device *pci = NULL;
+  while (nvme_total_controllers < VIOS_DISK_NVME_MAX_CONTROLLERS &&
+         (pci = pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_NVM,
+                               next)) != NULL) {
+    next = (pci - pci_device_get(0)) + 1;
+    if (pci->prog_if != PCI_PROG_IF_NVME) {
+      continue;
+    }
+
+    // Counted before init so the interrupt handler already sees it
+    struct nvme_controller *controller =
+        &nvme_controllers[nvme_total_controllers++];
+    memset(controller, 0, sizeof(*controller));
+    if (nvme_controller_init(controller, pci) < 0) {
+      print("NVMe: controller failed to initialize\n");
+      nvme_total_controllers--;
+    }
+  }
+
+  return nvme_namespace_count;
+}
+
+int nvme_total_namespaces() { return nvme_namespace_count; }
+
+struct nvme_namespace *nvme_namespace_get(int index) {
+  if (index < 0 || index >= nvme_namespace_count) {
+    return NULL;
+  }
+
+  return nvme_namespaces[index];
+}
@@ -0,0 +1,183 @@
+#ifndef KERNEL_DISK_NVME_H
+#define KERNEL_DISK_NVME_H
+
+#include "config.h"
+#include "disk/request.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// BAR0 holds the controller registers followed by the doorbells
+#define NVME_BAR 0
+#define NVME_DOORBELL_OFFSET 0x1000
+
+// Controller capabilities
+#define NVME_CAP_MQES_MASK 0xFFFF
+#define NVME_CAP_DSTRD_SHIFT 32
+#define NVME_CAP_DSTRD_MASK 0x0F
+#define NVME_CAP_CSS_NVM (1ULL << 37)
+#define NVME_CAP_MPSMIN_SHIFT 48
+#define NVME_CAP_MPSMIN_MASK 0x0F
+
+// Controller configuration, 64 byte submission and 16 byte completion
+// entries on 4KB pages with the NVM command set
+#define NVME_CC_ENABLE 0x00000001
+#define NVME_CC_IOSQES (6 << 16)
+#define NVME_CC_IOCQES (4 << 20)
+
+#define NVME_CSTS_READY 0x00000001
+#define NVME_CSTS_FATAL 0x00000002
+
+#define NVME_ADMIN_CREATE_SQ 0x01
+#define NVME_ADMIN_CREATE_CQ 0x05
+#define NVME_ADMIN_IDENTIFY 0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+#define NVME_IDENTIFY_NAMESPACE 0x00
+#define NVME_IDENTIFY_CONTROLLER 0x01
+
+#define NVME_FEATURE_NUMBER_OF_QUEUES 0x07
+
+// Queue creation flags
+#define NVME_QUEUE_PHYSICALLY_CONTIGUOUS 0x01
+#define NVME_QUEUE_INTERRUPTS_ENABLED 0x02
+
+#define NVME_COMMAND_WRITE 0x01
+#define NVME_COMMAND_READ 0x02
+
+// Completion status, bit zero is the phase tag
+#define NVME_STATUS_PHASE 0x0001
+
+#define NVME_ADMIN_QUEUE_ENTRIES 16
+#define NVME_IO_QUEUE_ENTRIES 128
+
+// Commands kept in flight on one I/O queue
+#define NVME_MAX_QUEUE_DEPTH 64
+
+// A PRP list fills one page
+#define NVME_PRP_LIST_ENTRIES 512
+
+// Keeps every transfer within one PRP list, even unaligned
+#define NVME_MAX_SECTORS_PER_COMMAND 2048
+
+#define NVME_MAX_NAMESPACES 16
+
+#define NVME_SECTOR_SIZE 512
+
+// Gives up on a controller that does not respond in this many polls
+#define NVME_TIMEOUT_SPINS 100000000
+
+struct nvme_registers {
+  uint64_t capabilities;
+  uint32_t version;
+  uint32_t interrupt_mask_set;
+  uint32_t interrupt_mask_clear;
+  uint32_t configuration;
+  uint32_t reserved0;
+  uint32_t status;
+  uint32_t subsystem_reset;
+  uint32_t admin_queue_attributes;
+  uint64_t admin_submission_queue;
+  uint64_t admin_completion_queue;
+};
+
+struct nvme_submission_entry {
+  uint8_t opcode;
+  uint8_t flags;
+  uint16_t command_id;
+  uint32_t namespace_id;
+  uint64_t reserved;
+  uint64_t metadata;
+  uint64_t prp1;
+  uint64_t prp2;
+  uint32_t cdw10;
+  uint32_t cdw11;
+  uint32_t cdw12;
+  uint32_t cdw13;
+  uint32_t cdw14;
+  uint32_t cdw15;
+} __attribute__((packed));
+
+struct nvme_completion_entry {
+  uint32_t result;
+  uint32_t reserved;
+  uint16_t submission_head;
+  uint16_t submission_id;
+  uint16_t command_id;
+  uint16_t status;
+} __attribute__((packed));
+
+struct nvme_controller;
+
+struct nvme_queue {
+  struct nvme_controller *controller;
+  uint16_t id;
+  uint16_t entries;
+
+  struct nvme_submission_entry *submission;
+  volatile struct nvme_completion_entry *completion;
+  volatile uint32_t *submission_doorbell;
+  volatile uint32_t *completion_doorbell;
+
+  uint16_t submission_tail;
+  uint16_t completion_head;
+  // Flips every time the completion queue wraps
+  uint16_t phase;
+
+  // Command identifiers in flight and the requests they belong to
+  uint64_t commands_in_use;
+  struct disk_request *command_requests[NVME_MAX_QUEUE_DEPTH];
+  uint64_t command_start[NVME_MAX_QUEUE_DEPTH];
+
+  // One PRP list page per command identifier
+  uint64_t *prp_lists;
+
+  // Doorbell writes, batching keeps this well below the command count
+  uint64_t doorbell_writes;
+  // TSC ticks spent halted waiting for completions
+  uint64_t idle_ticks;
+};
+
+struct nvme_namespace {
+  struct nvme_controller *controller;
+  uint32_t id;
+  uint64_t total_sectors;
+};
+
+struct nvme_controller {
+  struct pci_device *pci;
+  volatile struct nvme_registers *registers;
+  uint32_t doorbell_stride;
+
+  // Page used for identify data
+  void *identify;
+
+  struct nvme_queue admin_queue;
+  struct nvme_queue io_queues[VIOS_DISK_NVME_IO_QUEUES];
+  int total_io_queues;
+
+  // Commands allowed in flight on each I/O queue
+  int queue_depth;
+  size_t max_sectors_per_command;
+
+  // False when the controller has no legacy interrupt line, we then poll
+  bool interrupts;
+
+  struct nvme_namespace namespaces[NVME_MAX_NAMESPACES];
+  int total_namespaces;
+};
+
+extern struct disk_driver nvme_disk_driver;
+
+int nvme_init();
+int nvme_total_namespaces();
+struct nvme_namespace *nvme_namespace_get(int index);
+int nvme_submit_requests(struct nvme_namespace *ns,
+                         struct disk_request *requests, size_t total,
+                         int queue_depth);
+int nvme_read_sectors(struct nvme_namespace *ns, uint64_t lba, size_t total,
+                      void *buf);
+int nvme_write_sectors(struct nvme_namespace *ns, uint64_t lba, size_t total,
+                       const void *buf);
+
+#endif
@@ -0,0 +1,104 @@
+#include "ramdisk.h"
+#include "config.h"
+#include "disk/disk.h"
+#include "kernel.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "status.h"
+#include "string/string.h"
+
+static struct ramdisk ramdisk;
+
+static int ramdisk_map(uint64_t base, uint64_t size) {
+  void *start = paging_align_to_lower_page((void *)base);
+  void *end = paging_align_address((void *)(base + size));
+  return paging_map_to(kernel_desc(), start, start, end,
+                       PAGING_IS_WRITEABLE | PAGING_IS_PRESENT);
+}
+
+/**
+ * The image must stay clear of the kernel and the heap table which the
+ * kernel places at fixed addresses
+ */
+static bool ramdisk_range_usable(uint64_t base, uint64_t size) {
+  if (!base || !size || size % VIOS_SECTOR_SIZE) {
+    return false;
+  }
+
+  return base >= VIOS_MINIMAL_HEAP_ADDRESS ||
+         base + size <= VIOS_KERNEL_LOCATION;
+}
+
+static int ramdisk_read(struct disk *disk, size_t lba, int total, void *buf) {
+  struct ramdisk *ramdisk = disk->driver_private;
+  if (total < 0 || lba + total > ramdisk->total_sectors) {
+    return -EIO;
+  }
+
+  memcpy(buf, ramdisk->data + lba * VIOS_SECTOR_SIZE,
+         total * VIOS_SECTOR_SIZE);
+  return 0;
+}
+
+static int ramdisk_write(struct disk *disk, size_t lba, int total,
+                         const void *buf) {
+  struct ramdisk *ramdisk = disk->driver_private;
+  if (total < 0 || lba + total > ramdisk->total_sectors) {
+    return -EIO;
+  }
+
+  memcpy(ramdisk->data + lba * VIOS_SECTOR_SIZE, (void *)buf,
+         total * VIOS_SECTOR_SIZE);
+  return 0;
+}
+
+struct disk_driver ramdisk_disk_driver = {
+    .name = "ramdisk",
+    .read = ramdisk_read,
+    .write = ramdisk_write,
+    // The same files at memory speed
+    .preferred_primary = true};
+
+/**
+ * Registers the disk image the UEFI loader left in memory, the loader
+ * keeps it out of the E820 map so the heap never reuses it
+ */
+int ramdisk_init() {
+  int res = 0;
+  uint64_t info_address = VIOS_RAMDISK_INFO_LOCATION;
+  res = ramdisk_map(info_address, sizeof(struct ramdisk_boot_info));
+  if (res < 0) {
+    goto out;
+  }
+
+  struct ramdisk_boot_info *info = (struct ramdisk_boot_info *)info_address;
+  if (info->magic != VIOS_RAMDISK_MAGIC || !info->size) {
+    res = -EIO;
+    goto out;
+  }
+
+  if (!ramdisk_range_usable(info->base, info->size)) {
+    print("RAM disk: image overlaps the kernel, ignoring it\n");
+    res = -EINVARG;
+    goto out;
+  }
+
+  res = ramdisk_map(info->base, info->size);
+  if (res < 0) {
+    goto out;
+  }
+
+  ramdisk.data = (uint8_t *)info->base;
+  ramdisk.total_sectors = info->size / VIOS_SECTOR_SIZE;
+  print("RAM disk: ");
+  print(itoa(info->size / 1024));
+  print("KB\n");
+  res = disk_create_new(VIOS_DISK_TYPE_RAM, 0, 0, VIOS_SECTOR_SIZE,
+                        &ramdisk_disk_driver, &ramdisk, NULL);
+out:
+  return res;
+}
+
+struct ramdisk *ramdisk_get() {
+  return ramdisk.data ? &ramdisk : NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef KERNEL_DISK_RAMDISK_H
+#define KERNEL_DISK_RAMDISK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Written by the UEFI loader at VIOS_RAMDISK_INFO_LOCATION, a zero size
+// means the loader found no disk image
+struct ramdisk_boot_info {
+  uint64_t magic;
+  uint64_t base;
+  uint64_t size;
+} __attribute__((packed));
+
+struct ramdisk {
+  uint8_t *data;
+  uint64_t total_sectors;
+};
+
+extern struct disk_driver ramdisk_disk_driver;
+
+int ramdisk_init();
+struct ramdisk *ramdisk_get();
+
+#endif
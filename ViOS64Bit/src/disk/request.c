@@ -0,0 +1,80 @@
+#include "request.h"
+#include "config.h"
+#include "cpu/cpu.h"
+#include "status.h"
+
+/**
+ * Runs every request keeping up to "queue_depth" of them in flight,
+ * zero or a depth beyond "max_queue_depth" uses the maximum.
+ * Returns zero or the first error, each request holds its own status.
+ */
+int disk_request_submit(const struct disk_request_ops *ops, void *device,
+                        struct disk_request *requests, size_t total,
+                        int queue_depth, int max_queue_depth) {
+  int res = 0;
+  size_t next = 0;
+  size_t completed = 0;
+  int in_flight = 0;
+  int spins = 0;
+  uint64_t last_progress = cpu_rdtsc();
+
+  if (queue_depth < 1 || queue_depth > max_queue_depth) {
+    queue_depth = max_queue_depth;
+  }
+
+  // Interrupts stay off until we sleep so a completion cannot be missed
+  uint64_t flags = cpu_save_interrupts();
+  while (completed < total) {
+    int issued = 0;
+    while (next < total && in_flight < queue_depth) {
+      struct disk_request *request = &requests[next++];
+      int issue_res = ops->issue(device, request);
+      if (issue_res < 0) {
+        request->status = issue_res;
+        completed++;
+        continue;
+      }
+      in_flight++;
+      issued++;
+    }
+
+    if (issued && ops->kick) {
+      ops->kick(device);
+    }
+
+    int reaped = ops->reap(device);
+    if (reaped > 0) {
+      completed += reaped;
+      in_flight -= reaped;
+      spins = 0;
+      last_progress = cpu_rdtsc();
+      continue;
+    }
+
+    // The deadline also catches a lost interrupt, the clock wakes us.
+    // Polls are counted too in case the TSC could not be calibrated
+    bool failed = reaped < 0 || cpu_tsc_to_us(cpu_rdtsc() - last_progress) >
+                                    VIOS_DISK_REQUEST_TIMEOUT_MS * 1000ULL;
+    if (!failed && !ops->wait(device)) {
+      failed = ++spins > ops->timeout_spins;
+    }
+
+    if (failed) {
+      // Give up on everything in flight and everything not yet issued
+      ops->abort(device);
+      for (; next < total; next++) {
+        requests[next].status = -EIO;
+      }
+      break;
+    }
+  }
+  cpu_restore_interrupts(flags);
+
+  for (size_t i = 0; i < total && res == 0; i++) {
+    if (requests[i].status < 0) {
+      res = requests[i].status;
+    }
+  }
+
+  return res;
+}
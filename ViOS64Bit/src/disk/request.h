@@ -0,0 +1,56 @@
+#ifndef KERNEL_DISK_REQUEST_H
+#define KERNEL_DISK_REQUEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * One read or write of "count" sectors handed straight to a controller
+ * driver, many of these are kept in flight at once
+ */
+struct disk_request {
+  uint64_t lba;
+  size_t count;
+  void *buf;
+  bool write;
+
+  // Positive while in flight, zero once completed, negative on failure
+  int status;
+
+  // TSC ticks from submission to completion, zero when the driver does
+  // not time its commands
+  uint64_t latency_ticks;
+};
+
+typedef int (*DISK_REQUEST_ISSUE_FUNCTION)(void *device,
+                                           struct disk_request *request);
+typedef void (*DISK_REQUEST_KICK_FUNCTION)(void *device);
+typedef int (*DISK_REQUEST_REAP_FUNCTION)(void *device);
+typedef bool (*DISK_REQUEST_WAIT_FUNCTION)(void *device);
+typedef void (*DISK_REQUEST_ABORT_FUNCTION)(void *device);
+
+// How a controller driver keeps requests in flight on one of its queues
+struct disk_request_ops {
+  // Hands one request to the device, negative when it cannot be issued
+  DISK_REQUEST_ISSUE_FUNCTION issue;
+  // Optional, tells the device about the requests issued since last time
+  DISK_REQUEST_KICK_FUNCTION kick;
+  // Completes the finished requests, returns how many or negative when
+  // the device reported an error
+  DISK_REQUEST_REAP_FUNCTION reap;
+  // Halts until the device interrupts, false for a polled device
+  DISK_REQUEST_WAIT_FUNCTION wait;
+  // Fails every request in flight, the device must not touch their
+  // buffers once it returns
+  DISK_REQUEST_ABORT_FUNCTION abort;
+
+  // Polls before giving up when the TSC could not be calibrated
+  int timeout_spins;
+};
+
+int disk_request_submit(const struct disk_request_ops *ops, void *device,
+                        struct disk_request *requests, size_t total,
+                        int queue_depth, int max_queue_depth);
+
+#endif
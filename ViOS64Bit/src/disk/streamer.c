@@ -1,7 +1,9 @@
 #include "streamer.h"
 #include "config.h"
+#include "kernel.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
+#include "status.h"
 
 #include <stdbool.h>
 struct disk_stream *diskstreamer_new(int disk_id) {
@@ -10,17 +12,21 @@ struct disk_stream *diskstreamer_new(int disk_id) {
     return 0;
   }
 
-  struct disk_stream *streamer = kzalloc(sizeof(struct disk_stream));
-  streamer->pos = 0;
-  streamer->disk = disk;
-  return streamer;
+  return diskstreamer_new_from_disk(disk);
 }
 
 struct disk_stream* diskstreamer_new_from_disk(struct disk* disk)
 {
     struct disk_stream* streamer = kzalloc(sizeof(struct disk_stream));
+    if (!streamer)
+    {
+        return 0;
+    }
+
     streamer->pos = 0;
     streamer->disk = disk;
+    streamer->next_pos = -1;
+    streamer->readahead_sectors = VIOS_DISKSTREAM_MIN_READAHEAD_SECTORS;
     return streamer;
 }
 
@@ -29,37 +35,240 @@ int diskstreamer_seek(struct disk_stream *stream, int pos) {
   return 0;
 }
 
-int diskstreamer_read(struct disk_stream* stream, void* out, int total)
+/**
+ * Clamps a read of "total" sectors at "sector" so it stays within the disk
+ */
+static int diskstreamer_clamp_sectors(struct disk_stream* stream, int sector, int total)
 {
-    int sector = stream->pos / VIOS_SECTOR_SIZE;
-    int offset = stream->pos % VIOS_SECTOR_SIZE;
-    int total_to_read = total;
-    bool overflow = (offset+total_to_read) >= VIOS_SECTOR_SIZE;
-    char buf[VIOS_SECTOR_SIZE];
-    if (overflow)
+    struct disk* disk = stream->disk;
+    if (disk->ending_lba == 0)
+    {
+        // The primary disk has no bounds
+        return total;
+    }
+
+    int total_sectors = disk->ending_lba - disk->starting_lba;
+    if (sector + total > total_sectors)
+    {
+        total = total_sectors - sector;
+    }
+
+    return total < 1 ? 1 : total;
+}
+
+/**
+ * Refills the window at "sector", reading ahead when access is sequential
+ */
+static int diskstreamer_fill_window(struct disk_stream* stream, int sector, bool sequential)
+{
+    int res = 0;
+    if (!stream->window)
     {
-        total_to_read -= (offset+total_to_read) - VIOS_SECTOR_SIZE;
+        stream->window = kmalloc(VIOS_DISKSTREAM_MAX_READAHEAD_SECTORS * VIOS_SECTOR_SIZE);
+        if (!stream->window)
+        {
+            res = -ENOMEM;
+            goto out;
+        }
     }
 
-    int res = disk_read_block(stream->disk, sector, 1, buf);
+    int total = 1;
+    if (sequential)
+    {
+        total = diskstreamer_clamp_sectors(stream, sector, stream->readahead_sectors);
+    }
+
+    res = disk_read_block(stream->disk, sector, total, stream->window);
     if (res < 0)
     {
+        stream->window_count = 0;
         goto out;
     }
 
-    for(int i = 0; i < total_to_read; i++)
+    stream->window_sector = sector;
+    stream->window_count = total;
+out:
+    return res;
+}
+
+/**
+ * Reads whole sectors straight into the callers buffer, returns the bytes read
+ */
+static int diskstreamer_read_direct(struct disk_stream* stream, void* out, int total)
+{
+    int sector = stream->pos / VIOS_SECTOR_SIZE;
+    int sectors = diskstreamer_clamp_sectors(stream, sector, total / VIOS_SECTOR_SIZE);
+    if (sectors > VIOS_DISKSTREAM_MAX_READAHEAD_SECTORS)
     {
-        *(char*)out++ = buf[offset+i];
+        sectors = VIOS_DISKSTREAM_MAX_READAHEAD_SECTORS;
     }
 
-    stream->pos += total_to_read;
-    if (overflow)
+    int res = disk_read_block(stream->disk, sector, sectors, out);
+    if (res < 0)
     {
-        res = diskstreamer_read(stream, out, total-total_to_read);
+        return res;
     }
-    
+
+    return sectors * VIOS_SECTOR_SIZE;
+}
+
+int diskstreamer_read(struct disk_stream* stream, void* out, int total)
+{
+    int res = 0;
+    char* dest = out;
+
+    bool sequential = stream->pos == stream->next_pos;
+
+    while (total > 0)
+    {
+        int sector = stream->pos / VIOS_SECTOR_SIZE;
+        int offset = stream->pos % VIOS_SECTOR_SIZE;
+
+        // Serve as much as possible from the read ahead window
+        if (stream->window_count && sector >= stream->window_sector &&
+            sector < stream->window_sector + stream->window_count)
+        {
+            int window_offset = ((sector - stream->window_sector) * VIOS_SECTOR_SIZE) + offset;
+            int available = (stream->window_count * VIOS_SECTOR_SIZE) - window_offset;
+            int total_to_read = MIN(available, total);
+            memcpy(dest, stream->window + window_offset, total_to_read);
+            dest += total_to_read;
+            stream->pos += total_to_read;
+            total -= total_to_read;
+            continue;
+        }
+
+        // Large aligned reads need no buffering at all
+        if (offset == 0 && total >= VIOS_DISKSTREAM_MIN_READAHEAD_SECTORS * VIOS_SECTOR_SIZE)
+        {
+            res = diskstreamer_read_direct(stream, dest, total);
+            if (res < 0)
+            {
+                goto out;
+            }
+
+            dest += res;
+            stream->pos += res;
+            total -= res;
+            continue;
+        }
+
+        // Any read that does not continue from the last one starts the
+        // read ahead over from its smallest window
+        if (!sequential)
+        {
+            stream->readahead_sectors = VIOS_DISKSTREAM_MIN_READAHEAD_SECTORS;
+        }
+
+        res = diskstreamer_fill_window(stream, sector, sequential);
+        if (res < 0)
+        {
+            goto out;
+        }
+
+        if (sequential && stream->readahead_sectors < VIOS_DISKSTREAM_MAX_READAHEAD_SECTORS)
+        {
+            stream->readahead_sectors *= 2;
+        }
+
+        // A read spanning several sectors is sequential from here on
+        sequential = true;
+    }
+
+    res = 0;
+    stream->next_pos = stream->pos;
+
 out:
     return res;
 }
 
-void diskstreamer_close(struct disk_stream *stream) { kfree(stream); }
+/**
+ * Copies bytes just written at "pos" into the window so reads that
+ * follow see them
+ */
+static void diskstreamer_update_window(struct disk_stream* stream, int pos, const char* in, int total)
+{
+    if (!stream->window_count)
+    {
+        return;
+    }
+
+    int window_start = stream->window_sector * VIOS_SECTOR_SIZE;
+    int window_end = window_start + (stream->window_count * VIOS_SECTOR_SIZE);
+    int start = MAX(pos, window_start);
+    int end = MIN(pos + total, window_end);
+    if (start < end)
+    {
+        memcpy(stream->window + (start - window_start), (void*)(in + (start - pos)), end - start);
+    }
+}
+
+/**
+ * Writes at the stream position, partial sectors are read, patched and
+ * written back whole
+ */
+int diskstreamer_write(struct disk_stream* stream, const void* in, int total)
+{
+    int res = 0;
+    const char* src = in;
+    char sector_buf[VIOS_SECTOR_SIZE];
+
+    while (total > 0)
+    {
+        int sector = stream->pos / VIOS_SECTOR_SIZE;
+        int offset = stream->pos % VIOS_SECTOR_SIZE;
+        int total_to_write = 0;
+        if (offset == 0 && total >= VIOS_SECTOR_SIZE)
+        {
+            int sectors = diskstreamer_clamp_sectors(stream, sector, total / VIOS_SECTOR_SIZE);
+            total_to_write = sectors * VIOS_SECTOR_SIZE;
+            res = disk_write_block(stream->disk, sector, sectors, src);
+        }
+        else
+        {
+            total_to_write = MIN(VIOS_SECTOR_SIZE - offset, total);
+            res = disk_read_block(stream->disk, sector, 1, sector_buf);
+            if (res < 0)
+            {
+                goto out;
+            }
+
+            memcpy(sector_buf + offset, (void*)src, total_to_write);
+            res = disk_write_block(stream->disk, sector, 1, sector_buf);
+        }
+
+        if (res < 0)
+        {
+            goto out;
+        }
+
+        diskstreamer_update_window(stream, stream->pos, src, total_to_write);
+        src += total_to_write;
+        stream->pos += total_to_write;
+        total -= total_to_write;
+    }
+
+    res = 0;
+    stream->next_pos = stream->pos;
+
+out:
+    return res;
+}
+
+/**
+ * Drops the read ahead window, for when the disk changed underneath it
+ */
+void diskstreamer_invalidate(struct disk_stream* stream)
+{
+    stream->window_count = 0;
+}
+
+void diskstreamer_close(struct disk_stream *stream)
+{
+    if (stream->window)
+    {
+        kfree(stream->window);
+    }
+
+    kfree(stream);
+}
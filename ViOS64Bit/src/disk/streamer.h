@@ -7,11 +7,26 @@ struct disk_stream
 {
     int pos;
     struct disk* disk;
+
+    // Where the previous read ended, a read starting here is sequential
+    int next_pos;
+
+    // Sectors buffered ahead of the reader, allocated on first use
+    char* window;
+    // Disk sector held at the start of the window
+    int window_sector;
+    // Total sectors currently held in the window
+    int window_count;
+
+    // Sectors to read on the next refill, doubles while access stays sequential
+    int readahead_sectors;
 };
 
 struct disk_stream* diskstreamer_new(int disk_id);
 int diskstreamer_seek(struct disk_stream* stream, int pos);
 int diskstreamer_read(struct disk_stream* stream, void* out, int total);
+int diskstreamer_write(struct disk_stream* stream, const void* in, int total);
+void diskstreamer_invalidate(struct disk_stream* stream);
 void diskstreamer_close(struct disk_stream* stream);
 struct disk_stream* diskstreamer_new_from_disk(struct disk* disk);
 
@@ -0,0 +1,584 @@
+#include "virtio_blk.h"
+#include "config.h"
+#include "cpu/cpu.h"
+#include "disk/disk.h"
+#include "idt/idt.h"
+#include "io/io.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "pci/pci.h"
+#include "status.h"
+#include "string/string.h"
+
+static struct virtio_blk_device
+    virtio_blk_devices[VIOS_DISK_VIRTIO_MAX_DEVICES];
+static int virtio_blk_total = 0;
+
+/**
+ * Orders our writes to the rings against the device reading them
+ */
+static void virtio_blk_barrier() {
+  __asm__ __volatile__("mfence" : : : "memory");
+}
+
+static volatile uint16_t *
+virtio_blk_used_event(struct virtio_blk_queue *queue) {
+  return &queue->avail->ring[queue->size];
+}
+
+static volatile uint16_t *
+virtio_blk_avail_event(struct virtio_blk_queue *queue) {
+  return (volatile uint16_t *)&queue->used->ring[queue->size];
+}
+
+static uint64_t virtio_blk_physical_address(struct paging_desc *desc,
+                                            void *virt) {
+  if (!desc) {
+    return (uint64_t)(uintptr_t)virt;
+  }
+
+  return (uint64_t)(uintptr_t)paging_get_physical_address(desc, virt);
+}
+
+/**
+ * Hands the emptied rings to the device, every slot starts out free
+ */
+static void virtio_blk_queue_install(struct virtio_blk_device *device) {
+  struct virtio_blk_queue *queue = &device->queue;
+  memset(queue->descriptors, 0, queue->ring_size);
+  queue->avail_index = 0;
+  queue->last_used = 0;
+  queue->slots_in_use = 0;
+  memset(queue->slot_requests, 0, sizeof(queue->slot_requests));
+
+  // Only ask for interrupts right before sleeping on them
+  if (!(device->features & VIRTIO_F_EVENT_IDX)) {
+    queue->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+  }
+
+  outw(device->io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+  outdw(device->io_base + VIRTIO_REG_QUEUE_ADDRESS,
+        (uintptr_t)queue->descriptors >> VIRTIO_QUEUE_ADDRESS_SHIFT);
+}
+
+/**
+ * Lays out the legacy split virtqueue, descriptors and the avail ring
+ * share the first pages and the used ring starts on the next boundary
+ */
+static int virtio_blk_queue_init(struct virtio_blk_device *device) {
+  struct virtio_blk_queue *queue = &device->queue;
+  outw(device->io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+  queue->size = insw(device->io_base + VIRTIO_REG_QUEUE_SIZE);
+  if (!queue->size) {
+    return -EIO;
+  }
+
+  size_t used_offset = sizeof(struct virtq_desc) * queue->size +
+                       sizeof(struct virtq_avail) +
+                       sizeof(uint16_t) * (queue->size + 1);
+  used_offset = (used_offset + VIRTIO_QUEUE_ALIGN - 1) &
+                ~(size_t)(VIRTIO_QUEUE_ALIGN - 1);
+  size_t used_size = sizeof(struct virtq_used) +
+                     sizeof(struct virtq_used_element) * queue->size +
+                     sizeof(uint16_t);
+
+  // Heap blocks are page aligned as the legacy interface requires
+  uint8_t *ring = kzalloc(used_offset + used_size);
+  device->queue_depth = MIN(queue->size, VIRTIO_BLK_MAX_QUEUE_DEPTH);
+  queue->request_pages = kzalloc(PAGING_PAGE_SIZE * device->queue_depth);
+  if (!ring || !queue->request_pages) {
+    return -ENOMEM;
+  }
+
+  queue->descriptors = (struct virtq_desc *)ring;
+  queue->avail = (struct virtq_avail *)(ring + sizeof(struct virtq_desc) *
+                                                   queue->size);
+  queue->used = (struct virtq_used *)(ring + used_offset);
+  queue->ring_size = used_offset + used_size;
+  virtio_blk_queue_install(device);
+  return 0;
+}
+
+/**
+ * Takes every request back from the device, once reset it no longer
+ * uses the rings. The handshake then runs again on the emptied queue
+ */
+static int virtio_blk_reset(struct virtio_blk_device *device) {
+  uint16_t io = device->io_base;
+  outb(io + VIRTIO_REG_DEVICE_STATUS, 0);
+  int spins = 0;
+  while (insb(io + VIRTIO_REG_DEVICE_STATUS) != 0) {
+    if (++spins > VIRTIO_BLK_TIMEOUT_SPINS) {
+      return -EIO;
+    }
+  }
+
+  outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+  outb(io + VIRTIO_REG_DEVICE_STATUS,
+       VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+  outdw(io + VIRTIO_REG_GUEST_FEATURES, device->features);
+  virtio_blk_queue_install(device);
+  outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE |
+                                          VIRTIO_STATUS_DRIVER |
+                                          VIRTIO_STATUS_DRIVER_OK);
+  return 0;
+}
+
+/**
+ * Points ring descriptor "slot" at an indirect table describing the
+ * request header, the data buffer and the status byte
+ */
+static int virtio_blk_build_request(struct virtio_blk_device *device,
+                                    int slot,
+                                    struct disk_request *request) {
+  struct virtio_blk_queue *queue = &device->queue;
+  uint8_t *page = queue->request_pages + slot * PAGING_PAGE_SIZE;
+  struct virtio_blk_request_header *header = (void *)page;
+  struct virtq_desc *table =
+      (struct virtq_desc *)(page + VIRTIO_BLK_REQUEST_TABLE_OFFSET);
+
+  header->type = request->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  header->reserved = 0;
+  header->sector = request->lba;
+  page[VIRTIO_BLK_REQUEST_STATUS_OFFSET] = 0xFF;
+
+  table[0].address = (uintptr_t)header;
+  table[0].length = sizeof(*header);
+  table[0].flags = VIRTQ_DESC_F_NEXT;
+  table[0].next = 1;
+
+  // Physically contiguous pages share one descriptor
+  struct paging_desc *desc = paging_current_descriptor();
+  uint16_t data_flags =
+      VIRTQ_DESC_F_NEXT | (request->write ? 0 : VIRTQ_DESC_F_WRITE);
+  uint8_t *buf = request->buf;
+  size_t bytes = request->count * VIRTIO_BLK_SECTOR_SIZE;
+  size_t total = 1;
+  while (bytes) {
+    uint64_t phys = virtio_blk_physical_address(desc, buf);
+    if (!phys) {
+      return -EINVARG;
+    }
+
+    size_t chunk = MIN(bytes, PAGING_PAGE_SIZE -
+                                  ((uintptr_t)buf % PAGING_PAGE_SIZE));
+    struct virtq_desc *last = &table[total - 1];
+    if (total > 1 && last->address + last->length == phys) {
+      last->length += chunk;
+    } else {
+      if (total == VIRTIO_BLK_MAX_INDIRECT_DESCRIPTORS - 1) {
+        return -EINVARG;
+      }
+      table[total].address = phys;
+      table[total].length = chunk;
+      table[total].flags = data_flags;
+      table[total].next = total + 1;
+      total++;
+    }
+
+    buf += chunk;
+    bytes -= chunk;
+  }
+
+  table[total].address = (uintptr_t)&page[VIRTIO_BLK_REQUEST_STATUS_OFFSET];
+  table[total].length = 1;
+  table[total].flags = VIRTQ_DESC_F_WRITE;
+  table[total].next = 0;
+  total++;
+
+  queue->descriptors[slot].address = (uintptr_t)table;
+  queue->descriptors[slot].length = total * sizeof(struct virtq_desc);
+  queue->descriptors[slot].flags = VIRTQ_DESC_F_INDIRECT;
+  queue->descriptors[slot].next = 0;
+  return 0;
+}
+
+/**
+ * Adds a request to our copy of the avail ring, the device does not see
+ * it until the whole batch is published
+ */
+static int virtio_blk_queue_request(struct virtio_blk_device *device,
+                                    struct disk_request *request) {
+  struct virtio_blk_queue *queue = &device->queue;
+  if (!request->count || request->count > device->max_sectors_per_request) {
+    return -EINVARG;
+  }
+
+  if (request->lba + request->count > device->total_sectors) {
+    return -EIO;
+  }
+
+  uint64_t all = device->queue_depth == VIRTIO_BLK_MAX_QUEUE_DEPTH
+                     ? ~0ULL
+                     : (1ULL << device->queue_depth) - 1;
+  if ((queue->slots_in_use & all) == all) {
+    return -EIO;
+  }
+
+  int slot = __builtin_ctzll(~queue->slots_in_use);
+  int res = virtio_blk_build_request(device, slot, request);
+  if (res < 0) {
+    return res;
+  }
+
+  queue->slots_in_use |= 1ULL << slot;
+  queue->slot_requests[slot] = request;
+  request->status = 1;
+  queue->avail->ring[queue->avail_index % queue->size] = slot;
+  queue->avail_index++;
+  return 0;
+}
+
+/**
+ * Publishes every queued request at once and notifies the device only
+ * when it asked to hear about this part of the ring
+ */
+static void virtio_blk_queue_kick(struct virtio_blk_device *device) {
+  struct virtio_blk_queue *queue = &device->queue;
+  uint16_t old = queue->avail->index;
+  uint16_t new = queue->avail_index;
+  if (old == new) {
+    return;
+  }
+
+  virtio_blk_barrier();
+  queue->avail->index = new;
+  virtio_blk_barrier();
+
+  bool notify;
+  if (device->features & VIRTIO_F_EVENT_IDX) {
+    uint16_t event = *virtio_blk_avail_event(queue);
+    notify = (uint16_t)(new - event - 1) < (uint16_t)(new - old);
+  } else {
+    notify = !(queue->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+  }
+
+  if (notify) {
+    outw(device->io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+    device->notifications++;
+  }
+}
+
+/**
+ * Completes every used entry, returns the number of requests completed
+ */
+static int virtio_blk_queue_reap(struct virtio_blk_device *device) {
+  struct virtio_blk_queue *queue = &device->queue;
+  int total = 0;
+  while (queue->last_used != queue->used->index) {
+    virtio_blk_barrier();
+    uint32_t slot = queue->used->ring[queue->last_used % queue->size].id;
+    queue->last_used++;
+    if (slot >= VIRTIO_BLK_MAX_QUEUE_DEPTH) {
+      continue;
+    }
+
+    struct disk_request *request = queue->slot_requests[slot];
+    queue->slot_requests[slot] = NULL;
+    queue->slots_in_use &= ~(1ULL << slot);
+
+    if (!request) {
+      continue;
+    }
+
+    uint8_t status = queue->request_pages[slot * PAGING_PAGE_SIZE +
+                                          VIRTIO_BLK_REQUEST_STATUS_OFFSET];
+    request->status = status == VIRTIO_BLK_S_OK ? 0 : -EIO;
+    total++;
+  }
+
+  return total;
+}
+
+/**
+ * Asks the device to interrupt on the next completion, with the event
+ * index a batch completing together raises one interrupt
+ */
+static void virtio_blk_interrupts_arm(struct virtio_blk_device *device,
+                                      bool arm) {
+  struct virtio_blk_queue *queue = &device->queue;
+  if (device->features & VIRTIO_F_EVENT_IDX) {
+    // A stale event index already suppresses interrupts
+    if (arm) {
+      *virtio_blk_used_event(queue) = queue->last_used;
+    }
+  } else {
+    queue->avail->flags = arm ? 0 : VIRTQ_AVAIL_F_NO_INTERRUPT;
+  }
+  virtio_blk_barrier();
+}
+
+static int virtio_blk_request_issue(void *device,
+                                    struct disk_request *request) {
+  return virtio_blk_queue_request(device, request);
+}
+
+static void virtio_blk_request_kick(void *device) {
+  virtio_blk_queue_kick(device);
+}
+
+static int virtio_blk_request_reap(void *device) {
+  return virtio_blk_queue_reap(device);
+}
+
+static bool virtio_blk_request_wait(void *device) {
+  struct virtio_blk_device *blk = device;
+  struct virtio_blk_queue *queue = &blk->queue;
+  if (!blk->interrupts) {
+    return false;
+  }
+
+  // Check again once armed, the device may have just caught up
+  virtio_blk_interrupts_arm(blk, true);
+  if (queue->used->index == queue->last_used) {
+    uint64_t start = cpu_rdtsc();
+    cpu_wait_for_interrupt();
+    blk->idle_ticks += cpu_rdtsc() - start;
+  }
+  virtio_blk_interrupts_arm(blk, false);
+  return true;
+}
+
+/**
+ * Fails what is in flight and resets the device, until then it may
+ * still write into the buffers of those requests
+ */
+static void virtio_blk_request_abort(void *device) {
+  struct virtio_blk_device *blk = device;
+  struct virtio_blk_queue *queue = &blk->queue;
+  for (int i = 0; i < VIRTIO_BLK_MAX_QUEUE_DEPTH; i++) {
+    if (queue->slot_requests[i]) {
+      queue->slot_requests[i]->status = -EIO;
+      queue->slot_requests[i] = NULL;
+    }
+  }
+
+  if (virtio_blk_reset(blk) < 0) {
+    print("virtio-blk: device reset failed\n");
+  }
+}
+
+static const struct disk_request_ops virtio_blk_request_ops = {
+    .issue = virtio_blk_request_issue,
+    .kick = virtio_blk_request_kick,
+    .reap = virtio_blk_request_reap,
+    .wait = virtio_blk_request_wait,
+    .abort = virtio_blk_request_abort,
+    .timeout_spins = VIRTIO_BLK_TIMEOUT_SPINS};
+
+int virtio_blk_submit_requests(struct virtio_blk_device *device,
+                               struct disk_request *requests, size_t total,
+                               int queue_depth) {
+  return disk_request_submit(&virtio_blk_request_ops, device, requests, total,
+                             queue_depth, device->queue_depth);
+}
+
+/**
+ * Splits a transfer into requests within the size limit and runs them
+ * concurrently
+ */
+static int virtio_blk_transfer(struct virtio_blk_device *device, uint64_t lba,
+                               size_t total, uint8_t *buf, bool write) {
+  int res = 0;
+  struct disk_request requests[VIRTIO_BLK_MAX_QUEUE_DEPTH];
+  while (total) {
+    size_t batch = 0;
+    while (total && batch < VIRTIO_BLK_MAX_QUEUE_DEPTH) {
+      size_t count = MIN(total, device->max_sectors_per_request);
+      requests[batch].lba = lba;
+      requests[batch].count = count;
+      requests[batch].buf = buf;
+      requests[batch].write = write;
+      requests[batch].status = 0;
+      batch++;
+
+      lba += count;
+      total -= count;
+      buf += count * VIRTIO_BLK_SECTOR_SIZE;
+    }
+
+    res = virtio_blk_submit_requests(device, requests, batch, 0);
+    if (res < 0) {
+      break;
+    }
+  }
+
+  return res;
+}
+
+int virtio_blk_read_sectors(struct virtio_blk_device *device, uint64_t lba,
+                            size_t total, void *buf) {
+  return virtio_blk_transfer(device, lba, total, buf, false);
+}
+
+int virtio_blk_write_sectors(struct virtio_blk_device *device, uint64_t lba,
+                             size_t total, const void *buf) {
+  return virtio_blk_transfer(device, lba, total, (uint8_t *)buf, true);
+}
+
+static int virtio_blk_disk_read(struct disk *disk, size_t lba, int total,
+                                void *buf) {
+  return virtio_blk_read_sectors(disk->driver_private, lba, total, buf);
+}
+
+static int virtio_blk_disk_write(struct disk *disk, size_t lba, int total,
+                                 const void *buf) {
+  return virtio_blk_write_sectors(disk->driver_private, lba, total, buf);
+}
+
+struct disk_driver virtio_blk_disk_driver = {.name = "virtio-blk",
+                                             .read = virtio_blk_disk_read,
+                                             .write = virtio_blk_disk_write};
+
+/**
+ * Reading the ISR acknowledges the device and drops the shared line
+ */
+static void virtio_blk_interrupt_handler(struct interrupt_frame *frame) {
+  for (int i = 0; i < virtio_blk_total; i++) {
+    struct virtio_blk_device *device = &virtio_blk_devices[i];
+    if (device->interrupts &&
+        insb(device->io_base + VIRTIO_REG_ISR_STATUS) & VIRTIO_ISR_QUEUE) {
+      device->interrupt_count++;
+    }
+  }
+}
+
+/**
+ * Interrupt routing on the PIC is left to the firmware, read the first
+ * sector polled with interrupts armed and make sure our line fired
+ */
+static void virtio_blk_check_interrupts(struct virtio_blk_device *device) {
+  if (pci_enable_interrupts(device->pci, virtio_blk_interrupt_handler) < 0) {
+    return;
+  }
+
+  void *sector = kzalloc(VIRTIO_BLK_SECTOR_SIZE);
+  if (!sector) {
+    return;
+  }
+
+  virtio_blk_interrupts_arm(device, true);
+  virtio_blk_read_sectors(device, 0, 1, sector);
+  device->interrupts = true;
+  for (int i = 0;
+       i < VIRTIO_BLK_TIMEOUT_SPINS / 1000 && !device->interrupt_count; i++) {
+    cpu_interrupt_window();
+  }
+  virtio_blk_interrupts_arm(device, false);
+  kfree(sector);
+
+  if (!device->interrupt_count) {
+    print("virtio-blk: no interrupts, polling for completions\n");
+    device->interrupts = false;
+  }
+}
+
+static int virtio_blk_device_init(struct virtio_blk_device *device,
+                                  struct pci_device *pci) {
+  int res = 0;
+  device->pci = pci;
+  if (!pci_bar_is_io(pci, VIRTIO_BAR)) {
+    return -EIO;
+  }
+
+  device->io_base = pci_bar_address(pci, VIRTIO_BAR);
+  pci_enable(pci, PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+
+  uint16_t io = device->io_base;
+  outb(io + VIRTIO_REG_DEVICE_STATUS, 0);
+  outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+  outb(io + VIRTIO_REG_DEVICE_STATUS,
+       VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+  // Every request is a single indirect descriptor on the ring
+  uint32_t offered = insdw(io + VIRTIO_REG_DEVICE_FEATURES);
+  if (!(offered & VIRTIO_F_INDIRECT_DESC)) {
+    print("virtio-blk: indirect descriptors not supported\n");
+    res = -EIO;
+    goto out;
+  }
+
+  device->features = offered & (VIRTIO_F_INDIRECT_DESC | VIRTIO_F_EVENT_IDX |
+                                VIRTIO_BLK_F_SEG_MAX);
+  outdw(io + VIRTIO_REG_GUEST_FEATURES, device->features);
+  device->total_sectors =
+      insdw(io + VIRTIO_REG_BLK_CAPACITY) |
+      ((uint64_t)insdw(io + VIRTIO_REG_BLK_CAPACITY + 4) << 32);
+
+  // The header and status take two descriptors of the indirect table
+  size_t segments = VIRTIO_BLK_MAX_INDIRECT_DESCRIPTORS - 2;
+  if (device->features & VIRTIO_BLK_F_SEG_MAX) {
+    uint32_t seg_max = insdw(io + VIRTIO_REG_BLK_SEG_MAX);
+    if (seg_max && seg_max < segments) {
+      segments = seg_max;
+    }
+  }
+
+  // An unaligned buffer touches one page more than it spans
+  device->max_sectors_per_request =
+      MIN(VIRTIO_BLK_MAX_SECTORS_PER_REQUEST,
+          (segments - 1) * (PAGING_PAGE_SIZE / VIRTIO_BLK_SECTOR_SIZE));
+  if (!device->max_sectors_per_request) {
+    res = -EIO;
+    goto out;
+  }
+
+  res = virtio_blk_queue_init(device);
+  if (res < 0) {
+    goto out;
+  }
+
+  outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE |
+                                          VIRTIO_STATUS_DRIVER |
+                                          VIRTIO_STATUS_DRIVER_OK);
+  virtio_blk_check_interrupts(device);
+
+out:
+  if (res < 0) {
+    outb(io + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+  }
+  return res;
+}
+
+/**
+ * Finds every virtio block device and registers it as a real disk,
+ * returns the number of disks found
+ */
+int virtio_blk_init() {
+  size_t next = 0;
+  struct pci_device *pci = NULL;
+  while (virtio_blk_total < VIOS_DISK_VIRTIO_MAX_DEVICES &&
+         (pci = pci_find_device(VIRTIO_PCI_VENDOR_ID, VIRTIO_PCI_DEVICE_BLOCK,
+                                next)) != NULL) {
+    next = (pci - pci_device_get(0)) + 1;
+
+    // Counted before init so the interrupt handler already sees it
+    struct virtio_blk_device *device = &virtio_blk_devices[virtio_blk_total++];
+    memset(device, 0, sizeof(*device));
+    if (virtio_blk_device_init(device, pci) < 0) {
+      print("virtio-blk: device failed to initialize\n");
+      virtio_blk_total--;
+      continue;
+    }
+
+    print("virtio-blk: queue depth ");
+    print(itoa(device->queue_depth));
+    print(device->features & VIRTIO_F_EVENT_IDX ? ", event index\n" : "\n");
+    disk_create_new(VIOS_DISK_TYPE_REAL, 0, 0, VIRTIO_BLK_SECTOR_SIZE,
+                    &virtio_blk_disk_driver, device, NULL);
+  }
+
+  return virtio_blk_total;
+}
+
+int virtio_blk_total_devices() { return virtio_blk_total; }
+
+struct virtio_blk_device *virtio_blk_device_get(int index) {
+  if (index < 0 || index >= virtio_blk_total) {
+    return NULL;
+  }
+
+  return &virtio_blk_devices[index];
+}
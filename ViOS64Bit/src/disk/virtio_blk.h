@@ -0,0 +1,160 @@
+#ifndef KERNEL_DISK_VIRTIO_BLK_H
+#define KERNEL_DISK_VIRTIO_BLK_H
+
+#include "disk/request.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Transitional virtio block device, it offers the legacy IO port interface
+#define VIRTIO_PCI_VENDOR_ID 0x1AF4
+#define VIRTIO_PCI_DEVICE_BLOCK 0x1001
+
+// BAR0 holds the legacy registers in IO space
+#define VIRTIO_BAR 0
+
+// Legacy register offsets
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES 0x04
+#define VIRTIO_REG_QUEUE_ADDRESS 0x08
+#define VIRTIO_REG_QUEUE_SIZE 0x0C
+#define VIRTIO_REG_QUEUE_SELECT 0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10
+#define VIRTIO_REG_DEVICE_STATUS 0x12
+#define VIRTIO_REG_ISR_STATUS 0x13
+// Device configuration follows while MSI-X is disabled
+#define VIRTIO_REG_BLK_CAPACITY 0x14
+#define VIRTIO_REG_BLK_SEG_MAX 0x20
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+// Reading the ISR clears it and drops the legacy interrupt
+#define VIRTIO_ISR_QUEUE 0x01
+
+#define VIRTIO_BLK_F_SEG_MAX (1U << 2)
+#define VIRTIO_F_INDIRECT_DESC (1U << 28)
+#define VIRTIO_F_EVENT_IDX (1U << 29)
+
+// The legacy interface places the used ring on a 4KB boundary
+#define VIRTIO_QUEUE_ALIGN 4096
+#define VIRTIO_QUEUE_ADDRESS_SHIFT 12
+
+#define VIRTQ_DESC_F_NEXT 0x01
+// The device writes into this buffer
+#define VIRTQ_DESC_F_WRITE 0x02
+#define VIRTQ_DESC_F_INDIRECT 0x04
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 0x01
+#define VIRTQ_USED_F_NO_NOTIFY 0x01
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+
+#define VIRTIO_BLK_S_OK 0
+
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+// Requests kept in flight, each owns one ring descriptor and one page
+#define VIRTIO_BLK_MAX_QUEUE_DEPTH 64
+
+// Each request page holds the header, the status byte and the indirect
+// descriptor table
+#define VIRTIO_BLK_REQUEST_STATUS_OFFSET 16
+#define VIRTIO_BLK_REQUEST_TABLE_OFFSET 64
+#define VIRTIO_BLK_MAX_INDIRECT_DESCRIPTORS                                    \
+  ((4096 - VIRTIO_BLK_REQUEST_TABLE_OFFSET) / sizeof(struct virtq_desc))
+
+// Keeps every data buffer within the indirect table, even unaligned
+#define VIRTIO_BLK_MAX_SECTORS_PER_REQUEST 512
+
+// Gives up on a device that does not respond in this many polls
+#define VIRTIO_BLK_TIMEOUT_SPINS 100000000
+
+struct virtq_desc {
+  uint64_t address;
+  uint32_t length;
+  uint16_t flags;
+  uint16_t next;
+};
+
+// The used event index follows the ring entries
+struct virtq_avail {
+  uint16_t flags;
+  uint16_t index;
+  uint16_t ring[];
+};
+
+struct virtq_used_element {
+  uint32_t id;
+  uint32_t length;
+};
+
+// The avail event index follows the ring entries
+struct virtq_used {
+  uint16_t flags;
+  uint16_t index;
+  struct virtq_used_element ring[];
+};
+
+struct virtio_blk_request_header {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t sector;
+};
+
+struct virtio_blk_queue {
+  uint16_t size;
+  struct virtq_desc *descriptors;
+  volatile struct virtq_avail *avail;
+  volatile struct virtq_used *used;
+  // Bytes from the descriptors to the end of the used ring
+  size_t ring_size;
+
+  // Our copy of the avail index and the next used entry to consume
+  uint16_t avail_index;
+  uint16_t last_used;
+
+  // Ring descriptor "i" points at the indirect table of request page "i"
+  uint64_t slots_in_use;
+  struct disk_request *slot_requests[VIRTIO_BLK_MAX_QUEUE_DEPTH];
+  uint8_t *request_pages;
+};
+
+struct virtio_blk_device {
+  struct pci_device *pci;
+  uint16_t io_base;
+  uint32_t features;
+  uint64_t total_sectors;
+
+  struct virtio_blk_queue queue;
+  int queue_depth;
+  size_t max_sectors_per_request;
+
+  // False when the device has no legacy interrupt line, we then poll
+  bool interrupts;
+  volatile uint32_t interrupt_count;
+
+  // Notifications written, event index suppression keeps this well
+  // below the request count
+  uint64_t notifications;
+  // TSC ticks spent halted waiting for completions
+  uint64_t idle_ticks;
+};
+
+extern struct disk_driver virtio_blk_disk_driver;
+
+int virtio_blk_init();
+int virtio_blk_total_devices();
+struct virtio_blk_device *virtio_blk_device_get(int index);
+int virtio_blk_submit_requests(struct virtio_blk_device *device,
+                               struct disk_request *requests,
+                               size_t total, int queue_depth);
+int virtio_blk_read_sectors(struct virtio_blk_device *device, uint64_t lba,
+                            size_t total, void *buf);
+int virtio_blk_write_sectors(struct virtio_blk_device *device, uint64_t lba,
+                             size_t total, const void *buf);
+
+#endif
@@ -0,0 +1,421 @@
+#include "archive.h"
+#include "archive_format.h"
+#include "disk/disk.h"
+#include "kernel.h"
+#include "lib/lz4/lz4.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include "string/string.h"
+
+struct archive_private {
+  struct archive_header header;
+
+  // Sorted by name, looked up with a binary search
+  struct archive_entry *entries;
+
+  // Compressed entries once unpacked, kept for the next open
+  void **unpacked;
+
+  // Holds a sector while a read copies part of it
+  uint8_t *sector;
+
+  char name[ARCHIVE_VOLUME_NAME_MAX];
+};
+
+struct archive_file_descriptor {
+  struct archive_private *archive;
+  struct archive_entry *entry;
+  // The whole file when the entry is compressed, NULL otherwise
+  uint8_t *unpacked;
+  uint32_t pos;
+};
+
+int archive_resolve(struct disk *disk);
+void *archive_open(struct disk *disk, struct path_part *path, FILE_MODE mode);
+int archive_read(struct disk *disk, void *descriptor, uint32_t size,
+                 uint32_t nmemb, char *out_ptr);
+int archive_readv(struct disk *disk, void *descriptor,
+                  const struct file_iovec *iov, int iovcnt, int64_t offset);
+int archive_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
+int archive_stat(struct disk *disk, void *private, struct file_stat *stat);
+int archive_close(void *private);
+int archive_volume_name(void *private, char *name_out, size_t max);
+
+struct filesystem archive_fs = {.resolve = archive_resolve,
+                                .open = archive_open,
+                                .read = archive_read,
+                                .readv = archive_readv,
+                                .seek = archive_seek,
+                                .stat = archive_stat,
+                                .close = archive_close,
+                                .volume_name = archive_volume_name,
+                                // Packs the files for one read each
+                                .preferred_primary = true};
+
+struct filesystem *archive_init() {
+  strcpy(archive_fs.name, "ARCHIVE");
+  return &archive_fs;
+}
+
+/**
+ * Reads the header and the index in one go, nothing else is read until
+ * a file is
+ */
+int archive_resolve(struct disk *disk) {
+  int res = 0;
+  uint8_t *index = NULL;
+  struct archive_private *private = kzalloc(sizeof(struct archive_private));
+  if (!private) {
+    return -ENOMEM;
+  }
+
+  private->sector = kzalloc(disk->sector_size);
+  if (!private->sector) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  res = disk_read_block(disk, 0, 1, private->sector);
+  if (res < 0) {
+    goto out;
+  }
+  memcpy(&private->header, private->sector, sizeof(private->header));
+
+  struct archive_header *header = &private->header;
+  if (memcmp(header->magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) != 0 ||
+      header->total_entries == 0) {
+    res = -EFSNOTUS;
+    goto out;
+  }
+
+  uint64_t index_end = sizeof(struct archive_header) +
+                       (uint64_t)header->total_entries *
+                           sizeof(struct archive_entry);
+  if (index_end > ARCHIVE_PAGE_SIZE * 1024) {
+    res = -EINFORMAT;
+    goto out;
+  }
+
+  uint32_t index_sectors =
+      (index_end + disk->sector_size - 1) / disk->sector_size;
+
+  index = kzalloc(index_sectors * disk->sector_size);
+  private->unpacked = kzalloc(header->total_entries * sizeof(void *));
+  if (!index || !private->unpacked) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  res = disk_read_block(disk, 0, index_sectors, index);
+  if (res < 0) {
+    goto out;
+  }
+  private->entries =
+      (struct archive_entry *)(index + sizeof(struct archive_header));
+
+  memcpy(private->name, header->volume_name, sizeof(private->name));
+  private->name[sizeof(private->name) - 1] = 0;
+  disk->fs_private = private;
+
+  print("Archive: ");
+  print(itoa(header->total_entries));
+  print(" files\n");
+
+out:
+  if (res < 0) {
+    if (index) {
+      kfree(index);
+    }
+    if (private->unpacked) {
+      kfree(private->unpacked);
+    }
+    if (private->sector) {
+      kfree(private->sector);
+    }
+    kfree(private);
+    disk->fs_private = 0;
+  }
+  return res;
+}
+
+static struct archive_entry *archive_find(struct archive_private *private,
+                                          const char *name) {
+  // Longer names would be cut short and match another entry
+  if (strlen(name) >= ARCHIVE_NAME_MAX) {
+    return NULL;
+  }
+
+  char upper[ARCHIVE_NAME_MAX] = {0};
+  for (int i = 0; name[i]; i++) {
+    upper[i] = toupper(name[i]);
+  }
+
+  uint32_t low = 0;
+  uint32_t high = private->header.total_entries;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    struct archive_entry *entry = &private->entries[middle];
+    int cmp = strncmp(upper, entry->name, ARCHIVE_NAME_MAX);
+    if (cmp == 0) {
+      return entry;
+    }
+
+    if (cmp < 0) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Reads "total" bytes at "offset" of the archive. Whole sectors go
+ * straight to "out", partial sectors at either end through the sector
+ * buffer
+ */
+static int archive_read_bytes(struct disk *disk, uint32_t offset,
+                              uint32_t total, uint8_t *out) {
+  struct archive_private *private = disk->fs_private;
+  int sector_size = disk->sector_size;
+  int res = 0;
+  while (total) {
+    uint32_t lba = offset / sector_size;
+    uint32_t in_sector = offset % sector_size;
+    uint32_t chunk = 0;
+    if (in_sector == 0 && total >= sector_size) {
+      chunk = total - total % sector_size;
+      res = disk_read_block(disk, lba, chunk / sector_size, out);
+    } else {
+      chunk = sector_size - in_sector;
+      if (chunk > total) {
+        chunk = total;
+      }
+
+      res = disk_read_block(disk, lba, 1, private->sector);
+      memcpy(out, private->sector + in_sector, chunk);
+    }
+
+    if (res < 0) {
+      return res;
+    }
+
+    offset += chunk;
+    out += chunk;
+    total -= chunk;
+  }
+
+  return VIOS_ALL_OK;
+}
+
+/**
+ * Decompresses a compressed entry the first time it is opened, later
+ * opens share the copy
+ */
+static void *archive_unpack(struct disk *disk, struct archive_entry *entry) {
+  struct archive_private *private = disk->fs_private;
+  uint32_t index = entry - private->entries;
+  if (private->unpacked[index]) {
+    return private->unpacked[index];
+  }
+
+  int res = 0;
+  uint8_t *packed = kzalloc(entry->stored_size);
+  uint8_t *data = kzalloc(entry->size);
+  if (!packed || !data) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  res = archive_read_bytes(disk, entry->offset, entry->stored_size, packed);
+  if (res < 0) {
+    goto out;
+  }
+
+  res = lz4_decompress(packed, entry->stored_size, data, entry->size);
+  if (res >= 0 && res != entry->size) {
+    res = -EINFORMAT;
+  }
+out:
+  if (packed) {
+    kfree(packed);
+  }
+
+  if (res < 0) {
+    if (data) {
+      kfree(data);
+    }
+    return ERROR(res);
+  }
+
+  private->unpacked[index] = data;
+  return data;
+}
+
+void *archive_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
+  struct archive_file_descriptor *descriptor = 0;
+  int err_code = 0;
+  if (mode != FILE_MODE_READ) {
+    err_code = -ERDONLY;
+    goto err_out;
+  }
+
+  // The archive is flat, every file is in the root
+  if (path->next) {
+    err_code = -EBADPATH;
+    goto err_out;
+  }
+
+  struct archive_entry *entry = archive_find(disk->fs_private, path->part);
+  if (!entry) {
+    err_code = -EIO;
+    goto err_out;
+  }
+
+  descriptor = kzalloc(sizeof(struct archive_file_descriptor));
+  if (!descriptor) {
+    err_code = -ENOMEM;
+    goto err_out;
+  }
+
+  descriptor->archive = disk->fs_private;
+  descriptor->entry = entry;
+  if (entry->flags & ARCHIVE_ENTRY_LZ4 && entry->size) {
+    descriptor->unpacked = archive_unpack(disk, entry);
+    if (ISERR(descriptor->unpacked)) {
+      err_code = ERROR_I(descriptor->unpacked);
+      goto err_out;
+    }
+  }
+
+  return descriptor;
+
+err_out:
+  if (descriptor) {
+    kfree(descriptor);
+  }
+
+  return ERROR(err_code);
+}
+
+int archive_close(void *private) {
+  kfree(private);
+  return 0;
+}
+
+int archive_volume_name(void *private, char *name_out, size_t max) {
+  struct archive_private *fs_private = private;
+  strncpy(name_out, fs_private->name, max);
+  return 0;
+}
+
+int archive_stat(struct disk *disk, void *private, struct file_stat *stat) {
+  struct archive_file_descriptor *desc = private;
+  stat->filesize = desc->entry->size;
+  stat->flags = FILE_STAT_READ_ONLY;
+  // Entries never move, the index names the file for as long as the disk
+  stat->id = desc->entry - desc->archive->entries + 1;
+  return 0;
+}
+
+int archive_read(struct disk *disk, void *descriptor, uint32_t size,
+                 uint32_t nmemb, char *out_ptr) {
+  int res = 0;
+  struct archive_file_descriptor *desc = descriptor;
+  uint64_t total = (uint64_t)size * nmemb;
+  if (size == 0 || total > 0x7FFFFFFF) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  // Like fread only the whole elements before the end of the file are read
+  uint32_t filesize = desc->entry->size;
+  uint32_t left = filesize > desc->pos ? filesize - desc->pos : 0;
+  if (nmemb > left / size) {
+    nmemb = left / size;
+    total = (uint64_t)size * nmemb;
+  }
+
+  if (desc->unpacked) {
+    memcpy(out_ptr, desc->unpacked + desc->pos, total);
+  } else {
+    res = archive_read_bytes(disk, desc->entry->offset + desc->pos, total,
+                             (uint8_t *)out_ptr);
+    if (res < 0) {
+      goto out;
+    }
+  }
+
+  desc->pos += total;
+  res = nmemb;
+out:
+  return res;
+}
+
+int archive_readv(struct disk *disk, void *descriptor,
+                  const struct file_iovec *iov, int iovcnt, int64_t offset) {
+  struct archive_file_descriptor *desc = descriptor;
+  struct file_iovec clamped[VIOS_FILE_MAX_IOVECS];
+  if (iovcnt > VIOS_FILE_MAX_IOVECS) {
+    return -EINVARG;
+  }
+
+  uint32_t pos = offset == FILE_POSITION_CURRENT ? desc->pos : offset;
+  uint32_t filesize = desc->entry->size;
+  uint32_t left = filesize > pos ? filesize - pos : 0;
+  iovcnt = file_iovec_clamp(iov, iovcnt, left, clamped);
+
+  uint32_t done = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (desc->unpacked) {
+      memcpy(clamped[i].base, desc->unpacked + pos + done, clamped[i].len);
+    } else {
+      int res = archive_read_bytes(disk, desc->entry->offset + pos + done,
+                                   clamped[i].len, clamped[i].base);
+      if (res < 0) {
+        return res;
+      }
+    }
+    done += clamped[i].len;
+  }
+
+  if (offset == FILE_POSITION_CURRENT) {
+    desc->pos += done;
+  }
+  return done;
+}
+
+int archive_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
+  int res = 0;
+  struct archive_file_descriptor *desc = private;
+  uint32_t filesize = desc->entry->size;
+  switch (seek_mode) {
+  case SEEK_SET:
+    if (offset > filesize) {
+      res = -EIO;
+      break;
+    }
+    desc->pos = offset;
+    break;
+
+  case SEEK_CUR:
+    if (offset > filesize - desc->pos) {
+      res = -EIO;
+      break;
+    }
+    desc->pos += offset;
+    break;
+
+  case SEEK_END:
+    res = -EUNIMP;
+    break;
+
+  default:
+    res = -EINVARG;
+    break;
+  }
+
+  return res;
+}
@@ -0,0 +1,8 @@
+#ifndef KERNEL_FS_ARCHIVE_H
+#define KERNEL_FS_ARCHIVE_H
+
+#include "fs/file.h"
+
+struct filesystem *archive_init();
+
+#endif
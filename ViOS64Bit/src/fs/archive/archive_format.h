@@ -0,0 +1,48 @@
+#ifndef KERNEL_FS_ARCHIVE_FORMAT_H
+#define KERNEL_FS_ARCHIVE_FORMAT_H
+
+/*
+ * The layout of a ViOS asset archive, shared with the host tool that
+ * packs one. All fields are little endian
+ *
+ * header | index of entries sorted by name | payloads, each page aligned
+ */
+
+#include <stdint.h>
+
+#define ARCHIVE_MAGIC "VIOSARC1"
+#define ARCHIVE_MAGIC_SIZE 8
+
+// Payloads start on this boundary so they are read straight into pages
+#define ARCHIVE_PAGE_SIZE 4096
+
+#define ARCHIVE_NAME_MAX 48
+// Eleven characters padded with spaces like a FAT volume label
+#define ARCHIVE_VOLUME_NAME_MAX 12
+
+enum {
+  // The payload is one LZ4 block
+  ARCHIVE_ENTRY_LZ4 = 0b00000001
+};
+
+struct archive_header {
+  char magic[ARCHIVE_MAGIC_SIZE];
+  uint32_t total_entries;
+  char volume_name[ARCHIVE_VOLUME_NAME_MAX];
+  uint32_t reserved[2];
+} __attribute__((packed));
+
+struct archive_entry {
+  // Upper case and terminated, the index is sorted by strcmp on it
+  char name[ARCHIVE_NAME_MAX];
+
+  // From the start of the archive, a multiple of ARCHIVE_PAGE_SIZE
+  uint32_t offset;
+  // Bytes of the file
+  uint32_t size;
+  // Bytes of the payload, less than "size" when it is compressed
+  uint32_t stored_size;
+  uint32_t flags;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,235 @@
+#include "dcache.h"
+#include "disk/disk.h"
+#include "kernel.h"
+#include "memory/memory.h"
+#include "status.h"
+#include "string/string.h"
+
+struct fs_dcache {
+  struct fs_dentry *buckets[VIOS_FS_DCACHE_HASH_BUCKETS];
+
+  // Entries are recycled rather than freed
+  struct fs_dentry entries[VIOS_FS_DCACHE_ENTRIES];
+  size_t total_used;
+
+  struct fs_dentry *lru_head;
+  struct fs_dentry *lru_tail;
+
+  struct fs_dcache_stats stats;
+};
+
+static struct fs_dcache dcache;
+
+static uint32_t fs_dcache_hash_name(const char *name) {
+  // FNV-1a
+  uint32_t hash = 2166136261U;
+  while (*name) {
+    hash ^= (uint8_t)*name++;
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+static size_t fs_dcache_bucket(struct disk *disk, uint32_t parent,
+                               uint32_t hash) {
+  uint64_t key = ((uint64_t)(hash ^ (parent * 0x9E3779B9U)) *
+                  0x9E3779B97F4A7C15ULL) ^
+                 (uintptr_t)disk;
+  return (key >> 32) & (VIOS_FS_DCACHE_HASH_BUCKETS - 1);
+}
+
+static void fs_dcache_lru_unlink(struct fs_dentry *entry) {
+  if (entry->lru_prev) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    dcache.lru_head = entry->lru_next;
+  }
+
+  if (entry->lru_next) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    dcache.lru_tail = entry->lru_prev;
+  }
+
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void fs_dcache_lru_push_front(struct fs_dentry *entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = dcache.lru_head;
+  if (dcache.lru_head) {
+    dcache.lru_head->lru_prev = entry;
+  }
+  dcache.lru_head = entry;
+
+  if (!dcache.lru_tail) {
+    dcache.lru_tail = entry;
+  }
+}
+
+static void fs_dcache_hash_remove(struct fs_dentry *entry) {
+  struct fs_dentry **link = &dcache.buckets[fs_dcache_bucket(
+      entry->disk, entry->parent, entry->hash)];
+  while (*link) {
+    if (*link == entry) {
+      *link = entry->hash_next;
+      break;
+    }
+    link = &(*link)->hash_next;
+  }
+
+  entry->hash_next = NULL;
+}
+
+/**
+ * Drops the entry from the hash and hands its data back to the
+ * filesystem, the entry stays on the LRU list for reuse
+ */
+static void fs_dcache_release(struct fs_dentry *entry) {
+  fs_dcache_hash_remove(entry);
+  if (entry->data && entry->release) {
+    entry->release(entry->data);
+  }
+
+  entry->disk = NULL;
+  entry->data = NULL;
+  entry->release = NULL;
+}
+
+static struct fs_dentry *fs_dcache_take_entry() {
+  struct fs_dentry *entry = NULL;
+  if (dcache.total_used < VIOS_FS_DCACHE_ENTRIES) {
+    return &dcache.entries[dcache.total_used++];
+  }
+
+  entry = dcache.lru_tail;
+  fs_dcache_lru_unlink(entry);
+  if (entry->disk) {
+    fs_dcache_release(entry);
+    dcache.stats.evictions++;
+  }
+  return entry;
+}
+
+/**
+ * Finds "name" in the directory "parent" of "disk". A returned entry with
+ * NULL data means the filesystem already found that the name does not
+ * exist, NULL means the filesystem must look for itself
+ */
+struct fs_dentry *fs_dcache_lookup(struct disk *disk, uint32_t parent,
+                                   const char *name) {
+  uint32_t hash = fs_dcache_hash_name(name);
+  struct fs_dentry *entry =
+      dcache.buckets[fs_dcache_bucket(disk, parent, hash)];
+  while (entry) {
+    if (entry->disk == disk && entry->parent == parent &&
+        entry->hash == hash &&
+        strncmp(entry->name, name, sizeof(entry->name)) == 0) {
+      break;
+    }
+    entry = entry->hash_next;
+  }
+
+  if (!entry) {
+    dcache.stats.misses++;
+    return NULL;
+  }
+
+  dcache.stats.hits++;
+  if (!entry->data) {
+    dcache.stats.negative_hits++;
+  }
+
+  fs_dcache_lru_unlink(entry);
+  fs_dcache_lru_push_front(entry);
+  return entry;
+}
+
+/**
+ * Remembers what the filesystem found for "name", NULL data records that
+ * it does not exist. "release" frees the data once the entry is evicted.
+ * Returns NULL for a name too long to cache
+ */
+struct fs_dentry *fs_dcache_insert(struct disk *disk, uint32_t parent,
+                                   const char *name, uint32_t id, void *data,
+                                   FS_DCACHE_RELEASE_FUNCTION release) {
+  if (strlen(name) >= VIOS_FS_DCACHE_NAME_MAX) {
+    return NULL;
+  }
+
+  struct fs_dentry *entry = fs_dcache_take_entry();
+  entry->disk = disk;
+  entry->parent = parent;
+  entry->hash = fs_dcache_hash_name(name);
+  strncpy(entry->name, name, sizeof(entry->name));
+  entry->data = data;
+  entry->release = release;
+  entry->id = id;
+
+  size_t bucket = fs_dcache_bucket(disk, parent, entry->hash);
+  entry->hash_next = dcache.buckets[bucket];
+  dcache.buckets[bucket] = entry;
+  fs_dcache_lru_push_front(entry);
+  return entry;
+}
+
+/**
+ * Forgets "name" in the directory "parent", for when the filesystem
+ * changes that entry
+ */
+void fs_dcache_remove(struct disk *disk, uint32_t parent, const char *name) {
+  uint32_t hash = fs_dcache_hash_name(name);
+  struct fs_dentry *entry =
+      dcache.buckets[fs_dcache_bucket(disk, parent, hash)];
+  while (entry) {
+    struct fs_dentry *next = entry->hash_next;
+    if (entry->disk == disk && entry->parent == parent &&
+        entry->hash == hash &&
+        strncmp(entry->name, name, sizeof(entry->name)) == 0) {
+      fs_dcache_release(entry);
+    }
+    entry = next;
+  }
+}
+
+/**
+ * Forgets every entry with the given id, for when the filesystem changes
+ * the directory they hold. Entries below it stay cached
+ */
+void fs_dcache_remove_id(struct disk *disk, uint32_t id) {
+  for (size_t i = 0; i < dcache.total_used; i++) {
+    struct fs_dentry *entry = &dcache.entries[i];
+    if (entry->disk == disk && entry->id == id) {
+      fs_dcache_release(entry);
+    }
+  }
+}
+
+/**
+ * Forgets every entry of "disk", for when its directories change
+ */
+void fs_dcache_invalidate_disk(struct disk *disk) {
+  for (size_t i = 0; i < dcache.total_used; i++) {
+    struct fs_dentry *entry = &dcache.entries[i];
+    if (entry->disk == disk) {
+      fs_dcache_release(entry);
+    }
+  }
+}
+
+struct fs_dcache_stats *fs_dcache_stats() { return &dcache.stats; }
+
+void fs_dcache_print_stats() {
+  struct fs_dcache_stats *stats = &dcache.stats;
+  print("Dentry cache: ");
+  print(itoa(stats->hits));
+  print(" hits (");
+  print(itoa(stats->negative_hits));
+  print(" negative), ");
+  print(itoa(stats->misses));
+  print(" misses, ");
+  print(itoa(stats->evictions));
+  print(" evictions\n");
+}
@@ -0,0 +1,65 @@
+#ifndef KERNEL_FS_DCACHE_H
+#define KERNEL_FS_DCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+struct disk;
+
+// Parent id of the entries found in a disk's root directory
+#define FS_DCACHE_ROOT 0
+
+typedef void (*FS_DCACHE_RELEASE_FUNCTION)(void *data);
+
+/**
+ * One name looked up in one directory. Children refer to their parent by
+ * the "id" the filesystem gave it, which must name the same directory
+ * for as long as the disk is mounted so children outlive its eviction
+ */
+struct fs_dentry {
+  struct disk *disk;
+  uint32_t parent;
+  uint32_t hash;
+  char name[VIOS_FS_DCACHE_NAME_MAX];
+
+  // Used as the parent of the entries below this one
+  uint32_t id;
+
+  // Filesystem data for the entry, NULL when the name does not exist
+  void *data;
+  FS_DCACHE_RELEASE_FUNCTION release;
+
+  // Next entry in the same hash bucket
+  struct fs_dentry *hash_next;
+
+  // Least recently used list, the head is the most recently used entry
+  struct fs_dentry *lru_prev;
+  struct fs_dentry *lru_next;
+};
+
+struct fs_dcache_stats {
+  // Lookups that found an entry
+  size_t hits;
+  // Hits that said the name does not exist
+  size_t negative_hits;
+  // Lookups the filesystem had to answer from its directories
+  size_t misses;
+  // Entries thrown out to make room for others
+  size_t evictions;
+};
+
+struct fs_dentry *fs_dcache_lookup(struct disk *disk, uint32_t parent,
+                                   const char *name);
+struct fs_dentry *fs_dcache_insert(struct disk *disk, uint32_t parent,
+                                   const char *name, uint32_t id, void *data,
+                                   FS_DCACHE_RELEASE_FUNCTION release);
+void fs_dcache_remove(struct disk *disk, uint32_t parent, const char *name);
+void fs_dcache_remove_id(struct disk *disk, uint32_t id);
+void fs_dcache_invalidate_disk(struct disk *disk);
+struct fs_dcache_stats *fs_dcache_stats();
+void fs_dcache_print_stats();
+
+#endif
@@ -1,11 +1,14 @@
 #include "fat16.h"
 #include "disk/disk.h"
 #include "disk/streamer.h"
+#include "fat_common.h"
+#include "fs/dcache.h"
 #include "kernel.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
 #include "status.h"
 #include "string/string.h"
+#include <stdbool.h>
 #include <stdint.h>
 
 #define VIOS_FAT16_SIGNATURE 0x29
@@ -13,20 +16,21 @@
 #define VIOS_FAT16_BAD_SECTOR 0xFF7
 #define VIOS_FAT16_UNUSED 0x00
 
+// Cluster reads queued before a file read waits on them
+#define VIOS_FAT16_MAX_BIOS 16
+
+// No chain can be longer than the FAT, a longer one loops back on itself
+#define VIOS_FAT16_MAX_CHAIN_CLUSTERS 0xFFF0
+
+#define VIOS_FAT16_END_OF_CHAIN 0xFFFF
+
+// A FAT of 65536 entries fills 256 sectors of 512 bytes
+#define VIOS_FAT16_MAX_FAT_SECTORS 256
+
 typedef unsigned int FAT_ITEM_TYPE;
 #define FAT_ITEM_TYPE_DIRECTORY 0
 #define FAT_ITEM_TYPE_FILE 1
 
-// Fat directory entry attributes bitmask
-#define FAT_FILE_READ_ONLY 0x01
-#define FAT_FILE_HIDDEN 0x02
-#define FAT_FILE_SYSTEM 0x04
-#define FAT_FILE_VOLUME_LABEL 0x08
-#define FAT_FILE_SUBDIRECTORY 0x10
-#define FAT_FILE_ARCHIVED 0x20
-#define FAT_FILE_DEVICE 0x40
-#define FAT_FILE_RESERVED 0x80
-
 struct fat_header_extended {
   uint8_t drive_number;
   uint8_t win_nt_bit;
@@ -60,27 +64,16 @@ struct fat_h {
   } shared;
 };
 
-struct fat_directory_item {
-  uint8_t filename[8];
-  uint8_t ext[3];
-  uint8_t attribute;
-  uint8_t reserved;
-  uint8_t creation_time_tenths_of_a_sec;
-  uint16_t creation_time;
-  uint16_t creation_date;
-  uint16_t last_access;
-  uint16_t high_16_bits_first_cluster;
-  uint16_t last_mod_time;
-  uint16_t last_mod_date;
-  uint16_t low_16_bits_first_cluster;
-  uint32_t filesize;
-} __attribute__((packed));
-
 struct fat_directory {
   struct fat_directory_item *item;
   int total;
+  // Slots the directory has room for, used or not
+  int capacity;
   int sector_pos;
   int ending_sector_pos;
+
+  // The chain of a subdirectory, empty for the fixed root directory
+  struct fat_extent_map extents;
 };
 
 struct fat_item {
@@ -90,11 +83,22 @@ struct fat_item {
   };
 
   FAT_ITEM_TYPE type;
+
+  // Where the directory entry lives on disk and the first cluster of the
+  // directory holding it, zero for the root, so it can be written back
+  uint32_t entry_pos;
+  uint32_t parent;
 };
 
 struct fat_file_descriptor {
   struct fat_item *item;
   uint32_t pos;
+
+  // Built on the first read, file offsets resolve to sectors through it
+  struct fat_extent_map extents;
+
+  // The directory entry changed and must be written back on sync
+  bool dirty;
 };
 
 struct fat_private {
@@ -108,7 +112,19 @@ struct fat_private {
 
   // Used in situations where we stream the directory
   struct disk_stream *directory_stream;
-  
+
+  // The first FAT read in whole at mount time, chain lookups are served
+  // from here. NULL when it could not be loaded, lookups then stream it
+  uint16_t *fat_table;
+  uint32_t fat_table_entries;
+
+  // Clusters in the data area, and where the search for a free one starts
+  uint32_t total_clusters;
+  uint32_t next_free_cluster;
+
+  // Sectors of the cached FAT changed since the last sync, one bit each
+  uint8_t fat_dirty[VIOS_FAT16_MAX_FAT_SECTORS / 8];
+
   // FAT16 name
   char name[11];
 };
@@ -117,18 +133,33 @@ int fat16_resolve(struct disk *disk);
 void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode);
 int fat16_read(struct disk *disk, void *descriptor, uint32_t size,
                uint32_t nmemb, char *out_ptr);
+int fat16_readv(struct disk *disk, void *descriptor,
+                const struct file_iovec *iov, int iovcnt, int64_t offset);
 int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
 int fat16_stat(struct disk *disk, void *private, struct file_stat *stat);
 int fat16_close(void *private);
 int fat16_volume_name(void* private, char* name_out, size_t max);
+int fat16_write(struct disk *disk, void *descriptor, uint32_t size,
+                uint32_t nmemb, const char *in);
+int fat16_truncate(struct disk *disk, void *descriptor, uint32_t size);
+int fat16_sync(struct disk *disk, void *descriptor);
+int fat16_unlink(struct disk *disk, struct path_part *path);
+
+static int fat16_load_fat_table(struct disk *disk,
+                                struct fat_private *private);
 
 struct filesystem fat16_fs = {.resolve = fat16_resolve,
     .open = fat16_open,
     .read = fat16_read,
+    .readv = fat16_readv,
     .seek = fat16_seek,
     .stat = fat16_stat,
     .close = fat16_close,
-    .volume_name=fat16_volume_name
+    .volume_name=fat16_volume_name,
+    .write = fat16_write,
+    .truncate = fat16_truncate,
+    .sync = fat16_sync,
+    .unlink = fat16_unlink
 };
 
 struct filesystem *fat16_init() {
@@ -147,46 +178,18 @@ int fat16_sector_to_absolute(struct disk *disk, int sector) {
   return sector * disk->sector_size;
 }
 
-int fat16_get_total_items_for_directory(struct disk *disk,
-                                        uint32_t directory_start_sector) {
-  struct fat_directory_item item;
-  struct fat_directory_item empty_item;
-  memset(&empty_item, 0, sizeof(empty_item));
-
-  struct fat_private *fat_private = disk->fs_private;
-
-  int res = 0;
+/**
+ * Counts the slots before the end marker, deleted slots included so the
+ * count covers every live entry of the directory
+ */
+static int fat16_count_directory_items(struct fat_directory_item *items,
+                                       int max) {
   int i = 0;
-  int directory_start_pos = directory_start_sector * disk->sector_size;
-  struct disk_stream *stream = fat_private->directory_stream;
-  if (diskstreamer_seek(stream, directory_start_pos) != VIOS_ALL_OK) {
-    res = -EIO;
-    goto out;
-  }
-
-  while (1) {
-    if (diskstreamer_read(stream, &item, sizeof(item)) != VIOS_ALL_OK) {
-      res = -EIO;
-      goto out;
-    }
-
-    if (item.filename[0] == 0x00) {
-      // We are done
-      break;
-    }
-
-    // Is the item unused
-    if (item.filename[0] == 0xE5) {
-      continue;
-    }
-
+  while (i < max && items[i].filename[0] != VIOS_FAT_DIRECTORY_END) {
     i++;
   }
 
-  res = i;
-
-out:
-  return res;
+  return i;
 }
 
 int fat16_get_root_directory(struct disk *disk, struct fat_private *fat_private,
@@ -204,9 +207,6 @@ int fat16_get_root_directory(struct disk *disk, struct fat_private *fat_private,
     total_sectors += 1;
   }
 
-  int total_items =
-      fat16_get_total_items_for_directory(disk, root_dir_sector_pos);
-
   dir = kzalloc(root_dir_size);
   if (!dir) {
     res = -ENOMEM;
@@ -227,7 +227,8 @@ int fat16_get_root_directory(struct disk *disk, struct fat_private *fat_private,
   }
 
   directory->item = dir;
-  directory->total = total_items;
+  directory->total = fat16_count_directory_items(dir, root_dir_entries);
+  directory->capacity = root_dir_entries;
   directory->sector_pos = root_dir_sector_pos;
   directory->ending_sector_pos = root_dir_sector_pos + total_sectors;
 out:
@@ -260,7 +261,9 @@ int fat16_resolve(struct disk *disk) {
     goto out;
   }
 
-  if (fat_private->header.shared.extended_header.signature != 0x29) {
+  // FAT32 keeps its own header where ours ends, its 16 bit FAT size is 0
+  if (fat_private->header.shared.extended_header.signature != 0x29 ||
+      fat_private->header.primary_header.sectors_per_fat == 0) {
     res = -EFSNOTUS;
     goto out;
   }
@@ -271,6 +274,27 @@ int fat16_resolve(struct disk *disk) {
     goto out;
   }
 
+  // Not fatal, chain lookups fall back to reading the FAT from disk
+  if (fat16_load_fat_table(disk, fat_private) < 0) {
+    print("FAT16: could not cache the FAT\n");
+  }
+
+  struct fat_header *primary_header = &fat_private->header.primary_header;
+  uint32_t total_sectors = primary_header->number_of_sectors
+                               ? primary_header->number_of_sectors
+                               : primary_header->sectors_big;
+  uint32_t data_start = fat_private->root_directory.ending_sector_pos;
+  if (total_sectors > data_start && primary_header->sectors_per_cluster) {
+    fat_private->total_clusters =
+        (total_sectors - data_start) / primary_header->sectors_per_cluster;
+  }
+  if (fat_private->total_clusters + 2 > fat_private->fat_table_entries) {
+    fat_private->total_clusters = fat_private->fat_table_entries > 2
+                                      ? fat_private->fat_table_entries - 2
+                                      : 0;
+  }
+  fat_private->next_free_cluster = 2;
+
   // Copy the name into the private data
   strncpy(fat_private->name, (const char*) fat_private->header.shared.extended_header.volume_id_string, sizeof(fat_private->name));
 
@@ -286,35 +310,6 @@ out:
   return res;
 }
 
-void fat16_to_proper_string(char **out, const char *in, size_t size) {
-  int i = 0;
-  while (*in != 0x00 && *in != 0x20) {
-    **out = *in;
-    *out += 1;
-    in += 1;
-    // We cant process anymore since we have exceeded the input buffer size
-    if (i >= size - 1) {
-      break;
-    }
-    i++;
-  }
-
-  **out = 0x00;
-}
-
-void fat16_get_full_relative_filename(struct fat_directory_item *item,
-                                      char *out, int max_len) {
-  memset(out, 0x00, max_len);
-  char *out_tmp = out;
-  fat16_to_proper_string(&out_tmp, (const char *)item->filename,
-                         sizeof(item->filename));
-  if (item->ext[0] != 0x00 && item->ext[0] != 0x20) {
-    *out_tmp++ = '.';
-    fat16_to_proper_string(&out_tmp, (const char *)item->ext,
-                           sizeof(item->ext));
-  }
-}
-
 struct fat_directory_item *
 fat16_clone_directory_item(struct fat_directory_item *item, int size) {
   struct fat_directory_item *item_copy = 0;
@@ -331,11 +326,6 @@ fat16_clone_directory_item(struct fat_directory_item *item, int size) {
   return item_copy;
 }
 
-static uint32_t fat16_get_first_cluster(struct fat_directory_item *item) {
-  return (item->high_16_bits_first_cluster << 16) |
-         item->low_16_bits_first_cluster;
-};
-
 static int fat16_cluster_to_sector(struct fat_private *private, int cluster) {
   return private->root_directory.ending_sector_pos +
          ((cluster - 2) * private->header.primary_header.sectors_per_cluster);
@@ -345,9 +335,51 @@ static uint32_t fat16_get_first_fat_sector(struct fat_private *private) {
   return private->header.primary_header.reserved_sectors;
 }
 
+/**
+ * Reads the whole first FAT with one request, a FAT16 FAT is at most
+ * 128KB so it always fits in memory
+ */
+static int fat16_load_fat_table(struct disk *disk,
+                                struct fat_private *private) {
+  int res = 0;
+  int sectors = private->header.primary_header.sectors_per_fat;
+  // The value comes from the disk, a FAT16 FAT is never larger than this
+  if (sectors == 0 || sectors > VIOS_FAT16_MAX_FAT_SECTORS) {
+    res = -EINFORMAT;
+    goto out;
+  }
+
+  size_t size = sectors * disk->sector_size;
+  uint16_t *table = kmalloc(size);
+  if (!table) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  res = disk_read_block(disk, fat16_get_first_fat_sector(private), sectors,
+                        table);
+  if (res < 0) {
+    kfree(table);
+    goto out;
+  }
+
+  private->fat_table = table;
+  private->fat_table_entries = size / VIOS_FAT16_FAT_ENTRY_SIZE;
+out:
+  return res;
+}
+
 static int fat16_get_fat_entry(struct disk *disk, int cluster) {
   int res = -1;
   struct fat_private *private = disk->fs_private;
+  if (private->fat_table) {
+    if (cluster < 0 || (uint32_t)cluster >= private->fat_table_entries) {
+      return -EIO;
+    }
+
+    return private->fat_table[cluster];
+  }
+
   struct disk_stream *stream = private->fat_read_stream;
   if (!stream) {
     goto out;
@@ -373,95 +405,379 @@ out:
 }
 
 /**
- * Gets the correct cluster to use based on the starting cluster and the offset
+ * Gets the cluster that follows "cluster" in its chain, zero at the end
+ * of the chain
+ */
+static int fat16_get_next_cluster(struct disk *disk, uint32_t cluster) {
+  int entry = fat16_get_fat_entry(disk, cluster);
+  if (entry < 0) {
+    return entry;
+  }
+
+  if (entry >= 0xFFF8) {
+    // End of cluster chain
+    return 0;
+  }
+
+  // Check for other invalid or reserved entries
+  if (entry == VIOS_FAT16_BAD_SECTOR || (entry >= 0xFFF0 && entry <= 0xFFF6) ||
+      (entry == VIOS_FAT16_UNUSED)) {
+    return -EIO;
+  }
+
+  return entry;
+}
+
+static int fat16_build_extent_map(struct disk *disk, uint32_t first_cluster,
+                                  struct fat_extent_map *map) {
+  return fat_build_extent_map(disk, first_cluster,
+                              VIOS_FAT16_MAX_CHAIN_CLUSTERS,
+                              fat16_get_next_cluster, map);
+}
+
+/**
+ * Writing needs the FAT cached in memory, changes are made there and
+ * written out in batches
+ */
+static bool fat16_writable(struct fat_private *private) {
+  return private->fat_table &&
+         private->header.primary_header.sectors_per_fat <=
+             VIOS_FAT16_MAX_FAT_SECTORS;
+}
+
+static bool fat16_fat_sector_dirty(struct fat_private *private,
+                                   uint32_t sector) {
+  return private->fat_dirty[sector / 8] & (1 << (sector % 8));
+}
+
+/**
+ * Changes an entry of the cached FAT, the sector holding it is written
+ * out on the next flush
+ */
+static void fat16_set_fat_entry(struct disk *disk, uint32_t cluster,
+                                uint16_t value) {
+  struct fat_private *private = disk->fs_private;
+  private->fat_table[cluster] = value;
+  uint32_t sector = cluster * VIOS_FAT16_FAT_ENTRY_SIZE / disk->sector_size;
+  private->fat_dirty[sector / 8] |= 1 << (sector % 8);
+}
+
+/**
+ * Writes the FAT sectors changed since the last flush to every copy of
+ * the FAT, neighbouring sectors go out as one request
  */
-int fat16_get_cluster_for_offset(struct disk *disk, uint16_t starting_cluster,
-                                 int offset) {
+static int fat16_flush_fat(struct disk *disk) {
   int res = 0;
   struct fat_private *private = disk->fs_private;
-  int size_of_cluster_bytes =
-      private->header.primary_header.sectors_per_cluster * disk->sector_size;
-  uint16_t cluster_to_use = starting_cluster;
-  int clusters_ahead = offset / size_of_cluster_bytes;
-  for (int i = 0; i < clusters_ahead; i++) {
-    uint16_t entry = fat16_get_fat_entry(disk, cluster_to_use);
-    if (entry >= 0xFFF8) {
-      // End of cluster chain
-      res = -EOUTOFRANGE;
-      goto out;
+  struct fat_header *header = &private->header.primary_header;
+  uint32_t sectors = header->sectors_per_fat;
+  uint32_t sector = 0;
+  while (sector < sectors) {
+    if (!fat16_fat_sector_dirty(private, sector)) {
+      sector++;
+      continue;
     }
 
-    // Check for other invalid or reserved entries
-    if (entry == VIOS_FAT16_BAD_SECTOR ||
-        (entry >= 0xFFF0 && entry <= 0xFFF6) || (entry == 0x0000)) {
-      res = -EIO;
-      goto out;
+    uint32_t first = sector;
+    while (sector < sectors && fat16_fat_sector_dirty(private, sector)) {
+      sector++;
+    }
+
+    uint8_t *buf = (uint8_t *)private->fat_table + first * disk->sector_size;
+    for (int copy = 0; copy < header->fat_copies; copy++) {
+      uint32_t lba =
+          fat16_get_first_fat_sector(private) + copy * sectors + first;
+      res = disk_write_block(disk, lba, sector - first, buf);
+      if (res < 0) {
+        goto out;
+      }
     }
 
-    cluster_to_use = entry;
+    for (uint32_t i = first; i < sector; i++) {
+      private->fat_dirty[i / 8] &= ~(1 << (i % 8));
+    }
   }
 
-  res = cluster_to_use;
 out:
   return res;
 }
-static int fat16_read_internal_from_stream(struct disk *disk,
-                                           struct disk_stream *stream,
-                                           uint16_t cluster, int offset,
-                                           int total, void *out) {
-  int res = VIOS_ALL_OK;
+
+/**
+ * Finds up to "wanted" free clusters in a row, searching on from where
+ * the last allocation ended. Returns the first of them with their count
+ * in "total", zero when the disk is full
+ */
+static uint32_t fat16_find_free_run(struct fat_private *private,
+                                    uint32_t wanted, uint32_t *total) {
+  uint32_t end = private->total_clusters + 2;
+  uint32_t start = private->next_free_cluster;
+  if (private->total_clusters == 0) {
+    return 0;
+  }
+
+  if (start < 2 || start >= end) {
+    start = 2;
+  }
+
+  uint32_t cluster = start;
+  do {
+    if (private->fat_table[cluster] == VIOS_FAT16_UNUSED) {
+      uint32_t run = 1;
+      while (run < wanted && cluster + run < end &&
+             private->fat_table[cluster + run] == VIOS_FAT16_UNUSED) {
+        run++;
+      }
+
+      *total = run;
+      private->next_free_cluster = cluster + run;
+      return cluster;
+    }
+
+    cluster = cluster + 1 < end ? cluster + 1 : 2;
+  } while (cluster != start);
+
+  return 0;
+}
+
+/**
+ * Grows the chain behind "map" to "clusters" clusters. New clusters are
+ * looked for right after the chain first so files stay contiguous, the
+ * FAT only changes in memory until the next flush
+ */
+static int fat16_allocate_clusters(struct disk *disk,
+                                   struct fat_extent_map *map,
+                                   uint32_t clusters) {
+  int res = 0;
   struct fat_private *private = disk->fs_private;
-  int size_of_cluster_bytes =
-      private->header.primary_header.sectors_per_cluster * disk->sector_size;
-  uint16_t cluster_to_use = cluster;
-  int bytes_read = 0;
-  int starting_offset = offset;
+  uint32_t have = fat_extent_map_clusters(map);
+  while (have < clusters) {
+    uint32_t last = 0;
+    if (map->total) {
+      struct fat_extent *extent = &map->extents[map->total - 1];
+      last = extent->cluster + extent->total - 1;
+      private->next_free_cluster = last + 1;
+    }
+
+    uint32_t total = 0;
+    uint32_t first = fat16_find_free_run(private, clusters - have, &total);
+    if (!first) {
+      res = -ENOSPC;
+      goto out;
+    }
+
+    for (uint32_t i = 0; i < total; i++) {
+      fat16_set_fat_entry(disk, first + i,
+                          i + 1 < total ? first + i + 1
+                                        : VIOS_FAT16_END_OF_CHAIN);
+    }
 
-  while (total > 0) {
-    res = fat16_get_cluster_for_offset(disk, cluster, starting_offset);
+    if (last) {
+      fat16_set_fat_entry(disk, last, first);
+    }
+
+    res = fat_extent_map_append(map, first, total);
     if (res < 0) {
+      goto out;
+    }
+    have += total;
+  }
+
+out:
+  return res;
+}
+
+/**
+ * Cuts the chain behind "map" down to its first "keep" clusters and
+ * frees the rest
+ */
+static void fat16_free_clusters(struct disk *disk, struct fat_extent_map *map,
+                                uint32_t keep) {
+  struct fat_private *private = disk->fs_private;
+  bool freed = false;
+  while (map->total) {
+    struct fat_extent *extent = &map->extents[map->total - 1];
+    uint32_t first =
+        extent->file_cluster >= keep ? 0 : keep - extent->file_cluster;
+    if (first >= extent->total) {
       break;
     }
 
-    cluster_to_use = (uint16_t)res;
-    int offset_from_cluster = starting_offset % size_of_cluster_bytes;
-    int starting_sector = fat16_cluster_to_sector(private, cluster_to_use);
-    int starting_pos =
-        (starting_sector * disk->sector_size) + offset_from_cluster;
-    int total_to_read = size_of_cluster_bytes - offset_from_cluster;
-    if (total_to_read > total) {
-      total_to_read = total;
+    for (uint32_t i = first; i < extent->total; i++) {
+      fat16_set_fat_entry(disk, extent->cluster + i, VIOS_FAT16_UNUSED);
     }
 
-    res = diskstreamer_seek(stream, starting_pos);
-    if (res != VIOS_ALL_OK) {
-      break;
+    if (extent->cluster + first < private->next_free_cluster) {
+      private->next_free_cluster = extent->cluster + first;
     }
 
-    res = diskstreamer_read(stream, out, total_to_read);
-    if (res != VIOS_ALL_OK) {
+    freed = true;
+    extent->total = first;
+    if (extent->total) {
       break;
     }
+    map->total--;
+  }
+
+  if (freed && map->total) {
+    struct fat_extent *last = &map->extents[map->total - 1];
+    fat16_set_fat_entry(disk, last->cluster + last->total - 1,
+                        VIOS_FAT16_END_OF_CHAIN);
+  }
+}
+
+static int fat16_stream_rw(struct disk_stream *stream, size_t pos,
+                           void *buf, int total, bool write) {
+  int res = diskstreamer_seek(stream, pos);
+  if (res != VIOS_ALL_OK) {
+    return res;
+  }
+
+  if (write) {
+    return diskstreamer_write(stream, buf, total);
+  }
+
+  return diskstreamer_read(stream, buf, total);
+}
+
+/**
+ * Reads or writes the buffers of "iov" in turn from "offset" through the
+ * extent map. The whole sectors of each contiguous run are queued as one
+ * bio, partial sectors at either end of a run go through the stream. One
+ * plug covers every buffer, so runs that continue each other on disk
+ * reach the device as one command even when they land in different
+ * buffers
+ */
+static int fat16_rw_extents(struct disk *disk, struct disk_stream *stream,
+                            struct fat_extent_map *map, uint32_t offset,
+                            const struct file_iovec *iov, int iovcnt,
+                            bool write) {
+  int res = VIOS_ALL_OK;
+  struct fat_private *private = disk->fs_private;
+  uint32_t size_of_cluster_bytes =
+      private->header.primary_header.sectors_per_cluster * disk->sector_size;
+  int bytes_done = 0;
+  struct disk_bio bios[VIOS_FAT16_MAX_BIOS];
+  int total_bios = 0;
+
+  disk_queue_plug(disk);
+  for (int i = 0; i < iovcnt && res == VIOS_ALL_OK; i++) {
+    uint8_t *buf = iov[i].base;
+    int total = iov[i].len;
+    while (total > 0) {
+      uint32_t file_cluster = offset / size_of_cluster_bytes;
+      struct fat_extent *extent = fat_find_extent(map, file_cluster);
+      if (!extent) {
+        res = -EOUTOFRANGE;
+        break;
+      }
+
+      uint32_t offset_from_cluster = offset % size_of_cluster_bytes;
+      uint32_t clusters_left =
+          extent->file_cluster + extent->total - file_cluster;
+      int cluster = extent->cluster + (file_cluster - extent->file_cluster);
+      size_t starting_pos = (size_t)fat16_cluster_to_sector(private, cluster) *
+                                disk->sector_size +
+                            offset_from_cluster;
+      size_t run_bytes =
+          clusters_left * size_of_cluster_bytes - offset_from_cluster;
+      int total_to_move = run_bytes < (size_t)total ? run_bytes : total;
+
+      // Bytes before the first whole sector and the whole sectors after
+      int head = (disk->sector_size - starting_pos % disk->sector_size) %
+                 disk->sector_size;
+      if (head > total_to_move) {
+        head = total_to_move;
+      }
+      int sectors = (total_to_move - head) / disk->sector_size;
+      int tail = total_to_move - head - sectors * disk->sector_size;
+
+      if (head) {
+        res = fat16_stream_rw(stream, starting_pos, buf, head, write);
+        if (res != VIOS_ALL_OK) {
+          break;
+        }
+      }
+
+      if (sectors) {
+        if (total_bios == VIOS_FAT16_MAX_BIOS) {
+          res = fat_wait_bios(bios, total_bios);
+          total_bios = 0;
+          if (res != VIOS_ALL_OK) {
+            break;
+          }
+        }
+
+        struct disk_bio *bio = &bios[total_bios];
+        disk_bio_init(bio, disk, (starting_pos + head) / disk->sector_size,
+                      sectors, buf + head, write);
+        res = disk_bio_submit(bio);
+        if (res != VIOS_ALL_OK) {
+          break;
+        }
+        total_bios++;
+      }
+
+      if (tail) {
+        res = fat16_stream_rw(stream, starting_pos + total_to_move - tail,
+                              buf + total_to_move - tail, tail, write);
+        if (res != VIOS_ALL_OK) {
+          break;
+        }
+      }
+
+      buf += total_to_move;
+      offset += total_to_move;
+      bytes_done += total_to_move;
+      total -= total_to_move;
+    }
+  }
+  disk_queue_unplug(disk);
 
-    out += total_to_read;
-    starting_offset += total_to_read;
-    bytes_read += total_to_read;
-    total -= total_to_read;
+  // The bios live on our stack, they must complete even after an error
+  int bios_res = fat_wait_bios(bios, total_bios);
+  if (res == VIOS_ALL_OK) {
+    res = bios_res;
   }
 
   if (res < 0) {
     return res;
   }
 
-  return bytes_read;
+  return bytes_done;
+}
+
+static int fat16_readv_internal(struct disk *disk, struct fat_extent_map *map,
+                                uint32_t offset, const struct file_iovec *iov,
+                                int iovcnt) {
+  struct fat_private *fs_private = disk->fs_private;
+  struct disk_stream *stream = fs_private->cluster_read_stream;
+  return fat16_rw_extents(disk, stream, map, offset, iov, iovcnt, false);
+}
+
+static int fat16_read_internal(struct disk *disk, struct fat_extent_map *map,
+                               uint32_t offset, int total, void *out) {
+  struct file_iovec iov = {.base = out, .len = total};
+  return fat16_readv_internal(disk, map, offset, &iov, 1);
+}
+
+/**
+ * Drops the read ahead of every stream, for after a write went around
+ * them
+ */
+static void fat16_invalidate_streams(struct fat_private *private) {
+  diskstreamer_invalidate(private->cluster_read_stream);
+  diskstreamer_invalidate(private->fat_read_stream);
+  diskstreamer_invalidate(private->directory_stream);
 }
 
-static int fat16_read_internal(struct disk *disk, int starting_cluster,
-                               int offset, int total, void *out) {
+static int fat16_write_internal(struct disk *disk, struct fat_extent_map *map,
+                                uint32_t offset, int total, const void *in) {
   struct fat_private *fs_private = disk->fs_private;
   struct disk_stream *stream = fs_private->cluster_read_stream;
-  return fat16_read_internal_from_stream(disk, stream, starting_cluster, offset,
-                                         total, out);
+  struct file_iovec iov = {.base = (void *)in, .len = total};
+  int res = fat16_rw_extents(disk, stream, map, offset, &iov, 1, true);
+  fat16_invalidate_streams(fs_private);
+  return res;
 }
 
 void fat16_free_directory(struct fat_directory *directory) {
@@ -473,6 +789,10 @@ void fat16_free_directory(struct fat_directory *directory) {
     kfree(directory->item);
   }
 
+  if (directory->extents.extents) {
+    kfree(directory->extents.extents);
+  }
+
   kfree(directory);
 }
 
@@ -502,29 +822,42 @@ fat16_load_fat_directory(struct disk *disk, struct fat_directory_item *item) {
     goto out;
   }
 
-  int cluster = fat16_get_first_cluster(item);
-  int cluster_sector = fat16_cluster_to_sector(fat_private, cluster);
-  int total_items = fat16_get_total_items_for_directory(disk, cluster_sector);
-  directory->total = total_items;
-  int directory_size = directory->total * sizeof(struct fat_directory_item);
+  // The whole chain is read in one pass and the entries counted in memory,
+  // the map is kept to find the slots again when entries are written
+  struct fat_extent_map *map = &directory->extents;
+  res = fat16_build_extent_map(disk, fat_get_first_cluster(item), map);
+  if (res < 0) {
+    goto out;
+  }
+
+  int size_of_cluster_bytes =
+      fat_private->header.primary_header.sectors_per_cluster *
+      disk->sector_size;
+  int directory_size = fat_extent_map_clusters(map) * size_of_cluster_bytes;
   directory->item = kzalloc(directory_size);
   if (!directory->item) {
     res = -ENOMEM;
     goto out;
   }
 
-  res =
-      fat16_read_internal(disk, cluster, 0x00, directory_size, directory->item);
-  if (res != VIOS_ALL_OK) {
+  res = fat16_read_internal(disk, map, 0x00, directory_size, directory->item);
+  if (res < 0) {
     goto out;
   }
 
+  directory->capacity = directory_size / sizeof(struct fat_directory_item);
+  directory->total =
+      fat16_count_directory_items(directory->item, directory->capacity);
+  res = VIOS_ALL_OK;
+
 out:
   if (res != VIOS_ALL_OK) {
     fat16_free_directory(directory);
+    directory = 0;
   }
   return directory;
 }
+
 struct fat_item *
 fat16_new_fat_item_for_directory_item(struct disk *disk,
                                       struct fat_directory_item *item) {
@@ -545,87 +878,477 @@ fat16_new_fat_item_for_directory_item(struct disk *disk,
   return f_item;
 }
 
-struct fat_item *fat16_find_item_in_directory(struct disk *disk,
-                                              struct fat_directory *directory,
-                                              const char *name) {
-  struct fat_item *f_item = 0;
-  char tmp_filename[VIOS_MAX_PATH];
-  for (int i = 0; i < directory->total; i++) {
-    fat16_get_full_relative_filename(&directory->item[i], tmp_filename,
-                                     sizeof(tmp_filename));
-    if (istrncmp(tmp_filename, name, sizeof(tmp_filename)) == 0) {
-      // Found it let's create a new fat_item
-      f_item = fat16_new_fat_item_for_directory_item(disk, &directory->item[i]);
-    }
-  }
+/**
+ * What the dentry cache keeps for a name found in a directory, the
+ * entries of a subdirectory are loaded the first time a path goes
+ * through it
+ */
+struct fat_dentry {
+  struct fat_directory_item item;
+  struct fat_directory *directory;
 
-  return f_item;
+  // Where "item" lives on disk
+  uint32_t entry_pos;
+};
+
+static void fat16_dentry_release(void *data) {
+  struct fat_dentry *dentry = data;
+  fat16_free_directory(dentry->directory);
+  kfree(dentry);
 }
-struct fat_item *fat16_get_directory_entry(struct disk *disk,
-                                           struct path_part *path) {
-  struct fat_private *fat_private = disk->fs_private;
-  struct fat_item *current_item = 0;
-  struct fat_item *root_item = fat16_find_item_in_directory(
-      disk, &fat_private->root_directory, path->part);
-  if (!root_item) {
-    goto out;
+
+static void fat16_item_key(struct fat_directory_item *item, char *key) {
+  char name[VIOS_FAT_MAX_NAME];
+  fat_get_full_relative_filename(item, name, sizeof(name));
+  fat_name_key(name, key);
+}
+
+static bool fat16_valid_name_char(char c) {
+  const char *invalid = "\"*+,/:;<=>?[\\]|. ";
+  if (c < 0x20 || c > 0x7E) {
+    return false;
   }
 
-  struct path_part *next_part = path->next;
-  current_item = root_item;
-  while (next_part != 0) {
-    if (current_item->type != FAT_ITEM_TYPE_DIRECTORY) {
-      current_item = 0;
-      break;
+  for (int i = 0; invalid[i]; i++) {
+    if (c == invalid[i]) {
+      return false;
     }
-
-    struct fat_item *tmp_item = fat16_find_item_in_directory(
-        disk, current_item->directory, next_part->part);
-    fat16_fat_item_free(current_item);
-    current_item = tmp_item;
-    next_part = next_part->next;
   }
-out:
-  return current_item;
+
+  return true;
 }
 
-void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
-  struct fat_file_descriptor *descriptor = 0;
-  int err_code = 0;
-  if (mode != FILE_MODE_READ) {
-    err_code = -ERDONLY;
-    goto err_out;
+/**
+ * Fills in the 8.3 name of "item" from "name", stored upper case and
+ * padded with spaces
+ */
+static int fat16_short_name(const char *name,
+                            struct fat_directory_item *item) {
+  memset(item->filename, ' ', sizeof(item->filename));
+  memset(item->ext, ' ', sizeof(item->ext));
+
+  int i = 0;
+  int total = 0;
+  for (; name[i] && name[i] != '.'; i++) {
+    if (total == sizeof(item->filename) || !fat16_valid_name_char(name[i])) {
+      return -EINVARG;
+    }
+    item->filename[total++] = toupper(name[i]);
   }
 
-  descriptor = kzalloc(sizeof(struct fat_file_descriptor));
-  if (!descriptor) {
-    err_code = -ENOMEM;
-    goto err_out;
+  if (total == 0) {
+    return -EINVARG;
   }
 
-  descriptor->item = fat16_get_directory_entry(disk, path);
-  if (!descriptor->item) {
-    err_code = -EIO;
-    goto err_out;
+  if (name[i] == '.') {
+    i++;
+    total = 0;
+    for (; name[i]; i++) {
+      if (total == sizeof(item->ext) || !fat16_valid_name_char(name[i])) {
+        return -EINVARG;
+      }
+      item->ext[total++] = toupper(name[i]);
+    }
   }
 
-  descriptor->pos = 0;
-  return descriptor;
+  return 0;
+}
 
-err_out:
-  if (descriptor)
-    kfree(descriptor);
+/**
+ * Byte position on the disk of slot "slot" of "directory"
+ */
+static int fat16_directory_slot_pos(struct disk *disk,
+                                    struct fat_directory *directory, int slot,
+                                    uint32_t *pos) {
+  struct fat_private *private = disk->fs_private;
+  uint32_t offset = slot * sizeof(struct fat_directory_item);
+  if (directory == &private->root_directory) {
+    *pos = directory->sector_pos * disk->sector_size + offset;
+    return 0;
+  }
 
-  return ERROR(err_code);
-}
+  uint32_t size_of_cluster_bytes =
+      private->header.primary_header.sectors_per_cluster * disk->sector_size;
+  uint32_t file_cluster = offset / size_of_cluster_bytes;
+  struct fat_extent *extent =
+      fat_find_extent(&directory->extents, file_cluster);
+  if (!extent) {
+    return -EOUTOFRANGE;
+  }
 
-static void fat16_free_file_descriptor(struct fat_file_descriptor *desc) {
-  fat16_fat_item_free(desc->item);
-  kfree(desc);
+  int cluster = extent->cluster + (file_cluster - extent->file_cluster);
+  *pos = fat16_cluster_to_sector(private, cluster) * disk->sector_size +
+         offset % size_of_cluster_bytes;
+  return 0;
 }
 
-int fat16_close(void *private) {
-  fat16_free_file_descriptor((struct fat_file_descriptor *)private);
+/**
+ * Looks "name" up in "directory" through the dentry cache, both found
+ * and missing names are remembered. A directory is known to its
+ * children by its first cluster, which stays the same while it exists
+ */
+static struct fs_dentry *fat16_lookup(struct disk *disk, uint32_t parent,
+                                      struct fat_directory *directory,
+                                      const char *name) {
+  char key[VIOS_FAT_MAX_NAME];
+  if (fat_name_key(name, key) < 0) {
+    return 0;
+  }
+
+  struct fs_dentry *entry = fs_dcache_lookup(disk, parent, key);
+  if (entry) {
+    return entry->data ? entry : 0;
+  }
+
+  int slot = fat_find_item(directory->item, directory->total, key);
+  if (slot < 0) {
+    fs_dcache_insert(disk, parent, key, 0, 0, 0);
+    return 0;
+  }
+
+  struct fat_dentry *dentry = kzalloc(sizeof(struct fat_dentry));
+  if (!dentry) {
+    return 0;
+  }
+
+  dentry->item = directory->item[slot];
+  if (fat16_directory_slot_pos(disk, directory, slot, &dentry->entry_pos) <
+      0) {
+    kfree(dentry);
+    return 0;
+  }
+
+  return fs_dcache_insert(disk, parent, key,
+                          fat_get_first_cluster(&dentry->item), dentry,
+                          fat16_dentry_release);
+}
+
+/**
+ * Writes a directory entry back to its slot and drops what the dentry
+ * cache knew under "key". The root directory is patched in memory, a
+ * changed subdirectory is loaded again by the next path through it
+ */
+static int fat16_update_directory_item(struct disk *disk, uint32_t parent,
+                                       uint32_t pos,
+                                       struct fat_directory_item *item,
+                                       const char *key) {
+  int res = 0;
+  struct fat_private *private = disk->fs_private;
+  struct disk_stream *stream = private->directory_stream;
+  res = diskstreamer_seek(stream, pos);
+  if (res < 0) {
+    goto out;
+  }
+
+  res = diskstreamer_write(stream, item, sizeof(*item));
+  if (res < 0) {
+    goto out;
+  }
+
+  if (parent == FS_DCACHE_ROOT) {
+    struct fat_directory *root = &private->root_directory;
+    int slot = (pos - root->sector_pos * disk->sector_size) / sizeof(*item);
+    root->item[slot] = *item;
+    if (slot >= root->total) {
+      root->total = slot + 1;
+    }
+  } else {
+    fs_dcache_remove_id(disk, parent);
+  }
+
+  fs_dcache_remove(disk, parent, key);
+  diskstreamer_invalidate(private->cluster_read_stream);
+out:
+  return res;
+}
+
+/**
+ * Follows "path" through the dentry cache. Gives back the directory
+ * holding the last part with its dentry id, and the entry of the last
+ * part, which is NULL when only that part does not exist
+ */
+static int fat16_walk(struct disk *disk, struct path_part *path,
+                      struct fat_directory **directory_out,
+                      uint32_t *parent_out, struct fat_dentry **dentry_out) {
+  struct fat_private *fat_private = disk->fs_private;
+  struct fat_directory *directory = &fat_private->root_directory;
+  uint32_t parent = FS_DCACHE_ROOT;
+  struct fs_dentry *entry = 0;
+  if (!path) {
+    return -EBADPATH;
+  }
+
+  for (struct path_part *part = path; part; part = part->next) {
+    if (entry) {
+      struct fat_dentry *dentry = entry->data;
+      if (!(dentry->item.attribute & FAT_FILE_SUBDIRECTORY)) {
+        return -EBADPATH;
+      }
+
+      if (!dentry->directory) {
+        dentry->directory = fat16_load_fat_directory(disk, &dentry->item);
+        if (!dentry->directory) {
+          return -EIO;
+        }
+      }
+      directory = dentry->directory;
+      parent = entry->id;
+    }
+
+    entry = fat16_lookup(disk, parent, directory, part->part);
+    if (!entry && part->next) {
+      return -EBADPATH;
+    }
+  }
+
+  *directory_out = directory;
+  *parent_out = parent;
+  *dentry_out = entry ? entry->data : 0;
+  return 0;
+}
+
+static struct fat_item *fat16_new_fat_item(struct disk *disk, uint32_t parent,
+                                           struct fat_directory_item *item,
+                                           uint32_t entry_pos) {
+  struct fat_item *f_item = fat16_new_fat_item_for_directory_item(disk, item);
+  if (f_item) {
+    f_item->parent = parent;
+    f_item->entry_pos = entry_pos;
+  }
+
+  return f_item;
+}
+
+struct fat_item *fat16_get_directory_entry(struct disk *disk,
+                                           struct path_part *path) {
+  struct fat_directory *directory = 0;
+  uint32_t parent = 0;
+  struct fat_dentry *dentry = 0;
+  if (fat16_walk(disk, path, &directory, &parent, &dentry) < 0 || !dentry) {
+    return 0;
+  }
+
+  return fat16_new_fat_item(disk, parent, &dentry->item, dentry->entry_pos);
+}
+
+/**
+ * Adds one zeroed cluster to a full subdirectory, the root directory
+ * cannot grow
+ */
+static int fat16_grow_directory(struct disk *disk,
+                                struct fat_directory *directory) {
+  int res = 0;
+  struct fat_private *private = disk->fs_private;
+  uint32_t size_of_cluster_bytes =
+      private->header.primary_header.sectors_per_cluster * disk->sector_size;
+  uint8_t *zeroes = 0;
+  if (directory == &private->root_directory) {
+    res = -ENOSPC;
+    goto out;
+  }
+
+  uint32_t clusters = fat_extent_map_clusters(&directory->extents);
+  res = fat16_allocate_clusters(disk, &directory->extents, clusters + 1);
+  if (res < 0) {
+    goto out;
+  }
+
+  zeroes = kzalloc(size_of_cluster_bytes);
+  if (!zeroes) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  res = fat16_write_internal(disk, &directory->extents,
+                             clusters * size_of_cluster_bytes,
+                             size_of_cluster_bytes, zeroes);
+  if (res < 0) {
+    goto out;
+  }
+
+  directory->capacity +=
+      size_of_cluster_bytes / sizeof(struct fat_directory_item);
+  res = 0;
+out:
+  if (zeroes) {
+    kfree(zeroes);
+  }
+  return res;
+}
+
+/**
+ * Adds an empty file called "name" to "directory", taking the first
+ * deleted slot or the one after the last entry
+ */
+static int fat16_create(struct disk *disk, struct fat_directory *directory,
+                        uint32_t parent, const char *name,
+                        struct fat_directory_item *item, uint32_t *pos) {
+  int res = 0;
+  char key[VIOS_FAT_MAX_NAME];
+  memset(item, 0, sizeof(*item));
+  res = fat_name_key(name, key);
+  if (res < 0) {
+    goto out;
+  }
+
+  res = fat16_short_name(name, item);
+  if (res < 0) {
+    goto out;
+  }
+  item->attribute = FAT_FILE_ARCHIVED;
+
+  int slot = 0;
+  while (slot < directory->total &&
+         directory->item[slot].filename[0] != VIOS_FAT_DIRECTORY_DELETED) {
+    slot++;
+  }
+
+  if (slot == directory->capacity) {
+    res = fat16_grow_directory(disk, directory);
+    if (res < 0) {
+      goto out;
+    }
+  }
+
+  res = fat16_directory_slot_pos(disk, directory, slot, pos);
+  if (res < 0) {
+    goto out;
+  }
+
+  res = fat16_update_directory_item(disk, parent, *pos, item, key);
+  if (res < 0) {
+    goto out;
+  }
+
+  // A grown directory links its new cluster right away
+  res = fat16_flush_fat(disk);
+out:
+  return res;
+}
+
+/**
+ * Builds the extent map of an open file the first time it is needed
+ */
+static int fat16_file_extents(struct disk *disk,
+                              struct fat_file_descriptor *desc) {
+  if (desc->extents.extents) {
+    return 0;
+  }
+
+  return fat16_build_extent_map(disk, fat_get_first_cluster(desc->item->item),
+                                &desc->extents);
+}
+
+/**
+ * Grows the chain of an open file to hold "size" bytes, an empty file
+ * gets its first cluster in its directory entry
+ */
+static int fat16_reserve(struct disk *disk, struct fat_file_descriptor *desc,
+                         uint32_t size) {
+  struct fat_private *private = disk->fs_private;
+  struct fat_directory_item *item = desc->item->item;
+  uint32_t size_of_cluster_bytes =
+      private->header.primary_header.sectors_per_cluster * disk->sector_size;
+  uint32_t clusters =
+      ((uint64_t)size + size_of_cluster_bytes - 1) / size_of_cluster_bytes;
+  int res = fat16_allocate_clusters(disk, &desc->extents, clusters);
+  if (!fat_get_first_cluster(item) && desc->extents.total) {
+    item->low_16_bits_first_cluster = desc->extents.extents[0].cluster;
+    item->high_16_bits_first_cluster = 0;
+    desc->dirty = true;
+  }
+
+  return res;
+}
+
+void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
+  struct fat_private *private = disk->fs_private;
+  struct fat_file_descriptor *descriptor = 0;
+  struct fat_directory *directory = 0;
+  uint32_t parent = 0;
+  struct fat_dentry *dentry = 0;
+  int err_code = 0;
+  if (mode != FILE_MODE_READ && !fat16_writable(private)) {
+    err_code = -ERDONLY;
+    goto err_out;
+  }
+
+  descriptor = kzalloc(sizeof(struct fat_file_descriptor));
+  if (!descriptor) {
+    err_code = -ENOMEM;
+    goto err_out;
+  }
+
+  err_code = fat16_walk(disk, path, &directory, &parent, &dentry);
+  if (err_code < 0) {
+    goto err_out;
+  }
+
+  if (dentry) {
+    descriptor->item =
+        fat16_new_fat_item(disk, parent, &dentry->item, dentry->entry_pos);
+  } else if (mode != FILE_MODE_READ) {
+    struct path_part *last = path;
+    while (last->next) {
+      last = last->next;
+    }
+
+    struct fat_directory_item item;
+    uint32_t entry_pos = 0;
+    err_code = fat16_create(disk, directory, parent, last->part, &item,
+                            &entry_pos);
+    if (err_code < 0) {
+      goto err_out;
+    }
+    descriptor->item = fat16_new_fat_item(disk, parent, &item, entry_pos);
+  }
+
+  if (!descriptor->item) {
+    err_code = -EIO;
+    goto err_out;
+  }
+
+  descriptor->pos = 0;
+  if (mode != FILE_MODE_READ) {
+    if (descriptor->item->type != FAT_ITEM_TYPE_FILE ||
+        (descriptor->item->item->attribute & FAT_FILE_READ_ONLY)) {
+      err_code = -ERDONLY;
+      goto err_out;
+    }
+
+    if (mode == FILE_MODE_WRITE) {
+      err_code = fat16_truncate(disk, descriptor, 0);
+      if (err_code < 0) {
+        goto err_out;
+      }
+    } else {
+      descriptor->pos = descriptor->item->item->filesize;
+    }
+  }
+
+  return descriptor;
+
+err_out:
+  if (descriptor) {
+    if (descriptor->item) {
+      fat16_fat_item_free(descriptor->item);
+    }
+    kfree(descriptor);
+  }
+
+  return ERROR(err_code);
+}
+
+static void fat16_free_file_descriptor(struct fat_file_descriptor *desc) {
+  fat16_fat_item_free(desc->item);
+  if (desc->extents.extents) {
+    kfree(desc->extents.extents);
+  }
+  kfree(desc);
+}
+
+int fat16_close(void *private) {
+  fat16_free_file_descriptor((struct fat_file_descriptor *)private);
   return 0;
 }
 
@@ -649,6 +1372,7 @@ int fat16_stat(struct disk *disk, void *private, struct file_stat *stat) {
   struct fat_directory_item *ritem = desc_item->item;
   stat->filesize = ritem->filesize;
   stat->flags = 0x00;
+  stat->id = fat_get_first_cluster(ritem);
 
   if (ritem->attribute & FAT_FILE_READ_ONLY) {
     stat->flags |= FILE_STAT_READ_ONLY;
@@ -661,24 +1385,75 @@ int fat16_read(struct disk *disk, void *descriptor, uint32_t size,
                uint32_t nmemb, char *out_ptr) {
   int res = 0;
   struct fat_file_descriptor *fat_desc = descriptor;
+  uint64_t total = (uint64_t)size * nmemb;
+  if (total > 0x7FFFFFFF) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  res = fat16_file_extents(disk, fat_desc);
+  if (res < 0) {
+    goto out;
+  }
+
+  // Like fread only the whole elements before the end of the file are read
   struct fat_directory_item *item = fat_desc->item->item;
-  int offset = fat_desc->pos;
-  for (uint32_t i = 0; i < nmemb; i++) {
-    res = fat16_read_internal(disk, fat16_get_first_cluster(item), offset, size,
-                              out_ptr);
-    if (ISERR(res)) {
-      goto out;
-    }
+  uint32_t left = item->filesize > fat_desc->pos
+                      ? item->filesize - fat_desc->pos
+                      : 0;
+  if (nmemb > left / size) {
+    nmemb = left / size;
+    total = (uint64_t)size * nmemb;
+  }
 
-    out_ptr += size;
-    offset += size;
+  // Every element is read in one pass, the extents cover them all
+  res = fat16_read_internal(disk, &fat_desc->extents, fat_desc->pos, total,
+                            out_ptr);
+  if (ISERR(res)) {
+    goto out;
   }
-  fat_desc->pos = offset;
+
+  fat_desc->pos += total;
   res = nmemb;
 out:
   return res;
 }
 
+/**
+ * Fills every buffer from the extents in one pass, see fat16_rw_extents
+ */
+int fat16_readv(struct disk *disk, void *descriptor,
+                const struct file_iovec *iov, int iovcnt, int64_t offset) {
+  int res = 0;
+  struct fat_file_descriptor *fat_desc = descriptor;
+  struct file_iovec clamped[VIOS_FILE_MAX_IOVECS];
+  if (fat_desc->item->type != FAT_ITEM_TYPE_FILE ||
+      iovcnt > VIOS_FILE_MAX_IOVECS) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  res = fat16_file_extents(disk, fat_desc);
+  if (res < 0) {
+    goto out;
+  }
+
+  uint32_t pos = offset == FILE_POSITION_CURRENT ? fat_desc->pos : offset;
+  uint32_t filesize = fat_desc->item->item->filesize;
+  uint32_t left = filesize > pos ? filesize - pos : 0;
+  iovcnt = file_iovec_clamp(iov, iovcnt, left, clamped);
+  res = fat16_readv_internal(disk, &fat_desc->extents, pos, clamped, iovcnt);
+  if (res < 0) {
+    goto out;
+  }
+
+  if (offset == FILE_POSITION_CURRENT) {
+    fat_desc->pos += res;
+  }
+out:
+  return res;
+}
+
 int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
   int res = 0;
   struct fat_file_descriptor *desc = private;
@@ -688,8 +1463,9 @@ int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
     goto out;
   }
 
+  // The end of the file is a valid position, writes append from there
   struct fat_directory_item *ritem = desc_item->item;
-  if (offset >= ritem->filesize) {
+  if (offset > ritem->filesize) {
     res = -EIO;
     goto out;
   }
@@ -714,3 +1490,204 @@ int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
 out:
   return res;
 }
+
+/**
+ * Writes at the file position, clusters are allocated as the file grows
+ * and the directory entry catches up on the next sync
+ */
+int fat16_write(struct disk *disk, void *descriptor, uint32_t size,
+                uint32_t nmemb, const char *in) {
+  int res = 0;
+  struct fat_file_descriptor *fat_desc = descriptor;
+  struct fat_directory_item *item = fat_desc->item->item;
+  uint64_t total = (uint64_t)size * nmemb;
+  if (fat_desc->item->type != FAT_ITEM_TYPE_FILE || total > 0x7FFFFFFF ||
+      fat_desc->pos + total > 0xFFFFFFFF) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  res = fat16_file_extents(disk, fat_desc);
+  if (res < 0) {
+    goto out;
+  }
+
+  uint32_t end = fat_desc->pos + total;
+  res = fat16_reserve(disk, fat_desc, end);
+  if (res < 0) {
+    goto out;
+  }
+
+  res = fat16_write_internal(disk, &fat_desc->extents, fat_desc->pos, total,
+                             in);
+  if (res < 0) {
+    goto out;
+  }
+
+  fat_desc->pos = end;
+  if (end > item->filesize) {
+    item->filesize = end;
+    fat_desc->dirty = true;
+  }
+  res = nmemb;
+out:
+  return res;
+}
+
+/**
+ * Sets the file size, a shrinking file frees the clusters it no longer
+ * needs and a growing one reads back zeroes past its old end
+ */
+int fat16_truncate(struct disk *disk, void *descriptor, uint32_t size) {
+  int res = 0;
+  struct fat_file_descriptor *desc = descriptor;
+  struct fat_private *private = disk->fs_private;
+  uint8_t *zeroes = 0;
+  if (desc->item->type != FAT_ITEM_TYPE_FILE) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  struct fat_directory_item *item = desc->item->item;
+  res = fat16_file_extents(disk, desc);
+  if (res < 0) {
+    goto out;
+  }
+
+  uint32_t size_of_cluster_bytes =
+      private->header.primary_header.sectors_per_cluster * disk->sector_size;
+  if (size > item->filesize) {
+    res = fat16_reserve(disk, desc, size);
+    if (res < 0) {
+      goto out;
+    }
+
+    zeroes = kzalloc(size_of_cluster_bytes);
+    if (!zeroes) {
+      res = -ENOMEM;
+      goto out;
+    }
+
+    uint32_t pos = item->filesize;
+    while (pos < size) {
+      uint32_t total = size - pos;
+      if (total > size_of_cluster_bytes) {
+        total = size_of_cluster_bytes;
+      }
+
+      res = fat16_write_internal(disk, &desc->extents, pos, total, zeroes);
+      if (res < 0) {
+        goto out;
+      }
+      pos += total;
+    }
+  } else {
+    uint32_t clusters =
+        ((uint64_t)size + size_of_cluster_bytes - 1) / size_of_cluster_bytes;
+    fat16_free_clusters(disk, &desc->extents, clusters);
+    if (clusters == 0) {
+      item->low_16_bits_first_cluster = 0;
+      item->high_16_bits_first_cluster = 0;
+    }
+  }
+
+  if (item->filesize != size) {
+    item->filesize = size;
+    desc->dirty = true;
+  }
+
+  if (desc->pos > size) {
+    desc->pos = size;
+  }
+  res = 0;
+out:
+  if (zeroes) {
+    kfree(zeroes);
+  }
+  return res;
+}
+
+/**
+ * Writes the directory entry of the file back when it changed, then
+ * every FAT sector changed since the last sync in one batch
+ */
+int fat16_sync(struct disk *disk, void *descriptor) {
+  int res = 0;
+  struct fat_file_descriptor *desc = descriptor;
+  if (desc->item->type == FAT_ITEM_TYPE_FILE && desc->dirty) {
+    char key[VIOS_FAT_MAX_NAME];
+    fat16_item_key(desc->item->item, key);
+    res = fat16_update_directory_item(disk, desc->item->parent,
+                                      desc->item->entry_pos, desc->item->item,
+                                      key);
+    if (res < 0) {
+      goto out;
+    }
+    desc->dirty = false;
+  }
+
+  res = fat16_flush_fat(disk);
+out:
+  return res;
+}
+
+/**
+ * Frees the clusters of a file and marks its directory entry deleted,
+ * directories cannot be removed
+ */
+int fat16_unlink(struct disk *disk, struct path_part *path) {
+  int res = 0;
+  struct fat_private *private = disk->fs_private;
+  struct fat_directory *directory = 0;
+  uint32_t parent = 0;
+  struct fat_dentry *dentry = 0;
+  struct fat_extent_map map = {0};
+  if (!fat16_writable(private)) {
+    res = -ERDONLY;
+    goto out;
+  }
+
+  res = fat16_walk(disk, path, &directory, &parent, &dentry);
+  if (res < 0) {
+    goto out;
+  }
+
+  if (!dentry) {
+    res = -EIO;
+    goto out;
+  }
+
+  // The dentry is dropped once the entry changes, keep what we need
+  struct fat_directory_item item = dentry->item;
+  uint32_t entry_pos = dentry->entry_pos;
+  if (item.attribute & FAT_FILE_SUBDIRECTORY) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  if (item.attribute & FAT_FILE_READ_ONLY) {
+    res = -ERDONLY;
+    goto out;
+  }
+
+  res = fat16_build_extent_map(disk, fat_get_first_cluster(&item), &map);
+  if (res < 0) {
+    goto out;
+  }
+  fat16_free_clusters(disk, &map, 0);
+
+  char key[VIOS_FAT_MAX_NAME];
+  fat16_item_key(&item, key);
+  item.filename[0] = VIOS_FAT_DIRECTORY_DELETED;
+  res = fat16_update_directory_item(disk, parent, entry_pos, &item, key);
+  if (res < 0) {
+    goto out;
+  }
+
+  res = fat16_flush_fat(disk);
+out:
+  if (map.extents) {
+    kfree(map.extents);
+  }
+  return res;
+}
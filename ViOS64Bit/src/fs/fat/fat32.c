@@ -0,0 +1,875 @@
+#include "fat32.h"
+#include "config.h"
+#include "disk/disk.h"
+#include "fat_common.h"
+#include "fs/dcache.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include "string/string.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define VIOS_FAT32_SIGNATURE 0x29
+#define VIOS_FAT32_FAT_ENTRY_SIZE 0x04
+
+// The top four bits of a FAT32 entry are reserved
+#define VIOS_FAT32_ENTRY_MASK 0x0FFFFFFF
+#define VIOS_FAT32_BAD_CLUSTER 0x0FFFFFF7
+#define VIOS_FAT32_END_OF_CHAIN 0x0FFFFFF8
+#define VIOS_FAT32_UNUSED 0x00
+
+#define VIOS_FAT32_FSINFO_LEAD_SIGNATURE 0x41615252
+#define VIOS_FAT32_FSINFO_STRUCT_SIGNATURE 0x61417272
+#define VIOS_FAT32_FSINFO_TRAIL_SIGNATURE 0xAA550000
+// A hint the formatter left unset
+#define VIOS_FAT32_FSINFO_UNKNOWN 0xFFFFFFFF
+
+// Cluster reads queued before a file read waits on them
+#define VIOS_FAT32_MAX_BIOS 16
+
+typedef unsigned int FAT32_ITEM_TYPE;
+#define FAT32_ITEM_TYPE_DIRECTORY 0
+#define FAT32_ITEM_TYPE_FILE 1
+
+struct fat32_header {
+  uint8_t short_jmp_ins[3];
+  uint8_t oem_identifier[8];
+  uint16_t bytes_per_sector;
+  uint8_t sectors_per_cluster;
+  uint16_t reserved_sectors;
+  uint8_t fat_copies;
+  // Both zero on FAT32, the root directory is a cluster chain
+  uint16_t root_dir_entries;
+  uint16_t number_of_sectors;
+  uint8_t media_type;
+  // Zero on FAT32, "sectors_per_fat32" holds the size
+  uint16_t sectors_per_fat;
+  uint16_t sectors_per_track;
+  uint16_t number_of_heads;
+  uint32_t hidden_sectors;
+  uint32_t sectors_big;
+  uint32_t sectors_per_fat32;
+  uint16_t extended_flags;
+  uint16_t version;
+  uint32_t root_cluster;
+  uint16_t fsinfo_sector;
+  uint16_t backup_boot_sector;
+  uint8_t reserved[12];
+} __attribute__((packed));
+
+struct fat32_header_extended {
+  uint8_t drive_number;
+  uint8_t win_nt_bit;
+  uint8_t signature;
+  uint32_t volume_id;
+  uint8_t volume_id_string[11];
+  uint8_t system_id_string[8];
+} __attribute__((packed));
+
+struct fat32_h {
+  struct fat32_header primary_header;
+  struct fat32_header_extended extended_header;
+} __attribute__((packed));
+
+// The sector "fsinfo_sector" points at, its counts are only hints
+struct fat32_fsinfo {
+  uint32_t lead_signature;
+  uint8_t reserved[480];
+  uint32_t struct_signature;
+  uint32_t free_clusters;
+  uint32_t next_free_cluster;
+  uint8_t reserved2[12];
+  uint32_t trail_signature;
+} __attribute__((packed));
+
+struct fat32_directory {
+  struct fat_directory_item *item;
+  int total;
+};
+
+struct fat32_item {
+  union {
+    struct fat_directory_item *item;
+    struct fat32_directory *directory;
+  };
+
+  FAT32_ITEM_TYPE type;
+};
+
+struct fat32_file_descriptor {
+  struct fat32_item *item;
+  uint32_t pos;
+
+  // Built on the first read, file offsets resolve to sectors through it
+  struct fat_extent_map extents;
+};
+
+struct fat32_private {
+  struct fat32_h header;
+
+  // The root directory is loaded like any other directory
+  struct fat32_directory *root_directory;
+
+  // Data clusters start here and are numbered from two
+  uint32_t data_start_sector;
+  uint32_t total_clusters;
+
+  // The FAT read in whole at mount time when it fits the cache limit.
+  // NULL otherwise, entries are then read a sector at a time
+  uint32_t *fat_table;
+  uint32_t *fat_sector;
+  uint32_t fat_sector_lba;
+
+  // From FSInfo, or counted from the cached FAT when the hint is unset
+  uint32_t free_clusters;
+  uint32_t next_free_cluster;
+
+  // Holds a sector while a read copies part of it
+  uint8_t *sector;
+
+  char name[11];
+};
+
+int fat32_resolve(struct disk *disk);
+void *fat32_open(struct disk *disk, struct path_part *path, FILE_MODE mode);
+int fat32_read(struct disk *disk, void *descriptor, uint32_t size,
+               uint32_t nmemb, char *out_ptr);
+int fat32_readv(struct disk *disk, void *descriptor,
+                const struct file_iovec *iov, int iovcnt, int64_t offset);
+int fat32_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
+int fat32_stat(struct disk *disk, void *private, struct file_stat *stat);
+int fat32_close(void *private);
+int fat32_volume_name(void *private, char *name_out, size_t max);
+
+struct filesystem fat32_fs = {.resolve = fat32_resolve,
+                              .open = fat32_open,
+                              .read = fat32_read,
+                              .readv = fat32_readv,
+                              .seek = fat32_seek,
+                              .stat = fat32_stat,
+                              .close = fat32_close,
+                              .volume_name = fat32_volume_name};
+
+struct filesystem *fat32_init() {
+  strcpy(fat32_fs.name, "FAT32");
+  return &fat32_fs;
+}
+
+static uint32_t fat32_cluster_to_sector(struct fat32_private *private,
+                                        uint32_t cluster) {
+  return private->data_start_sector +
+         (cluster - 2) * private->header.primary_header.sectors_per_cluster;
+}
+
+/**
+ * Reads the FAT entries that map data clusters with one request, the
+ * sectors past the last cluster are never needed
+ */
+static int fat32_load_fat_table(struct disk *disk,
+                                struct fat32_private *private) {
+  int res = 0;
+  struct fat32_header *header = &private->header.primary_header;
+  uint32_t entries = private->total_clusters + 2;
+  uint32_t bytes = entries * VIOS_FAT32_FAT_ENTRY_SIZE;
+  uint32_t sectors = (bytes + disk->sector_size - 1) / disk->sector_size;
+  if (sectors > header->sectors_per_fat32) {
+    sectors = header->sectors_per_fat32;
+  }
+
+  if ((size_t)sectors * disk->sector_size > VIOS_FAT32_MAX_FAT_CACHE_BYTES) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  uint32_t *table = kmalloc(sectors * disk->sector_size);
+  if (!table) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  res = disk_read_block(disk, header->reserved_sectors, sectors, table);
+  if (res < 0) {
+    kfree(table);
+    goto out;
+  }
+
+  private->fat_table = table;
+out:
+  return res;
+}
+
+static int fat32_get_fat_entry(struct disk *disk, uint32_t cluster) {
+  struct fat32_private *private = disk->fs_private;
+  if (cluster < 2 || cluster >= private->total_clusters + 2) {
+    return -EIO;
+  }
+
+  if (private->fat_table) {
+    return private->fat_table[cluster] & VIOS_FAT32_ENTRY_MASK;
+  }
+
+  uint32_t per_sector = disk->sector_size / VIOS_FAT32_FAT_ENTRY_SIZE;
+  uint32_t lba =
+      private->header.primary_header.reserved_sectors + cluster / per_sector;
+  if (lba != private->fat_sector_lba) {
+    int res = disk_read_block(disk, lba, 1, private->fat_sector);
+    if (res < 0) {
+      private->fat_sector_lba = 0;
+      return res;
+    }
+    private->fat_sector_lba = lba;
+  }
+
+  return private->fat_sector[cluster % per_sector] & VIOS_FAT32_ENTRY_MASK;
+}
+
+/**
+ * Gets the cluster that follows "cluster" in its chain, zero at the end
+ * of the chain
+ */
+static int fat32_get_next_cluster(struct disk *disk, uint32_t cluster) {
+  int entry = fat32_get_fat_entry(disk, cluster);
+  if (entry < 0) {
+    return entry;
+  }
+
+  if (entry >= VIOS_FAT32_END_OF_CHAIN) {
+    return 0;
+  }
+
+  if (entry == VIOS_FAT32_BAD_CLUSTER || entry == VIOS_FAT32_UNUSED) {
+    return -EIO;
+  }
+
+  return entry;
+}
+
+// No chain is longer than the volume, a longer one loops
+static int fat32_build_extent_map(struct disk *disk, uint32_t first_cluster,
+                                  struct fat_extent_map *map) {
+  struct fat32_private *private = disk->fs_private;
+  return fat_build_extent_map(disk, first_cluster, private->total_clusters,
+                              fat32_get_next_cluster, map);
+}
+
+/**
+ * Copies "total" bytes from "offset" within sector "lba". Volumes past
+ * 2GB do not fit the byte positions of a disk stream, so partial sectors
+ * are read whole from the block cache instead
+ */
+static int fat32_read_partial(struct disk *disk, uint32_t lba, int offset,
+                              int total, void *out) {
+  struct fat32_private *private = disk->fs_private;
+  int res = disk_read_block(disk, lba, 1, private->sector);
+  if (res < 0) {
+    return res;
+  }
+
+  memcpy(out, private->sector + offset, total);
+  return VIOS_ALL_OK;
+}
+
+/**
+ * Reads "total" bytes at "offset" through the extent map. The whole
+ * sectors of each contiguous run are queued as one bio under a plug,
+ * partial sectors at either end of a run are copied out of the cache
+ */
+static int fat32_read_extents(struct disk *disk, struct fat_extent_map *map,
+                              uint32_t offset, int total, void *out) {
+  int res = VIOS_ALL_OK;
+  struct fat32_private *private = disk->fs_private;
+  int sector_size = disk->sector_size;
+  uint32_t size_of_cluster_bytes =
+      private->header.primary_header.sectors_per_cluster * sector_size;
+  int bytes_read = 0;
+  struct disk_bio bios[VIOS_FAT32_MAX_BIOS];
+  int total_bios = 0;
+
+  disk_queue_plug(disk);
+  while (total > 0) {
+    uint32_t file_cluster = offset / size_of_cluster_bytes;
+    struct fat_extent *extent = fat_find_extent(map, file_cluster);
+    if (!extent) {
+      res = -EOUTOFRANGE;
+      break;
+    }
+
+    uint32_t offset_from_cluster = offset % size_of_cluster_bytes;
+    uint32_t clusters_left =
+        extent->file_cluster + extent->total - file_cluster;
+    uint32_t cluster = extent->cluster + (file_cluster - extent->file_cluster);
+    uint32_t lba = fat32_cluster_to_sector(private, cluster) +
+                   offset_from_cluster / sector_size;
+    int offset_in_sector = offset_from_cluster % sector_size;
+    uint64_t run_bytes =
+        (uint64_t)clusters_left * size_of_cluster_bytes - offset_from_cluster;
+    int total_to_read = run_bytes < (uint64_t)total ? run_bytes : total;
+
+    // Bytes before the first whole sector and the whole sectors after
+    int head = (sector_size - offset_in_sector) % sector_size;
+    if (head > total_to_read) {
+      head = total_to_read;
+    }
+    int sectors = (total_to_read - head) / sector_size;
+    int tail = total_to_read - head - sectors * sector_size;
+
+    if (head) {
+      res = fat32_read_partial(disk, lba, offset_in_sector, head, out);
+      if (res != VIOS_ALL_OK) {
+        break;
+      }
+      lba++;
+    }
+
+    if (sectors) {
+      if (total_bios == VIOS_FAT32_MAX_BIOS) {
+        res = fat_wait_bios(bios, total_bios);
+        total_bios = 0;
+        if (res != VIOS_ALL_OK) {
+          break;
+        }
+      }
+
+      struct disk_bio *bio = &bios[total_bios];
+      disk_bio_init(bio, disk, lba, sectors, (uint8_t *)out + head, false);
+      res = disk_bio_submit(bio);
+      if (res != VIOS_ALL_OK) {
+        break;
+      }
+      total_bios++;
+    }
+
+    if (tail) {
+      res = fat32_read_partial(disk, lba + sectors, 0, tail,
+                               (uint8_t *)out + total_to_read - tail);
+      if (res != VIOS_ALL_OK) {
+        break;
+      }
+    }
+
+    out += total_to_read;
+    offset += total_to_read;
+    bytes_read += total_to_read;
+    total -= total_to_read;
+  }
+  disk_queue_unplug(disk);
+
+  // The bios live on our stack, they must complete even after an error
+  int bios_res = fat_wait_bios(bios, total_bios);
+  if (res == VIOS_ALL_OK) {
+    res = bios_res;
+  }
+
+  if (res < 0) {
+    return res;
+  }
+
+  return bytes_read;
+}
+
+static void fat32_free_directory(struct fat32_directory *directory) {
+  if (!directory) {
+    return;
+  }
+
+  if (directory->item) {
+    kfree(directory->item);
+  }
+
+  kfree(directory);
+}
+
+/**
+ * Reads the whole chain of a directory in one pass, the root directory
+ * included, and counts its entries in memory
+ */
+static struct fat32_directory *fat32_load_directory(struct disk *disk,
+                                                    uint32_t first_cluster) {
+  int res = 0;
+  struct fat32_private *private = disk->fs_private;
+  struct fat_extent_map map = {0};
+  struct fat32_directory *directory = kzalloc(sizeof(struct fat32_directory));
+  if (!directory) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  res = fat32_build_extent_map(disk, first_cluster, &map);
+  if (res < 0) {
+    goto out;
+  }
+
+  uint32_t size_of_cluster_bytes =
+      private->header.primary_header.sectors_per_cluster * disk->sector_size;
+  uint64_t directory_size =
+      (uint64_t)fat_extent_map_clusters(&map) * size_of_cluster_bytes;
+  if (directory_size == 0 || directory_size > 0x7FFFFFFF) {
+    res = -EIO;
+    goto out;
+  }
+
+  directory->item = kzalloc(directory_size);
+  if (!directory->item) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  res = fat32_read_extents(disk, &map, 0, directory_size, directory->item);
+  if (res < 0) {
+    goto out;
+  }
+
+  int max = directory_size / sizeof(struct fat_directory_item);
+  while (directory->total < max &&
+         directory->item[directory->total].filename[0] !=
+             VIOS_FAT_DIRECTORY_END) {
+    directory->total++;
+  }
+  res = VIOS_ALL_OK;
+
+out:
+  if (map.extents) {
+    kfree(map.extents);
+  }
+
+  if (res != VIOS_ALL_OK) {
+    fat32_free_directory(directory);
+    directory = 0;
+  }
+  return directory;
+}
+
+/**
+ * Takes the free cluster count and search hint from FSInfo. Both are
+ * only hints, an unset or impossible count is counted again from the
+ * cached FAT
+ */
+static void fat32_load_fsinfo(struct disk *disk,
+                              struct fat32_private *private) {
+  struct fat32_header *header = &private->header.primary_header;
+  struct fat32_fsinfo *fsinfo = (struct fat32_fsinfo *)private->sector;
+  private->free_clusters = VIOS_FAT32_FSINFO_UNKNOWN;
+  private->next_free_cluster = 2;
+  if (header->fsinfo_sector != 0 && header->fsinfo_sector != 0xFFFF &&
+      disk_read_block(disk, header->fsinfo_sector, 1, fsinfo) >= 0 &&
+      fsinfo->lead_signature == VIOS_FAT32_FSINFO_LEAD_SIGNATURE &&
+      fsinfo->struct_signature == VIOS_FAT32_FSINFO_STRUCT_SIGNATURE &&
+      fsinfo->trail_signature == VIOS_FAT32_FSINFO_TRAIL_SIGNATURE) {
+    if (fsinfo->free_clusters <= private->total_clusters) {
+      private->free_clusters = fsinfo->free_clusters;
+    }
+
+    if (fsinfo->next_free_cluster >= 2 &&
+        fsinfo->next_free_cluster < private->total_clusters + 2) {
+      private->next_free_cluster = fsinfo->next_free_cluster;
+    }
+  }
+
+  if (private->free_clusters == VIOS_FAT32_FSINFO_UNKNOWN &&
+      private->fat_table) {
+    private->free_clusters = 0;
+    for (uint32_t i = 2; i < private->total_clusters + 2; i++) {
+      if ((private->fat_table[i] & VIOS_FAT32_ENTRY_MASK) ==
+          VIOS_FAT32_UNUSED) {
+        private->free_clusters++;
+      }
+    }
+  }
+}
+
+int fat32_resolve(struct disk *disk) {
+  int res = 0;
+  struct fat32_private *private = kzalloc(sizeof(struct fat32_private));
+  if (!private) {
+    return -ENOMEM;
+  }
+
+  private->sector = kzalloc(disk->sector_size);
+  if (!private->sector) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  res = disk_read_block(disk, 0, 1, private->sector);
+  if (res < 0) {
+    goto out;
+  }
+  memcpy(&private->header, private->sector, sizeof(private->header));
+
+  struct fat32_header *header = &private->header.primary_header;
+  if (private->header.extended_header.signature != VIOS_FAT32_SIGNATURE ||
+      header->sectors_per_fat != 0 || header->root_dir_entries != 0 ||
+      header->sectors_per_fat32 == 0 || header->sectors_per_cluster == 0 ||
+      header->bytes_per_sector != disk->sector_size) {
+    res = -EFSNOTUS;
+    goto out;
+  }
+
+  private->data_start_sector =
+      header->reserved_sectors + header->fat_copies * header->sectors_per_fat32;
+  uint32_t total_sectors =
+      header->number_of_sectors ? header->number_of_sectors
+                                : header->sectors_big;
+  if (total_sectors <= private->data_start_sector) {
+    res = -EFSNOTUS;
+    goto out;
+  }
+
+  private->total_clusters = (total_sectors - private->data_start_sector) /
+                            header->sectors_per_cluster;
+  uint32_t fat_entries = header->sectors_per_fat32 *
+                         (disk->sector_size / VIOS_FAT32_FAT_ENTRY_SIZE);
+  if (private->total_clusters + 2 > fat_entries) {
+    private->total_clusters = fat_entries - 2;
+  }
+
+  disk->fs_private = private;
+
+  // Not fatal, chain lookups fall back to reading the FAT a sector at a
+  // time
+  if (fat32_load_fat_table(disk, private) < 0) {
+    private->fat_sector = kzalloc(disk->sector_size);
+    if (!private->fat_sector) {
+      res = -ENOMEM;
+      goto out;
+    }
+  }
+
+  fat32_load_fsinfo(disk, private);
+
+  private->root_directory = fat32_load_directory(disk, header->root_cluster);
+  if (!private->root_directory) {
+    res = -EIO;
+    goto out;
+  }
+
+  strncpy(private->name,
+          (const char *)private->header.extended_header.volume_id_string,
+          sizeof(private->name));
+
+  print("FAT32: ");
+  print(itoa(private->free_clusters));
+  print(" of ");
+  print(itoa(private->total_clusters));
+  print(" clusters free\n");
+
+out:
+  if (res < 0) {
+    if (private->fat_table) {
+      kfree(private->fat_table);
+    }
+    if (private->fat_sector) {
+      kfree(private->fat_sector);
+    }
+    if (private->sector) {
+      kfree(private->sector);
+    }
+    kfree(private);
+    disk->fs_private = 0;
+  }
+  return res;
+}
+
+/**
+ * What the dentry cache keeps for a name found in a directory, the
+ * entries of a subdirectory are loaded the first time a path goes
+ * through it
+ */
+struct fat32_dentry {
+  struct fat_directory_item item;
+  struct fat32_directory *directory;
+};
+
+static void fat32_dentry_release(void *data) {
+  struct fat32_dentry *dentry = data;
+  fat32_free_directory(dentry->directory);
+  kfree(dentry);
+}
+
+/**
+ * Looks "name" up in "directory" through the dentry cache, keyed by the
+ * lower case name. A directory is known to its children by its first
+ * cluster
+ */
+static struct fs_dentry *fat32_lookup(struct disk *disk, uint32_t parent,
+                                      struct fat32_directory *directory,
+                                      const char *name) {
+  char key[VIOS_FAT_MAX_NAME];
+  if (fat_name_key(name, key) < 0) {
+    return 0;
+  }
+
+  struct fs_dentry *entry = fs_dcache_lookup(disk, parent, key);
+  if (entry) {
+    return entry->data ? entry : 0;
+  }
+
+  int slot = fat_find_item(directory->item, directory->total, key);
+  if (slot < 0) {
+    fs_dcache_insert(disk, parent, key, 0, 0, 0);
+    return 0;
+  }
+
+  struct fat32_dentry *dentry = kzalloc(sizeof(struct fat32_dentry));
+  if (!dentry) {
+    return 0;
+  }
+
+  dentry->item = directory->item[slot];
+  return fs_dcache_insert(disk, parent, key,
+                          fat_get_first_cluster(&dentry->item), dentry,
+                          fat32_dentry_release);
+}
+
+static struct fat32_item *
+fat32_new_item(struct disk *disk, struct fat32_dentry *dentry) {
+  struct fat32_item *f_item = kzalloc(sizeof(struct fat32_item));
+  if (!f_item) {
+    return 0;
+  }
+
+  if (dentry->item.attribute & FAT_FILE_SUBDIRECTORY) {
+    f_item->type = FAT32_ITEM_TYPE_DIRECTORY;
+    f_item->directory =
+        fat32_load_directory(disk, fat_get_first_cluster(&dentry->item));
+    return f_item;
+  }
+
+  f_item->type = FAT32_ITEM_TYPE_FILE;
+  f_item->item = kzalloc(sizeof(struct fat_directory_item));
+  if (!f_item->item) {
+    kfree(f_item);
+    return 0;
+  }
+
+  *f_item->item = dentry->item;
+  return f_item;
+}
+
+static void fat32_item_free(struct fat32_item *item) {
+  if (item->type == FAT32_ITEM_TYPE_DIRECTORY) {
+    fat32_free_directory(item->directory);
+  } else if (item->type == FAT32_ITEM_TYPE_FILE) {
+    kfree(item->item);
+  }
+
+  kfree(item);
+}
+
+static struct fat32_item *fat32_get_directory_entry(struct disk *disk,
+                                                    struct path_part *path) {
+  struct fat32_private *private = disk->fs_private;
+  struct fat32_directory *directory = private->root_directory;
+  uint32_t parent = FS_DCACHE_ROOT;
+  struct fat32_dentry *dentry = 0;
+  for (struct path_part *part = path; part; part = part->next) {
+    if (dentry) {
+      if (!(dentry->item.attribute & FAT_FILE_SUBDIRECTORY)) {
+        return 0;
+      }
+
+      if (!dentry->directory) {
+        dentry->directory =
+            fat32_load_directory(disk, fat_get_first_cluster(&dentry->item));
+        if (!dentry->directory) {
+          return 0;
+        }
+      }
+      directory = dentry->directory;
+    }
+
+    struct fs_dentry *entry = fat32_lookup(disk, parent, directory, part->part);
+    if (!entry) {
+      return 0;
+    }
+
+    parent = entry->id;
+    dentry = entry->data;
+  }
+
+  return dentry ? fat32_new_item(disk, dentry) : 0;
+}
+
+void *fat32_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
+  struct fat32_file_descriptor *descriptor = 0;
+  int err_code = 0;
+  if (mode != FILE_MODE_READ) {
+    err_code = -ERDONLY;
+    goto err_out;
+  }
+
+  descriptor = kzalloc(sizeof(struct fat32_file_descriptor));
+  if (!descriptor) {
+    err_code = -ENOMEM;
+    goto err_out;
+  }
+
+  descriptor->item = fat32_get_directory_entry(disk, path);
+  if (!descriptor->item) {
+    err_code = -EIO;
+    goto err_out;
+  }
+
+  return descriptor;
+
+err_out:
+  if (descriptor) {
+    kfree(descriptor);
+  }
+
+  return ERROR(err_code);
+}
+
+int fat32_close(void *private) {
+  struct fat32_file_descriptor *desc = private;
+  fat32_item_free(desc->item);
+  if (desc->extents.extents) {
+    kfree(desc->extents.extents);
+  }
+  kfree(desc);
+  return 0;
+}
+
+int fat32_volume_name(void *private, char *name_out, size_t max) {
+  struct fat32_private *fs_private = private;
+  strncpy(name_out, fs_private->name, max);
+  return 0;
+}
+
+int fat32_stat(struct disk *disk, void *private, struct file_stat *stat) {
+  struct fat32_file_descriptor *descriptor = private;
+  if (descriptor->item->type != FAT32_ITEM_TYPE_FILE) {
+    return -EINVARG;
+  }
+
+  struct fat_directory_item *item = descriptor->item->item;
+  stat->filesize = item->filesize;
+  stat->flags = 0x00;
+  stat->id = fat_get_first_cluster(item);
+  if (item->attribute & FAT_FILE_READ_ONLY) {
+    stat->flags |= FILE_STAT_READ_ONLY;
+  }
+
+  return 0;
+}
+
+int fat32_read(struct disk *disk, void *descriptor, uint32_t size,
+               uint32_t nmemb, char *out_ptr) {
+  int res = 0;
+  struct fat32_file_descriptor *desc = descriptor;
+  uint64_t total = (uint64_t)size * nmemb;
+  if (desc->item->type != FAT32_ITEM_TYPE_FILE || total > 0x7FFFFFFF) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  if (!desc->extents.extents) {
+    struct fat_directory_item *item = desc->item->item;
+    res = fat32_build_extent_map(disk, fat_get_first_cluster(item),
+                                 &desc->extents);
+    if (res < 0) {
+      goto out;
+    }
+  }
+
+  // Like fread only the whole elements before the end of the file are read
+  uint32_t filesize = desc->item->item->filesize;
+  uint32_t left = filesize > desc->pos ? filesize - desc->pos : 0;
+  if (nmemb > left / size) {
+    nmemb = left / size;
+    total = (uint64_t)size * nmemb;
+  }
+
+  res = fat32_read_extents(disk, &desc->extents, desc->pos, total, out_ptr);
+  if (res < 0) {
+    goto out;
+  }
+
+  desc->pos += total;
+  res = nmemb;
+out:
+  return res;
+}
+
+int fat32_readv(struct disk *disk, void *descriptor,
+                const struct file_iovec *iov, int iovcnt, int64_t offset) {
+  int res = 0;
+  struct fat32_file_descriptor *desc = descriptor;
+  struct file_iovec clamped[VIOS_FILE_MAX_IOVECS];
+  if (desc->item->type != FAT32_ITEM_TYPE_FILE ||
+      iovcnt > VIOS_FILE_MAX_IOVECS) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  if (!desc->extents.extents) {
+    struct fat_directory_item *item = desc->item->item;
+    res = fat32_build_extent_map(disk, fat_get_first_cluster(item),
+                                 &desc->extents);
+    if (res < 0) {
+      goto out;
+    }
+  }
+
+  uint32_t pos = offset == FILE_POSITION_CURRENT ? desc->pos : offset;
+  uint32_t filesize = desc->item->item->filesize;
+  uint32_t left = filesize > pos ? filesize - pos : 0;
+  iovcnt = file_iovec_clamp(iov, iovcnt, left, clamped);
+
+  uint32_t done = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    res = fat32_read_extents(disk, &desc->extents, pos + done,
+                             clamped[i].len, clamped[i].base);
+    if (res < 0) {
+      goto out;
+    }
+    done += clamped[i].len;
+  }
+
+  if (offset == FILE_POSITION_CURRENT) {
+    desc->pos += done;
+  }
+  res = done;
+out:
+  return res;
+}
+
+int fat32_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
+  int res = 0;
+  struct fat32_file_descriptor *desc = private;
+  if (desc->item->type != FAT32_ITEM_TYPE_FILE) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  uint32_t filesize = desc->item->item->filesize;
+  switch (seek_mode) {
+  case SEEK_SET:
+    if (offset > filesize) {
+      res = -EIO;
+      break;
+    }
+    desc->pos = offset;
+    break;
+
+  case SEEK_END:
+    res = -EUNIMP;
+    break;
+
+  case SEEK_CUR:
+    if (desc->pos > filesize || offset > filesize - desc->pos) {
+      res = -EIO;
+      break;
+    }
+    desc->pos += offset;
+    break;
+
+  default:
+    res = -EINVARG;
+    break;
+  }
+out:
+  return res;
+}
@@ -0,0 +1,7 @@
+#ifndef FAT32_H
+#define FAT32_H
+
+#include "fs/file.h"
+
+struct filesystem* fat32_init();
+#endif
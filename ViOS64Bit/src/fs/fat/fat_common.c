@@ -0,0 +1,225 @@
+#include "fat_common.h"
+#include "disk/disk.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "status.h"
+#include "string/string.h"
+
+uint32_t fat_get_first_cluster(struct fat_directory_item *item) {
+  return ((uint32_t)item->high_16_bits_first_cluster << 16) |
+         item->low_16_bits_first_cluster;
+}
+
+static void fat_to_proper_string(char **out, const char *in, size_t size) {
+  for (size_t i = 0; i < size && in[i] != 0x00 && in[i] != 0x20; i++) {
+    **out = in[i];
+    *out += 1;
+  }
+
+  **out = 0x00;
+}
+
+void fat_get_full_relative_filename(struct fat_directory_item *item,
+                                    char *out, int max_len) {
+  memset(out, 0x00, max_len);
+  char *out_tmp = out;
+  fat_to_proper_string(&out_tmp, (const char *)item->filename,
+                       sizeof(item->filename));
+  if (item->ext[0] != 0x00 && item->ext[0] != 0x20) {
+    *out_tmp++ = '.';
+    fat_to_proper_string(&out_tmp, (const char *)item->ext,
+                         sizeof(item->ext));
+  }
+}
+
+/**
+ * FAT names ignore case so the dentry cache is keyed by the lower case
+ * name, fails for names longer than any 8.3 name
+ */
+int fat_name_key(const char *name, char *key) {
+  if (strlen(name) >= VIOS_FAT_MAX_NAME) {
+    return -EINVARG;
+  }
+
+  int i = 0;
+  for (; name[i]; i++) {
+    key[i] = tolower(name[i]);
+  }
+  key[i] = 0x00;
+  return 0;
+}
+
+/**
+ * Gives the slot of "name" among the "total" entries of "items", -1 when
+ * it is not there
+ */
+int fat_find_item(struct fat_directory_item *items, int total,
+                  const char *name) {
+  char tmp_filename[VIOS_FAT_MAX_NAME];
+  for (int i = 0; i < total; i++) {
+    struct fat_directory_item *item = &items[i];
+    if (item->filename[0] == VIOS_FAT_DIRECTORY_DELETED ||
+        (item->attribute & FAT_FILE_VOLUME_LABEL)) {
+      continue;
+    }
+
+    fat_get_full_relative_filename(item, tmp_filename, sizeof(tmp_filename));
+    if (istrncmp(tmp_filename, name, sizeof(tmp_filename)) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Walks the chain from "first_cluster" twice, once to count its runs so
+ * the extents are allocated once and then to fill them in. A chain longer
+ * than "max_clusters" loops back on itself
+ */
+int fat_build_extent_map(struct disk *disk, uint32_t first_cluster,
+                         uint32_t max_clusters,
+                         FAT_NEXT_CLUSTER_FUNCTION next_cluster,
+                         struct fat_extent_map *map) {
+  int res = 0;
+  struct fat_extent *extents = NULL;
+  int total = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    int cluster = first_cluster;
+    int previous = -1;
+    uint32_t file_cluster = 0;
+    total = 0;
+    while (cluster != 0) {
+      if (file_cluster >= max_clusters) {
+        res = -EIO;
+        goto out;
+      }
+
+      if (cluster != previous + 1) {
+        if (extents) {
+          extents[total].file_cluster = file_cluster;
+          extents[total].cluster = cluster;
+        }
+        total++;
+      }
+
+      if (extents) {
+        extents[total - 1].total++;
+      }
+
+      previous = cluster;
+      file_cluster++;
+      cluster = next_cluster(disk, cluster);
+      if (cluster < 0) {
+        res = cluster;
+        goto out;
+      }
+    }
+
+    if (total == 0) {
+      break;
+    }
+
+    if (!extents) {
+      extents = kzalloc(total * sizeof(struct fat_extent));
+      if (!extents) {
+        res = -ENOMEM;
+        goto out;
+      }
+    }
+  }
+
+  map->extents = extents;
+  map->total = total;
+  map->capacity = total;
+out:
+  if (res < 0 && extents) {
+    kfree(extents);
+  }
+  return res;
+}
+
+/**
+ * Binary search for the extent holding "file_cluster", NULL when the
+ * chain ends before it
+ */
+struct fat_extent *fat_find_extent(struct fat_extent_map *map,
+                                   uint32_t file_cluster) {
+  int low = 0;
+  int high = map->total - 1;
+  while (low <= high) {
+    int middle = low + (high - low) / 2;
+    struct fat_extent *extent = &map->extents[middle];
+    if (file_cluster < extent->file_cluster) {
+      high = middle - 1;
+    } else if (file_cluster >= extent->file_cluster + extent->total) {
+      low = middle + 1;
+    } else {
+      return extent;
+    }
+  }
+
+  return NULL;
+}
+
+uint32_t fat_extent_map_clusters(struct fat_extent_map *map) {
+  if (!map->total) {
+    return 0;
+  }
+
+  struct fat_extent *last = &map->extents[map->total - 1];
+  return last->file_cluster + last->total;
+}
+
+/**
+ * Adds "total" clusters from "cluster" to the end of the map, growing
+ * the last extent when they continue it
+ */
+int fat_extent_map_append(struct fat_extent_map *map, uint32_t cluster,
+                          uint32_t total) {
+  uint32_t file_cluster = fat_extent_map_clusters(map);
+  if (map->total) {
+    struct fat_extent *last = &map->extents[map->total - 1];
+    if (last->cluster + last->total == cluster) {
+      last->total += total;
+      return 0;
+    }
+  }
+
+  if (map->total == map->capacity) {
+    int capacity = map->capacity ? map->capacity * 2 : 4;
+    struct fat_extent *extents =
+        kzalloc(capacity * sizeof(struct fat_extent));
+    if (!extents) {
+      return -ENOMEM;
+    }
+
+    if (map->extents) {
+      memcpy(extents, map->extents, map->total * sizeof(struct fat_extent));
+      kfree(map->extents);
+    }
+    map->extents = extents;
+    map->capacity = capacity;
+  }
+
+  struct fat_extent *extent = &map->extents[map->total++];
+  extent->file_cluster = file_cluster;
+  extent->cluster = cluster;
+  extent->total = total;
+  return 0;
+}
+
+/**
+ * Waits for every queued bio, returns the first error
+ */
+int fat_wait_bios(struct disk_bio *bios, int total) {
+  int res = VIOS_ALL_OK;
+  for (int i = 0; i < total; i++) {
+    int bio_res = disk_bio_wait(&bios[i]);
+    if (res == VIOS_ALL_OK && bio_res < 0) {
+      res = bio_res;
+    }
+  }
+
+  return res;
+}
@@ -0,0 +1,84 @@
+#ifndef FAT_COMMON_H
+#define FAT_COMMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// First filename byte of the slot that ends a directory and of a
+// deleted entry
+#define VIOS_FAT_DIRECTORY_END 0x00
+#define VIOS_FAT_DIRECTORY_DELETED 0xE5
+
+// Longest 8.3 name with its dot and terminator
+#define VIOS_FAT_MAX_NAME 13
+
+// Fat directory entry attributes bitmask
+#define FAT_FILE_READ_ONLY 0x01
+#define FAT_FILE_HIDDEN 0x02
+#define FAT_FILE_SYSTEM 0x04
+#define FAT_FILE_VOLUME_LABEL 0x08
+#define FAT_FILE_SUBDIRECTORY 0x10
+#define FAT_FILE_ARCHIVED 0x20
+#define FAT_FILE_DEVICE 0x40
+#define FAT_FILE_RESERVED 0x80
+
+struct disk;
+struct disk_bio;
+
+struct fat_directory_item {
+  uint8_t filename[8];
+  uint8_t ext[3];
+  uint8_t attribute;
+  uint8_t reserved;
+  uint8_t creation_time_tenths_of_a_sec;
+  uint16_t creation_time;
+  uint16_t creation_date;
+  uint16_t last_access;
+  uint16_t high_16_bits_first_cluster;
+  uint16_t last_mod_time;
+  uint16_t last_mod_date;
+  uint16_t low_16_bits_first_cluster;
+  uint32_t filesize;
+} __attribute__((packed));
+
+/**
+ * A run of clusters that lie next to each other on disk, "file_cluster"
+ * is the index of its first cluster within the file
+ */
+struct fat_extent {
+  uint32_t file_cluster;
+  uint32_t cluster;
+  uint32_t total;
+};
+
+// A whole cluster chain as extents sorted by file cluster
+struct fat_extent_map {
+  struct fat_extent *extents;
+  int total;
+  int capacity;
+};
+
+// Gives the cluster after "cluster" in its chain, zero at the end of the
+// chain and negative on error
+typedef int (*FAT_NEXT_CLUSTER_FUNCTION)(struct disk *disk, uint32_t cluster);
+
+uint32_t fat_get_first_cluster(struct fat_directory_item *item);
+void fat_get_full_relative_filename(struct fat_directory_item *item,
+                                    char *out, int max_len);
+int fat_name_key(const char *name, char *key);
+int fat_find_item(struct fat_directory_item *items, int total,
+                  const char *name);
+
+int fat_build_extent_map(struct disk *disk, uint32_t first_cluster,
+                         uint32_t max_clusters,
+                         FAT_NEXT_CLUSTER_FUNCTION next_cluster,
+                         struct fat_extent_map *map);
+struct fat_extent *fat_find_extent(struct fat_extent_map *map,
+                                   uint32_t file_cluster);
+uint32_t fat_extent_map_clusters(struct fat_extent_map *map);
+int fat_extent_map_append(struct fat_extent_map *map, uint32_t cluster,
+                          uint32_t total);
+
+int fat_wait_bios(struct disk_bio *bios, int total);
+
+#endif
@@ -1,14 +1,30 @@
 #include "file.h"
+#include "archive/archive.h"
 #include "config.h"
+#include "cpu/cpu.h"
+#include "disk/bcache.h"
 #include "disk/disk.h"
 #include "fat/fat16.h"
+#include "fat/fat32.h"
 #include "kernel.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
+#include "pagecache.h"
+#include "tmpfs/tmpfs.h"
 #include "status.h"
 #include "string/string.h"
+#include "task/process.h"
+
 struct filesystem *filesystems[VIOS_MAX_FILESYSTEMS];
-struct file_descriptor *file_descriptors[VIOS_MAX_FILE_DESCRIPTORS];
+
+// Descriptors of code running outside any process
+static struct file_table kernel_file_table;
+
+// Every open file of every table
+static struct file_descriptor *open_files;
+
+// When the oldest change not yet synced was made, zero when there is none
+static uint64_t fs_dirty_since;
 
 static struct filesystem **fs_get_free_filesystem() {
   int i = 0;
@@ -33,7 +49,13 @@ void fs_insert_filesystem(struct filesystem *filesystem) {
   *fs = filesystem;
 }
 
-static void fs_static_load() { fs_insert_filesystem(fat16_init()); }
+static void fs_static_load() {
+  // Claims only its own memory disks, before the others try to read them
+  fs_insert_filesystem(tmpfs_init());
+  fs_insert_filesystem(fat16_init());
+  fs_insert_filesystem(fat32_init());
+  fs_insert_filesystem(archive_init());
+}
 
 void fs_load() {
   memset(filesystems, 0, sizeof(filesystems));
@@ -41,40 +63,235 @@ void fs_load() {
 }
 
 void fs_init() {
-  memset(file_descriptors, 0, sizeof(file_descriptors));
+  memset(&kernel_file_table, 0, sizeof(kernel_file_table));
+  open_files = 0;
   fs_load();
 }
 
-static void file_free_descriptor(struct file_descriptor *desc) {
-  file_descriptors[desc->index - 1] = 0x00;
-  kfree(desc);
+/**
+ * Kernel code running on behalf of a process uses its table, boot code
+ * uses the kernel's own
+ */
+static struct file_table *file_current_table() {
+  struct process *process = process_current();
+  return process ? &process->files : &kernel_file_table;
+}
+
+/**
+ * Doubles the slots of "table", the bitmaps grow with it
+ */
+static int file_table_grow(struct file_table *table) {
+  int capacity = table->capacity ? table->capacity * 2
+                                 : VIOS_FILE_TABLE_INITIAL_SIZE;
+  if (capacity > VIOS_MAX_FILE_DESCRIPTORS) {
+    return -ENOMEM;
+  }
+
+  int used_words = capacity / 64;
+  int full_words = (used_words + 63) / 64;
+  struct file_descriptor **files =
+      kzalloc(capacity * sizeof(struct file_descriptor *));
+  uint64_t *used = kzalloc(used_words * sizeof(uint64_t));
+  uint64_t *full = kzalloc(full_words * sizeof(uint64_t));
+  if (!files || !used || !full) {
+    if (files) {
+      kfree(files);
+    }
+    if (used) {
+      kfree(used);
+    }
+    if (full) {
+      kfree(full);
+    }
+    return -ENOMEM;
+  }
+
+  if (table->capacity) {
+    int old_used_words = table->capacity / 64;
+    memcpy(files, table->files,
+           table->capacity * sizeof(struct file_descriptor *));
+    memcpy(used, table->used, old_used_words * sizeof(uint64_t));
+    memcpy(full, table->full, ((old_used_words + 63) / 64) * sizeof(uint64_t));
+    kfree(table->files);
+    kfree(table->used);
+    kfree(table->full);
+  }
+
+  table->files = files;
+  table->used = used;
+  table->full = full;
+  table->capacity = capacity;
+  return 0;
 }
 
-static int file_new_descriptor(struct file_descriptor **desc_out) {
-  int res = -ENOMEM;
-  for (int i = 0; i < VIOS_MAX_FILE_DESCRIPTORS; i++) {
-    if (file_descriptors[i] == 0) {
-      struct file_descriptor *desc = kzalloc(sizeof(struct file_descriptor));
-      // Descriptors start at 1
-      desc->index = i + 1;
-      file_descriptors[i] = desc;
-      *desc_out = desc;
-      res = 0;
+/**
+ * Puts "desc" in the lowest free slot of "table" and returns its
+ * descriptor. The summary bitmap leads straight to a word with a free
+ * bit, so no slot is scanned
+ */
+static int file_table_install(struct file_table *table,
+                              struct file_descriptor *desc) {
+  int full_words = (table->capacity / 64 + 63) / 64;
+  int word = -1;
+  for (int i = 0; i < full_words; i++) {
+    // Bits past the last word of "used" read as free, skip them
+    uint64_t free_words = ~table->full[i];
+    int words_here = table->capacity / 64 - i * 64;
+    if (words_here < 64) {
+      free_words &= (1ULL << words_here) - 1;
+    }
+
+    if (free_words) {
+      word = i * 64 + __builtin_ctzll(free_words);
       break;
     }
   }
 
-  return res;
+  if (word < 0) {
+    word = table->capacity / 64;
+    int res = file_table_grow(table);
+    if (res < 0) {
+      return res;
+    }
+  }
+
+  int slot = word * 64 + __builtin_ctzll(~table->used[word]);
+  table->used[word] |= 1ULL << (slot % 64);
+  if (table->used[word] == ~0ULL) {
+    table->full[word / 64] |= 1ULL << (word % 64);
+  }
+  table->files[slot] = desc;
+  desc->refcount++;
+
+  // Descriptors start at 1
+  return slot + 1;
 }
 
-static struct file_descriptor *file_get_descriptor(int fd) {
-  if (fd <= 0 || fd >= VIOS_MAX_FILE_DESCRIPTORS) {
+static struct file_descriptor *file_table_get(struct file_table *table,
+                                              int fd) {
+  if (fd <= 0 || fd > table->capacity) {
     return 0;
   }
 
   // Descriptors start at 1
-  int index = fd - 1;
-  return file_descriptors[index];
+  return table->files[fd - 1];
+}
+
+static void file_table_remove(struct file_table *table, int fd) {
+  int slot = fd - 1;
+  int word = slot / 64;
+  table->files[slot] = 0x00;
+  table->used[word] &= ~(1ULL << (slot % 64));
+  table->full[word / 64] &= ~(1ULL << (word % 64));
+}
+
+static struct file_descriptor *file_get_descriptor(int fd) {
+  return file_table_get(file_current_table(), fd);
+}
+
+static struct file_descriptor *file_new_descriptor() {
+  struct file_descriptor *desc = kzalloc(sizeof(struct file_descriptor));
+  if (!desc) {
+    return 0;
+  }
+
+  desc->next = open_files;
+  if (open_files) {
+    open_files->prev = desc;
+  }
+  open_files = desc;
+  return desc;
+}
+
+static void file_free_descriptor(struct file_descriptor *desc) {
+  if (desc->prev) {
+    desc->prev->next = desc->next;
+  } else {
+    open_files = desc->next;
+  }
+
+  if (desc->next) {
+    desc->next->prev = desc->prev;
+  }
+  kfree(desc);
+}
+
+/**
+ * Drops one reference to an open file. The last one syncs what the file
+ * changed and closes it, a failed close leaves it open
+ */
+static int file_put(struct file_descriptor *desc) {
+  int res = 0;
+  if (desc->refcount > 1) {
+    desc->refcount--;
+    goto out;
+  }
+
+  // Whatever the file changed reaches the device in one sorted batch
+  if (desc->mode != FILE_MODE_READ && desc->filesystem->sync) {
+    res = desc->filesystem->sync(desc->disk, desc->private);
+    if (res == VIOS_ALL_OK) {
+      res = disk_bcache_flush(desc->disk->physical);
+    }
+
+    if (res < 0) {
+      goto out;
+    }
+  }
+
+  res = desc->filesystem->close(desc->private);
+  if (res == VIOS_ALL_OK) {
+    file_free_descriptor(desc);
+  }
+out:
+  return res;
+}
+
+/**
+ * Gives "to" a new descriptor for the open file behind "fd" in "from",
+ * both then share its position
+ */
+int file_table_dup(struct file_table *to, struct file_table *from, int fd) {
+  struct file_descriptor *desc = file_table_get(from, fd);
+  if (!desc) {
+    return -EINVARG;
+  }
+
+  return file_table_install(to, desc);
+}
+
+/**
+ * Closes every descriptor of "table", for when its process exits. A file
+ * that fails to sync or close is released all the same, nothing would
+ * be left to close it later
+ */
+int file_table_free(struct file_table *table) {
+  int res = 0;
+  for (int fd = 1; fd <= table->capacity; fd++) {
+    struct file_descriptor *desc = file_table_get(table, fd);
+    if (!desc) {
+      continue;
+    }
+
+    // Only a failed sync fails the last put, the file is still open
+    int put_res = file_put(desc);
+    if (put_res < 0) {
+      if (res == 0) {
+        res = put_res;
+      }
+      desc->filesystem->close(desc->private);
+      file_free_descriptor(desc);
+    }
+    file_table_remove(table, fd);
+  }
+
+  if (table->capacity) {
+    kfree(table->files);
+    kfree(table->used);
+    kfree(table->full);
+  }
+  memset(table, 0, sizeof(*table));
+  return res;
 }
 
 struct filesystem *fs_resolve(struct disk *disk) {
@@ -89,6 +306,52 @@ struct filesystem *fs_resolve(struct disk *disk) {
   return fs;
 }
 
+static void fs_mark_dirty() {
+  if (!fs_dirty_since) {
+    fs_dirty_since = cpu_rdtsc();
+  }
+}
+
+/**
+ * Syncs every file open for writing, then writes back every dirty block
+ */
+int fs_sync() {
+  int res = 0;
+  for (struct file_descriptor *desc = open_files; desc; desc = desc->next) {
+    if (desc->mode == FILE_MODE_READ || !desc->filesystem->sync) {
+      continue;
+    }
+
+    int sync_res = desc->filesystem->sync(desc->disk, desc->private);
+    if (res == 0 && sync_res < 0) {
+      res = sync_res;
+    }
+  }
+
+  int flush_res = disk_bcache_flush(NULL);
+  if (res == 0) {
+    res = flush_res;
+  }
+
+  fs_dirty_since = 0;
+  return res;
+}
+
+/**
+ * Stands in for a write back timer, which the kernel does not have.
+ * Every file call syncs once changes have waited long enough
+ */
+static void fs_writeback() {
+  if (fs_dirty_since &&
+      cpu_tsc_to_us(cpu_rdtsc() - fs_dirty_since) >=
+          VIOS_DISK_BCACHE_WRITEBACK_MS * 1000ULL) {
+    fs_sync();
+    return;
+  }
+
+  disk_bcache_writeback();
+}
+
 FILE_MODE file_get_mode_by_string(const char *str) {
   FILE_MODE mode = FILE_MODE_INVALID;
   if (strncmp(str, "r", 1) == 0) {
@@ -101,12 +364,86 @@ FILE_MODE file_get_mode_by_string(const char *str) {
   return mode;
 }
 
+/**
+ * Drops the cached pages of the file at "path" before a change the open
+ * descriptors cannot see coming, such as unlinking or truncating on open
+ */
+static void fs_pagecache_invalidate_path(struct disk *disk,
+                                         struct path_part *path) {
+  void *private = disk->filesystem->open(disk, path, FILE_MODE_READ);
+  if (!private || ISERR(private)) {
+    return;
+  }
+
+  struct file_stat stat;
+  if (disk->filesystem->stat(disk, private, &stat) == VIOS_ALL_OK &&
+      stat.id) {
+    pagecache_invalidate(disk, stat.id);
+  }
+  disk->filesystem->close(private);
+}
+
+/**
+ * True when "desc" was opened by the path "path" names on "disk". Names
+ * are compared without case like the filesystems compare them
+ */
+static bool file_descriptor_has_path(struct file_descriptor *desc,
+                                     struct disk *disk,
+                                     struct path_part *path) {
+  if (desc->disk != disk) {
+    return false;
+  }
+
+  struct path_root *root = pathparser_parse(desc->path, NULL);
+  if (!root) {
+    return false;
+  }
+
+  struct path_part *part = root->first;
+  while (part && path &&
+         istrncmp(part->part, path->part, VIOS_MAX_PATH) == 0) {
+    part = part->next;
+    path = path->next;
+  }
+
+  bool same = !part && !path;
+  pathparser_free(root);
+  return same;
+}
+
+/**
+ * True while a descriptor is open for writing the file at "path". The
+ * filesystems keep what a writer changed in its own descriptor, a second
+ * writer or an unlink would be overwritten by it on the next sync
+ */
+static bool fs_path_open_for_writing(struct disk *disk,
+                                     struct path_part *path) {
+  for (struct file_descriptor *desc = open_files; desc; desc = desc->next) {
+    if (desc->mode != FILE_MODE_READ &&
+        file_descriptor_has_path(desc, disk, path)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void file_pagecache_invalidate(struct file_descriptor *desc) {
+  struct file_stat stat;
+  if (desc->filesystem->stat(desc->disk, desc->private, &stat) ==
+          VIOS_ALL_OK &&
+      stat.id) {
+    pagecache_invalidate(desc->disk, stat.id);
+  }
+}
+
 int fopen(const char *filename, const char *mode_str) {
   int res = 0;
   struct disk *disk = NULL;
   FILE_MODE mode = FILE_MODE_INVALID;
   void *descriptor_private_data = NULL;
   struct file_descriptor *desc = 0;
+  fs_writeback();
   struct path_root *root_path = pathparser_parse(filename, NULL);
   if (!root_path) {
     res = -EINVARG;
@@ -137,6 +474,17 @@ int fopen(const char *filename, const char *mode_str) {
     goto out;
   }
 
+  if (mode != FILE_MODE_READ &&
+      fs_path_open_for_writing(disk, root_path->first)) {
+    res = -EBUSY;
+    goto out;
+  }
+
+  // Opening for writing truncates the file
+  if (mode == FILE_MODE_WRITE) {
+    fs_pagecache_invalidate_path(disk, root_path->first);
+  }
+
   descriptor_private_data =
       disk->filesystem->open(disk, root_path->first, mode);
   if (ISERR(descriptor_private_data)) {
@@ -144,14 +492,17 @@ int fopen(const char *filename, const char *mode_str) {
     goto out;
   }
 
-  res = file_new_descriptor(&desc);
-  if (res < 0) {
+  desc = file_new_descriptor();
+  if (!desc) {
+    res = -ENOMEM;
     goto out;
   }
   desc->filesystem = disk->filesystem;
   desc->private = descriptor_private_data;
   desc->disk = disk;
-  res = desc->index;
+  desc->mode = mode;
+  strncpy(desc->path, filename, sizeof(desc->path));
+  res = file_table_install(file_current_table(), desc);
 
 out:
 
@@ -200,9 +551,50 @@ int fclose(int fd) {
     goto out;
   }
 
-  res = desc->filesystem->close(desc->private);
+  res = file_put(desc);
   if (res == VIOS_ALL_OK) {
-    file_free_descriptor(desc);
+    file_table_remove(file_current_table(), fd);
+  }
+out:
+  return res;
+}
+
+/**
+ * Returns a new descriptor for the same open file as "fd"
+ */
+int fdup(int fd) {
+  struct file_table *table = file_current_table();
+  return file_table_dup(table, table, fd);
+}
+
+/**
+ * Gives the cached pages of the file behind "fd", held until they are
+ * handed back with pagecache_file_put
+ */
+int fcache(int fd, struct pagecache_file **file_out) {
+  int res = 0;
+  struct file_descriptor *desc = file_get_descriptor(fd);
+  if (!desc) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  struct file_stat stat;
+  res = desc->filesystem->stat(desc->disk, desc->private, &stat);
+  if (res < 0) {
+    goto out;
+  }
+
+  // An empty file has nothing to cache and no id to find it by
+  if (!stat.id || !stat.filesize) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  *file_out = pagecache_file_get(desc->disk, desc->filesystem, desc->path,
+                                 stat.id, stat.filesize);
+  if (!*file_out) {
+    res = -ENOMEM;
   }
 out:
   return res;
@@ -233,8 +625,185 @@ int fread(void *ptr, uint32_t size, uint32_t nmemb, int fd) {
     goto out;
   }
 
+  fs_writeback();
   res = desc->filesystem->read(desc->disk, desc->private, size, nmemb,
                                (char *)ptr);
 out:
   return res;
+}
+
+/**
+ * Copies the buffers of "iov" that fall in the first "max" bytes to "out",
+ * the last one cut short. Returns how many there are
+ */
+int file_iovec_clamp(const struct file_iovec *iov, int iovcnt, uint32_t max,
+                     struct file_iovec *out) {
+  int total = 0;
+  for (int i = 0; i < iovcnt && max; i++) {
+    out[total] = iov[i];
+    if (out[total].len > max) {
+      out[total].len = max;
+    }
+    max -= out[total].len;
+    total++;
+  }
+
+  return total;
+}
+
+static int file_readv(int fd, const struct file_iovec *iov, int iovcnt,
+                      int64_t offset) {
+  int res = 0;
+  if (fd < 1 || iovcnt < 1 || iovcnt > VIOS_FILE_MAX_IOVECS) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  uint64_t total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    total += iov[i].len;
+  }
+
+  if (total > 0x7FFFFFFF) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  struct file_descriptor *desc = file_get_descriptor(fd);
+  if (!desc) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  fs_writeback();
+  res = desc->filesystem->readv(desc->disk, desc->private, iov, iovcnt,
+                                offset);
+out:
+  return res;
+}
+
+/**
+ * Fills the buffers in turn from the file position, returns the bytes
+ * read
+ */
+int freadv(int fd, const struct file_iovec *iov, int iovcnt) {
+  return file_readv(fd, iov, iovcnt, FILE_POSITION_CURRENT);
+}
+
+/**
+ * Fills the buffers in turn from "offset", the file position is left
+ * alone so readers sharing the descriptor do not disturb each other
+ */
+int fpreadv(int fd, const struct file_iovec *iov, int iovcnt,
+            uint32_t offset) {
+  return file_readv(fd, iov, iovcnt, offset);
+}
+
+int fpread(void *ptr, uint32_t size, uint32_t offset, int fd) {
+  struct file_iovec iov = {.base = ptr, .len = size};
+  return file_readv(fd, &iov, 1, offset);
+}
+
+int fwrite(const void *ptr, uint32_t size, uint32_t nmemb, int fd) {
+  int res = 0;
+  if (size == 0 || nmemb == 0 || fd < 1) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  struct file_descriptor *desc = file_get_descriptor(fd);
+  if (!desc) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  if (desc->mode == FILE_MODE_READ || !desc->filesystem->write) {
+    res = -ERDONLY;
+    goto out;
+  }
+
+  fs_writeback();
+  file_pagecache_invalidate(desc);
+  res = desc->filesystem->write(desc->disk, desc->private, size, nmemb,
+                                (const char *)ptr);
+  fs_mark_dirty();
+out:
+  return res;
+}
+
+int ftruncate(int fd, uint32_t size) {
+  int res = 0;
+  struct file_descriptor *desc = file_get_descriptor(fd);
+  if (!desc) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  if (desc->mode == FILE_MODE_READ || !desc->filesystem->truncate) {
+    res = -ERDONLY;
+    goto out;
+  }
+
+  file_pagecache_invalidate(desc);
+  res = desc->filesystem->truncate(desc->disk, desc->private, size);
+  fs_mark_dirty();
+out:
+  return res;
+}
+
+/**
+ * Returns once everything written to the file is on the device
+ */
+int fsync(int fd) {
+  int res = 0;
+  struct file_descriptor *desc = file_get_descriptor(fd);
+  if (!desc) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  if (desc->mode != FILE_MODE_READ && desc->filesystem->sync) {
+    res = desc->filesystem->sync(desc->disk, desc->private);
+    if (res < 0) {
+      goto out;
+    }
+  }
+
+  res = disk_flush(desc->disk);
+out:
+  return res;
+}
+
+int funlink(const char *filename) {
+  int res = 0;
+  struct path_root *root_path = pathparser_parse(filename, NULL);
+  if (!root_path || !root_path->first) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  struct disk *disk = disk_get(root_path->drive_no);
+  if (!disk || !disk->filesystem) {
+    res = -EIO;
+    goto out;
+  }
+
+  if (!disk->filesystem->unlink) {
+    res = -ERDONLY;
+    goto out;
+  }
+
+  if (fs_path_open_for_writing(disk, root_path->first)) {
+    res = -EBUSY;
+    goto out;
+  }
+
+  fs_pagecache_invalidate_path(disk, root_path->first);
+  res = disk->filesystem->unlink(disk, root_path->first);
+  fs_mark_dirty();
+out:
+  if (root_path) {
+    pathparser_free(root_path);
+  }
+  return res;
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #ifndef FILE_H
 #define FILE_H
 
+#include "config.h"
 #include "pparser.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -30,18 +32,38 @@ enum
 
 typedef unsigned int FILE_STAT_FLAGS;
 
+// Passed as the offset of a vectored read to read at the file position
+#define FILE_POSITION_CURRENT -1
+
+// One buffer of a vectored read
+struct file_iovec
+{
+    void* base;
+    uint32_t len;
+};
+
 struct disk;
+struct pagecache_file;
 typedef void*(*FS_OPEN_FUNCTION)(struct disk* disk, struct path_part* path, FILE_MODE mode);
 typedef int (*FS_READ_FUNCTION)(struct disk* disk, void* private, uint32_t size, uint32_t nmemb, char* out);
+// Fills the buffers in turn from "offset", or from the file position which then moves past the data when "offset" is FILE_POSITION_CURRENT. Returns the bytes read, fewer at the end of the file
+typedef int (*FS_READV_FUNCTION)(struct disk* disk, void* private, const struct file_iovec* iov, int iovcnt, int64_t offset);
 typedef int (*FS_RESOLVE_FUNCTION)(struct disk* disk);
 typedef int (*FS_CLOSE_FUNCTION)(void* private);
 typedef int (*FS_SEEK_FUNCTION)(void* private, uint32_t offset, FILE_SEEK_MODE seek_mode);
 typedef int (*FS_VOLUME_NAME_FUNCTION)(void* private, char* name_out, size_t max);
+typedef int (*FS_WRITE_FUNCTION)(struct disk* disk, void* private, uint32_t size, uint32_t nmemb, const char* in);
+typedef int (*FS_TRUNCATE_FUNCTION)(struct disk* disk, void* private, uint32_t size);
+// Moves what the filesystem holds back for the file into the block cache
+typedef int (*FS_SYNC_FUNCTION)(struct disk* disk, void* private);
+typedef int (*FS_UNLINK_FUNCTION)(struct disk* disk, struct path_part* path);
 
 struct file_stat
 {
     FILE_STAT_FLAGS flags;
     uint32_t filesize;
+    // Names the file on its disk for as long as it exists, zero when the filesystem cannot
+    uint32_t id;
 };
 
 typedef int (*FS_STAT_FUNCTION)(struct disk* disk, void* private, struct file_stat* stat);
@@ -52,17 +74,27 @@ struct filesystem
     FS_RESOLVE_FUNCTION resolve;
     FS_OPEN_FUNCTION open;
     FS_READ_FUNCTION read;
+    FS_READV_FUNCTION readv;
     FS_SEEK_FUNCTION seek;
     FS_STAT_FUNCTION stat;
     FS_CLOSE_FUNCTION close;
     FS_VOLUME_NAME_FUNCTION  volume_name;
+
+    // Optional, a filesystem without them is read only
+    FS_WRITE_FUNCTION write;
+    FS_TRUNCATE_FUNCTION truncate;
+    FS_SYNC_FUNCTION sync;
+    FS_UNLINK_FUNCTION unlink;
     char name[20];
+
+    // Once primary a disk with this filesystem stays primary over later
+    // disks with the volume
+    bool preferred_primary;
 };
 
+// One open file, shared by every descriptor that refers to it
 struct file_descriptor
 {
-    // The descriptor index
-    int index;
     struct filesystem* filesystem;
 
     // Private data for internal file descriptor
@@ -70,6 +102,36 @@ struct file_descriptor
 
     // The disk that the file descriptor should be used on
     struct disk* disk;
+
+    FILE_MODE mode;
+
+    // The path the file was opened by, the page cache opens it again
+    char path[VIOS_MAX_PATH];
+
+    // Descriptors referring to this file, it is closed when the last goes
+    int refcount;
+
+    // Every open file is listed so it can be synced
+    struct file_descriptor* prev;
+    struct file_descriptor* next;
+};
+
+/**
+ * The descriptors of one process, or of the kernel. Descriptor "fd"
+ * lives in slot fd - 1 and the lowest free slot is found through two
+ * levels of bitmaps
+ */
+struct file_table
+{
+    struct file_descriptor** files;
+
+    // Bit "i" is set while slot "i" is in use
+    uint64_t* used;
+    // Bit "i" is set while word "i" of "used" is full
+    uint64_t* full;
+
+    // Slots, a multiple of 64 that doubles as the table fills
+    int capacity;
 };
 
 
@@ -78,8 +140,23 @@ void fs_init();
 int fopen(const char* filename, const char* mode_str);
 int fseek(int fd, int offset, FILE_SEEK_MODE whence);
 int fread(void* ptr, uint32_t size, uint32_t nmemb, int fd);
+int freadv(int fd, const struct file_iovec* iov, int iovcnt);
+int fpreadv(int fd, const struct file_iovec* iov, int iovcnt, uint32_t offset);
+int fpread(void* ptr, uint32_t size, uint32_t offset, int fd);
 int fstat(int fd, struct file_stat* stat);
 int fclose(int fd);
+int fwrite(const void* ptr, uint32_t size, uint32_t nmemb, int fd);
+int ftruncate(int fd, uint32_t size);
+int fsync(int fd);
+int funlink(const char* filename);
+int fdup(int fd);
+int fcache(int fd, struct pagecache_file** file_out);
+int fs_sync();
+
+int file_iovec_clamp(const struct file_iovec* iov, int iovcnt, uint32_t max, struct file_iovec* out);
+
+int file_table_dup(struct file_table* to, struct file_table* from, int fd);
+int file_table_free(struct file_table* table);
 
 void fs_insert_filesystem(struct filesystem* filesystem);
 struct filesystem* fs_resolve(struct disk* disk);
@@ -0,0 +1,412 @@
+#include "pagecache.h"
+#include "file.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "pparser.h"
+#include "status.h"
+
+// A node holds a page worth of slots, three levels cover a 4GB file
+#define PAGECACHE_RADIX_BITS 9
+#define PAGECACHE_RADIX_SLOTS (1 << PAGECACHE_RADIX_BITS)
+#define PAGECACHE_RADIX_MASK (PAGECACHE_RADIX_SLOTS - 1)
+
+struct pagecache_node {
+  void *slots[PAGECACHE_RADIX_SLOTS];
+};
+
+// Pages read from the file with one call, they are contiguous in memory
+struct pagecache_run {
+  void *data;
+  uint32_t first;
+  uint32_t pages;
+  struct pagecache_run *next;
+};
+
+struct pagecache {
+  struct pagecache_file *lru_head;
+  struct pagecache_file *lru_tail;
+
+  // Pages held by every file, stale ones included
+  size_t total_pages;
+};
+
+static struct pagecache pagecache;
+
+static uint32_t pagecache_file_pages(struct pagecache_file *file) {
+  return ((uint64_t)file->filesize + PAGING_PAGE_SIZE - 1) / PAGING_PAGE_SIZE;
+}
+
+static void pagecache_lru_unlink(struct pagecache_file *file) {
+  if (file->prev) {
+    file->prev->next = file->next;
+  } else {
+    pagecache.lru_head = file->next;
+  }
+
+  if (file->next) {
+    file->next->prev = file->prev;
+  } else {
+    pagecache.lru_tail = file->prev;
+  }
+
+  file->prev = NULL;
+  file->next = NULL;
+}
+
+static void pagecache_lru_push_front(struct pagecache_file *file) {
+  file->prev = NULL;
+  file->next = pagecache.lru_head;
+  if (pagecache.lru_head) {
+    pagecache.lru_head->prev = file;
+  }
+  pagecache.lru_head = file;
+
+  if (!pagecache.lru_tail) {
+    pagecache.lru_tail = file;
+  }
+}
+
+/**
+ * Returns the slot of page "index", creating the nodes on the way when
+ * "create" is set. NULL when the page has no slot or a node could not be
+ * allocated
+ */
+static void **pagecache_slot(struct pagecache_file *file, uint32_t index,
+                             bool create) {
+  // The tree grows upwards until "index" fits under the root
+  while ((uint64_t)index >> (PAGECACHE_RADIX_BITS * file->height)) {
+    if (!create) {
+      return NULL;
+    }
+
+    struct pagecache_node *node = kzalloc(sizeof(struct pagecache_node));
+    if (!node) {
+      return NULL;
+    }
+    node->slots[0] = file->root;
+    file->root = node;
+    file->height++;
+  }
+
+  if (!file->root) {
+    if (!create) {
+      return NULL;
+    }
+
+    file->root = kzalloc(sizeof(struct pagecache_node));
+    if (!file->root) {
+      return NULL;
+    }
+    file->height = 1;
+  }
+
+  struct pagecache_node *node = file->root;
+  for (int level = file->height - 1; level > 0; level--) {
+    int i = (index >> (PAGECACHE_RADIX_BITS * level)) & PAGECACHE_RADIX_MASK;
+    if (!node->slots[i]) {
+      if (!create) {
+        return NULL;
+      }
+
+      node->slots[i] = kzalloc(sizeof(struct pagecache_node));
+      if (!node->slots[i]) {
+        return NULL;
+      }
+    }
+    node = node->slots[i];
+  }
+
+  return &node->slots[index & PAGECACHE_RADIX_MASK];
+}
+
+static void *pagecache_find_page(struct pagecache_file *file, uint32_t index) {
+  void **slot = pagecache_slot(file, index, false);
+  return slot ? *slot : NULL;
+}
+
+static void pagecache_free_node(struct pagecache_node *node, int level) {
+  if (level > 1) {
+    for (int i = 0; i < PAGECACHE_RADIX_SLOTS; i++) {
+      if (node->slots[i]) {
+        pagecache_free_node(node->slots[i], level - 1);
+      }
+    }
+  }
+  kfree(node);
+}
+
+/**
+ * Frees the pages and the descriptor of a file nobody holds any more
+ */
+static void pagecache_file_free(struct pagecache_file *file) {
+  struct pagecache_run *run = file->runs;
+  while (run) {
+    struct pagecache_run *next = run->next;
+    kfree(run->data);
+    kfree(run);
+    run = next;
+  }
+  pagecache.total_pages -= file->total_pages;
+
+  if (file->root) {
+    pagecache_free_node(file->root, file->height);
+  }
+
+  file->filesystem->close(file->private);
+  kfree(file);
+}
+
+/**
+ * Makes room for "pages" more pages by freeing the least recently used
+ * files nobody holds, fails when the files in use fill the cache
+ */
+static int pagecache_reserve(uint32_t pages) {
+  size_t max_pages = VIOS_PAGECACHE_MAX_BYTES / PAGING_PAGE_SIZE;
+  struct pagecache_file *file = pagecache.lru_tail;
+  while (file && pagecache.total_pages + pages > max_pages) {
+    struct pagecache_file *prev = file->prev;
+    if (file->refcount == 0) {
+      pagecache_lru_unlink(file);
+      pagecache_file_free(file);
+    }
+    file = prev;
+  }
+
+  return pagecache.total_pages + pages > max_pages ? -ENOMEM : VIOS_ALL_OK;
+}
+
+/**
+ * Reads "count" pages from page "first" on into one allocation and puts
+ * them in the tree, the part of the last page past the end stays zero
+ */
+static int pagecache_fill(struct pagecache_file *file, uint32_t first,
+                          uint32_t count, void **data_out) {
+  int res = pagecache_reserve(count);
+  if (res < 0) {
+    return res;
+  }
+
+  struct pagecache_run *run = kzalloc(sizeof(struct pagecache_run));
+  void *data = kzalloc((size_t)count * PAGING_PAGE_SIZE);
+  if (!run || !data) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  uint32_t offset = first * PAGING_PAGE_SIZE;
+  uint32_t bytes = file->filesize - offset;
+  if (bytes > count * PAGING_PAGE_SIZE) {
+    bytes = count * PAGING_PAGE_SIZE;
+  }
+
+  // At the offset, the file position of the cache's descriptor is unused
+  struct file_iovec iov = {.base = data, .len = bytes};
+  res = file->filesystem->readv(file->disk, file->private, &iov, 1, offset);
+  if (res < 0) {
+    goto out;
+  }
+
+  if (res != bytes) {
+    res = -EIO;
+    goto out;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    void **slot = pagecache_slot(file, first + i, true);
+    if (!slot) {
+      // The pages already placed must not point at the freed run
+      while (i-- > 0) {
+        *pagecache_slot(file, first + i, false) = NULL;
+      }
+      res = -ENOMEM;
+      goto out;
+    }
+    *slot = (char *)data + (size_t)i * PAGING_PAGE_SIZE;
+  }
+
+  run->data = data;
+  run->first = first;
+  run->pages = count;
+  run->next = file->runs;
+  file->runs = run;
+  file->total_pages += count;
+  pagecache.total_pages += count;
+  if (data_out) {
+    *data_out = data;
+  }
+  res = VIOS_ALL_OK;
+out:
+  if (res < 0) {
+    if (run) {
+      kfree(run);
+    }
+
+    if (data) {
+      kfree(data);
+    }
+  }
+  return res;
+}
+
+/**
+ * Returns the cached pages of file "id" on "disk", reading none yet. A
+ * file not cached before is opened again from "path" for its own reads
+ */
+struct pagecache_file *pagecache_file_get(struct disk *disk,
+                                          struct filesystem *filesystem,
+                                          const char *path, uint32_t id,
+                                          uint32_t filesize) {
+  struct pagecache_file *file = NULL;
+  struct path_root *root_path = NULL;
+  void *private = NULL;
+  for (file = pagecache.lru_head; file; file = file->next) {
+    if (file->disk == disk && file->id == id) {
+      pagecache_lru_unlink(file);
+      goto out;
+    }
+  }
+
+  root_path = pathparser_parse(path, NULL);
+  if (!root_path || !root_path->first) {
+    goto out;
+  }
+
+  private = filesystem->open(disk, root_path->first, FILE_MODE_READ);
+  if (!private || ISERR(private)) {
+    goto out;
+  }
+
+  file = kzalloc(sizeof(struct pagecache_file));
+  if (!file) {
+    filesystem->close(private);
+    goto out;
+  }
+
+  file->disk = disk;
+  file->id = id;
+  file->filesize = filesize;
+  file->filesystem = filesystem;
+  file->private = private;
+out:
+  if (root_path) {
+    pathparser_free(root_path);
+  }
+
+  if (file) {
+    file->refcount++;
+    pagecache_lru_push_front(file);
+  }
+  return file;
+}
+
+void pagecache_file_put(struct pagecache_file *file) {
+  file->refcount--;
+  if (file->refcount == 0 && file->stale) {
+    pagecache_file_free(file);
+  }
+}
+
+/**
+ * Returns page "index" of the file, reading it and up to the read ahead
+ * of missing pages after it on a miss. ERROR on failure
+ */
+void *pagecache_get_page(struct pagecache_file *file, uint32_t index) {
+  uint32_t file_pages = pagecache_file_pages(file);
+  if (index >= file_pages) {
+    return ERROR(-EOUTOFRANGE);
+  }
+
+  void *page = pagecache_find_page(file, index);
+  if (page) {
+    return page;
+  }
+
+  uint32_t count = 1;
+  while (count < VIOS_PAGECACHE_READAHEAD_PAGES &&
+         index + count < file_pages &&
+         !pagecache_find_page(file, index + count)) {
+    count++;
+  }
+
+  int res = pagecache_fill(file, index, count, &page);
+  if (res < 0) {
+    return ERROR(res);
+  }
+  return page;
+}
+
+/**
+ * Copies "size" bytes from "offset" of the file to "out", reading the
+ * pages that are missing
+ */
+int pagecache_read(struct pagecache_file *file, uint32_t offset,
+                   uint32_t size, void *out) {
+  if ((uint64_t)offset + size > file->filesize) {
+    return -EOUTOFRANGE;
+  }
+
+  uint32_t done = 0;
+  while (done < size) {
+    uint32_t pos = offset + done;
+    void *page = pagecache_get_page(file, pos / PAGING_PAGE_SIZE);
+    if (ISERR(page)) {
+      return ERROR_I(page);
+    }
+
+    uint32_t in_page = pos % PAGING_PAGE_SIZE;
+    uint32_t total = PAGING_PAGE_SIZE - in_page;
+    if (total > size - done) {
+      total = size - done;
+    }
+
+    memcpy((char *)out + done, (char *)page + in_page, total);
+    done += total;
+  }
+
+  return VIOS_ALL_OK;
+}
+
+/**
+ * Returns the whole file as one contiguous block of cached pages. A file
+ * with no pages yet is read in one go, one already cached in pieces
+ * cannot be and the caller must read it itself
+ */
+int pagecache_map_contiguous(struct pagecache_file *file, void **data_out) {
+  uint32_t file_pages = pagecache_file_pages(file);
+  if (file_pages == 0) {
+    return -EINVARG;
+  }
+
+  if (!file->runs) {
+    return pagecache_fill(file, 0, file_pages, data_out);
+  }
+
+  struct pagecache_run *run = file->runs;
+  if (run->next || run->first != 0 || run->pages != file_pages) {
+    return -EUNIMP;
+  }
+
+  *data_out = run->data;
+  return VIOS_ALL_OK;
+}
+
+/**
+ * Forgets file "id" on "disk" because it changed. Its pages go once the
+ * last holder is done, mappings keep seeing the old contents until then
+ */
+void pagecache_invalidate(struct disk *disk, uint32_t id) {
+  for (struct pagecache_file *file = pagecache.lru_head; file;
+       file = file->next) {
+    if (file->disk == disk && file->id == id) {
+      pagecache_lru_unlink(file);
+      if (file->refcount == 0) {
+        pagecache_file_free(file);
+      } else {
+        file->stale = true;
+      }
+      break;
+    }
+  }
+}
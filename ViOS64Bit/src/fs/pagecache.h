@@ -0,0 +1,58 @@
+#ifndef KERNEL_FS_PAGECACHE_H
+#define KERNEL_FS_PAGECACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+struct disk;
+struct filesystem;
+struct pagecache_node;
+struct pagecache_run;
+
+/**
+ * The cached pages of one file, shared by everyone reading it. A file is
+ * found by the id its filesystem gives it in "fstat" and keeps a
+ * descriptor of its own that missing pages are read through
+ */
+struct pagecache_file {
+  struct disk *disk;
+  uint32_t id;
+  uint32_t filesize;
+
+  struct filesystem *filesystem;
+  void *private;
+
+  // Radix tree of the pages by their index in the file
+  struct pagecache_node *root;
+  int height;
+
+  // The allocations the pages were read into, freed with the file
+  struct pagecache_run *runs;
+  uint32_t total_pages;
+
+  // Readers and mappings holding the pages
+  int refcount;
+
+  // Set once the file changed, later readers get a new copy
+  bool stale;
+
+  // Least recently used list, the head is the most recently used file
+  struct pagecache_file *prev;
+  struct pagecache_file *next;
+};
+
+struct pagecache_file *pagecache_file_get(struct disk *disk,
+                                          struct filesystem *filesystem,
+                                          const char *path, uint32_t id,
+                                          uint32_t filesize);
+void pagecache_file_put(struct pagecache_file *file);
+void *pagecache_get_page(struct pagecache_file *file, uint32_t index);
+int pagecache_read(struct pagecache_file *file, uint32_t offset,
+                   uint32_t size, void *out);
+int pagecache_map_contiguous(struct pagecache_file *file, void **data_out);
+void pagecache_invalidate(struct disk *disk, uint32_t id);
+
+#endif
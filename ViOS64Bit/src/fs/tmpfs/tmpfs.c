@@ -0,0 +1,481 @@
+#include "tmpfs.h"
+#include "config.h"
+#include "disk/disk.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "status.h"
+#include "string/string.h"
+
+/**
+ * A file held in memory. Its pages are listed in an array that doubles
+ * as the file grows, so appending a page is amortised O(1) and any
+ * offset is found without walking a list
+ */
+struct tmpfs_inode {
+  char name[VIOS_TMPFS_NAME_MAX];
+  uint32_t id;
+  uint32_t size;
+
+  void **pages;
+  uint32_t total_pages;
+  uint32_t max_pages;
+
+  // Open descriptors, an unlinked file is freed when the last closes
+  int refcount;
+  bool unlinked;
+
+  struct tmpfs_inode *next;
+};
+
+struct tmpfs_private {
+  // Every file, the volume has a single flat directory
+  struct tmpfs_inode *files;
+
+  // Pages held by every file, unlinked ones still open included
+  size_t total_pages;
+
+  uint32_t next_id;
+};
+
+struct tmpfs_file_descriptor {
+  struct tmpfs_private *tmpfs;
+  struct tmpfs_inode *inode;
+  uint32_t pos;
+};
+
+int tmpfs_resolve(struct disk *disk);
+void *tmpfs_open(struct disk *disk, struct path_part *path, FILE_MODE mode);
+int tmpfs_read(struct disk *disk, void *descriptor, uint32_t size,
+               uint32_t nmemb, char *out_ptr);
+int tmpfs_readv(struct disk *disk, void *descriptor,
+                const struct file_iovec *iov, int iovcnt, int64_t offset);
+int tmpfs_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
+int tmpfs_stat(struct disk *disk, void *private, struct file_stat *stat);
+int tmpfs_close(void *private);
+int tmpfs_volume_name(void *private, char *name_out, size_t max);
+int tmpfs_write(struct disk *disk, void *descriptor, uint32_t size,
+                uint32_t nmemb, const char *in);
+int tmpfs_truncate(struct disk *disk, void *descriptor, uint32_t size);
+int tmpfs_unlink(struct disk *disk, struct path_part *path);
+
+struct filesystem tmpfs_fs = {.resolve = tmpfs_resolve,
+                              .open = tmpfs_open,
+                              .read = tmpfs_read,
+                              .readv = tmpfs_readv,
+                              .seek = tmpfs_seek,
+                              .stat = tmpfs_stat,
+                              .close = tmpfs_close,
+                              .volume_name = tmpfs_volume_name,
+                              .write = tmpfs_write,
+                              .truncate = tmpfs_truncate,
+                              .unlink = tmpfs_unlink};
+
+// The disk has no sectors, anything that reads it gets -EIO
+struct disk_driver tmpfs_disk_driver = {.name = "tmpfs"};
+
+struct filesystem *tmpfs_init() {
+  strcpy(tmpfs_fs.name, "TMPFS");
+  return &tmpfs_fs;
+}
+
+/**
+ * Adds an empty volume as a drive of its own, its number is printed
+ */
+int tmpfs_mount() {
+  struct disk *disk = NULL;
+  int res = disk_create_new(VIOS_DISK_TYPE_MEMORY, 0, 0, VIOS_SECTOR_SIZE,
+                            &tmpfs_disk_driver, NULL, &disk);
+  if (res < 0) {
+    return res;
+  }
+
+  if (disk->filesystem != &tmpfs_fs) {
+    return -EIO;
+  }
+
+  print("tmpfs: drive ");
+  print(itoa(disk->id));
+  print(", ");
+  print(itoa(VIOS_TMPFS_MAX_BYTES / 1024));
+  print("KB\n");
+  return VIOS_ALL_OK;
+}
+
+/**
+ * Claims the memory disks "tmpfs_mount" creates and nothing else
+ */
+int tmpfs_resolve(struct disk *disk) {
+  if (disk->driver != &tmpfs_disk_driver) {
+    return -EFSNOTUS;
+  }
+
+  struct tmpfs_private *private = kzalloc(sizeof(struct tmpfs_private));
+  if (!private) {
+    return -ENOMEM;
+  }
+
+  private->next_id = 1;
+  disk->fs_private = private;
+  return VIOS_ALL_OK;
+}
+
+static struct tmpfs_inode *tmpfs_find(struct tmpfs_private *private,
+                                      const char *name) {
+  for (struct tmpfs_inode *inode = private->files; inode;
+       inode = inode->next) {
+    if (istrncmp(inode->name, name, VIOS_TMPFS_NAME_MAX) == 0) {
+      return inode;
+    }
+  }
+
+  return NULL;
+}
+
+static struct tmpfs_inode *tmpfs_create(struct tmpfs_private *private,
+                                        const char *name) {
+  if (strlen(name) >= VIOS_TMPFS_NAME_MAX) {
+    return ERROR(-EBADPATH);
+  }
+
+  struct tmpfs_inode *inode = kzalloc(sizeof(struct tmpfs_inode));
+  if (!inode) {
+    return ERROR(-ENOMEM);
+  }
+
+  strcpy(inode->name, name);
+  inode->id = private->next_id++;
+  inode->next = private->files;
+  private->files = inode;
+  return inode;
+}
+
+/**
+ * Frees the pages from "first" on, the file keeps the ones before it
+ */
+static void tmpfs_free_pages(struct tmpfs_private *private,
+                             struct tmpfs_inode *inode, uint32_t first) {
+  while (inode->total_pages > first) {
+    kfree(inode->pages[--inode->total_pages]);
+    inode->pages[inode->total_pages] = NULL;
+    private->total_pages--;
+  }
+}
+
+static void tmpfs_inode_free(struct tmpfs_private *private,
+                             struct tmpfs_inode *inode) {
+  tmpfs_free_pages(private, inode, 0);
+  if (inode->pages) {
+    kfree(inode->pages);
+  }
+  kfree(inode);
+}
+
+/**
+ * Appends zeroed pages until the file has "pages" of them. Fails without
+ * growing the file when the volume would go over its cap
+ */
+static int tmpfs_grow(struct tmpfs_private *private, struct tmpfs_inode *inode,
+                      uint32_t pages) {
+  if (pages <= inode->total_pages) {
+    return VIOS_ALL_OK;
+  }
+
+  size_t needed = pages - inode->total_pages;
+  if (private->total_pages + needed >
+      VIOS_TMPFS_MAX_BYTES / PAGING_PAGE_SIZE) {
+    return -ENOSPC;
+  }
+
+  if (pages > inode->max_pages) {
+    uint32_t max_pages = inode->max_pages ? inode->max_pages * 2 : 8;
+    while (max_pages < pages) {
+      max_pages *= 2;
+    }
+
+    void **list = kzalloc(max_pages * sizeof(void *));
+    if (!list) {
+      return -ENOMEM;
+    }
+
+    if (inode->pages) {
+      memcpy(list, inode->pages, inode->total_pages * sizeof(void *));
+      kfree(inode->pages);
+    }
+    inode->pages = list;
+    inode->max_pages = max_pages;
+  }
+
+  uint32_t old_pages = inode->total_pages;
+  while (inode->total_pages < pages) {
+    void *page = kzalloc(PAGING_PAGE_SIZE);
+    if (!page) {
+      tmpfs_free_pages(private, inode, old_pages);
+      return -ENOMEM;
+    }
+
+    inode->pages[inode->total_pages++] = page;
+    private->total_pages++;
+  }
+
+  return VIOS_ALL_OK;
+}
+
+static uint32_t tmpfs_pages_for(uint32_t size) {
+  return ((uint64_t)size + PAGING_PAGE_SIZE - 1) / PAGING_PAGE_SIZE;
+}
+
+/**
+ * Copies "total" bytes between "buf" and the file at "offset", the pages
+ * must already be there
+ */
+static void tmpfs_copy(struct tmpfs_inode *inode, uint32_t offset,
+                       uint32_t total, char *buf, bool write) {
+  while (total) {
+    char *page = inode->pages[offset / PAGING_PAGE_SIZE];
+    uint32_t in_page = offset % PAGING_PAGE_SIZE;
+    uint32_t chunk = PAGING_PAGE_SIZE - in_page;
+    if (chunk > total) {
+      chunk = total;
+    }
+
+    if (write) {
+      memcpy(page + in_page, buf, chunk);
+    } else {
+      memcpy(buf, page + in_page, chunk);
+    }
+
+    offset += chunk;
+    buf += chunk;
+    total -= chunk;
+  }
+}
+
+void *tmpfs_open(struct disk *disk, struct path_part *path, FILE_MODE mode) {
+  struct tmpfs_private *private = disk->fs_private;
+  struct tmpfs_file_descriptor *descriptor = 0;
+  int err_code = 0;
+  if (path->next) {
+    err_code = -EBADPATH;
+    goto err_out;
+  }
+
+  descriptor = kzalloc(sizeof(struct tmpfs_file_descriptor));
+  if (!descriptor) {
+    err_code = -ENOMEM;
+    goto err_out;
+  }
+
+  struct tmpfs_inode *inode = tmpfs_find(private, path->part);
+  if (!inode) {
+    if (mode == FILE_MODE_READ) {
+      err_code = -EIO;
+      goto err_out;
+    }
+
+    inode = tmpfs_create(private, path->part);
+    if (ISERR(inode)) {
+      err_code = ERROR_I(inode);
+      goto err_out;
+    }
+  }
+
+  if (mode == FILE_MODE_WRITE) {
+    tmpfs_free_pages(private, inode, 0);
+    inode->size = 0;
+  }
+
+  descriptor->tmpfs = private;
+  descriptor->inode = inode;
+  descriptor->pos = mode == FILE_MODE_APPEND ? inode->size : 0;
+  inode->refcount++;
+  return descriptor;
+
+err_out:
+  if (descriptor) {
+    kfree(descriptor);
+  }
+
+  return ERROR(err_code);
+}
+
+int tmpfs_close(void *private) {
+  struct tmpfs_file_descriptor *desc = private;
+  struct tmpfs_inode *inode = desc->inode;
+  inode->refcount--;
+  if (inode->refcount == 0 && inode->unlinked) {
+    tmpfs_inode_free(desc->tmpfs, inode);
+  }
+  kfree(desc);
+  return 0;
+}
+
+int tmpfs_volume_name(void *private, char *name_out, size_t max) {
+  strncpy(name_out, "TMP", max);
+  return 0;
+}
+
+int tmpfs_stat(struct disk *disk, void *private, struct file_stat *stat) {
+  struct tmpfs_file_descriptor *desc = private;
+  stat->filesize = desc->inode->size;
+  stat->flags = 0x00;
+  stat->id = desc->inode->id;
+  return 0;
+}
+
+int tmpfs_read(struct disk *disk, void *descriptor, uint32_t size,
+               uint32_t nmemb, char *out_ptr) {
+  struct tmpfs_file_descriptor *desc = descriptor;
+  uint64_t total = (uint64_t)size * nmemb;
+  if (size == 0 || total > 0x7FFFFFFF) {
+    return -EINVARG;
+  }
+
+  // Like fread only the whole elements before the end of the file are read
+  uint32_t filesize = desc->inode->size;
+  uint32_t left = filesize > desc->pos ? filesize - desc->pos : 0;
+  if (nmemb > left / size) {
+    nmemb = left / size;
+    total = (uint64_t)size * nmemb;
+  }
+
+  tmpfs_copy(desc->inode, desc->pos, total, out_ptr, false);
+  desc->pos += total;
+  return nmemb;
+}
+
+int tmpfs_readv(struct disk *disk, void *descriptor,
+                const struct file_iovec *iov, int iovcnt, int64_t offset) {
+  struct tmpfs_file_descriptor *desc = descriptor;
+  struct file_iovec clamped[VIOS_FILE_MAX_IOVECS];
+  if (iovcnt > VIOS_FILE_MAX_IOVECS) {
+    return -EINVARG;
+  }
+
+  uint32_t pos = offset == FILE_POSITION_CURRENT ? desc->pos : offset;
+  uint32_t filesize = desc->inode->size;
+  uint32_t left = filesize > pos ? filesize - pos : 0;
+  iovcnt = file_iovec_clamp(iov, iovcnt, left, clamped);
+
+  uint32_t done = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    tmpfs_copy(desc->inode, pos + done, clamped[i].len, clamped[i].base,
+               false);
+    done += clamped[i].len;
+  }
+
+  if (offset == FILE_POSITION_CURRENT) {
+    desc->pos += done;
+  }
+  return done;
+}
+
+int tmpfs_write(struct disk *disk, void *descriptor, uint32_t size,
+                uint32_t nmemb, const char *in) {
+  struct tmpfs_file_descriptor *desc = descriptor;
+  struct tmpfs_inode *inode = desc->inode;
+  uint64_t total = (uint64_t)size * nmemb;
+  if (total > 0x7FFFFFFF || desc->pos + total > 0xFFFFFFFF) {
+    return -EINVARG;
+  }
+
+  uint32_t end = desc->pos + total;
+  int res = tmpfs_grow(desc->tmpfs, inode, tmpfs_pages_for(end));
+  if (res < 0) {
+    return res;
+  }
+
+  tmpfs_copy(inode, desc->pos, total, (char *)in, true);
+  desc->pos = end;
+  if (end > inode->size) {
+    inode->size = end;
+  }
+  return nmemb;
+}
+
+/**
+ * Sets the file size, a growing file reads back zeroes past its old end
+ */
+int tmpfs_truncate(struct disk *disk, void *descriptor, uint32_t size) {
+  struct tmpfs_file_descriptor *desc = descriptor;
+  struct tmpfs_inode *inode = desc->inode;
+  if (size > inode->size) {
+    int res = tmpfs_grow(desc->tmpfs, inode, tmpfs_pages_for(size));
+    if (res < 0) {
+      return res;
+    }
+
+    inode->size = size;
+    return VIOS_ALL_OK;
+  }
+
+  tmpfs_free_pages(desc->tmpfs, inode, tmpfs_pages_for(size));
+  // The rest of the last page must read back as zeroes if the file grows
+  if (size % PAGING_PAGE_SIZE) {
+    char *page = inode->pages[size / PAGING_PAGE_SIZE];
+    memset(page + size % PAGING_PAGE_SIZE, 0,
+           PAGING_PAGE_SIZE - size % PAGING_PAGE_SIZE);
+  }
+  inode->size = size;
+  return VIOS_ALL_OK;
+}
+
+int tmpfs_unlink(struct disk *disk, struct path_part *path) {
+  struct tmpfs_private *private = disk->fs_private;
+  if (path->next) {
+    return -EBADPATH;
+  }
+
+  struct tmpfs_inode **link = &private->files;
+  while (*link && istrncmp((*link)->name, path->part, VIOS_TMPFS_NAME_MAX)) {
+    link = &(*link)->next;
+  }
+
+  struct tmpfs_inode *inode = *link;
+  if (!inode) {
+    return -EIO;
+  }
+
+  *link = inode->next;
+  if (inode->refcount) {
+    inode->unlinked = true;
+  } else {
+    tmpfs_inode_free(private, inode);
+  }
+  return VIOS_ALL_OK;
+}
+
+int tmpfs_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode) {
+  int res = 0;
+  struct tmpfs_file_descriptor *desc = private;
+  uint32_t filesize = desc->inode->size;
+  switch (seek_mode) {
+  case SEEK_SET:
+    if (offset > filesize) {
+      res = -EIO;
+      break;
+    }
+    desc->pos = offset;
+    break;
+
+  case SEEK_CUR:
+    // Another descriptor may have truncated the file under this one
+    if (desc->pos > filesize || offset > filesize - desc->pos) {
+      res = -EIO;
+      break;
+    }
+    desc->pos += offset;
+    break;
+
+  case SEEK_END:
+    res = -EUNIMP;
+    break;
+
+  default:
+    res = -EINVARG;
+    break;
+  }
+
+  return res;
+}
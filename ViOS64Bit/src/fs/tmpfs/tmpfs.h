@@ -0,0 +1,9 @@
+#ifndef KERNEL_FS_TMPFS_H
+#define KERNEL_FS_TMPFS_H
+
+#include "fs/file.h"
+
+struct filesystem *tmpfs_init();
+int tmpfs_mount();
+
+#endif
@@ -0,0 +1,183 @@
+#include "benchmark.h"
+#include "blit.h"
+#include "cpu/cpu.h"
+#include "font.h"
+#include "graphics.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "string/string.h"
+
+// Full screen pastes per measurement
+#define GRAPHICS_BENCHMARK_ITERATIONS 8
+
+// Lines of text drawn per measurement
+#define GRAPHICS_BENCHMARK_TEXT_LINES 256
+
+static const char graphics_benchmark_text[] =
+    "The quick brown fox jumps over the lazy dog 0123456789 !?#@&*()";
+
+static uint64_t graphics_benchmark_mp_per_second(uint64_t pixels,
+                                                 uint64_t cycles) {
+  uint64_t tsc_per_ms = cpu_info()->tsc_per_ms;
+  if (!cycles || !tsc_per_ms) {
+    return 0;
+  }
+
+  // pixels per cycle * cycles per second, scaled to megapixels
+  return pixels * tsc_per_ms / cycles / 1000;
+}
+
+static void graphics_benchmark_print(const char *name, uint64_t pixels,
+                                     uint64_t cycles) {
+  print(name);
+  print(": ");
+  print(itoa(graphics_benchmark_mp_per_second(pixels, cycles)));
+  print("MP/s\n");
+}
+
+/**
+ * The paste loop as it was before the row blitters, one memcmp against
+ * the key per pixel. Kept to show what they gained
+ */
+static void graphics_benchmark_per_pixel(struct framebuffer_pixel *dst,
+                                         struct framebuffer_pixel *src,
+                                         uint32_t count,
+                                         struct framebuffer_pixel *key) {
+  for (uint32_t i = 0; i < count; i++) {
+    struct framebuffer_pixel no_transparency_color = {0};
+    if (memcmp(key, &no_transparency_color, sizeof(*key)) != 0 &&
+        memcmp(&src[i], key, sizeof(*key)) == 0) {
+      continue;
+    }
+    dst[i] = src[i];
+  }
+}
+
+/**
+ * Draws lines of text with font_draw_text over the top of the screen and
+ * prints the characters per second, the pixels drawn over are put back
+ */
+static void graphics_benchmark_text_draw() {
+  struct graphics_info *screen = graphics_screen_info();
+  struct font *font = font_get_system_font();
+  if (!font) {
+    return;
+  }
+
+  size_t line_pixels = screen->width * font->bits_height_per_character;
+  struct framebuffer_pixel *saved =
+      kmalloc(line_pixels * sizeof(struct framebuffer_pixel));
+  if (!saved) {
+    print("Graphics benchmark: out of memory\n");
+    return;
+  }
+  memcpy(saved, screen->pixels, line_pixels * sizeof(struct framebuffer_pixel));
+
+  struct framebuffer_pixel color = {.green = 0xff, .red = 0xff};
+  uint64_t start = cpu_rdtsc();
+  for (int i = 0; i < GRAPHICS_BENCHMARK_TEXT_LINES; i++) {
+    font_draw_text(screen, font, 0, 0, graphics_benchmark_text, color);
+  }
+  uint64_t cycles = cpu_rdtsc() - start;
+
+  memcpy(screen->pixels, saved, line_pixels * sizeof(struct framebuffer_pixel));
+  graphics_redraw_graphics_to_screen(screen, 0, 0, screen->width,
+                                     font->bits_height_per_character);
+  graphics_flush();
+  kfree(saved);
+
+  uint64_t characters =
+      (sizeof(graphics_benchmark_text) - 1) * GRAPHICS_BENCHMARK_TEXT_LINES;
+  uint64_t tsc_per_ms = cpu_info()->tsc_per_ms;
+  print("text: ");
+  print(itoa(cycles ? characters * tsc_per_ms * 1000 / cycles : 0));
+  print(" chars/s\n");
+}
+
+/**
+ * Pastes a screen sized image into a screen sized buffer and prints the
+ * megapixels per second of every way of doing it, opaque and with about
+ * a third of the pixels matching the transparency key. Then measures
+ * drawing text
+ */
+void graphics_benchmark() {
+  struct graphics_info *screen = graphics_screen_info();
+  uint32_t width = screen->horizontal_resolution;
+  uint32_t height = screen->vertical_resolution;
+  uint32_t stride = screen->pixels_per_scanline;
+  uint64_t pixels = (uint64_t)width * height * GRAPHICS_BENCHMARK_ITERATIONS;
+  struct framebuffer_pixel key = {.blue = 0xff, .red = 0xff};
+
+  struct framebuffer_pixel *src =
+      kmalloc(width * height * sizeof(struct framebuffer_pixel));
+  struct framebuffer_pixel *dst =
+      kmalloc(stride * height * sizeof(struct framebuffer_pixel));
+  if (!src || !dst) {
+    print("Graphics benchmark: out of memory\n");
+    goto out;
+  }
+
+  for (uint32_t i = 0; i < width * height; i++) {
+    src[i].blue = i;
+    src[i].green = i >> 8;
+    src[i].red = i >> 16;
+    src[i].reserved = 0;
+    if ((i / 3) % 3 == 0) {
+      src[i] = key;
+    }
+  }
+
+  print("Graphics benchmark, ");
+  print(itoa(width));
+  print("x");
+  print(itoa(height));
+  print(" pastes with the ");
+  print(graphics_blitter_current()->name);
+  print(" blitter\n");
+  if (!cpu_info()->tsc_per_ms) {
+    print("TSC calibration failed, MP/s unavailable\n");
+  }
+
+  uint64_t start = cpu_rdtsc();
+  for (int i = 0; i < GRAPHICS_BENCHMARK_ITERATIONS; i++) {
+    for (uint32_t y = 0; y < height; y++) {
+      graphics_benchmark_per_pixel(&dst[y * stride], &src[y * width], width,
+                                   &key);
+    }
+  }
+  graphics_benchmark_print("per pixel keyed", pixels, cpu_rdtsc() - start);
+
+  start = cpu_rdtsc();
+  for (int i = 0; i < GRAPHICS_BENCHMARK_ITERATIONS; i++) {
+    for (uint32_t y = 0; y < height; y++) {
+      graphics_blit_span(&dst[y * stride], &src[y * width], width, NULL);
+    }
+  }
+  graphics_benchmark_print("rows opaque", pixels, cpu_rdtsc() - start);
+
+  for (size_t b = 0; b < graphics_blit_total_blitters(); b++) {
+    struct graphics_blitter *blitter = graphics_blitter_get(b);
+    if (!graphics_blitter_supported(blitter)) {
+      continue;
+    }
+
+    uint32_t key_word = 0;
+    memcpy(&key_word, &key, sizeof(key_word));
+    start = cpu_rdtsc();
+    for (int i = 0; i < GRAPHICS_BENCHMARK_ITERATIONS; i++) {
+      for (uint32_t y = 0; y < height; y++) {
+        blitter->copy_keyed(&dst[y * stride], &src[y * width], width,
+                            key_word);
+      }
+    }
+    print("rows keyed ");
+    graphics_benchmark_print(blitter->name, pixels, cpu_rdtsc() - start);
+  }
+
+  graphics_benchmark_text_draw();
+
+out:
+  kfree(src);
+  kfree(dst);
+}
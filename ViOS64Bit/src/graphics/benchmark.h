@@ -0,0 +1,6 @@
+#ifndef KERNEL_GRAPHICS_BENCHMARK_H
+#define KERNEL_GRAPHICS_BENCHMARK_H
+
+void graphics_benchmark();
+
+#endif
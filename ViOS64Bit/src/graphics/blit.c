@@ -0,0 +1,156 @@
+#include "blit.h"
+#include "cpu/cpu.h"
+#include "graphics.h"
+#include "memory/memory.h"
+
+// Pixels compared and stored as whole 32 bit words
+typedef uint32_t __attribute__((may_alias)) graphics_blit_word_t;
+
+static void graphics_copy_keyed_generic(struct framebuffer_pixel *dst,
+                                        const struct framebuffer_pixel *src,
+                                        uint32_t count, uint32_t key) {
+  graphics_blit_word_t *d = (graphics_blit_word_t *)dst;
+  const graphics_blit_word_t *s = (const graphics_blit_word_t *)src;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t pixel = s[i];
+    if (pixel != key) {
+      d[i] = pixel;
+    }
+  }
+}
+
+/**
+ * Four pixels a step. Groups entirely of the key are skipped and groups
+ * with none of it stored as they are, only mixed groups read the
+ * destination to blend
+ */
+static void graphics_copy_keyed_sse2(struct framebuffer_pixel *dst,
+                                     const struct framebuffer_pixel *src,
+                                     uint32_t count, uint32_t key) {
+  uint8_t saved[CPU_SSE2_SAVE_BYTES];
+  size_t blocks = count / 4;
+  if (blocks) {
+    __asm__ __volatile__(CPU_SSE2_SAVE
+                         "movd %[key], %%xmm3\n\t"
+                         "pshufd $0, %%xmm3, %%xmm3\n\t"
+                         "1:\n\t"
+                         "movdqu (%[s]), %%xmm0\n\t"
+                         "movdqa %%xmm0, %%xmm1\n\t"
+                         "pcmpeqd %%xmm3, %%xmm1\n\t"
+                         "pmovmskb %%xmm1, %%eax\n\t"
+                         "cmp $0xffff, %%eax\n\t"
+                         "je 3f\n\t"
+                         "test %%eax, %%eax\n\t"
+                         "jz 2f\n\t"
+                         "movdqu (%[d]), %%xmm2\n\t"
+                         "pand %%xmm1, %%xmm2\n\t"
+                         "pandn %%xmm0, %%xmm1\n\t"
+                         "por %%xmm2, %%xmm1\n\t"
+                         "movdqa %%xmm1, %%xmm0\n\t"
+                         "2:\n\t"
+                         "movdqu %%xmm0, (%[d])\n\t"
+                         "3:\n\t"
+                         "add $16, %[s]\n\t"
+                         "add $16, %[d]\n\t"
+                         "dec %[n]\n\t"
+                         "jnz 1b\n\t" CPU_SSE2_RESTORE
+                         : [d] "+r"(dst), [s] "+r"(src), [n] "+r"(blocks)
+                         : [save] "r"(saved), [key] "r"(key)
+                         : "rax", "memory", "cc");
+  }
+
+  graphics_copy_keyed_generic(dst, src, count % 4, key);
+}
+
+/**
+ * Eight pixels a step, the pixels that are not the key are written with
+ * a masked store so the destination is never read
+ */
+static void graphics_copy_keyed_avx2(struct framebuffer_pixel *dst,
+                                     const struct framebuffer_pixel *src,
+                                     uint32_t count, uint32_t key) {
+  uint8_t saved[CPU_AVX_SAVE_BYTES];
+  size_t blocks = count / 8;
+  if (blocks) {
+    __asm__ __volatile__(CPU_AVX_SAVE
+                         "vmovd %[key], %%xmm3\n\t"
+                         "vpbroadcastd %%xmm3, %%ymm3\n\t"
+                         "vpcmpeqd %%ymm2, %%ymm2, %%ymm2\n\t"
+                         "1:\n\t"
+                         "vmovdqu (%[s]), %%ymm0\n\t"
+                         "vpcmpeqd %%ymm3, %%ymm0, %%ymm1\n\t"
+                         "vpxor %%ymm2, %%ymm1, %%ymm1\n\t"
+                         "vpmaskmovd %%ymm0, %%ymm1, (%[d])\n\t"
+                         "add $32, %[s]\n\t"
+                         "add $32, %[d]\n\t"
+                         "dec %[n]\n\t"
+                         "jnz 1b\n\t" CPU_AVX_RESTORE
+                         : [d] "+r"(dst), [s] "+r"(src), [n] "+r"(blocks)
+                         : [save] "r"(saved), [key] "r"(key)
+                         : "memory", "cc");
+  }
+
+  graphics_copy_keyed_generic(dst, src, count % 8, key);
+}
+
+static struct graphics_blitter graphics_blitters[] = {
+    {.name = "generic",
+     .required_features = 0,
+     .copy_keyed = graphics_copy_keyed_generic},
+    {.name = "sse2",
+     .required_features = CPU_FEATURE_SSE2,
+     .copy_keyed = graphics_copy_keyed_sse2},
+    {.name = "avx2",
+     .required_features = CPU_FEATURE_AVX2,
+     .copy_keyed = graphics_copy_keyed_avx2}};
+
+// Until graphics_blit_init runs only the generic routine is safe to use
+static struct graphics_blitter *graphics_current_blitter =
+    &graphics_blitters[0];
+
+size_t graphics_blit_total_blitters() {
+  return sizeof(graphics_blitters) / sizeof(graphics_blitters[0]);
+}
+
+struct graphics_blitter *graphics_blitter_get(size_t index) {
+  if (index >= graphics_blit_total_blitters()) {
+    return NULL;
+  }
+
+  return &graphics_blitters[index];
+}
+
+struct graphics_blitter *graphics_blitter_current() {
+  return graphics_current_blitter;
+}
+
+bool graphics_blitter_supported(struct graphics_blitter *blitter) {
+  return cpu_has_feature(blitter->required_features);
+}
+
+void graphics_blit_init() {
+  // The blitters are ordered from the least to the most capable
+  for (size_t i = graphics_blit_total_blitters(); i > 0; i--) {
+    struct graphics_blitter *blitter = &graphics_blitters[i - 1];
+    if (graphics_blitter_supported(blitter)) {
+      graphics_current_blitter = blitter;
+      break;
+    }
+  }
+}
+
+/**
+ * Copies a row of "count" pixels, skipping those equal to "key" unless it
+ * is NULL. Rows without a key are a plain memcpy
+ */
+void graphics_blit_span(struct framebuffer_pixel *dst,
+                        const struct framebuffer_pixel *src, uint32_t count,
+                        const struct framebuffer_pixel *key) {
+  if (!key) {
+    memcpy(dst, (void *)src, count * sizeof(struct framebuffer_pixel));
+    return;
+  }
+
+  graphics_current_blitter->copy_keyed(dst, src, count,
+                                       *(const graphics_blit_word_t *)key);
+}
@@ -0,0 +1,32 @@
+#ifndef KERNEL_GRAPHICS_BLIT_H
+#define KERNEL_GRAPHICS_BLIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct framebuffer_pixel;
+
+// A routine copying a row of pixels that skips those matching a key,
+// tuned for a particular CPU feature
+struct graphics_blitter {
+  const char *name;
+
+  // CPU_FEATURE_* bits the routine depends on
+  uint32_t required_features;
+
+  void (*copy_keyed)(struct framebuffer_pixel *dst,
+                     const struct framebuffer_pixel *src, uint32_t count,
+                     uint32_t key);
+};
+
+void graphics_blit_init();
+size_t graphics_blit_total_blitters();
+struct graphics_blitter *graphics_blitter_get(size_t index);
+struct graphics_blitter *graphics_blitter_current();
+bool graphics_blitter_supported(struct graphics_blitter *blitter);
+void graphics_blit_span(struct framebuffer_pixel *dst,
+                        const struct framebuffer_pixel *src, uint32_t count,
+                        const struct framebuffer_pixel *key);
+
+#endif
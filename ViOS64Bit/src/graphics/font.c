@@ -1,4 +1,5 @@
 #include "graphics/font.h"
+#include "graphics/blit.h"
 #include "graphics/graphics.h"
 #include "kernel.h"
 #include "lib/vector/vector.h"
@@ -11,6 +12,23 @@
 struct vector *loaded_fonts = NULL;
 struct font *system_font = NULL;
 
+// A character rasterized in one colour, the pixels it leaves alone hold
+// "key" so it can be pasted with the keyed row blitter
+struct font_glyph {
+  struct font *font;
+  int index;
+  uint32_t color;
+  struct framebuffer_pixel key;
+  struct framebuffer_pixel *pixels;
+};
+
+// Direct mapped by (font, character, colour), a glyph that collides with
+// another is rasterized again over it
+static struct {
+  struct font_glyph *glyphs;
+  struct framebuffer_pixel *pixels;
+} font_glyph_cache;
+
 int font_draw_from_index(struct graphics_info *graphics_info, struct font *font,
                          int screen_x, int screen_y, int index_character,
                          struct framebuffer_pixel font_color);
@@ -142,20 +160,7 @@ struct font *font_create(uint8_t *character_data, size_t character_count,
   return font;
 }
 
-int font_draw_from_index(struct graphics_info *graphics_info, struct font *font,
-                         int screen_x, int screen_y, int index_character,
-                         struct framebuffer_pixel font_color) {
-  int res = 0;
-  if (!font) {
-    res = -EINVARG;
-    goto out;
-  }
-
-  if (index_character > font->character_count) {
-    res = 0;
-    goto out;
-  }
-
+static size_t font_bytes_per_character(struct font *font) {
   size_t total_required_bits_per_character =
       font->bits_width_per_character * font->bits_height_per_character;
 
@@ -165,18 +170,163 @@ int font_draw_from_index(struct graphics_info *graphics_info, struct font *font,
     total_required_bytes_per_character++;
   }
 
-  size_t character_index = index_character * total_required_bytes_per_character;
-  for (size_t x = 0; x < font->bits_width_per_character; x++) {
-    for (size_t y = 0; y < font->bits_height_per_character; y++) {
-      size_t char_offset = character_index;
-      size_t bit_index = y * font->bits_width_per_character + x;
-      size_t byte_index = char_offset + (bit_index / 8);
-      if ((font->character_data[byte_index] >> (bit_index % 8)) & 0x01) {
-        size_t abs_x = screen_x + x;
-        size_t abs_y = screen_y + y;
-        graphics_draw_pixel(graphics_info, abs_x, abs_y, font_color);
+  return total_required_bytes_per_character;
+}
+
+static bool font_glyph_bit(struct font *font, int index_character, size_t x,
+                           size_t y) {
+  size_t char_offset = index_character * font_bytes_per_character(font);
+  size_t bit_index = y * font->bits_width_per_character + x;
+  size_t byte_index = char_offset + (bit_index / 8);
+  return (font->character_data[byte_index] >> (bit_index % 8)) & 0x01;
+}
+
+/**
+ * Allocates the glyph cache once, drawing falls back to plotting each
+ * pixel when it is turned off or cannot be allocated
+ */
+static void font_glyph_cache_init() {
+  if (!VIOS_FONT_GLYPH_CACHE) {
+    return;
+  }
+
+  struct font_glyph *glyphs =
+      kzalloc(VIOS_FONT_GLYPH_CACHE_ENTRIES * sizeof(struct font_glyph));
+  struct framebuffer_pixel *pixels =
+      kzalloc(VIOS_FONT_GLYPH_CACHE_ENTRIES * VIOS_FONT_GLYPH_MAX_PIXELS *
+              sizeof(struct framebuffer_pixel));
+  if (!glyphs || !pixels) {
+    if (glyphs) {
+      kfree(glyphs);
+    }
+    if (pixels) {
+      kfree(pixels);
+    }
+    return;
+  }
+
+  font_glyph_cache.glyphs = glyphs;
+  font_glyph_cache.pixels = pixels;
+}
+
+/**
+ * Returns the character rasterized in "font_color", rasterizing it on a
+ * miss. NULL when the cache is turned off, could not be allocated or the
+ * font is too large for it
+ */
+static struct font_glyph *font_glyph_get(struct font *font,
+                                         int index_character,
+                                         struct framebuffer_pixel font_color) {
+  size_t total_pixels =
+      font->bits_width_per_character * font->bits_height_per_character;
+  if (!VIOS_FONT_GLYPH_CACHE || total_pixels > VIOS_FONT_GLYPH_MAX_PIXELS) {
+    return NULL;
+  }
+
+  if (!font_glyph_cache.glyphs) {
+    return NULL;
+  }
+
+  uint32_t color = 0;
+  memcpy(&color, &font_color, sizeof(color));
+  uint32_t hash = (uint32_t)index_character * 2654435761u ^ color * 40503u ^
+                  (uint32_t)((uintptr_t)font >> 4);
+  size_t slot = hash & (VIOS_FONT_GLYPH_CACHE_ENTRIES - 1);
+  struct font_glyph *glyph = &font_glyph_cache.glyphs[slot];
+  if (glyph->font == font && glyph->index == index_character &&
+      glyph->color == color) {
+    return glyph;
+  }
+
+  glyph->font = font;
+  glyph->index = index_character;
+  glyph->color = color;
+  glyph->pixels = &font_glyph_cache.pixels[slot * VIOS_FONT_GLYPH_MAX_PIXELS];
+
+  // Differs from the colour in the reserved byte so it never matches it
+  glyph->key = font_color;
+  glyph->key.reserved = ~font_color.reserved;
+
+  struct framebuffer_pixel *pixel = glyph->pixels;
+  for (size_t y = 0; y < font->bits_height_per_character; y++) {
+    for (size_t x = 0; x < font->bits_width_per_character; x++) {
+      *pixel++ = font_glyph_bit(font, index_character, x, y) ? font_color
+                                                              : glyph->key;
+    }
+  }
+
+  return glyph;
+}
+
+/**
+ * Draws a character into the pixels of "graphics_info" without redrawing
+ * them to the screen. Cached glyphs are pasted a clipped row at a time
+ */
+static int font_draw_index_to_pixels(struct graphics_info *graphics_info,
+                                     struct font *font, int screen_x,
+                                     int screen_y, int index_character,
+                                     struct framebuffer_pixel font_color) {
+  if (!font) {
+    return -EINVARG;
+  }
+
+  if (index_character < 0 || index_character >= font->character_count) {
+    return 0;
+  }
+
+  // Mirrors graphics_draw_pixel, a character in the ignore colour is not drawn
+  struct framebuffer_pixel black_pixel = {0};
+  if (memcmp(&graphics_info->ignore_color, &black_pixel,
+             sizeof(black_pixel)) != 0 &&
+      memcmp(&graphics_info->ignore_color, &font_color, sizeof(font_color)) ==
+          0) {
+    return 0;
+  }
+
+  struct font_glyph *glyph =
+      font_glyph_get(font, index_character, font_color);
+  if (!glyph) {
+    for (size_t x = 0; x < font->bits_width_per_character; x++) {
+      for (size_t y = 0; y < font->bits_height_per_character; y++) {
+        if (font_glyph_bit(font, index_character, x, y)) {
+          size_t abs_x = screen_x + x;
+          size_t abs_y = screen_y + y;
+          graphics_draw_pixel(graphics_info, abs_x, abs_y, font_color);
+        }
       }
     }
+    return 0;
+  }
+
+  // Clip to the pixels of the graphics
+  int width = font->bits_width_per_character;
+  int height = font->bits_height_per_character;
+  int first_x = screen_x < 0 ? -screen_x : 0;
+  int first_y = screen_y < 0 ? -screen_y : 0;
+  int end_x = MIN(width, (int)graphics_info->width - screen_x);
+  int end_y = MIN(height, (int)graphics_info->height - screen_y);
+  if (first_x >= end_x || first_y >= end_y) {
+    return 0;
+  }
+
+  for (int y = first_y; y < end_y; y++) {
+    struct framebuffer_pixel *dst =
+        &graphics_info->pixels[(screen_y + y) * graphics_info->width +
+                               screen_x + first_x];
+    graphics_blit_span(dst, &glyph->pixels[y * width + first_x],
+                       end_x - first_x, &glyph->key);
+  }
+
+  return 0;
+}
+
+int font_draw_from_index(struct graphics_info *graphics_info, struct font *font,
+                         int screen_x, int screen_y, int index_character,
+                         struct framebuffer_pixel font_color) {
+  int res = font_draw_index_to_pixels(graphics_info, font, screen_x, screen_y,
+                                      index_character, font_color);
+  if (res < 0) {
+    goto out;
   }
 
   // redraw the region to the screen
@@ -195,6 +345,18 @@ int font_draw(struct graphics_info *graphics_info, struct font *font,
                               character, font_color);
 }
 
+/**
+ * Draws a character like font_draw but leaves redrawing the region to
+ * the screen to the caller, so a run of characters is redrawn at once
+ */
+int font_draw_to_pixels(struct graphics_info *graphics_info, struct font *font,
+                        int screen_x, int screen_y, int character,
+                        struct framebuffer_pixel font_color) {
+  character -= (int)font->subtract_from_ascii_char_index_for_drawing;
+  return font_draw_index_to_pixels(graphics_info, font, screen_x, screen_y,
+                                   character, font_color);
+}
+
 int font_draw_text(struct graphics_info *graphics_info, struct font *font,
                    int screen_x, int screen_y, const char *str,
                    struct framebuffer_pixel font_color) {
@@ -205,7 +367,7 @@ int font_draw_text(struct graphics_info *graphics_info, struct font *font,
     font = font_get_system_font();
   }
   while (*str != 0) {
-    res = font_draw(graphics_info, font, x, y, *str, font_color);
+    res = font_draw_to_pixels(graphics_info, font, x, y, *str, font_color);
     if (res < 0) {
       break;
     }
@@ -213,6 +375,13 @@ int font_draw_text(struct graphics_info *graphics_info, struct font *font,
     x += font->bits_width_per_character;
     str++;
   }
+
+  // The whole string reaches the screen as one region
+  if (x > screen_x) {
+    graphics_redraw_graphics_to_screen(graphics_info, screen_x, screen_y,
+                                       x - screen_x,
+                                       font->bits_height_per_character);
+  }
   return res;
 }
 int font_system_init() {
@@ -223,6 +392,8 @@ int font_system_init() {
     goto out;
   }
 
+  font_glyph_cache_init();
+
   system_font = font_load("@:/sysfont.bmp");
   if (!system_font) {
     // Don't panic - just return an error and let the system continue without
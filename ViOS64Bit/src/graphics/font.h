@@ -34,6 +34,9 @@ int font_draw_text(struct graphics_info *graphics_info, struct font *font,
 int font_draw(struct graphics_info *graphics_info, struct font *font,
               int screen_x, int screen_y, int character,
               struct framebuffer_pixel font_color);
+int font_draw_to_pixels(struct graphics_info *graphics_info, struct font *font,
+                        int screen_x, int screen_y, int character,
+                        struct framebuffer_pixel font_color);
 struct font *font_create(uint8_t *character_data, size_t character_count,
                          size_t bits_width_per_character,
                          size_t bits_height_per_chracter,
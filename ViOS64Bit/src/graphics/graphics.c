@@ -1,10 +1,14 @@
 #include "graphics.h"
+#include "blit.h"
+#include "config.h"
+#include "cpu/cpu.h"
 #include "kernel.h"
 #include "memory/paging/paging.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
 #include "lib/vector/vector.h"
 #include "status.h"
+#include "string/string.h"
 
 
 struct graphics_info* loaded_graphics_info = NULL;
@@ -19,7 +23,38 @@ size_t real_framebuffer_width = 0;
 size_t real_framebuffer_height = 0;
 size_t real_framebuffer_pixels_per_scanline = 0;
 
+// The real framebuffer once the screen draws to a back buffer in system
+// memory, NULL when pastes go straight to the real framebuffer
+static struct framebuffer_pixel *graphics_front_buffer = NULL;
+
+struct graphics_rect {
+  uint32_t x;
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+};
+
+// Parts of the back buffer not yet copied to the real framebuffer, no two
+// of them touch
+static struct {
+  struct graphics_rect rects[VIOS_GRAPHICS_MAX_DAMAGE_RECTS];
+  int total;
+
+  // When the oldest damage was done, zero when there is none
+  uint64_t since;
+} graphics_damage;
+
+static struct {
+  uint64_t pastes;
+  uint64_t paste_ticks;
+  uint64_t flushes;
+  uint64_t flush_ticks;
+  uint64_t flushed_pixels;
+} graphics_stats;
+
 void graphics_redraw_children(struct graphics_info* g);
+static void graphics_damage_add(uint32_t x, uint32_t y, uint32_t width,
+                                uint32_t height);
 
 struct graphics_info* graphics_screen_info()
 {
@@ -81,32 +116,175 @@ void graphics_paste_pixels_to_framebuffer(
     if (clipped_w == 0 || clipped_h == 0)
         return;
 
+    uint64_t start = cpu_rdtsc();
+
+    // Transparency color, check if we have one
+    // black pixel transparency color means no transparency color.
+    struct framebuffer_pixel no_transparency_color = {0};
+    struct framebuffer_pixel* key = NULL;
+    if (memcmp(&src_info->transparency_key, &no_transparency_color, sizeof(no_transparency_color)) != 0)
+    {
+        key = &src_info->transparency_key;
+    }
+
+    struct framebuffer_pixel* src_row = &src_info->pixels[src_y * src_info->width + src_x];
+    struct framebuffer_pixel* dst_row = &screen->framebuffer[dst_abs_y * screen->pixels_per_scanline + dst_abs_x];
+
+    // Rows that run on into the next without a gap on both sides go as one span
+    uint32_t span = clipped_w;
+    uint32_t total_spans = clipped_h;
+    if (clipped_w == src_info->width && clipped_w == screen->pixels_per_scanline)
+    {
+        span = clipped_w * clipped_h;
+        total_spans = 1;
+    }
+
     // Copy line by line
-    for(uint32_t ly = 0; ly < clipped_h; ly++)
+    for (uint32_t ly = 0; ly < total_spans; ly++)
     {
-        for (uint32_t lx = 0; lx < clipped_w; lx++)
-        {
-            struct framebuffer_pixel p = src_info->pixels[(src_y + ly) * src_info->width + (src_x + lx)];
-
-            // Transparency color, check if we have one
-            // black pixel transparency color means no transparency color.
-            struct framebuffer_pixel no_transparency_color = {0};
-
-            // Do we have a transparncy key?
-            if(memcmp(&src_info->transparency_key, &no_transparency_color, sizeof(no_transparency_color)) != 0)
-            {
-                // We have a transprancy key does it match
-                if (memcmp(&p, &src_info->transparency_key, sizeof(p)) == 0)
-                {
-                    // Continue do not draw this pixel.
-                    continue;
-                }
-            }
-
-            // Write to the screen
-            screen->framebuffer[(dst_abs_y + ly) * screen->pixels_per_scanline + (dst_abs_x + lx)] = p; 
-        }
+        graphics_blit_span(dst_row, src_row, span, key);
+        src_row += src_info->width;
+        dst_row += screen->pixels_per_scanline;
+    }
+
+    graphics_stats.pastes++;
+    graphics_stats.paste_ticks += cpu_rdtsc() - start;
+    graphics_damage_add(dst_abs_x, dst_abs_y, clipped_w, clipped_h);
+}
+
+static bool graphics_rect_touches(struct graphics_rect *a,
+                                  struct graphics_rect *b) {
+  return a->x <= b->x + b->width && b->x <= a->x + a->width &&
+         a->y <= b->y + b->height && b->y <= a->y + a->height;
+}
+
+static struct graphics_rect graphics_rect_union(struct graphics_rect *a,
+                                                struct graphics_rect *b) {
+  struct graphics_rect rect;
+  rect.x = MIN(a->x, b->x);
+  rect.y = MIN(a->y, b->y);
+  rect.width = MAX(a->x + a->width, b->x + b->width) - rect.x;
+  rect.height = MAX(a->y + a->height, b->y + b->height) - rect.y;
+  return rect;
+}
+
+static uint64_t graphics_rect_area(struct graphics_rect *rect) {
+  return (uint64_t)rect->width * rect->height;
+}
+
+/**
+ * Records that part of the back buffer changed. Damage touching what is
+ * already recorded is merged with it, so a line of text becomes one
+ * rectangle. The back buffer is flushed once the oldest damage has
+ * waited VIOS_GRAPHICS_FLUSH_INTERVAL_US
+ */
+static void graphics_damage_add(uint32_t x, uint32_t y, uint32_t width,
+                                uint32_t height) {
+  if (!graphics_front_buffer) {
+    return;
+  }
+
+  struct graphics_rect rect = {x, y, width, height};
+  int i = 0;
+  while (i < graphics_damage.total) {
+    struct graphics_rect *other = &graphics_damage.rects[i];
+    if (graphics_rect_touches(&rect, other)) {
+      // The bigger rectangle may now touch ones already passed
+      rect = graphics_rect_union(&rect, other);
+      *other = graphics_damage.rects[--graphics_damage.total];
+      i = 0;
+    } else {
+      i++;
+    }
+  }
+
+  // Full, merge with the rectangle that grows the least
+  if (graphics_damage.total == VIOS_GRAPHICS_MAX_DAMAGE_RECTS) {
+    int best = 0;
+    uint64_t best_growth = UINT64_MAX;
+    for (i = 0; i < graphics_damage.total; i++) {
+      struct graphics_rect *other = &graphics_damage.rects[i];
+      struct graphics_rect merged = graphics_rect_union(&rect, other);
+      uint64_t growth =
+          graphics_rect_area(&merged) - graphics_rect_area(other);
+      if (growth < best_growth) {
+        best = i;
+        best_growth = growth;
+      }
     }
+
+    rect = graphics_rect_union(&rect, &graphics_damage.rects[best]);
+    graphics_damage.rects[best] =
+        graphics_damage.rects[--graphics_damage.total];
+  }
+
+  graphics_damage.rects[graphics_damage.total++] = rect;
+  if (!graphics_damage.since) {
+    graphics_damage.since = cpu_rdtsc();
+  }
+
+  if (cpu_tsc_to_us(cpu_rdtsc() - graphics_damage.since) >=
+      VIOS_GRAPHICS_FLUSH_INTERVAL_US) {
+    graphics_flush();
+  }
+}
+
+/**
+ * Copies every damaged rectangle from the back buffer to the real
+ * framebuffer a row span at a time. A rectangle as wide as half the
+ * screen is widened to whole rows, it then goes out as one contiguous
+ * copy
+ */
+void graphics_flush() {
+  if (!graphics_front_buffer || !graphics_damage.total) {
+    return;
+  }
+
+  uint64_t start = cpu_rdtsc();
+  struct graphics_info *screen = graphics_screen_info();
+  size_t stride = screen->pixels_per_scanline;
+  for (int i = 0; i < graphics_damage.total; i++) {
+    struct graphics_rect *rect = &graphics_damage.rects[i];
+    size_t offset = rect->y * stride + rect->x;
+    if (rect->width * 2 >= screen->horizontal_resolution) {
+      offset = rect->y * stride;
+      memcpy(graphics_front_buffer + offset, screen->framebuffer + offset,
+             rect->height * stride * sizeof(struct framebuffer_pixel));
+      graphics_stats.flushed_pixels += rect->height * stride;
+      continue;
+    }
+
+    for (uint32_t row = 0; row < rect->height; row++) {
+      memcpy(graphics_front_buffer + offset, screen->framebuffer + offset,
+             rect->width * sizeof(struct framebuffer_pixel));
+      offset += stride;
+    }
+    graphics_stats.flushed_pixels += graphics_rect_area(rect);
+  }
+
+  graphics_damage.total = 0;
+  graphics_damage.since = 0;
+  graphics_stats.flushes++;
+  graphics_stats.flush_ticks += cpu_rdtsc() - start;
+}
+
+/**
+ * Prints the time spent drawing to the screen since boot, built with
+ * VIOS_GRAPHICS_BACK_BUFFER 0 it shows the cost of drawing straight to
+ * the real framebuffer
+ */
+void graphics_print_stats() {
+  print("Graphics: ");
+  print(itoa(graphics_stats.pastes));
+  print(" pastes in ");
+  print(itoa(cpu_tsc_to_us(graphics_stats.paste_ticks)));
+  print("us, ");
+  print(itoa(graphics_stats.flushes));
+  print(" flushes of ");
+  print(itoa(graphics_stats.flushed_pixels / 1024));
+  print("K pixels in ");
+  print(itoa(cpu_tsc_to_us(graphics_stats.flush_ticks)));
+  print("us\n");
 }
 
 void graphics_draw_pixel(struct graphics_info* graphics_info, uint32_t x, uint32_t y, struct framebuffer_pixel pixel)
@@ -324,10 +502,14 @@ void graphics_redraw_all()
 {
     // Redraw only the source graphics, which will redraw all the children
     graphics_redraw(graphics_screen_info());
+    graphics_flush();
 }
 
 void graphics_setup(struct graphics_info* main_graphics_info)
 {
+    // Pick the fastest way to paste keyed pixels for this CPU
+    graphics_blit_init();
+
     if (loaded_graphics_info)
     {
         panic("The graphic system was already loaded\n");
@@ -354,6 +536,20 @@ void graphics_setup(struct graphics_info* main_graphics_info)
     // Map the memory we allocated to point to the frame buffer point 
     paging_map_to(kernel_desc(), new_framebuffer_memory, real_framebuffer, real_framebuffer_end, PAGING_IS_WRITEABLE | PAGING_IS_PRESENT);
 
+    // Pastes land in system memory and reach the real framebuffer through
+    // graphics_flush, reading it back or writing it a pixel at a time is slow
+    struct framebuffer_pixel* back_buffer = NULL;
+    if (VIOS_GRAPHICS_BACK_BUFFER)
+    {
+        back_buffer = kzalloc(real_framebuffer_height * real_framebuffer_pixels_per_scanline * sizeof(struct framebuffer_pixel));
+    }
+
+    if (back_buffer)
+    {
+        graphics_front_buffer = new_framebuffer_memory;
+        main_graphics_info->framebuffer = back_buffer;
+    }
+
     loaded_graphics_info = main_graphics_info;
     for(uint32_t y = 0; y < main_graphics_info->vertical_resolution; y++)
     {
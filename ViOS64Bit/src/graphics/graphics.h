@@ -104,4 +104,6 @@ void graphics_redraw_graphics_to_screen(struct graphics_info *relative_graphics,
 struct graphics_info *graphics_screen_info();
 void graphics_setup(struct graphics_info *main_graphics_info);
 void graphics_redraw_all();
+void graphics_flush();
+void graphics_print_stats();
 #endif
\ No newline at end of file
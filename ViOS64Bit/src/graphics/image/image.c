@@ -3,6 +3,7 @@
 #include "graphics/graphics.h"
 #include "memory/memory.h"
 #include "fs/file.h"
+#include "fs/pagecache.h"
 
 #include "lib/vector/vector.h"
 #include "status.h"
@@ -69,6 +70,7 @@ struct image* graphics_image_load(const char* path)
 {
     struct image* img = NULL;
     void* img_memory = NULL;
+    struct pagecache_file* cached = NULL;
     int fd = 0;
     int res = 0;
 
@@ -86,16 +88,26 @@ struct image* graphics_image_load(const char* path)
         goto out;
     }
 
-    img_memory = kzalloc(stat.filesize);
-    if (!img_memory)
+    // Decoding only reads the file, so the cached pages are used as they are
+    if (fcache(fd, &cached) < 0 || pagecache_map_contiguous(cached, &img_memory) < 0)
     {
-        goto out;
-    }
+        if (cached)
+        {
+            pagecache_file_put(cached);
+            cached = NULL;
+        }
 
-    res = fread(img_memory, stat.filesize, 1, fd);
-    if (res < 0)
-    {
-        goto out;
+        img_memory = kzalloc(stat.filesize);
+        if (!img_memory)
+        {
+            goto out;
+        }
+
+        res = fread(img_memory, stat.filesize, 1, fd);
+        if (res < 0)
+        {
+            goto out;
+        }
     }
 
     // Let's try to load the image from this memory
@@ -109,7 +121,12 @@ struct image* graphics_image_load(const char* path)
 out:
     // Close the file
     fclose(fd);
-    if (img_memory)
+    if (cached)
+    {
+        pagecache_file_put(cached);
+        cached = NULL;
+    }
+    else if (img_memory)
     {
         kfree(img_memory);
         img_memory = NULL;
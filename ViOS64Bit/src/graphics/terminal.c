@@ -2,6 +2,7 @@
 #include "graphics/font.h"
 #include "graphics/graphics.h"
 #include "graphics/image/image.h"
+#include "kernel.h"
 #include "lib/vector/vector.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
@@ -11,6 +12,16 @@
 #include <stdint.h>
 
 struct vector *terminal_vector = NULL;
+
+// Area of the graphics drawn to by a run of characters, redrawn to the
+// screen once the run is done
+struct terminal_damage {
+  size_t start_x;
+  size_t start_y;
+  size_t end_x;
+  size_t end_y;
+};
+
 inline static size_t
 terminal_abs_x_for_next_character(struct terminal *terminal) {
   return terminal->bounds.abs_x +
@@ -279,7 +290,12 @@ int terminal_backspace(struct terminal *terminal) {
   return res;
 }
 
-int terminal_write(struct terminal *terminal, int c) {
+/**
+ * Writes a character, when "damage" is given the character is only drawn
+ * to the pixels of the graphics and its area added to "damage"
+ */
+static int terminal_write_internal(struct terminal *terminal, int c,
+                                   struct terminal_damage *damage) {
   if (c == '\n') {
     terminal_handle_newline(terminal);
     return 0;
@@ -293,13 +309,36 @@ int terminal_write(struct terminal *terminal, int c) {
   size_t abs_x = terminal_abs_x_for_next_character(terminal);
   size_t abs_y = terminal_abs_y_for_next_character(terminal);
 
-  font_draw(terminal->graphics_info, terminal->font, abs_x, abs_y, c,
-            terminal->font_color);
+  if (!damage) {
+    font_draw(terminal->graphics_info, terminal->font, abs_x, abs_y, c,
+              terminal->font_color);
+  } else {
+    font_draw_to_pixels(terminal->graphics_info, terminal->font, abs_x, abs_y,
+                        c, terminal->font_color);
+
+    size_t end_x = abs_x + terminal->font->bits_width_per_character;
+    size_t end_y = abs_y + terminal->font->bits_height_per_character;
+    if (damage->end_x == 0) {
+      damage->start_x = abs_x;
+      damage->start_y = abs_y;
+      damage->end_x = end_x;
+      damage->end_y = end_y;
+    } else {
+      damage->start_x = MIN(damage->start_x, abs_x);
+      damage->start_y = MIN(damage->start_y, abs_y);
+      damage->end_x = MAX(damage->end_x, end_x);
+      damage->end_y = MAX(damage->end_y, end_y);
+    }
+  }
   terminal_update_positon_after_draw(terminal);
 
   return 0;
 }
 
+int terminal_write(struct terminal *terminal, int c) {
+  return terminal_write_internal(terminal, c, NULL);
+}
+
 int terminal_pixel_set(struct terminal *terminal, size_t x, size_t y,
                        struct framebuffer_pixel pixel_color) {
   int res = 0;
@@ -371,15 +410,25 @@ out:
   return res;
 }
 
+/**
+ * Writes a string, the characters drawn are redrawn to the screen as a
+ * single region
+ */
 int terminal_print(struct terminal *terminal, const char *message) {
   int res = 0;
+  struct terminal_damage damage = {0};
   while (*message != 0) {
-    res = terminal_write(terminal, *message);
+    res = terminal_write_internal(terminal, *message, &damage);
     if (res < 0) {
       break;
     }
     message++;
   }
 
+  if (damage.end_x) {
+    graphics_redraw_graphics_to_screen(
+        terminal->graphics_info, damage.start_x, damage.start_y,
+        damage.end_x - damage.start_x, damage.end_y - damage.start_y);
+  }
   return res;
 }
\ No newline at end of file
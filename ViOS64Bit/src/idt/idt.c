@@ -7,6 +7,13 @@
 #include "status.h"
 #include "task/process.h"
 #include "task/task.h"
+
+#include <stdbool.h>
+
+// IRQ8 to IRQ15 after the PIC remap
+#define IDT_SLAVE_PIC_FIRST_INTERRUPT 0x28
+#define IDT_SLAVE_PIC_LAST_INTERRUPT 0x2F
+
 struct idt_desc idt_descriptors[VIOS_TOTAL_INTERRUPTS];
 struct idtr_desc idtr_descriptor;
 
@@ -24,13 +31,29 @@ extern void isr80h_wrapper();
 void no_interrupt_handler() { outb(0x20, 0x20); }
 
 void interrupt_handler(int interrupt, struct interrupt_frame *frame) {
-  kernel_page();
+  // The kernel itself can be interrupted while it sleeps waiting for a
+  // device, there is no task state to save and no task to return to
+  bool from_kernel = (frame->cs & 0x03) == 0;
+  if (!from_kernel) {
+    kernel_page();
+  }
+
   if (interrupt_callbacks[interrupt] != 0) {
-    task_current_save_state(frame);
+    if (!from_kernel) {
+      task_current_save_state(frame);
+    }
     interrupt_callbacks[interrupt](frame);
   }
 
-  task_page();
+  if (!from_kernel) {
+    task_page();
+  }
+
+  // Interrupts from the slave PIC must be acknowledged on both PICs
+  if (interrupt >= IDT_SLAVE_PIC_FIRST_INTERRUPT &&
+      interrupt <= IDT_SLAVE_PIC_LAST_INTERRUPT) {
+    outb(0xA0, 0x20);
+  }
   outb(0x20, 0x20);
 }
 
@@ -25,6 +25,9 @@ enum
 #define IRQ_MASTER_PORT 0x21
 #define IRQ_SLAVE_PORT 0xA1
 
+// Interrupt vector of IRQ0 after the PIC remap
+#define IRQ_VECTOR_OFFSET 0x20
+
 typedef int IRQ;
 void IRQ_disable(IRQ irq);
 void IRQ_enable(IRQ irq);
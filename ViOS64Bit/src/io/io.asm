@@ -4,6 +4,8 @@ section .asm
 global insb
 global insw
 global insdw
+global insws
+global outsws
 global outb
 global outw
 global outdw
@@ -42,4 +44,21 @@ outdw:
     mov rax, rsi
     mov rdx, rdi
     out dx, eax
-    ret
\ No newline at end of file
+    ret
+
+; Reads count words from port into buf with a single rep insw
+insws:
+    mov ecx, edx
+    mov dx, di
+    mov rdi, rsi
+    cld
+    rep insw
+    ret
+
+; Writes count words from buf to port with a single rep outsw
+outsws:
+    mov ecx, edx
+    mov dx, di
+    cld
+    rep outsw
+    ret
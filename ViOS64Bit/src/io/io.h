@@ -4,9 +4,11 @@
 unsigned char insb(unsigned short port);
 unsigned short insw(unsigned short port);
 unsigned int insdw(unsigned short port);
+void insws(unsigned short port, void* buf, unsigned int count);
 
 void outb(unsigned short port, unsigned char val);
 void outw(unsigned short port, unsigned short val);
 void outdw(unsigned short port, unsigned int val);
+void outsws(unsigned short port, const void* buf, unsigned int count);
 
 #endif
\ No newline at end of file
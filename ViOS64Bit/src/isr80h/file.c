@@ -0,0 +1,206 @@
+#include "file.h"
+#include "config.h"
+#include "fs/file.h"
+#include "fs/pagecache.h"
+#include "kernel.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "status.h"
+#include "task/process.h"
+#include "task/task.h"
+
+// Long enough for every mode fopen understands
+#define ISR80H_FILE_MAX_MODE 8
+
+/**
+ * Translates the user buffer at "virt" and returns how many of its "size"
+ * bytes are physically contiguous from there, every page must be present
+ * and user accessible, and writable when "write" is set
+ */
+static int isr80h_file_user_run(struct task *task, uintptr_t virt,
+                                size_t size, bool write, void **phys_out) {
+  struct paging_desc *desc = task_paging_desc(task);
+  uintptr_t phys_start = 0;
+  size_t run = 0;
+  while (run < size) {
+    struct paging_desc_entry *entry = paging_get(desc, (void *)(virt + run));
+    if (!entry || !entry->present || !entry->user_supervisor ||
+        (write && !entry->read_write)) {
+      return run ? (int)run : -EINVARG;
+    }
+
+    uintptr_t phys = ((uint64_t)entry->address << 12) +
+                     ((virt + run) & (PAGING_PAGE_SIZE - 1));
+    if (run == 0) {
+      phys_start = phys;
+    } else if (phys != phys_start + run) {
+      break;
+    }
+
+    run += PAGING_PAGE_SIZE - ((virt + run) & (PAGING_PAGE_SIZE - 1));
+  }
+
+  *phys_out = (void *)phys_start;
+  return run < size ? (int)run : (int)size;
+}
+
+/**
+ * Reads straight into the pages behind the user buffer so the disk moves
+ * the data without a kernel copy in between. Its physically contiguous
+ * runs are gathered into one vectored read at a time, at "offset" or at
+ * the file position when it is FILE_POSITION_CURRENT
+ */
+static int isr80h_file_read_to_task(struct task *task, int fd, void *buf,
+                                    size_t count, int64_t offset) {
+  int res = 0;
+  size_t done = 0;
+  if (count > 0x7FFFFFFF) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  while (done < count) {
+    struct file_iovec iov[VIOS_FILE_MAX_IOVECS];
+    int iovcnt = 0;
+    size_t wanted = 0;
+    while (iovcnt < VIOS_FILE_MAX_IOVECS && done + wanted < count) {
+      void *phys = 0;
+      res = isr80h_file_user_run(task, (uintptr_t)buf + done + wanted,
+                                 count - done - wanted, true, &phys);
+      if (res < 0) {
+        goto out;
+      }
+
+      iov[iovcnt].base = phys;
+      iov[iovcnt].len = res;
+      iovcnt++;
+      wanted += res;
+    }
+
+    if (offset == FILE_POSITION_CURRENT) {
+      res = freadv(fd, iov, iovcnt);
+    } else {
+      res = fpreadv(fd, iov, iovcnt, offset + done);
+    }
+
+    if (res < 0) {
+      goto out;
+    }
+
+    done += res;
+    if (res < wanted) {
+      break;
+    }
+  }
+  res = done;
+out:
+  return res;
+}
+
+void *isr80h_command10_fopen(struct interrupt_frame *frame) {
+  struct task *task = task_current();
+  char path[VIOS_MAX_PATH];
+  char mode[ISR80H_FILE_MAX_MODE];
+  int res = copy_string_from_task(task, task_get_stack_item(task, 0), path,
+                                  sizeof(path));
+  if (res < 0) {
+    goto out;
+  }
+
+  res = copy_string_from_task(task, task_get_stack_item(task, 1), mode,
+                              sizeof(mode));
+  if (res < 0) {
+    goto out;
+  }
+
+  // fopen reports failure as zero, there is no descriptor zero to return
+  res = fopen(path, mode);
+  if (res == 0) {
+    res = -EIO;
+  }
+out:
+  return ERROR(res);
+}
+
+void *isr80h_command11_fread(struct interrupt_frame *frame) {
+  struct task *task = task_current();
+  int fd = (int)(intptr_t)task_get_stack_item(task, 0);
+  void *buf = task_get_stack_item(task, 1);
+  size_t count = (size_t)task_get_stack_item(task, 2);
+  return ERROR(
+      isr80h_file_read_to_task(task, fd, buf, count, FILE_POSITION_CURRENT));
+}
+
+void *isr80h_command12_fpread(struct interrupt_frame *frame) {
+  struct task *task = task_current();
+  int fd = (int)(intptr_t)task_get_stack_item(task, 0);
+  void *buf = task_get_stack_item(task, 1);
+  size_t count = (size_t)task_get_stack_item(task, 2);
+  uint32_t offset = (uint32_t)(uintptr_t)task_get_stack_item(task, 3);
+
+  // The file position is left alone
+  return ERROR(isr80h_file_read_to_task(task, fd, buf, count, offset));
+}
+
+void *isr80h_command13_fseek(struct interrupt_frame *frame) {
+  struct task *task = task_current();
+  int fd = (int)(intptr_t)task_get_stack_item(task, 0);
+  int offset = (int)(intptr_t)task_get_stack_item(task, 1);
+  FILE_SEEK_MODE whence =
+      (FILE_SEEK_MODE)(uintptr_t)task_get_stack_item(task, 2);
+  return ERROR(fseek(fd, offset, whence));
+}
+
+void *isr80h_command14_fstat(struct interrupt_frame *frame) {
+  struct task *task = task_current();
+  int fd = (int)(intptr_t)task_get_stack_item(task, 0);
+  uintptr_t virt = (uintptr_t)task_get_stack_item(task, 1);
+  struct file_stat stat;
+  int res = fstat(fd, &stat);
+  if (res < 0) {
+    goto out;
+  }
+
+  size_t done = 0;
+  while (done < sizeof(stat)) {
+    void *phys = 0;
+    res = isr80h_file_user_run(task, virt + done, sizeof(stat) - done, true,
+                               &phys);
+    if (res < 0) {
+      goto out;
+    }
+
+    memcpy(phys, (char *)&stat + done, res);
+    done += res;
+  }
+  res = 0;
+out:
+  return ERROR(res);
+}
+
+void *isr80h_command15_fclose(struct interrupt_frame *frame) {
+  int fd = (int)(intptr_t)task_get_stack_item(task_current(), 0);
+  return ERROR(fclose(fd));
+}
+
+void *isr80h_command16_mmap(struct interrupt_frame *frame) {
+  struct task *task = task_current();
+  int fd = (int)(intptr_t)task_get_stack_item(task, 0);
+  uint32_t offset = (uint32_t)(uintptr_t)task_get_stack_item(task, 1);
+  size_t length = (size_t)task_get_stack_item(task, 2);
+  int flags = (int)(intptr_t)task_get_stack_item(task, 3);
+  struct pagecache_file *file = NULL;
+  void *virt = NULL;
+  int res = fcache(fd, &file);
+  if (res < 0) {
+    goto out;
+  }
+
+  res = process_mmap(task->process, file, offset, length, flags, &virt);
+  if (res < 0) {
+    pagecache_file_put(file);
+  }
+out:
+  // Like the other file commands the error reaches user space as it is
+  return res < 0 ? ERROR(res) : virt;
+}
@@ -0,0 +1,13 @@
+#ifndef ISR80H_FILE_H
+#define ISR80H_FILE_H
+
+struct interrupt_frame;
+void* isr80h_command10_fopen(struct interrupt_frame* frame);
+void* isr80h_command11_fread(struct interrupt_frame* frame);
+void* isr80h_command12_fpread(struct interrupt_frame* frame);
+void* isr80h_command13_fseek(struct interrupt_frame* frame);
+void* isr80h_command14_fstat(struct interrupt_frame* frame);
+void* isr80h_command15_fclose(struct interrupt_frame* frame);
+void* isr80h_command16_mmap(struct interrupt_frame* frame);
+
+#endif
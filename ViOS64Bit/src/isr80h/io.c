@@ -2,6 +2,7 @@
 #include "task/task.h"
 #include "keyboard/keyboard.h"
 #include "kernel.h"
+#include "graphics/graphics.h"
 void* isr80h_command1_print(struct interrupt_frame* frame)
 {
     void* user_space_msg_buffer = task_get_stack_item(task_current(), 0);
@@ -23,5 +24,6 @@ void* isr80h_command3_putchar(struct interrupt_frame* frame)
 {
     char c = (char)(uintptr_t) task_get_stack_item(task_current(), 0);
     terminal_writechar(c, 15);
+    graphics_flush();
     return 0;
 }
\ No newline at end of file
@@ -12,7 +12,14 @@ enum SystemCommands
     SYSTEM_COMMAND6_PROCESS_LOAD_START,
     SYSTEM_COMMAND7_INVOKE_SYSTEM_COMMAND,
     SYSTEM_COMMAND8_GET_PROGRAM_ARGUMENTS,
-    SYSTEM_COMMAND9_EXIT
+    SYSTEM_COMMAND9_EXIT,
+    SYSTEM_COMMAND10_FOPEN,
+    SYSTEM_COMMAND11_FREAD,
+    SYSTEM_COMMAND12_FPREAD,
+    SYSTEM_COMMAND13_FSEEK,
+    SYSTEM_COMMAND14_FSTAT,
+    SYSTEM_COMMAND15_FCLOSE,
+    SYSTEM_COMMAND16_MMAP
 };
 
 void isr80h_register_commands();
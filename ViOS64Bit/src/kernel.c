@@ -1,11 +1,16 @@
 #include "kernel.h"
 #include "config.h"
+#include "cpu/cpu.h"
+#include "disk/bcache.h"
+#include "disk/benchmark.h"
 #include "disk/disk.h"
 #include "disk/gpt.h"
 #include "disk/streamer.h"
+#include "fs/dcache.h"
 #include "fs/file.h"
 #include "fs/pparser.h"
 #include "gdt/gdt.h"
+#include "graphics/benchmark.h"
 #include "graphics/font.h"
 #include "graphics/graphics.h"
 #include "graphics/image/image.h"
@@ -13,10 +18,12 @@
 #include "idt/idt.h"
 #include "isr80h/isr80h.h"
 #include "keyboard/keyboard.h"
+#include "memory/benchmark.h"
 #include "memory/heap/heap.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
 #include "memory/paging/paging.h"
+#include "pci/pci.h"
 #include "status.h"
 #include "string/string.h"
 #include "task/process.h"
@@ -34,10 +41,12 @@ void terminal_writechar(char c, char colour) {
 }
 
 void print(const char *str) {
-  size_t len = strlen(str);
-  for (int i = 0; i < len; i++) {
-    terminal_writechar(str[i], 15);
+  if (!system_terminal) {
+    return;
   }
+
+  terminal_print(system_terminal, str);
+  graphics_flush();
 }
 
 void panic(const char *msg) {
@@ -91,6 +100,11 @@ void kernel_main() {
   struct graphics_info *screen_info = NULL;
   print("Hello 64-bit!\n");
 
+  // Detect CPU features and pick the fastest memory routines
+  cpu_init();
+  memory_init();
+  uint64_t boot_start = cpu_rdtsc();
+
   print("Total memory\n");
   print(itoa(e820_total_accessible_memory()));
   print("\n");
@@ -125,6 +139,9 @@ void kernel_main() {
   // Enable fs functionality
   fs_init();
 
+  // Find the PCI devices disk controllers live on
+  pci_init();
+
   // Enable the disks
   disk_search_and_init();
 
@@ -153,6 +170,18 @@ void kernel_main() {
     panic("Failed to create system terminal\n");
   }
 
+#if VIOS_MEMORY_BENCHMARK
+  memory_benchmark();
+#endif
+
+#if VIOS_GRAPHICS_BENCHMARK
+  graphics_benchmark();
+#endif
+
+#if VIOS_DISK_BENCHMARK
+  disk_benchmark();
+#endif
+
   // Allocate a 1 MB stack for the kernel IDT
   size_t stack_size = 1024 * 1024;
   void *megabyte_stack_tss_end = kzalloc(stack_size);
@@ -190,6 +219,24 @@ void kernel_main() {
     panic("Failed to load user program\n");
   }
 
+  // Shows how many device reads the block cache saved during boot
+  disk_bcache_print_stats();
+  disk_queue_print_stats();
+  fs_dcache_print_stats();
+  graphics_print_stats();
+
+  // Lets disk drivers be compared on the time taken to reach the shell
+  struct disk *fs_disk = disk_primary_fs_disk();
+  print("Boot to shell: ");
+  print(itoa(cpu_tsc_to_us(cpu_rdtsc() - boot_start) / 1000));
+  print("ms from ");
+  print(fs_disk ? fs_disk->physical->driver->name : "no disk");
+  if (fs_disk) {
+    print(" ");
+    print(fs_disk->filesystem->name);
+  }
+  print("\n");
+
   // Drop to user land
   task_run_first_ever_task();
 
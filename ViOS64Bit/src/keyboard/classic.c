@@ -71,7 +71,8 @@ uint8_t classic_keyboard_scancode_to_char(uint8_t scancode)
 
 void classic_keyboard_handle_interrupt()
 {
-    kernel_page();
+    // interrupt_handler has already switched to the kernel page tables
+    // when a task was interrupted
     uint8_t scancode = 0;
     scancode = insb(KEYBOARD_INPUT_PORT);
     insb(KEYBOARD_INPUT_PORT);
@@ -92,9 +93,6 @@ void classic_keyboard_handle_interrupt()
     {
         keyboard_push(c);
     }
-
-    task_page();
-
 }
 
 struct keyboard* classic_init()
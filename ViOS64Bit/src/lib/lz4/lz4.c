@@ -0,0 +1,82 @@
+#include "lib/lz4/lz4.h"
+#include "status.h"
+
+#include <stdint.h>
+
+/**
+ * Adds the extra length bytes that follow a nibble of 15, returns -1 when
+ * they run past the end of the input
+ */
+static int lz4_read_length(const uint8_t **in, const uint8_t *in_end,
+                           size_t *length) {
+  uint8_t byte = 255;
+  while (byte == 255) {
+    if (*in >= in_end) {
+      return -1;
+    }
+    byte = *(*in)++;
+    *length += byte;
+  }
+  return 0;
+}
+
+/**
+ * Decompresses one raw LZ4 block, without the frame around it. Returns
+ * the bytes written to "dst" or -EINFORMAT when the block is corrupt or
+ * does not fit
+ */
+int lz4_decompress(const void *src, size_t src_size, void *dst,
+                   size_t dst_size) {
+  const uint8_t *in = src;
+  const uint8_t *in_end = in + src_size;
+  uint8_t *out = dst;
+  uint8_t *out_end = out + dst_size;
+
+  while (in < in_end) {
+    uint8_t token = *in++;
+
+    size_t literals = token >> 4;
+    if (literals == 15 && lz4_read_length(&in, in_end, &literals) < 0) {
+      return -EINFORMAT;
+    }
+
+    if (literals > (size_t)(in_end - in) ||
+        literals > (size_t)(out_end - out)) {
+      return -EINFORMAT;
+    }
+
+    for (size_t i = 0; i < literals; i++) {
+      *out++ = *in++;
+    }
+
+    // The last sequence of a block holds literals only
+    if (in == in_end) {
+      break;
+    }
+
+    if (in_end - in < 2) {
+      return -EINFORMAT;
+    }
+    size_t offset = in[0] | (in[1] << 8);
+    in += 2;
+
+    size_t match = token & 0x0F;
+    if (match == 15 && lz4_read_length(&in, in_end, &match) < 0) {
+      return -EINFORMAT;
+    }
+    match += 4;
+
+    if (offset == 0 || offset > (size_t)(out - (uint8_t *)dst) ||
+        match > (size_t)(out_end - out)) {
+      return -EINFORMAT;
+    }
+
+    // Byte by byte, a match may overlap the bytes it produces
+    const uint8_t *from = out - offset;
+    for (size_t i = 0; i < match; i++) {
+      *out++ = *from++;
+    }
+  }
+
+  return out - (uint8_t *)dst;
+}
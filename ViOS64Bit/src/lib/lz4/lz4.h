@@ -0,0 +1,9 @@
+#ifndef KERNEL_LZ4_H
+#define KERNEL_LZ4_H
+
+#include <stddef.h>
+
+int lz4_decompress(const void *src, size_t src_size, void *dst,
+                   size_t dst_size);
+
+#endif
@@ -1,6 +1,7 @@
 #include "elfloader.h"
 #include "config.h"
 #include "fs/file.h"
+#include "fs/pagecache.h"
 #include "kernel.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
@@ -165,6 +166,26 @@ struct elf_file *elf_file_new() {
   return (struct elf_file *)kzalloc(sizeof(struct elf_file));
 }
 
+/**
+ * Copies the file out of the page cache, so a program started again is
+ * not read from the disk. The loader writes to its copy, the cached pages
+ * stay as the file has them
+ */
+static int elf_read_file(int fd, void *out, uint32_t size) {
+  struct pagecache_file *cached = NULL;
+  int res = fcache(fd, &cached);
+  if (res == VIOS_ALL_OK) {
+    res = pagecache_read(cached, 0, size, out);
+    pagecache_file_put(cached);
+  }
+
+  // A full cache is no reason to fail the load
+  if (res < 0) {
+    res = fread(out, size, 1, fd);
+  }
+  return res;
+}
+
 int elf_load(const char *filename, struct elf_file **file_out) {
   struct elf_file *elf_file = elf_file_new();
   int fd = 0;
@@ -182,7 +203,7 @@ int elf_load(const char *filename, struct elf_file **file_out) {
   }
 
   elf_file->elf_memory = kzalloc(stat.filesize);
-  res = fread(elf_file->elf_memory, stat.filesize, 1, fd);
+  res = elf_read_file(fd, elf_file->elf_memory, stat.filesize);
   if (res < 0) {
     goto out;
   }
@@ -0,0 +1,150 @@
+#include "benchmark.h"
+#include "cpu/cpu.h"
+#include "kernel.h"
+#include "memory/heap/kheap.h"
+#include "memory/memory.h"
+#include "string/string.h"
+
+#define MEMORY_BENCHMARK_MIN_SIZE 8
+#define MEMORY_BENCHMARK_MAX_SIZE (8 * 1024 * 1024)
+
+// Every measurement moves at least this many bytes so small sizes are stable
+#define MEMORY_BENCHMARK_BYTES_PER_RUN (4 * 1024 * 1024)
+
+enum {
+  MEMORY_BENCHMARK_COPY,
+  MEMORY_BENCHMARK_SET,
+  MEMORY_BENCHMARK_COMPARE,
+  MEMORY_BENCHMARK_TOTAL_OPERATIONS
+};
+
+static const char *memory_benchmark_operation_names[] = {"copy", "set",
+                                                         "compare"};
+
+static void memory_benchmark_print_padded(const char *str, int width) {
+  print(str);
+  for (int i = strlen(str); i < width; i++) {
+    print(" ");
+  }
+}
+
+static const char *memory_benchmark_size_string(size_t size) {
+  static char text[16];
+  const char *unit = "B";
+  if (size >= 1024 * 1024) {
+    size /= 1024 * 1024;
+    unit = "MB";
+  } else if (size >= 1024) {
+    size /= 1024;
+    unit = "KB";
+  }
+
+  strcpy(text, itoa(size));
+  strcpy(text + strlen(text), unit);
+  return text;
+}
+
+/**
+ * Runs one operation repeatedly and returns the average cycles per call
+ */
+static uint64_t memory_benchmark_run(struct memory_implementation *impl,
+                                     int operation, void *dest, void *src,
+                                     size_t size, size_t iterations) {
+  uint64_t start = cpu_rdtsc();
+  for (size_t i = 0; i < iterations; i++) {
+    switch (operation) {
+    case MEMORY_BENCHMARK_COPY:
+      impl->copy(dest, src, size);
+      break;
+    case MEMORY_BENCHMARK_SET:
+      impl->set(dest, (int)i, size);
+      break;
+    case MEMORY_BENCHMARK_COMPARE:
+      impl->compare(dest, src, size);
+      break;
+    }
+  }
+  uint64_t end = cpu_rdtsc();
+
+  return (end - start) / iterations;
+}
+
+static uint64_t memory_benchmark_mb_per_second(size_t size, uint64_t cycles) {
+  uint64_t tsc_per_ms = cpu_info()->tsc_per_ms;
+  if (!cycles || !tsc_per_ms) {
+    return 0;
+  }
+
+  // bytes per cycle * cycles per second, scaled to megabytes
+  return (size * tsc_per_ms * 1000 / cycles) / (1024 * 1024);
+}
+
+/**
+ * Prints cycles per call and throughput of every supported memory
+ * implementation for sizes from 8 bytes to 8 megabytes.
+ */
+void memory_benchmark() {
+  uint8_t *src = kmalloc(MEMORY_BENCHMARK_MAX_SIZE);
+  uint8_t *dest = kmalloc(MEMORY_BENCHMARK_MAX_SIZE);
+  if (!src || !dest) {
+    print("Memory benchmark: out of memory\n");
+    goto out;
+  }
+
+  // Identical buffers so compare always scans the full length
+  for (size_t i = 0; i < MEMORY_BENCHMARK_MAX_SIZE; i++) {
+    src[i] = i & 0xff;
+  }
+  memcpy(dest, src, MEMORY_BENCHMARK_MAX_SIZE);
+
+  print("Memory benchmark, active implementation: ");
+  print(memory_implementation_current()->name);
+  print("\n");
+  if (!cpu_info()->tsc_per_ms) {
+    print("TSC calibration failed, MB/s unavailable\n");
+  }
+
+  memory_benchmark_print_padded("size", 8);
+  memory_benchmark_print_padded("impl", 9);
+  for (int op = 0; op < MEMORY_BENCHMARK_TOTAL_OPERATIONS; op++) {
+    memory_benchmark_print_padded(memory_benchmark_operation_names[op], 19);
+  }
+  print("\n");
+
+  for (size_t size = MEMORY_BENCHMARK_MIN_SIZE;
+       size <= MEMORY_BENCHMARK_MAX_SIZE; size *= 4) {
+    size_t iterations = MEMORY_BENCHMARK_BYTES_PER_RUN / size;
+    if (iterations == 0) {
+      iterations = 1;
+    }
+
+    for (size_t i = 0; i < memory_total_implementations(); i++) {
+      struct memory_implementation *impl = memory_implementation_get(i);
+      if (!memory_implementation_supported(impl)) {
+        continue;
+      }
+
+      memory_benchmark_print_padded(memory_benchmark_size_string(size), 8);
+      memory_benchmark_print_padded(impl->name, 9);
+      for (int op = 0; op < MEMORY_BENCHMARK_TOTAL_OPERATIONS; op++) {
+        uint64_t cycles =
+            memory_benchmark_run(impl, op, dest, src, size, iterations);
+        // Restore the destination after memset so compare stays a full scan
+        if (op == MEMORY_BENCHMARK_SET) {
+          impl->copy(dest, src, size);
+        }
+
+        print(u64toa(cycles));
+        print("cyc ");
+        memory_benchmark_print_padded(
+            u64toa(memory_benchmark_mb_per_second(size, cycles)), 6);
+        print("MB/s ");
+      }
+      print("\n");
+    }
+  }
+
+out:
+  kfree(src);
+  kfree(dest);
+}
@@ -0,0 +1,6 @@
+#ifndef KERNEL_MEMORY_BENCHMARK_H
+#define KERNEL_MEMORY_BENCHMARK_H
+
+void memory_benchmark();
+
+#endif
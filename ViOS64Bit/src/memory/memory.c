@@ -1,5 +1,6 @@
 #include "memory.h"
 #include "config.h"
+#include "cpu/cpu.h"
 
 size_t e820_total_entries() {
   return *((uint16_t *)VIOS_MEMORY_MAP_TOTAL_ENTRIES_LOCATION);
@@ -54,31 +55,486 @@ size_t e820_total_accessible_memory() {
   return total_memory;
 }
 
-void *memset(void *ptr, int c, size_t size) {
-  char *c_ptr = (char *)ptr;
-  for (int i = 0; i < size; i++) {
-    c_ptr[i] = (char)c;
+// Word type used to move eight bytes at a time through unaligned pointers
+typedef uint64_t __attribute__((may_alias, aligned(1))) memory_word_t;
+
+#define MEMORY_WORD_SIZE sizeof(uint64_t)
+#define MEMORY_BYTE_BROADCAST 0x0101010101010101ULL
+
+static void *memory_copy_generic(void *dest, const void *src, size_t len) {
+  uint8_t *d = dest;
+  const uint8_t *s = src;
+
+  // Align the destination so that the word stores never split a cache line
+  while (len && ((uintptr_t)d & (MEMORY_WORD_SIZE - 1))) {
+    *d++ = *s++;
+    len--;
+  }
+
+  while (len >= MEMORY_WORD_SIZE * 4) {
+    memory_word_t w0 = ((const memory_word_t *)s)[0];
+    memory_word_t w1 = ((const memory_word_t *)s)[1];
+    memory_word_t w2 = ((const memory_word_t *)s)[2];
+    memory_word_t w3 = ((const memory_word_t *)s)[3];
+    ((memory_word_t *)d)[0] = w0;
+    ((memory_word_t *)d)[1] = w1;
+    ((memory_word_t *)d)[2] = w2;
+    ((memory_word_t *)d)[3] = w3;
+    d += MEMORY_WORD_SIZE * 4;
+    s += MEMORY_WORD_SIZE * 4;
+    len -= MEMORY_WORD_SIZE * 4;
+  }
+
+  while (len >= MEMORY_WORD_SIZE) {
+    *(memory_word_t *)d = *(const memory_word_t *)s;
+    d += MEMORY_WORD_SIZE;
+    s += MEMORY_WORD_SIZE;
+    len -= MEMORY_WORD_SIZE;
+  }
+
+  while (len--) {
+    *d++ = *s++;
+  }
+
+  return dest;
+}
+
+/**
+ * Copies from the end of the buffers towards the start, used by memmove
+ * when the destination overlaps the tail of the source.
+ */
+static void *memory_copy_backwards(void *dest, const void *src, size_t len) {
+  uint8_t *d = (uint8_t *)dest + len;
+  const uint8_t *s = (const uint8_t *)src + len;
+
+  while (len && ((uintptr_t)d & (MEMORY_WORD_SIZE - 1))) {
+    *--d = *--s;
+    len--;
+  }
+
+  while (len >= MEMORY_WORD_SIZE) {
+    d -= MEMORY_WORD_SIZE;
+    s -= MEMORY_WORD_SIZE;
+    *(memory_word_t *)d = *(const memory_word_t *)s;
+    len -= MEMORY_WORD_SIZE;
+  }
+
+  while (len--) {
+    *--d = *--s;
+  }
+
+  return dest;
+}
+
+static void *memory_set_generic(void *ptr, int c, size_t len) {
+  uint8_t *d = ptr;
+  uint64_t pattern = (uint8_t)c * MEMORY_BYTE_BROADCAST;
+
+  while (len && ((uintptr_t)d & (MEMORY_WORD_SIZE - 1))) {
+    *d++ = (uint8_t)c;
+    len--;
+  }
+
+  while (len >= MEMORY_WORD_SIZE * 4) {
+    ((memory_word_t *)d)[0] = pattern;
+    ((memory_word_t *)d)[1] = pattern;
+    ((memory_word_t *)d)[2] = pattern;
+    ((memory_word_t *)d)[3] = pattern;
+    d += MEMORY_WORD_SIZE * 4;
+    len -= MEMORY_WORD_SIZE * 4;
+  }
+
+  while (len >= MEMORY_WORD_SIZE) {
+    *(memory_word_t *)d = pattern;
+    d += MEMORY_WORD_SIZE;
+    len -= MEMORY_WORD_SIZE;
   }
+
+  while (len--) {
+    *d++ = (uint8_t)c;
+  }
+
   return ptr;
 }
 
-int memcmp(void *s1, void *s2, int count) {
-  char *c1 = s1;
-  char *c2 = s2;
-  while (count-- > 0) {
-    if (*c1++ != *c2++) {
-      return c1[-1] < c2[-1] ? -1 : 1;
+static int memory_compare_generic(const void *s1, const void *s2,
+                                  size_t len) {
+  const uint8_t *a = s1;
+  const uint8_t *b = s2;
+
+  // Skip equal words, the differing word is resolved bytewise below
+  while (len >= MEMORY_WORD_SIZE &&
+         *(const memory_word_t *)a == *(const memory_word_t *)b) {
+    a += MEMORY_WORD_SIZE;
+    b += MEMORY_WORD_SIZE;
+    len -= MEMORY_WORD_SIZE;
+  }
+
+  while (len--) {
+    if (*a != *b) {
+      return *a < *b ? -1 : 1;
     }
+    a++;
+    b++;
   }
 
   return 0;
 }
 
-void *memcpy(void *dest, void *src, int len) {
-  char *d = dest;
-  char *s = src;
-  while (len--) {
-    *d++ = *s++;
+static void *memory_copy_erms(void *dest, const void *src, size_t len) {
+  void *d = dest;
+  __asm__ __volatile__("rep movsb"
+                       : "+D"(d), "+S"(src), "+c"(len)
+                       :
+                       : "memory");
+  return dest;
+}
+
+static void *memory_set_erms(void *ptr, int c, size_t len) {
+  void *d = ptr;
+  __asm__ __volatile__("rep stosb"
+                       : "+D"(d), "+c"(len)
+                       : "a"(c)
+                       : "memory");
+  return ptr;
+}
+
+static void *memory_copy_sse2(void *dest, const void *src, size_t len) {
+  if (len < VIOS_MEMORY_VECTOR_MINIMUM) {
+    return memory_copy_generic(dest, src, len);
+  }
+
+  if (len >= VIOS_MEMORY_ERMS_THRESHOLD && cpu_has_feature(CPU_FEATURE_ERMS)) {
+    return memory_copy_erms(dest, src, len);
+  }
+
+  uint8_t saved[CPU_SSE2_SAVE_BYTES];
+  uint8_t *d = dest;
+  const uint8_t *s = src;
+  bool streaming = len >= VIOS_MEMORY_NONTEMPORAL_THRESHOLD;
+
+  // Align the destination to 16 bytes for the aligned stores
+  size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+  memory_copy_generic(d, s, head);
+  d += head;
+  s += head;
+  len -= head;
+
+  size_t blocks = len / 64;
+  len %= 64;
+  if (blocks && streaming) {
+    // Bypass the cache for copies far larger than it
+    __asm__ __volatile__(CPU_SSE2_SAVE "1:\n\t"
+                                       "movdqu 0(%[s]), %%xmm0\n\t"
+                                       "movdqu 16(%[s]), %%xmm1\n\t"
+                                       "movdqu 32(%[s]), %%xmm2\n\t"
+                                       "movdqu 48(%[s]), %%xmm3\n\t"
+                                       "movntdq %%xmm0, 0(%[d])\n\t"
+                                       "movntdq %%xmm1, 16(%[d])\n\t"
+                                       "movntdq %%xmm2, 32(%[d])\n\t"
+                                       "movntdq %%xmm3, 48(%[d])\n\t"
+                                       "add $64, %[s]\n\t"
+                                       "add $64, %[d]\n\t"
+                                       "dec %[n]\n\t"
+                                       "jnz 1b\n\t"
+                                       "sfence\n\t" CPU_SSE2_RESTORE
+                         : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+                         : [save] "r"(saved)
+                         : "memory", "cc");
+  } else if (blocks) {
+    __asm__ __volatile__(CPU_SSE2_SAVE "1:\n\t"
+                                       "movdqu 0(%[s]), %%xmm0\n\t"
+                                       "movdqu 16(%[s]), %%xmm1\n\t"
+                                       "movdqu 32(%[s]), %%xmm2\n\t"
+                                       "movdqu 48(%[s]), %%xmm3\n\t"
+                                       "movdqa %%xmm0, 0(%[d])\n\t"
+                                       "movdqa %%xmm1, 16(%[d])\n\t"
+                                       "movdqa %%xmm2, 32(%[d])\n\t"
+                                       "movdqa %%xmm3, 48(%[d])\n\t"
+                                       "add $64, %[s]\n\t"
+                                       "add $64, %[d]\n\t"
+                                       "dec %[n]\n\t"
+                                       "jnz 1b\n\t" CPU_SSE2_RESTORE
+                         : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+                         : [save] "r"(saved)
+                         : "memory", "cc");
+  }
+
+  memory_copy_generic(d, s, len);
+  return dest;
+}
+
+static void *memory_set_sse2(void *ptr, int c, size_t len) {
+  if (len < VIOS_MEMORY_VECTOR_MINIMUM) {
+    return memory_set_generic(ptr, c, len);
+  }
+
+  if (len >= VIOS_MEMORY_ERMS_THRESHOLD && cpu_has_feature(CPU_FEATURE_ERMS)) {
+    return memory_set_erms(ptr, c, len);
+  }
+
+  uint8_t saved[CPU_SSE2_SAVE_BYTES];
+  uint8_t *d = ptr;
+  uint64_t pattern = (uint8_t)c * MEMORY_BYTE_BROADCAST;
+
+  size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+  memory_set_generic(d, c, head);
+  d += head;
+  len -= head;
+
+  size_t blocks = len / 64;
+  len %= 64;
+  __asm__ __volatile__(CPU_SSE2_SAVE "movq %[pattern], %%xmm0\n\t"
+                                     "punpcklqdq %%xmm0, %%xmm0\n\t"
+                                     "1:\n\t"
+                                     "movdqa %%xmm0, 0(%[d])\n\t"
+                                     "movdqa %%xmm0, 16(%[d])\n\t"
+                                     "movdqa %%xmm0, 32(%[d])\n\t"
+                                     "movdqa %%xmm0, 48(%[d])\n\t"
+                                     "add $64, %[d]\n\t"
+                                     "dec %[n]\n\t"
+                                     "jnz 1b\n\t" CPU_SSE2_RESTORE
+                       : [d] "+r"(d), [n] "+r"(blocks)
+                       : [save] "r"(saved), [pattern] "r"(pattern)
+                       : "memory", "cc");
+
+  memory_set_generic(d, c, len);
+  return ptr;
+}
+
+static int memory_compare_sse2(const void *s1, const void *s2, size_t len) {
+  if (len < VIOS_MEMORY_VECTOR_MINIMUM) {
+    return memory_compare_generic(s1, s2, len);
+  }
+
+  uint8_t saved[CPU_SSE2_SAVE_BYTES];
+  const uint8_t *a = s1;
+  const uint8_t *b = s2;
+  size_t blocks = len / 16;
+  size_t remaining = blocks;
+
+  // Stops at the first 16 byte block that differs, leaving a and b on it
+  __asm__ __volatile__(CPU_SSE2_SAVE "1:\n\t"
+                                     "movdqu (%[a]), %%xmm0\n\t"
+                                     "movdqu (%[b]), %%xmm1\n\t"
+                                     "pcmpeqb %%xmm1, %%xmm0\n\t"
+                                     "pmovmskb %%xmm0, %%eax\n\t"
+                                     "cmp $0xffff, %%eax\n\t"
+                                     "jne 2f\n\t"
+                                     "add $16, %[a]\n\t"
+                                     "add $16, %[b]\n\t"
+                                     "dec %[n]\n\t"
+                                     "jnz 1b\n\t"
+                                     "2:\n\t" CPU_SSE2_RESTORE
+                       : [a] "+r"(a), [b] "+r"(b), [n] "+r"(remaining)
+                       : [save] "r"(saved)
+                       : "rax", "memory", "cc");
+
+  size_t compared = (blocks - remaining) * 16;
+  return memory_compare_generic(a, b, len - compared);
+}
+
+static void *memory_copy_avx(void *dest, const void *src, size_t len) {
+  if (len < VIOS_MEMORY_VECTOR_MINIMUM) {
+    return memory_copy_generic(dest, src, len);
+  }
+
+  if (len >= VIOS_MEMORY_ERMS_THRESHOLD && cpu_has_feature(CPU_FEATURE_ERMS)) {
+    return memory_copy_erms(dest, src, len);
+  }
+
+  uint8_t saved[CPU_AVX_SAVE_BYTES];
+  uint8_t *d = dest;
+  const uint8_t *s = src;
+  bool streaming = len >= VIOS_MEMORY_NONTEMPORAL_THRESHOLD;
+
+  // Align the destination to 32 bytes for the aligned stores
+  size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+  memory_copy_generic(d, s, head);
+  d += head;
+  s += head;
+  len -= head;
+
+  size_t blocks = len / 128;
+  len %= 128;
+  if (blocks && streaming) {
+    __asm__ __volatile__(CPU_AVX_SAVE "1:\n\t"
+                                      "vmovdqu 0(%[s]), %%ymm0\n\t"
+                                      "vmovdqu 32(%[s]), %%ymm1\n\t"
+                                      "vmovdqu 64(%[s]), %%ymm2\n\t"
+                                      "vmovdqu 96(%[s]), %%ymm3\n\t"
+                                      "vmovntdq %%ymm0, 0(%[d])\n\t"
+                                      "vmovntdq %%ymm1, 32(%[d])\n\t"
+                                      "vmovntdq %%ymm2, 64(%[d])\n\t"
+                                      "vmovntdq %%ymm3, 96(%[d])\n\t"
+                                      "add $128, %[s]\n\t"
+                                      "add $128, %[d]\n\t"
+                                      "dec %[n]\n\t"
+                                      "jnz 1b\n\t"
+                                      "sfence\n\t" CPU_AVX_RESTORE
+                         : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+                         : [save] "r"(saved)
+                         : "memory", "cc");
+  } else if (blocks) {
+    __asm__ __volatile__(CPU_AVX_SAVE "1:\n\t"
+                                      "vmovdqu 0(%[s]), %%ymm0\n\t"
+                                      "vmovdqu 32(%[s]), %%ymm1\n\t"
+                                      "vmovdqu 64(%[s]), %%ymm2\n\t"
+                                      "vmovdqu 96(%[s]), %%ymm3\n\t"
+                                      "vmovdqa %%ymm0, 0(%[d])\n\t"
+                                      "vmovdqa %%ymm1, 32(%[d])\n\t"
+                                      "vmovdqa %%ymm2, 64(%[d])\n\t"
+                                      "vmovdqa %%ymm3, 96(%[d])\n\t"
+                                      "add $128, %[s]\n\t"
+                                      "add $128, %[d]\n\t"
+                                      "dec %[n]\n\t"
+                                      "jnz 1b\n\t" CPU_AVX_RESTORE
+                         : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+                         : [save] "r"(saved)
+                         : "memory", "cc");
   }
+
+  memory_copy_generic(d, s, len);
   return dest;
-}
\ No newline at end of file
+}
+
+static void *memory_set_avx(void *ptr, int c, size_t len) {
+  if (len < VIOS_MEMORY_VECTOR_MINIMUM) {
+    return memory_set_generic(ptr, c, len);
+  }
+
+  if (len >= VIOS_MEMORY_ERMS_THRESHOLD && cpu_has_feature(CPU_FEATURE_ERMS)) {
+    return memory_set_erms(ptr, c, len);
+  }
+
+  uint8_t saved[CPU_AVX_SAVE_BYTES];
+  uint8_t *d = ptr;
+  uint64_t pattern = (uint8_t)c * MEMORY_BYTE_BROADCAST;
+
+  size_t head = (32 - ((uintptr_t)d & 31)) & 31;
+  memory_set_generic(d, c, head);
+  d += head;
+  len -= head;
+
+  size_t blocks = len / 128;
+  len %= 128;
+  if (blocks) {
+    __asm__ __volatile__(CPU_AVX_SAVE
+                         "vmovq %[pattern], %%xmm0\n\t"
+                         "vpunpcklqdq %%xmm0, %%xmm0, %%xmm0\n\t"
+                         "vinsertf128 $1, %%xmm0, %%ymm0, %%ymm0\n\t"
+                         "1:\n\t"
+                         "vmovdqa %%ymm0, 0(%[d])\n\t"
+                         "vmovdqa %%ymm0, 32(%[d])\n\t"
+                         "vmovdqa %%ymm0, 64(%[d])\n\t"
+                         "vmovdqa %%ymm0, 96(%[d])\n\t"
+                         "add $128, %[d]\n\t"
+                         "dec %[n]\n\t"
+                         "jnz 1b\n\t" CPU_AVX_RESTORE
+                         : [d] "+r"(d), [n] "+r"(blocks)
+                         : [save] "r"(saved), [pattern] "r"(pattern)
+                         : "memory", "cc");
+  }
+
+  memory_set_generic(d, c, len);
+  return ptr;
+}
+
+static struct memory_implementation memory_implementations[] = {
+    {.name = "generic",
+     .required_features = 0,
+     .copy = memory_copy_generic,
+     .set = memory_set_generic,
+     .compare = memory_compare_generic},
+    {.name = "erms",
+     .required_features = CPU_FEATURE_ERMS,
+     .copy = memory_copy_erms,
+     .set = memory_set_erms,
+     .compare = memory_compare_generic},
+    {.name = "sse2",
+     .required_features = CPU_FEATURE_SSE2,
+     .copy = memory_copy_sse2,
+     .set = memory_set_sse2,
+     .compare = memory_compare_sse2},
+    {.name = "avx",
+     .required_features = CPU_FEATURE_AVX,
+     .copy = memory_copy_avx,
+     .set = memory_set_avx,
+     .compare = memory_compare_sse2}};
+
+// Until memory_init runs only the generic routines are safe to use
+static struct memory_implementation *memory_current_implementation =
+    &memory_implementations[0];
+
+size_t memory_total_implementations() {
+  return sizeof(memory_implementations) / sizeof(memory_implementations[0]);
+}
+
+struct memory_implementation *memory_implementation_get(size_t index) {
+  if (index >= memory_total_implementations()) {
+    return NULL;
+  }
+
+  return &memory_implementations[index];
+}
+
+struct memory_implementation *memory_implementation_current() {
+  return memory_current_implementation;
+}
+
+bool memory_implementation_supported(struct memory_implementation *impl) {
+  return cpu_has_feature(impl->required_features);
+}
+
+void memory_init() {
+  // CPUs with fast short REP MOVSB beat the vector loops at every size
+  if (cpu_has_feature(CPU_FEATURE_ERMS | CPU_FEATURE_FSRM)) {
+    memory_current_implementation = &memory_implementations[1];
+    return;
+  }
+
+  // Otherwise prefer the widest vector routines the CPU supports, the
+  // implementations are ordered from the least to the most capable
+  for (size_t i = memory_total_implementations(); i > 0; i--) {
+    struct memory_implementation *impl = &memory_implementations[i - 1];
+    if (memory_implementation_supported(impl)) {
+      memory_current_implementation = impl;
+      break;
+    }
+  }
+}
+
+void *memset(void *ptr, int c, size_t size) {
+  return memory_current_implementation->set(ptr, c, size);
+}
+
+int memcmp(void *s1, void *s2, int count) {
+  if (count <= 0) {
+    return 0;
+  }
+
+  return memory_current_implementation->compare(s1, s2, count);
+}
+
+void *memcpy(void *dest, void *src, int len) {
+  if (len <= 0) {
+    return dest;
+  }
+
+  return memory_current_implementation->copy(dest, src, len);
+}
+
+void *memmove(void *dest, void *src, int len) {
+  if (len <= 0 || dest == src) {
+    return dest;
+  }
+
+  // A forward copy is only unsafe when the destination starts inside the source
+  uintptr_t d = (uintptr_t)dest;
+  uintptr_t s = (uintptr_t)src;
+  if (d < s || d >= s + (size_t)len) {
+    return memory_current_implementation->copy(dest, src, len);
+  }
+
+  return memory_copy_backwards(dest, src, len);
+}
@@ -1,6 +1,7 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -17,8 +18,28 @@ struct e820_entry* e820_largest_free_entry();
 size_t e820_total_entries();
 struct e820_entry* e820_entry(size_t index);
 
+// A set of memory routines tuned for a particular CPU feature
+struct memory_implementation
+{
+    const char* name;
+
+    // CPU_FEATURE_* bits the routines depend on
+    uint32_t required_features;
+
+    void* (*copy)(void* dest, const void* src, size_t len);
+    void* (*set)(void* ptr, int c, size_t len);
+    int (*compare)(const void* s1, const void* s2, size_t len);
+};
+
+void memory_init();
+size_t memory_total_implementations();
+struct memory_implementation* memory_implementation_get(size_t index);
+struct memory_implementation* memory_implementation_current();
+bool memory_implementation_supported(struct memory_implementation* impl);
+
 void* memset(void* ptr, int c, size_t size);
 int memcmp(void* s1, void* s2, int count);
 void* memcpy(void* dest, void* src, int len);
+void* memmove(void* dest, void* src, int len);
 
 #endif
\ No newline at end of file
@@ -220,6 +220,8 @@ int paging_map(struct paging_desc* desc, void* virt, void* phys, int flags)
     pt_entry->present = (flags & PAGING_IS_PRESENT) ? 1 : 0;
     pt_entry->read_write = (flags & PAGING_IS_WRITEABLE) ? 1 : 0;
     pt_entry->user_supervisor = (flags & PAGING_ACCESS_FROM_ALL) ? 1 : 0;
+    pt_entry->pwt = (flags & PAGING_WRITE_THROUGH) ? 1 : 0;
+    pt_entry->pcd = (flags & PAGING_CACHE_DISABLED) ? 1 : 0;
     return res;
 }
 
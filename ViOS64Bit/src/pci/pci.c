@@ -0,0 +1,258 @@
+#include "pci.h"
+#include "idt/irq.h"
+#include "io/io.h"
+#include "kernel.h"
+#include "memory/memory.h"
+#include "memory/paging/paging.h"
+#include "status.h"
+#include "string/string.h"
+
+#define PCI_MAX_BUSES 256
+#define PCI_MAX_SLOTS 32
+#define PCI_MAX_FUNCTIONS 8
+
+#define PCI_HEADER_MULTIFUNCTION 0x80
+
+static struct pci_device pci_devices[PCI_MAX_DEVICES];
+static size_t pci_device_count = 0;
+
+// Legacy lines are shared between devices, every handler runs on each one
+static INTERRUPT_CALLBACK_FUNCTION
+    pci_interrupt_handlers[PCI_MAX_INTERRUPT_HANDLERS];
+static int pci_total_interrupt_handlers = 0;
+
+static uint32_t pci_config_address(uint8_t bus, uint8_t slot,
+                                   uint8_t function, uint8_t offset) {
+  return 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+         ((uint32_t)function << 8) | (offset & 0xFC);
+}
+
+static uint32_t pci_read32(uint8_t bus, uint8_t slot, uint8_t function,
+                           uint8_t offset) {
+  outdw(PCI_CONFIG_ADDRESS_PORT,
+        pci_config_address(bus, slot, function, offset));
+  return insdw(PCI_CONFIG_DATA_PORT);
+}
+
+uint32_t pci_config_read32(struct pci_device *device, uint8_t offset) {
+  return pci_read32(device->bus, device->slot, device->function, offset);
+}
+
+uint16_t pci_config_read16(struct pci_device *device, uint8_t offset) {
+  return pci_config_read32(device, offset) >> ((offset & 2) * 8);
+}
+
+uint8_t pci_config_read8(struct pci_device *device, uint8_t offset) {
+  return pci_config_read32(device, offset) >> ((offset & 3) * 8);
+}
+
+void pci_config_write32(struct pci_device *device, uint8_t offset,
+                        uint32_t value) {
+  outdw(PCI_CONFIG_ADDRESS_PORT,
+        pci_config_address(device->bus, device->slot, device->function,
+                           offset));
+  outdw(PCI_CONFIG_DATA_PORT, value);
+}
+
+/**
+ * Writes only the word at "offset". Writing the whole dword back would
+ * also write the neighbouring register, for the command register that is
+ * the status register whose bits are cleared by writing them as one
+ */
+void pci_config_write16(struct pci_device *device, uint8_t offset,
+                        uint16_t value) {
+  outdw(PCI_CONFIG_ADDRESS_PORT,
+        pci_config_address(device->bus, device->slot, device->function,
+                           offset));
+  outw(PCI_CONFIG_DATA_PORT + (offset & 2), value);
+}
+
+static void pci_add_device(uint8_t bus, uint8_t slot, uint8_t function) {
+  if (pci_device_count >= PCI_MAX_DEVICES) {
+    return;
+  }
+
+  struct pci_device *device = &pci_devices[pci_device_count];
+  memset(device, 0, sizeof(struct pci_device));
+  device->bus = bus;
+  device->slot = slot;
+  device->function = function;
+
+  uint32_t id = pci_config_read32(device, PCI_CONFIG_VENDOR_ID);
+  device->vendor_id = id & 0xFFFF;
+  device->device_id = id >> 16;
+  device->class_code = pci_config_read8(device, PCI_CONFIG_CLASS);
+  device->subclass = pci_config_read8(device, PCI_CONFIG_SUBCLASS);
+  device->prog_if = pci_config_read8(device, PCI_CONFIG_PROG_IF);
+  device->interrupt_line =
+      pci_config_read8(device, PCI_CONFIG_INTERRUPT_LINE);
+  pci_device_count++;
+}
+
+/**
+ * Finds every function on every bus through configuration mechanism one
+ */
+void pci_init() {
+  pci_device_count = 0;
+  for (int bus = 0; bus < PCI_MAX_BUSES; bus++) {
+    for (int slot = 0; slot < PCI_MAX_SLOTS; slot++) {
+      if ((pci_read32(bus, slot, 0, PCI_CONFIG_VENDOR_ID) & 0xFFFF) ==
+          0xFFFF) {
+        continue;
+      }
+
+      uint8_t header = pci_read32(bus, slot, 0, PCI_CONFIG_HEADER_TYPE) >>
+                       ((PCI_CONFIG_HEADER_TYPE & 3) * 8);
+      int functions =
+          (header & PCI_HEADER_MULTIFUNCTION) ? PCI_MAX_FUNCTIONS : 1;
+      for (int function = 0; function < functions; function++) {
+        if ((pci_read32(bus, slot, function, PCI_CONFIG_VENDOR_ID) &
+             0xFFFF) == 0xFFFF) {
+          continue;
+        }
+
+        pci_add_device(bus, slot, function);
+      }
+    }
+  }
+}
+
+size_t pci_total_devices() { return pci_device_count; }
+
+struct pci_device *pci_device_get(size_t index) {
+  if (index >= pci_device_count) {
+    return NULL;
+  }
+
+  return &pci_devices[index];
+}
+
+/**
+ * Returns the first device of the given class at or after "start_index"
+ */
+struct pci_device *pci_find_class(uint8_t class_code, uint8_t subclass,
+                                  size_t start_index) {
+  for (size_t i = start_index; i < pci_device_count; i++) {
+    if (pci_devices[i].class_code == class_code &&
+        pci_devices[i].subclass == subclass) {
+      return &pci_devices[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Returns the first device with the given IDs at or after "start_index"
+ */
+struct pci_device *pci_find_device(uint16_t vendor_id, uint16_t device_id,
+                                   size_t start_index) {
+  for (size_t i = start_index; i < pci_device_count; i++) {
+    if (pci_devices[i].vendor_id == vendor_id &&
+        pci_devices[i].device_id == device_id) {
+      return &pci_devices[i];
+    }
+  }
+
+  return NULL;
+}
+
+bool pci_bar_is_io(struct pci_device *device, int bar) {
+  return pci_config_read32(device, PCI_CONFIG_BAR0 + (bar * 4)) &
+         PCI_BAR_IO_SPACE;
+}
+
+/**
+ * Returns the address a BAR decodes, 64 bit memory BARs span two slots
+ */
+uint64_t pci_bar_address(struct pci_device *device, int bar) {
+  uint32_t value = pci_config_read32(device, PCI_CONFIG_BAR0 + (bar * 4));
+  if (value & PCI_BAR_IO_SPACE) {
+    return value & ~0x3;
+  }
+
+  uint64_t address = value & ~0xF;
+  if ((value & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_64) {
+    address |=
+        (uint64_t)pci_config_read32(device, PCI_CONFIG_BAR0 + ((bar + 1) * 4))
+        << 32;
+  }
+
+  return address;
+}
+
+void pci_enable(struct pci_device *device, uint16_t command_flags) {
+  uint16_t command = pci_config_read16(device, PCI_CONFIG_COMMAND);
+  pci_config_write16(device, PCI_CONFIG_COMMAND, command | command_flags);
+}
+
+/**
+ * Identity maps "size" bytes of a memory BAR into the kernel as uncached
+ * device memory, returns NULL for IO BARs or when mapping fails
+ */
+void *pci_map_bar(struct pci_device *device, int bar, size_t size) {
+  if (pci_bar_is_io(device, bar)) {
+    return NULL;
+  }
+
+  uint64_t address = pci_bar_address(device, bar);
+  if (!address) {
+    return NULL;
+  }
+
+  void *start = paging_align_to_lower_page((void *)address);
+  void *end = paging_align_address((void *)(address + size));
+  int res = paging_map_to(kernel_desc(), start, start, end,
+                          PAGING_CACHE_DISABLED | PAGING_WRITE_THROUGH |
+                              PAGING_IS_WRITEABLE | PAGING_IS_PRESENT);
+  if (res < 0) {
+    return NULL;
+  }
+
+  return (void *)address;
+}
+
+static void pci_interrupt_dispatch(struct interrupt_frame *frame) {
+  for (int i = 0; i < pci_total_interrupt_handlers; i++) {
+    pci_interrupt_handlers[i](frame);
+  }
+}
+
+/**
+ * Routes the legacy interrupt line of a device to "handler", handlers
+ * must check their own device as the line may be shared. Returns -EIO
+ * when the firmware left the device without a usable PIC line
+ */
+int pci_enable_interrupts(struct pci_device *device,
+                          INTERRUPT_CALLBACK_FUNCTION handler) {
+  uint8_t line = device->interrupt_line;
+  if (line == 0 || line == IRQ_CASCADE || line > PIC_SLAVE_ENDING_IRQ) {
+    return -EIO;
+  }
+
+  bool registered = false;
+  for (int i = 0; i < pci_total_interrupt_handlers; i++) {
+    if (pci_interrupt_handlers[i] == handler) {
+      registered = true;
+    }
+  }
+
+  if (!registered) {
+    if (pci_total_interrupt_handlers == PCI_MAX_INTERRUPT_HANDLERS) {
+      return -ENOMEM;
+    }
+    pci_interrupt_handlers[pci_total_interrupt_handlers++] = handler;
+  }
+
+  uint16_t command = pci_config_read16(device, PCI_CONFIG_COMMAND) &
+                     ~PCI_COMMAND_INTERRUPT_DISABLE;
+  pci_config_write16(device, PCI_CONFIG_COMMAND, command);
+
+  idt_register_interrupt_callback(IRQ_VECTOR_OFFSET + line,
+                                  pci_interrupt_dispatch);
+  if (line >= PIC_SLAVE_STARTING_IRQ) {
+    IRQ_enable(IRQ_CASCADE);
+  }
+  IRQ_enable(line);
+  return 0;
+}
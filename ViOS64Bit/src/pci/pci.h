@@ -0,0 +1,81 @@
+#ifndef KERNEL_PCI_H
+#define KERNEL_PCI_H
+
+#include "idt/idt.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PCI_CONFIG_ADDRESS_PORT 0xCF8
+#define PCI_CONFIG_DATA_PORT 0xCFC
+
+// Configuration space offsets
+#define PCI_CONFIG_VENDOR_ID 0x00
+#define PCI_CONFIG_DEVICE_ID 0x02
+#define PCI_CONFIG_COMMAND 0x04
+#define PCI_CONFIG_STATUS 0x06
+#define PCI_CONFIG_PROG_IF 0x09
+#define PCI_CONFIG_SUBCLASS 0x0A
+#define PCI_CONFIG_CLASS 0x0B
+#define PCI_CONFIG_HEADER_TYPE 0x0E
+#define PCI_CONFIG_BAR0 0x10
+#define PCI_CONFIG_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO_SPACE 0x0001
+#define PCI_COMMAND_MEMORY_SPACE 0x0002
+#define PCI_COMMAND_BUS_MASTER 0x0004
+#define PCI_COMMAND_INTERRUPT_DISABLE 0x0400
+
+#define PCI_CLASS_MASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_SUBCLASS_SATA 0x06
+#define PCI_SUBCLASS_NVM 0x08
+#define PCI_PROG_IF_NVME 0x02
+
+#define PCI_BAR_IO_SPACE 0x01
+#define PCI_BAR_TYPE_MASK 0x06
+#define PCI_BAR_TYPE_64 0x04
+
+#define PCI_MAX_DEVICES 64
+#define PCI_MAX_INTERRUPT_HANDLERS 8
+
+struct pci_device {
+  uint8_t bus;
+  uint8_t slot;
+  uint8_t function;
+
+  uint16_t vendor_id;
+  uint16_t device_id;
+
+  uint8_t class_code;
+  uint8_t subclass;
+  uint8_t prog_if;
+
+  // Legacy PIC line the firmware routed the device to
+  uint8_t interrupt_line;
+};
+
+void pci_init();
+size_t pci_total_devices();
+struct pci_device *pci_device_get(size_t index);
+struct pci_device *pci_find_class(uint8_t class_code, uint8_t subclass,
+                                  size_t start_index);
+struct pci_device *pci_find_device(uint16_t vendor_id, uint16_t device_id,
+                                   size_t start_index);
+
+uint32_t pci_config_read32(struct pci_device *device, uint8_t offset);
+uint16_t pci_config_read16(struct pci_device *device, uint8_t offset);
+uint8_t pci_config_read8(struct pci_device *device, uint8_t offset);
+void pci_config_write32(struct pci_device *device, uint8_t offset,
+                        uint32_t value);
+void pci_config_write16(struct pci_device *device, uint8_t offset,
+                        uint16_t value);
+
+uint64_t pci_bar_address(struct pci_device *device, int bar);
+bool pci_bar_is_io(struct pci_device *device, int bar);
+void pci_enable(struct pci_device *device, uint16_t command_flags);
+void *pci_map_bar(struct pci_device *device, int bar, size_t size);
+int pci_enable_interrupts(struct pci_device *device,
+                          INTERRUPT_CALLBACK_FUNCTION handler);
+
+#endif
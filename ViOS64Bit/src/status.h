@@ -12,5 +12,7 @@
 #define EISTKN 8
 #define EINFORMAT 9
 #define EOUTOFRANGE 10
+#define ENOSPC 11
+#define EBUSY 12
 
 #endif
\ No newline at end of file
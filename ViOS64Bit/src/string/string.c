@@ -1,4 +1,24 @@
 #include "string.h"
+#include <stdint.h>
+
+// Eight characters are examined at once where it is safe to do so
+typedef uint64_t __attribute__((may_alias, aligned(1))) string_word_t;
+
+#define STRING_WORD_SIZE sizeof(uint64_t)
+#define STRING_PAGE_SIZE 4096
+
+// Non zero when any byte of the word is zero
+#define STRING_HAS_ZERO(w) \
+    (((w) - 0x0101010101010101ULL) & ~(w) & 0x8080808080808080ULL)
+
+/**
+ * Unaligned word reads may run past the terminator, only allow them
+ * when the whole word lives on the same page as the first byte.
+ */
+static inline bool string_word_safe(const char* ptr)
+{
+    return ((uintptr_t)ptr & (STRING_PAGE_SIZE - 1)) <= STRING_PAGE_SIZE - STRING_WORD_SIZE;
+}
 
 char tolower(char s1)
 {
@@ -10,22 +30,60 @@ char tolower(char s1)
     return s1;
 }
 
+char toupper(char s1)
+{
+    if (s1 >= 97 && s1 <= 122)
+    {
+        s1 -= 32;
+    }
+
+    return s1;
+}
+
 int strlen(const char* ptr)
 {
-    int i = 0;
-    while(*ptr != 0)
+    const char* s = ptr;
+
+    // Byte steps until aligned, an aligned word never crosses into the next page
+    while ((uintptr_t)s & (STRING_WORD_SIZE - 1))
     {
-        i++;
-        ptr += 1;
+        if (*s == 0)
+            return s - ptr;
+        s++;
     }
 
-    return i;
+    const string_word_t* w = (const string_word_t*)s;
+    while (!STRING_HAS_ZERO(*w))
+    {
+        w++;
+    }
+
+    s = (const char*)w;
+    while (*s != 0)
+    {
+        s++;
+    }
+
+    return s - ptr;
 }
 
 int strnlen(const char* ptr, int max)
 {
     int i = 0;
-    for (i = 0; i < max; i++)
+    while (i < max && ((uintptr_t)(ptr + i) & (STRING_WORD_SIZE - 1)))
+    {
+        if (ptr[i] == 0)
+            return i;
+        i++;
+    }
+
+    while (i + (int)STRING_WORD_SIZE <= max &&
+           !STRING_HAS_ZERO(*(const string_word_t*)(ptr + i)))
+    {
+        i += STRING_WORD_SIZE;
+    }
+
+    for (; i < max; i++)
     {
         if (ptr[i] == 0)
             break;
@@ -65,6 +123,21 @@ int strncmp(const char* str1, const char* str2, int n)
 {
     unsigned char u1, u2;
 
+    // Skip identical words that hold no terminator, the remainder is
+    // compared bytewise so the result matches the plain loop
+    while (n >= (int)STRING_WORD_SIZE && string_word_safe(str1) &&
+           string_word_safe(str2))
+    {
+        string_word_t w1 = *(const string_word_t*)str1;
+        string_word_t w2 = *(const string_word_t*)str2;
+        if (w1 != w2 || STRING_HAS_ZERO(w1))
+            break;
+
+        str1 += STRING_WORD_SIZE;
+        str2 += STRING_WORD_SIZE;
+        n -= STRING_WORD_SIZE;
+    }
+
     while(n-- > 0)
     {
         u1 = (unsigned char)*str1++;
@@ -121,10 +194,36 @@ char* itoa(int i)
     return &text[loc];
 }
 
+char* u64toa(uint64_t i)
+{
+    static char text[21];
+    int loc = 20;
+    text[20] = 0;
+    do
+    {
+        text[--loc] = '0' + (i % 10);
+        i /= 10;
+    } while (i);
+
+    return &text[loc];
+}
+
 char* strncpy(char* dest, const char* src, int count)
 {
     int i = 0;
-    for (i = 0; i < count-1; i++)
+
+    // Copy whole words while they are known to hold no terminator
+    while (i + (int)STRING_WORD_SIZE <= count - 1 && string_word_safe(src + i))
+    {
+        string_word_t w = *(const string_word_t*)(src + i);
+        if (STRING_HAS_ZERO(w))
+            break;
+
+        *(string_word_t*)(dest + i) = w;
+        i += STRING_WORD_SIZE;
+    }
+
+    for (; i < count-1; i++)
     {
         if (src[i] == 0x00)
             break;
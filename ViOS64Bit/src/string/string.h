@@ -1,6 +1,7 @@
 #ifndef STRING_H
 #define STRING_H
 #include <stdbool.h>
+#include <stdint.h>
 int strlen(const char* ptr);
 int strnlen(const char* ptr, int max);
 bool isdigit(char c);
@@ -11,6 +12,8 @@ int strncmp(const char* str1, const char* str2, int n);
 int istrncmp(const char* s1, const char* s2, int n);
 int strnlen_terminator(const char* str, int max, char terminator);
 char tolower(char s1);
+char toupper(char s1);
 char* itoa(int i);
+char* u64toa(uint64_t i);
 
 #endif
\ No newline at end of file
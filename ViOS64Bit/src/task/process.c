@@ -1,6 +1,7 @@
 #include "process.h"
 #include "config.h"
 #include "fs/file.h"
+#include "fs/pagecache.h"
 #include "kernel.h"
 #include "loader/formats/elfloader.h"
 #include "memory/heap/kheap.h"
@@ -105,6 +106,128 @@ process_get_allocation_by_addr(struct process *process, void *addr) {
   return 0;
 }
 
+static struct process_mapping *
+process_find_free_mapping(struct process *process) {
+  for (int i = 0; i < VIOS_MAX_PROGRAM_MAPPINGS; i++) {
+    if (!process->mappings[i].virt) {
+      return &process->mappings[i];
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Maps "length" bytes of the cached file from the page aligned "offset"
+ * into the process. Shared mappings are the cached pages themselves and
+ * read only, private ones are a writable copy made now since nothing
+ * catches a write fault to copy on. The reference to "file" is taken over
+ * on success
+ */
+int process_mmap(struct process *process, struct pagecache_file *file,
+                 uint32_t offset, size_t length, int flags, void **virt_out) {
+  int res = 0;
+  struct process_mapping *mapping = NULL;
+  size_t pages = 0;
+  void *virt = NULL;
+  if (length == 0 || offset % PAGING_PAGE_SIZE || offset >= file->filesize ||
+      (flags != PROCESS_MAP_SHARED && flags != PROCESS_MAP_PRIVATE)) {
+    res = -EINVARG;
+    goto out;
+  }
+
+  // The mapping ends with the file
+  uint64_t end = (uint64_t)offset + length;
+  if (end > file->filesize) {
+    end = file->filesize;
+  }
+
+  mapping = process_find_free_mapping(process);
+  if (!mapping) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  pages = (end - offset + PAGING_PAGE_SIZE - 1) / PAGING_PAGE_SIZE;
+  virt = (void *)(VIOS_PROGRAM_MMAP_VIRTUAL_ADDRESS +
+                  process->mapped_pages * PAGING_PAGE_SIZE);
+  struct paging_desc *desc = process->task->paging_desc;
+  if (flags == PROCESS_MAP_PRIVATE) {
+    mapping->copy = kzalloc(pages * PAGING_PAGE_SIZE);
+    if (!mapping->copy) {
+      res = -ENOMEM;
+      goto out;
+    }
+
+    res = pagecache_read(file, offset, end - offset, mapping->copy);
+    if (res < 0) {
+      goto out;
+    }
+
+    res = paging_map_to(desc, virt, mapping->copy,
+                        mapping->copy + pages * PAGING_PAGE_SIZE,
+                        PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL |
+                            PAGING_IS_WRITEABLE);
+    if (res < 0) {
+      goto out;
+    }
+
+    // The copy needs nothing more from the cache
+    pagecache_file_put(file);
+  } else {
+    for (size_t i = 0; i < pages; i++) {
+      void *page = pagecache_get_page(file, offset / PAGING_PAGE_SIZE + i);
+      if (ISERR(page)) {
+        res = ERROR_I(page);
+        goto out;
+      }
+
+      res = paging_map(desc, virt + i * PAGING_PAGE_SIZE, page,
+                       PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL);
+      if (res < 0) {
+        goto out;
+      }
+    }
+    mapping->file = file;
+  }
+
+  mapping->virt = virt;
+  mapping->pages = pages;
+  process->mapped_pages += pages;
+  *virt_out = virt;
+out:
+  if (res < 0 && pages) {
+    // Nothing of a failed mapping may stay reachable
+    for (size_t i = 0; i < pages; i++) {
+      paging_map(process->task->paging_desc, virt + i * PAGING_PAGE_SIZE,
+                 NULL, 0);
+    }
+
+    if (mapping->copy) {
+      kfree(mapping->copy);
+      mapping->copy = NULL;
+    }
+  }
+  return res;
+}
+
+/**
+ * Hands the pages of every mapping back, for when the process exits
+ */
+static void process_terminate_mappings(struct process *process) {
+  for (int i = 0; i < VIOS_MAX_PROGRAM_MAPPINGS; i++) {
+    struct process_mapping *mapping = &process->mappings[i];
+    if (mapping->file) {
+      pagecache_file_put(mapping->file);
+    }
+
+    if (mapping->copy) {
+      kfree(mapping->copy);
+    }
+  }
+  memset(process->mappings, 0, sizeof(process->mappings));
+}
+
 int process_terminate_allocations(struct process *process) {
   for (int i = 0; i < VIOS_MAX_PROGRAM_ALLOCATIONS; i++) {
     if (process->allocations[i].ptr) {
@@ -168,7 +291,9 @@ static void process_unlink(struct process *process) {
 int process_free_process(struct process *process) {
   int res = 0;
   process_terminate_allocations(process);
+  process_terminate_mappings(process);
   process_free_program_data(process);
+  file_table_free(&process->files);
 
   // Free the process stack memory.
   if (process->stack) {
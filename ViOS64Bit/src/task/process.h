@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 #include "config.h"
+#include "fs/file.h"
 #include "task.h"
 
 #define PROCESS_FILETYPE_ELF 0
@@ -16,6 +17,24 @@ struct process_allocation {
   size_t size;
 };
 
+enum {
+  // Read only, the pages are the page cache's own
+  PROCESS_MAP_SHARED,
+  // Writable, the process gets a copy of the pages
+  PROCESS_MAP_PRIVATE
+};
+
+struct process_mapping {
+  // Where the mapping starts in the process, NULL for a free slot
+  void *virt;
+  size_t pages;
+
+  // The cached file of a shared mapping, held until the process exits
+  struct pagecache_file *file;
+  // The pages of a private mapping
+  void *copy;
+};
+
 struct command_argument {
   char argument[512];
   struct command_argument *next;
@@ -60,6 +79,14 @@ struct process {
 
   // The arguments of the process.
   struct process_arguments arguments;
+
+  // The files the process has open, closed when it exits
+  struct file_table files;
+
+  // Files mapped into the process
+  struct process_mapping mappings[VIOS_MAX_PROGRAM_MAPPINGS];
+  // Pages handed out from VIOS_PROGRAM_MMAP_VIRTUAL_ADDRESS on
+  size_t mapped_pages;
 };
 
 int process_switch(struct process *process);
@@ -71,6 +98,8 @@ struct process *process_current();
 struct process *process_get(int process_id);
 void *process_malloc(struct process *process, size_t size);
 void process_free(struct process *process, void *ptr);
+int process_mmap(struct process *process, struct pagecache_file *file,
+                 uint32_t offset, size_t length, int flags, void **virt_out);
 
 void process_get_arguments(struct process *process, int *argc, char ***argv);
 int process_inject_arguments(struct process *process,
@@ -0,0 +1,266 @@
+/*
+ * Packs files into a ViOS asset archive, see src/fs/archive/archive_format.h
+ *
+ * mkarchive [-z] [-v volume] -o archive files...
+ *
+ * -z compresses with LZ4 the files it makes noticeably smaller
+ */
+
+#include "fs/archive/archive_format.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MKARCHIVE_HASH_BITS 16
+#define MKARCHIVE_MIN_MATCH 4
+#define MKARCHIVE_MAX_OFFSET 65535
+// LZ4 wants the last match to start this far before the end
+#define MKARCHIVE_MATCH_LIMIT 12
+// and the last bytes of a block to be literals
+#define MKARCHIVE_LAST_LITERALS 5
+
+struct mkarchive_file {
+  struct archive_entry entry;
+  unsigned char *payload;
+};
+
+static void mkarchive_write_length(unsigned char **out, size_t length) {
+  while (length >= 255) {
+    *(*out)++ = 255;
+    length -= 255;
+  }
+  *(*out)++ = length;
+}
+
+static unsigned char *mkarchive_emit(unsigned char *out,
+                                     const unsigned char *literals,
+                                     size_t total_literals, size_t offset,
+                                     size_t match) {
+  unsigned char *token = out++;
+  *token = (total_literals >= 15 ? 15 : total_literals) << 4;
+  if (total_literals >= 15) {
+    mkarchive_write_length(&out, total_literals - 15);
+  }
+  memcpy(out, literals, total_literals);
+  out += total_literals;
+
+  if (match) {
+    *out++ = offset & 0xFF;
+    *out++ = offset >> 8;
+    match -= MKARCHIVE_MIN_MATCH;
+    *token |= match >= 15 ? 15 : match;
+    if (match >= 15) {
+      mkarchive_write_length(&out, match - 15);
+    }
+  }
+  return out;
+}
+
+/**
+ * Compresses "in" into one raw LZ4 block with a greedy hash of four byte
+ * sequences. "out" must hold size + size / 255 + 16 bytes
+ */
+static size_t mkarchive_lz4(const unsigned char *in, size_t size,
+                            unsigned char *out) {
+  static size_t table[1 << MKARCHIVE_HASH_BITS];
+  memset(table, 0xFF, sizeof(table));
+
+  unsigned char *start = out;
+  size_t anchor = 0;
+  size_t pos = 0;
+  while (size > MKARCHIVE_MATCH_LIMIT &&
+         pos < size - MKARCHIVE_MATCH_LIMIT) {
+    unsigned int sequence;
+    memcpy(&sequence, in + pos, sizeof(sequence));
+    unsigned int hash =
+        (sequence * 2654435761u) >> (32 - MKARCHIVE_HASH_BITS);
+    size_t candidate = table[hash];
+    table[hash] = pos;
+
+    if (candidate == (size_t)-1 || pos - candidate > MKARCHIVE_MAX_OFFSET ||
+        memcmp(in + candidate, in + pos, MKARCHIVE_MIN_MATCH) != 0) {
+      pos++;
+      continue;
+    }
+
+    size_t match = MKARCHIVE_MIN_MATCH;
+    while (pos + match < size - MKARCHIVE_LAST_LITERALS &&
+           in[candidate + match] == in[pos + match]) {
+      match++;
+    }
+
+    out = mkarchive_emit(out, in + anchor, pos - anchor, pos - candidate,
+                         match);
+    pos += match;
+    anchor = pos;
+  }
+
+  out = mkarchive_emit(out, in + anchor, size - anchor, 0, 0);
+  return out - start;
+}
+
+static unsigned char *mkarchive_read_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  unsigned char *data = NULL;
+  if (fseek(file, 0, SEEK_END) != 0) {
+    goto out;
+  }
+
+  long length = ftell(file);
+  if (length < 0 || length > 0x7FFFFFFF || fseek(file, 0, SEEK_SET) != 0) {
+    goto out;
+  }
+
+  data = malloc(length ? length : 1);
+  if (data && fread(data, 1, length, file) != (size_t)length) {
+    free(data);
+    data = NULL;
+  }
+  *size = length;
+out:
+  fclose(file);
+  return data;
+}
+
+static int mkarchive_compare(const void *first, const void *second) {
+  const struct mkarchive_file *a = first;
+  const struct mkarchive_file *b = second;
+  return strcmp(a->entry.name, b->entry.name);
+}
+
+static void mkarchive_usage() {
+  fprintf(stderr, "usage: mkarchive [-z] [-v volume] -o archive files...\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *out_path = NULL;
+  const char *volume = "VIOS";
+  int compress = 0;
+  int first = 1;
+  for (; first < argc && argv[first][0] == '-'; first++) {
+    if (strcmp(argv[first], "-z") == 0) {
+      compress = 1;
+    } else if (strcmp(argv[first], "-o") == 0 && first + 1 < argc) {
+      out_path = argv[++first];
+    } else if (strcmp(argv[first], "-v") == 0 && first + 1 < argc) {
+      volume = argv[++first];
+    } else {
+      mkarchive_usage();
+    }
+  }
+
+  int total = argc - first;
+  if (!out_path || total <= 0) {
+    mkarchive_usage();
+  }
+
+  struct mkarchive_file *files = calloc(total, sizeof(struct mkarchive_file));
+  if (!files) {
+    return 1;
+  }
+
+  for (int i = 0; i < total; i++) {
+    const char *path = argv[first + i];
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (strlen(name) >= ARCHIVE_NAME_MAX) {
+      fprintf(stderr, "mkarchive: %s: name too long\n", path);
+      return 1;
+    }
+
+    struct archive_entry *entry = &files[i].entry;
+    for (int c = 0; name[c]; c++) {
+      entry->name[c] = toupper((unsigned char)name[c]);
+    }
+
+    size_t size = 0;
+    files[i].payload = mkarchive_read_file(path, &size);
+    if (!files[i].payload) {
+      fprintf(stderr, "mkarchive: %s: cannot read\n", path);
+      return 1;
+    }
+    entry->size = size;
+    entry->stored_size = size;
+
+    if (compress && size) {
+      unsigned char *packed = malloc(size + size / 255 + 16);
+      size_t packed_size = packed ? mkarchive_lz4(files[i].payload, size,
+                                                  packed)
+                                  : size;
+      // Unpacking costs a copy, only worth it when the disk reads shrink
+      if (packed_size <= size - size / 8) {
+        free(files[i].payload);
+        files[i].payload = packed;
+        entry->stored_size = packed_size;
+        entry->flags |= ARCHIVE_ENTRY_LZ4;
+      } else {
+        free(packed);
+      }
+    }
+  }
+
+  qsort(files, total, sizeof(struct mkarchive_file), mkarchive_compare);
+  for (int i = 1; i < total; i++) {
+    if (strcmp(files[i - 1].entry.name, files[i].entry.name) == 0) {
+      fprintf(stderr, "mkarchive: %s: duplicate name\n", files[i].entry.name);
+      return 1;
+    }
+  }
+
+  struct archive_header header = {0};
+  memcpy(header.magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+  header.total_entries = total;
+  // Space padded and upper case like the FAT label the kernel compares
+  memset(header.volume_name, ' ', ARCHIVE_VOLUME_NAME_MAX - 1);
+  for (int c = 0; volume[c] && c < ARCHIVE_VOLUME_NAME_MAX - 1; c++) {
+    header.volume_name[c] = toupper((unsigned char)volume[c]);
+  }
+
+  size_t offset = sizeof(header) + total * sizeof(struct archive_entry);
+  for (int i = 0; i < total; i++) {
+    offset = (offset + ARCHIVE_PAGE_SIZE - 1) / ARCHIVE_PAGE_SIZE *
+             ARCHIVE_PAGE_SIZE;
+    if (offset + files[i].entry.stored_size > 0xFFFFFFFF) {
+      fprintf(stderr, "mkarchive: archive larger than 4GB\n");
+      return 1;
+    }
+    files[i].entry.offset = offset;
+    offset += files[i].entry.stored_size;
+  }
+
+  FILE *out = fopen(out_path, "wb");
+  if (!out) {
+    fprintf(stderr, "mkarchive: %s: cannot create\n", out_path);
+    return 1;
+  }
+
+  fwrite(&header, sizeof(header), 1, out);
+  for (int i = 0; i < total; i++) {
+    fwrite(&files[i].entry, sizeof(struct archive_entry), 1, out);
+  }
+
+  static const unsigned char zero[ARCHIVE_PAGE_SIZE];
+  for (int i = 0; i < total; i++) {
+    long pad = files[i].entry.offset - ftell(out);
+    fwrite(zero, 1, pad, out);
+    fwrite(files[i].payload, 1, files[i].entry.stored_size, out);
+  }
+
+  // Whole sectors, the kernel reads the last one in full
+  long pad = (512 - ftell(out) % 512) % 512;
+  fwrite(zero, 1, pad, out);
+
+  if (fclose(out) != 0) {
+    fprintf(stderr, "mkarchive: %s: write failed\n", out_path);
+    return 1;
+  }
+
+  printf("mkarchive: %i files, %li bytes\n", total, (long)offset);
+  return 0;
+}
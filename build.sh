@@ -20,8 +20,81 @@ make clean || true
 make build
 cd ..
 
+# Files of increasing size for the kernel's file read benchmark, made once
+# so every data partition holds the same bytes
+rm -rf ./bin/bench
+mkdir -p ./bin/bench
+for size in 64K:64 1M:1024 32M:32768; do
+    name="bench$(echo "${size%%:*}" | tr 'A-Z' 'a-z').bin"
+    dd if=/dev/urandom of="./bin/bench/$name" bs=1024 count="${size##*:}" 2>/dev/null
+done
+
+# Everything opened through @:, partition 2, the RAM disk and the archive
+# are all built from this list so whichever is primary holds the same files.
+# The stdlib is linked into the programs and not loaded on its own
+ASSET_IMAGES="./ViOS64Bit/data/images/bkground.bmp ./ViOS64Bit/data/images/fonts/sysfont.bmp"
+ASSET_PROGRAMS=""
+for file in ./ViOS64Bit/assets/*/*.elf; do
+    if [ -f "$file" ] && [ "$(basename "$file")" != stdlib.elf ]; then
+        ASSET_PROGRAMS="$ASSET_PROGRAMS $file"
+    fi
+done
+ASSET_FILES=""
+for file in $ASSET_IMAGES $ASSET_PROGRAMS ./bin/bench/*.bin; do
+    if [ -f "$file" ]; then
+        ASSET_FILES="$ASSET_FILES $file"
+    fi
+done
+
+# Build the RAM disk image the UEFI loader reads into memory, it holds the
+# same files as partition 2. Set NO_RAMDISK=1 to boot from the disk alone
+# and compare the boot to shell time the kernel prints.
+rm -f ./bin/ramdisk.img
+if [ "${NO_RAMDISK:-0}" != 1 ]; then
+    echo "Building RAM disk image..."
+    # Sized to the files with room for the FAT16 tables and directory
+    RAMDISK_MB=$(( $(cat $ASSET_FILES | wc -c) / 1048576 + 8 ))
+    dd if=/dev/zero bs=1048576 count=$RAMDISK_MB of=./bin/ramdisk.img
+    RAMDISK_DEV=$(hdiutil attach -nomount ./bin/ramdisk.img | head -n 1 | awk '{print $1}')
+    newfs_msdos -F 16 -v ViOS "$RAMDISK_DEV"
+    mkdir -p ./mnt_ramdisk
+    sudo mount -t msdos "$RAMDISK_DEV" ./mnt_ramdisk
+    for file in $ASSET_FILES; do
+        sudo cp -v "$file" ./mnt_ramdisk/
+    done
+    sync
+    sudo umount ./mnt_ramdisk
+    hdiutil detach "$RAMDISK_DEV"
+fi
+
+# Set FAT32_MB to add a FAT32 partition of that size holding the benchmark
+# files, e.g. FAT32_MB=4096 to compare FAT32 and FAT16 reads on a multi-GB
+# volume
+FAT32_MB=${FAT32_MB:-0}
+export FAT32_MB
+
+# Pack the files of partition 2 into a read only archive on a partition of
+# its own. It takes over as the primary disk when there is no RAM disk, set
+# ARCHIVE=0 to boot from FAT16 and compare the boot to shell time. Set
+# ARCHIVE_LZ4=0 to store every file uncompressed
+ARCHIVE=${ARCHIVE:-1}
+ARCHIVE_MB=0
+rm -f ./bin/archive.img
+if [ "$ARCHIVE" = 1 ]; then
+    echo "Building asset archive..."
+    cc -O2 -I./ViOS64Bit/src -o ./bin/mkarchive ./ViOS64Bit/utilities/mkarchive.c
+    ARCHIVE_FLAGS=""
+    if [ "${ARCHIVE_LZ4:-1}" = 1 ]; then
+        ARCHIVE_FLAGS="-z"
+    fi
+    ./bin/mkarchive $ARCHIVE_FLAGS -v ViOS -o ./bin/archive.img $ASSET_FILES
+    # Rounded up with room for the backup GPT at the end of the image
+    ARCHIVE_MB=$(( $(wc -c < ./bin/archive.img) / 1048576 + 2 ))
+fi
+export ARCHIVE_MB
+
 # Create the final disk image with GPT structure
-dd if=/dev/zero bs=1048576 count=700 of=./bin/os.img
+dd if=/dev/zero bs=1048576 count=$((700 + FAT32_MB + ARCHIVE_MB)) of=./bin/os.img
 
 # Create GPT structure
 python3 - <<'PYEOF'
@@ -68,6 +141,11 @@ with open(img_path, 'r+b') as f:
     offset = 128
     part2_first_lba = 718848
     part2_last_lba = total_sectors - 34  # Last usable LBA
+    fat32_mb = int(os.environ.get('FAT32_MB', '0'))
+    archive_mb = int(os.environ.get('ARCHIVE_MB', '0'))
+    if fat32_mb > 0 or archive_mb > 0:
+        # Partition 2 keeps its size, the other partitions follow it
+        part2_last_lba = 700 * 2048 - 1
     partition_entries[offset:offset+16] = bytes.fromhex('28732ac11ff8d211ba4b00a0c93ec93b')
     partition_entries[offset+16:offset+32] = uuid.uuid4().bytes
     partition_entries[offset+32:offset+40] = struct.pack('<Q', part2_first_lba)  # First LBA
@@ -75,6 +153,29 @@ with open(img_path, 'r+b') as f:
     partition_entries[offset+48:offset+56] = struct.pack('<Q', 0)  # Attributes
     partition_entries[offset+56:offset+56+72] = 'ViOS'.encode('utf-16le').ljust(72, b'\x00')
 
+    # Partition 3: Optional FAT32 benchmark partition
+    if fat32_mb > 0:
+        offset = 256
+        partition_entries[offset:offset+16] = bytes.fromhex('a2a0d0ebe5b9334487c068b6b72699c7')  # Basic data
+        partition_entries[offset+16:offset+32] = uuid.uuid4().bytes
+        partition_entries[offset+32:offset+40] = struct.pack('<Q', 700 * 2048)  # First LBA
+        fat32_last_lba = total_sectors - 34
+        if archive_mb > 0:
+            fat32_last_lba = (700 + fat32_mb) * 2048 - 1
+        partition_entries[offset+40:offset+48] = struct.pack('<Q', fat32_last_lba)  # Last LBA
+        partition_entries[offset+48:offset+56] = struct.pack('<Q', 0)  # Attributes
+        partition_entries[offset+56:offset+56+72] = 'BENCH32'.encode('utf-16le').ljust(72, b'\x00')
+
+    # Partition 4: Optional asset archive, written in after formatting
+    if archive_mb > 0:
+        offset = 384
+        partition_entries[offset:offset+16] = bytes.fromhex('a2a0d0ebe5b9334487c068b6b72699c7')  # Basic data
+        partition_entries[offset+16:offset+32] = uuid.uuid4().bytes
+        partition_entries[offset+32:offset+40] = struct.pack('<Q', (700 + fat32_mb) * 2048)  # First LBA
+        partition_entries[offset+40:offset+48] = struct.pack('<Q', total_sectors - 34)  # Last LBA
+        partition_entries[offset+48:offset+56] = struct.pack('<Q', 0)  # Attributes
+        partition_entries[offset+56:offset+56+72] = 'ARCHIVE'.encode('utf-16le').ljust(72, b'\x00')
+
     # Calculate partition array CRC
     partition_array_crc = crc32(partition_entries)
 
@@ -144,6 +245,7 @@ echo "$ATTACH_OUTPUT"
 BASE_DISK=$(echo "$ATTACH_OUTPUT" | grep "GUID_partition_scheme" | awk '{print $1}')
 PART1_DEV="${BASE_DISK}s1"
 PART2_DEV="${BASE_DISK}s2"
+PART3_DEV="${BASE_DISK}s3"
 
 echo "Base disk: $BASE_DISK"
 echo "Partition 1: $PART1_DEV"
@@ -199,6 +301,9 @@ cp ./ViOS64Bit/bin/kernel.bin ./bin/kernel.bin
 sudo mkdir -p "$MOUNT_POINT/EFI/BOOT"
 sudo cp ./bin/ViOS.efi "$MOUNT_POINT/EFI/Boot/BOOTX64.efi"
 sudo cp ./bin/kernel.bin "$MOUNT_POINT/kernel.bin"
+if [ -f ./bin/ramdisk.img ]; then
+    sudo cp ./bin/ramdisk.img "$MOUNT_POINT/ramdisk.img"
+fi
 
 echo "Copied bootloader to $MOUNT_POINT/EFI/Boot/BOOTX64.efi"
 
@@ -245,28 +350,14 @@ if sudo mount -t msdos "$PART2_DEV" ./mnt; then
         echo "✗ Source sysfont.bmp file not found at ./ViOS64Bit/data/images/fonts/sysfont.bmp"
     fi
 
-    # Copy shell.elf if it exists
-    if [ -f ./ViOS64Bit/assets/shell/shell.elf ]; then
-        echo "Found source file: ./ViOS64Bit/assets/shell/shell.elf"
-        if sudo cp -v ./ViOS64Bit/assets/shell/shell.elf ./mnt/; then
-            echo "✓ shell.elf copied successfully"
+    # The user programs and the files for the kernel's file read benchmark
+    for file in $ASSET_PROGRAMS ./bin/bench/*.bin; do
+        if sudo cp "$file" ./mnt/; then
+            echo "✓ $(basename "$file") written"
         else
-            echo "✗ Failed to copy shell.elf (error code: $?)"
+            echo "✗ Failed to write $(basename "$file")"
         fi
-    else
-        echo "Note: shell.elf not found (optional)"
-    fi
-
-    if [ -f ./ViOS64Bit/assets/blank/blank.elf ]; then
-        echo "Found source file: ./ViOS64Bit/assets/blank/blank.elf"
-        if sudo cp -v ./ViOS64Bit/assets/blank/blank.elf ./mnt/; then
-            echo "✓ blank.elf copied successfully"
-        else
-            echo "✗ Failed to copy blank.elf (error code: $?)"
-        fi
-    else
-        echo "Note: blank.elf not found (optional)"
-    fi
+    done
 
     # Show final contents
     echo "Final contents of partition 2:"
@@ -290,7 +381,26 @@ else
     exit 1
 fi
 
+# The FAT32 partition holds the benchmark files only
+if [ "$FAT32_MB" -gt 0 ]; then
+    echo "Formatting partition 3 as FAT32..."
+    newfs_msdos -F 32 -v BENCH32 "$PART3_DEV"
+    if sudo mount -t msdos "$PART3_DEV" ./mnt; then
+        sudo cp -v ./bin/bench/*.bin ./mnt/
+        sync
+        sudo umount ./mnt
+        echo "✓ FAT32 partition written"
+    else
+        echo "✗ Failed to mount partition 3 at $PART3_DEV"
+    fi
+fi
+
 echo "Detaching disk..."
 hdiutil detach "$BASE_DISK"
 
+if [ -f ./bin/archive.img ]; then
+    echo "Writing asset archive to partition 4..."
+    dd if=./bin/archive.img of=./bin/os.img bs=512 seek=$(( (700 + FAT32_MB) * 2048 )) conv=notrunc
+fi
+
 echo "Build completed"